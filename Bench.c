@@ -0,0 +1,205 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: Bench.c
+*
+* Description: This file contains the latency recording and
+*	reporting shared by the benchmarks of the file system.
+****************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fsLow.h"
+#include "Bench.h"
+
+/**
+ * Returns the time in nanoseconds from a fixed point, unaffected by changes to the clock
+ * @returns the time in nanoseconds
+ */
+uint64_t benchNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Starts a phase.
+ * @param phase the phase to start
+ * @param partition the partition whose system calls are counted, NULL to count none
+ * @param name the name of the phase
+ * @param expectedOps the number of operations expected, to size the latencies up front
+ */
+void beginPhase(BenchPhase_p phase, partition_p partition, const char* name, uint64_t expectedOps) {
+	memset(phase, 0, sizeof(BenchPhase));
+	strncpy(phase->name, name, BENCH_NAME_SIZE - 1);
+	phase->capacity = (expectedOps > 0) ? expectedOps : 1;
+	phase->latencies = malloc(phase->capacity * sizeof(uint64_t));
+	phase->partition = partition;
+	if (partition != NULL)
+		phase->syscalls = LBAsyscalls(partition);
+	phase->start = benchNow();
+}
+
+/**
+ * Records an operation of the phase that started at the given time and ends now.
+ * @param phase the phase the operation belongs to
+ * @param start the time the operation started, from benchNow
+ * @param failed 1 if the operation returned an error
+ */
+void recordOp(BenchPhase_p phase, uint64_t start, int failed) {
+	uint64_t latency = benchNow() - start;
+
+	if (phase->count == phase->capacity) {
+		phase->capacity *= 2;
+		phase->latencies = realloc(phase->latencies, phase->capacity * sizeof(uint64_t));
+	}
+	phase->latencies[phase->count++] = latency;
+	if (failed)
+		phase->failures++;
+}
+
+/**
+ * Orders latencies from fastest to slowest
+ * @param a the first latency
+ * @param b the second latency
+ * @returns negative, zero or positive as a is less than, equal to or greater than b
+ */
+static int compareLatencies(const void* a, const void* b) {
+	uint64_t left = *(const uint64_t*)a;
+	uint64_t right = *(const uint64_t*)b;
+	return (left > right) - (left < right);
+}
+
+/**
+ * Ends a phase and sorts its latencies.
+ * @param phase the phase to end
+ */
+void endPhase(BenchPhase_p phase) {
+	phase->elapsed = benchNow() - phase->start;
+	if (phase->partition != NULL)
+		phase->syscalls = LBAsyscalls(phase->partition) - phase->syscalls;
+	qsort(phase->latencies, phase->count, sizeof(uint64_t), compareLatencies);
+}
+
+/**
+ * Adds the operations of a phase that has not ended to another
+ * @param merged the phase to add to
+ * @param phase the phase to add
+ */
+void mergePhase(BenchPhase_p merged, BenchPhase_p phase) {
+	if (merged->count + phase->count > merged->capacity) {
+		merged->capacity = merged->count + phase->count;
+		merged->latencies = realloc(merged->latencies, merged->capacity * sizeof(uint64_t));
+	}
+	memcpy(merged->latencies + merged->count, phase->latencies, phase->count * sizeof(uint64_t));
+	merged->count += phase->count;
+	merged->failures += phase->failures;
+	merged->bytes += phase->bytes;
+}
+
+/**
+ * Frees the latencies of a phase.
+ * @param phase the phase to free
+ */
+void freePhase(BenchPhase_p phase) {
+	free(phase->latencies);
+	phase->latencies = NULL;
+	phase->count = 0;
+	phase->capacity = 0;
+}
+
+/**
+ * Returns the latency below which the given fraction of the operations of an ended phase fall.
+ * @param phase the ended phase
+ * @param fraction the fraction of operations, such as 0.99
+ * @returns the latency in nanoseconds, 0 if the phase has no operations
+ */
+uint64_t phasePercentile(BenchPhase_p phase, double fraction) {
+	if (phase->count == 0)
+		return 0;
+	uint64_t index = (uint64_t)(fraction * phase->count);
+	if (index >= phase->count)
+		index = phase->count - 1;
+	return phase->latencies[index];
+}
+
+/**
+ * Returns the operations per second of an ended phase
+ * @param phase the ended phase
+ * @returns the operations per second
+ */
+static double phaseRate(BenchPhase_p phase) {
+	return (phase->elapsed > 0) ? phase->count * 1e9 / phase->elapsed : 0;
+}
+
+/**
+ * Returns the system calls per operation of an ended phase
+ * @param phase the ended phase
+ * @returns the system calls per operation
+ */
+static double phaseSyscalls(BenchPhase_p phase) {
+	return (phase->count > 0) ? (double)phase->syscalls / phase->count : 0;
+}
+
+/**
+ * Prints the settings and a table of the throughput and latencies of each phase.
+ * @param out where to print
+ * @param params the settings of the benchmark
+ * @param paramCount the number of settings
+ * @param phases the ended phases
+ * @param phaseCount the number of phases
+ */
+void printBenchText(FILE* out, BenchParam_p params, uint32_t paramCount, BenchPhase_p phases, uint32_t phaseCount) {
+	for (uint32_t i = 0; i < paramCount; i++) {
+		if (params[i].text != NULL)
+			fprintf(out, "%-20s%s\n", params[i].name, params[i].text);
+		else
+			fprintf(out, "%-20s%lu\n", params[i].name, params[i].value);
+	}
+
+	fprintf(out, "\n| Phase                        |      Ops | Failed |      Ops/s |    MB/s | Sys/op |  p50 us |  p99 us | p99.9 us |  max us\n");
+	for (uint32_t i = 0; i < phaseCount; i++) {
+		BenchPhase_p phase = &phases[i];
+		double megabytes = (phase->elapsed > 0) ? phase->bytes * 1e3 / phase->elapsed : 0;
+		fprintf(out, "  %-28s %10lu %8lu %12.1f %9.2f %8.1f %9.1f %9.1f %10.1f %9.1f\n", phase->name, phase->count,
+			phase->failures, phaseRate(phase), megabytes, phaseSyscalls(phase), phasePercentile(phase, 0.5) / 1e3,
+			phasePercentile(phase, 0.99) / 1e3, phasePercentile(phase, 0.999) / 1e3, phasePercentile(phase, 1.0) / 1e3);
+	}
+}
+
+/**
+ * Prints the settings and the throughput and latencies of each phase as a JSON object.
+ * @param out where to print
+ * @param benchmark the name of the benchmark
+ * @param params the settings of the benchmark
+ * @param paramCount the number of settings
+ * @param phases the ended phases
+ * @param phaseCount the number of phases
+ */
+void printBenchJson(FILE* out, const char* benchmark, BenchParam_p params, uint32_t paramCount, BenchPhase_p phases, uint32_t phaseCount) {
+	fprintf(out, "{\n  \"benchmark\": \"%s\",\n  \"params\": {", benchmark);
+	for (uint32_t i = 0; i < paramCount; i++) {
+		fprintf(out, "%s\n    \"%s\": ", (i > 0) ? "," : "", params[i].name);
+		if (params[i].text != NULL)
+			fprintf(out, "\"%s\"", params[i].text);
+		else
+			fprintf(out, "%lu", params[i].value);
+	}
+
+	fprintf(out, "\n  },\n  \"phases\": [");
+	for (uint32_t i = 0; i < phaseCount; i++) {
+		BenchPhase_p phase = &phases[i];
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"ops\": %lu, \"failures\": %lu, \"bytes\": %lu, \"seconds\": %.6f, "
+			"\"ops_per_sec\": %.1f, \"syscalls\": %lu, \"syscalls_per_op\": %.2f, "
+			"\"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}",
+			(i > 0) ? "," : "", phase->name, phase->count, phase->failures, phase->bytes, phase->elapsed / 1e9,
+			phaseRate(phase), phase->syscalls, phaseSyscalls(phase), phasePercentile(phase, 0.5), phasePercentile(phase, 0.99),
+			phasePercentile(phase, 0.999), phasePercentile(phase, 1.0));
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,119 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: Bench.h
+*
+* Description: This header file contains the structures and
+*	prototypes shared by the benchmarks of the file system.
+*	A benchmark runs in phases, recording the latency of every
+*	operation of a phase, and reports the throughput, latency
+*	percentiles and system calls per operation of each phase
+*	as text and as JSON.
+****************************************************************/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "fsLow.h"
+
+#define BENCH_NAME_SIZE 32			//Max size of the name of a phase or parameter
+
+/* The latencies of every operation of one phase of a benchmark */
+typedef struct BenchPhase {
+	char name[BENCH_NAME_SIZE];			//Name of the phase
+	uint64_t* latencies;				//Nanoseconds taken by each operation, sorted once the phase ends
+	uint64_t count;						//Number of operations recorded
+	uint64_t capacity;					//Operations latencies can hold before it grows
+	uint64_t failures;					//Operations that returned an error, counted in count
+	uint64_t bytes;						//Bytes moved by the phase, 0 if it moves none
+	uint64_t syscalls;					//System calls made by the LBA functions during the phase
+	partition_p partition;				//Partition whose system calls are counted, NULL for none
+	uint64_t start;						//Nanoseconds at the start of the phase
+	uint64_t elapsed;					//Nanoseconds from the start to the end of the phase
+} BenchPhase, *BenchPhase_p;
+
+/* A setting of a benchmark, reported with its results */
+typedef struct BenchParam {
+	const char* name;					//Name of the setting
+	const char* text;					//Value of a text setting, NULL for a number
+	uint64_t value;						//Value of a number setting
+} BenchParam, *BenchParam_p;
+
+/**
+ * Returns the time in nanoseconds from a fixed point, unaffected by changes to the clock
+ * @returns the time in nanoseconds
+ */
+uint64_t benchNow();
+
+/**
+ * Starts a phase.
+ * @param phase the phase to start
+ * @param partition the partition whose system calls are counted, NULL to count none
+ * @param name the name of the phase
+ * @param expectedOps the number of operations expected, to size the latencies up front
+ */
+void beginPhase(BenchPhase_p phase, partition_p partition, const char* name, uint64_t expectedOps);
+
+/**
+ * Records an operation of the phase that started at the given time and ends now.
+ * @param phase the phase the operation belongs to
+ * @param start the time the operation started, from benchNow
+ * @param failed 1 if the operation returned an error
+ */
+void recordOp(BenchPhase_p phase, uint64_t start, int failed);
+
+/**
+ * Ends a phase and sorts its latencies.
+ * @param phase the phase to end
+ */
+void endPhase(BenchPhase_p phase);
+
+/**
+ * Adds the operations of a phase that has not ended to another
+ * @param merged the phase to add to
+ * @param phase the phase to add
+ */
+void mergePhase(BenchPhase_p merged, BenchPhase_p phase);
+
+/**
+ * Frees the latencies of a phase.
+ * @param phase the phase to free
+ */
+void freePhase(BenchPhase_p phase);
+
+/**
+ * Returns the latency below which the given fraction of the operations of an ended phase fall.
+ * @param phase the ended phase
+ * @param fraction the fraction of operations, such as 0.99
+ * @returns the latency in nanoseconds, 0 if the phase has no operations
+ */
+uint64_t phasePercentile(BenchPhase_p phase, double fraction);
+
+/**
+ * Prints the settings and a table of the throughput and latencies of each phase.
+ * @param out where to print
+ * @param params the settings of the benchmark
+ * @param paramCount the number of settings
+ * @param phases the ended phases
+ * @param phaseCount the number of phases
+ */
+void printBenchText(FILE* out, BenchParam_p params, uint32_t paramCount, BenchPhase_p phases, uint32_t phaseCount);
+
+/**
+ * Prints the settings and the throughput and latencies of each phase as a JSON object.
+ * @param out where to print
+ * @param benchmark the name of the benchmark
+ * @param params the settings of the benchmark
+ * @param paramCount the number of settings
+ * @param phases the ended phases
+ * @param phaseCount the number of phases
+ */
+void printBenchJson(FILE* out, const char* benchmark, BenchParam_p params, uint32_t paramCount, BenchPhase_p phases, uint32_t phaseCount);
+
+#endif
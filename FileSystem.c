@@ -13,6 +13,8 @@
 *	functions.
 ****************************************************************/
 
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
@@ -21,71 +23,256 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 #include "FileSystem.h"
-
-void freeGlobals();
+#include "Record.h"
+
+void freeGlobals(FsVolume_p vol);
+void initMemoryPools(FsVolume_p vol);
+Inode_p getInodeBuffer(FsVolume_p vol);
+void putInodeBuffer(FsVolume_p vol, Inode_p inode);
+uint8_t* getBlockBuffer(FsVolume_p vol);
+void putBlockBuffer(FsVolume_p vol, void* buffer);
 uint64_t findNextPrime(uint64_t minBlockSize);
-uint64_t hashInode(char* name, uint64_t parentInode);
-uint64_t findFreeInode(char* name, uint64_t parentInode);
-int64_t writeFile(uint8_t* source, Inode_p inode, uint64_t startPos, uint64_t length);
-uint64_t readFile(uint8_t** destination, Inode_p inode, uint64_t startPos, uint64_t length);
-int readInode(uint64_t inodeID, Inode_p* inodeBuffer);
-int writeInode(Inode_p inode);
-void deleteFile(Inode_p inode);
-int addToDirectory(Inode_p dirInode, FCB_p newFile);
-int removeFromDirectory(Inode_p dirInode, uint64_t fileInodeID);
-uint64_t deallocateBlocks(Inode_p inode, uint64_t size);
-int64_t allocateBlocks(Inode_p inode, uint64_t size);
-uint64_t findFreeBlocks(uint64_t numberBlocksRequired, uint64_t** blockLocations);
+uint64_t hashInode(FsVolume_p vol, char* name, uint64_t parentInode);
+uint64_t countGroupInodes(FsVolume_p vol, uint64_t group, uint8_t* buffer);
+uint64_t pickInodeStart(FsVolume_p vol, char* name, uint64_t parentInode, uint8_t type);
+uint64_t findFreeInode(FsVolume_p vol, char* name, uint64_t parentInode, uint8_t type);
+void openBlockMap(BlockMap_p map, Inode_p inode);
+void flushBlockMap(FsVolume_p vol, BlockMap_p map);
+void closeBlockMap(FsVolume_p vol, BlockMap_p map);
+void loadMapBlock(FsVolume_p vol, uint64_t** buffer, uint64_t* heldBlock, uint8_t* dirty, uint64_t block);
+uint64_t newMapBlock(FsVolume_p vol, BlockMap_p map, uint64_t** buffer, uint64_t* heldBlock, uint8_t* dirty);
+uint64_t takePoolBlock(FsVolume_p vol, BlockMap_p map);
+uint64_t getMapBlock(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock);
+uint64_t getBlockRun(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock, uint64_t maxBlocks, uint64_t* dataBlock);
+int setMapBlock(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock, uint64_t dataBlock);
+void countMapBlock(Inode_p inode, uint64_t oldBlock, uint64_t newBlock);
+void extendBlockMap(FsVolume_p vol, BlockMap_p map, uint64_t newLength);
+int64_t reserveHoles(FsVolume_p vol, BlockMap_p map, uint64_t startBlock, uint64_t endBlock, bool copyShared);
+int findDataOrHole(FsVolume_p vol, Inode_p inode, uint64_t position, uint8_t findHole, uint64_t* foundPosition);
+int resizeInode(FsVolume_p vol, Inode_p inode, uint64_t size);
+int spillInline(FsVolume_p vol, Inode_p inode);
+void openVectorCursor(VectorCursor_p cursor, FileVector_p vectors, uint32_t count);
+uint64_t vectorBytesLeft(VectorCursor_p cursor);
+uint8_t* vectorPointer(VectorCursor_p cursor);
+void scatterToVectors(VectorCursor_p cursor, const uint8_t* source, uint64_t length);
+void gatherFromVectors(VectorCursor_p cursor, uint8_t* destination, uint64_t length);
+int64_t writeFile(FsVolume_p vol, uint8_t* source, Inode_p inode, uint64_t startPos, uint64_t length);
+int64_t writeFileVector(FsVolume_p vol, FileVector_p vectors, uint32_t count, Inode_p inode, uint64_t startPos);
+uint64_t readFile(FsVolume_p vol, uint8_t** destination, Inode_p inode, uint64_t startPos, uint64_t length);
+uint64_t readFileVector(FsVolume_p vol, FileVector_p vectors, uint32_t count, Inode_p inode, uint64_t startPos);
+void lockInodeBlock(FsVolume_p vol, uint64_t blockLocation);
+void unlockInodeBlock(FsVolume_p vol, uint64_t blockLocation);
+void locateInode(FsVolume_p vol, uint64_t inodeID, uint64_t* blockLocation, uint64_t* offset);
+int readInode(FsVolume_p vol, uint64_t inodeID, Inode_p* inodeBuffer);
+int compareInodeSlots(const void* a, const void* b);
+void lockInodeRun(FsVolume_p vol, uint64_t blockLocation, uint64_t count);
+void unlockInodeRun(FsVolume_p vol, uint64_t blockLocation, uint64_t count);
+int readInodes(FsVolume_p vol, uint64_t* inodeIDs, uint64_t count, Inode_p inodes);
+int writeInode(FsVolume_p vol, Inode_p inode);
+void addInodeTotals(Inode_p inode, int sign, int64_t* size, int64_t* reserved, int64_t* files);
+void addToAncestors(FsVolume_p vol, uint64_t inodeID, int64_t size, int64_t reserved, int64_t files);
+OpenFile_p openFileOfInode(FsVolume_p vol, Inode_p inode);
+void takeOpenFileTotals(OpenFile_p openFile, int64_t* size, int64_t* reserved);
+void takePendingTotals(FsVolume_p vol, uint64_t inodeID, int64_t* size, int64_t* reserved);
+void applyOpenFileTotals(FsVolume_p vol);
+void deleteFile(FsVolume_p vol, Inode_p inode);
+void freeInode(FsVolume_p vol, Inode_p inode);
+int addToDirectory(FsVolume_p vol, Inode_p dirInode, uint64_t inodeID, uint8_t type, const char* name);
+int removeFromDirectory(FsVolume_p vol, Inode_p dirInode, uint64_t fileInodeID);
+uint32_t hashName(const char* name);
+uint64_t writeEntry(FsVolume_p vol, uint8_t* record, uint64_t inodeID, uint8_t type, const char* name);
+uint64_t readEntry(FsVolume_p vol, uint8_t* record, uint64_t remaining, DirEntry_p entry);
+DirIterator_p dirOpen(FsVolume_p vol, Inode_p dirInode);
+void fillDirWindow(FsVolume_p vol, DirIterator_p iterator);
+int dirRead(FsVolume_p vol, DirIterator_p iterator, DirEntry_p entry);
+int64_t dirFind(FsVolume_p vol, DirIterator_p iterator, const char* name, uint64_t inodeID, DirEntry_p entry, uint64_t* length);
+void dirClose(FsVolume_p vol, DirIterator_p iterator);
+uint64_t readEntries(FsVolume_p vol, DirIterator_p iterator, DirEntry_p entries, uint64_t maxEntries);
+uint64_t deallocateBlocks(FsVolume_p vol, Inode_p inode, uint64_t size);
+int64_t allocateBlocks(FsVolume_p vol, Inode_p inode, uint64_t size);
+int64_t fillBlocks(FsVolume_p vol, Inode_p inode, uint64_t startBlock, uint64_t endBlock, bool wipe);
+uint64_t inodeBlockGoal(FsVolume_p vol, uint64_t inodeID);
+uint64_t mapBlockGoal(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock);
+uint64_t findFreeBlocks(FsVolume_p vol, uint64_t numberBlocksRequired, uint64_t** blockLocations, uint64_t goal);
+uint64_t searchFreeBlocks(FsVolume_p vol, uint64_t numberBlocksRequired, uint64_t** blockLocations, uint64_t goal);
 void fillArray(uint64_t* blockLocations, uint64_t startValue, uint64_t length);
-int bitUsed(uint64_t bit);
-void setBitOn(uint64_t bitToSet);
-void setBitOff(uint64_t bitToSet);
-void readBitVector();
-int writeBitVector();
-int writeSuperBlock();
-int saveMemory();
-void wipePartition();
+int bitUsed(FsVolume_p vol, uint64_t bit);
+void setBitOn(FsVolume_p vol, uint64_t bitToSet);
+void setBitOff(FsVolume_p vol, uint64_t bitToSet);
+void releaseBlock(FsVolume_p vol, uint64_t block);
+bool blockShared(FsVolume_p vol, uint64_t block);
+void shareBlock(FsVolume_p vol, uint64_t block);
+void setRefCount(FsVolume_p vol, uint64_t block, uint32_t count);
+void readBitVector(FsVolume_p vol);
+int writeBitVector(FsVolume_p vol);
+void readRefCounts(FsVolume_p vol);
+int writeRefCounts(FsVolume_p vol);
+int writeSuperBlock(FsVolume_p vol);
+int writeMemory(FsVolume_p vol);
+void markMemoryDirty(FsVolume_p vol);
+int saveMemory(FsVolume_p vol);
+void beginBatch(FsVolume_p vol);
+int endBatch(FsVolume_p vol);
+int fsSync(FsVolume_p vol);
+uint64_t currentMillis();
+void writeBack(FsVolume_p vol);
+void* runFlusher(void* arg);
+int startWriteback(FsVolume_p vol, WritebackConfig_p config);
+void stopWriteback(FsVolume_p vol);
+void wipePartition(FsVolume_p vol);
+void wipeBlocks(FsVolume_p vol, uint64_t startBlock, uint64_t count);
 uint32_t parsePath(char* path, char** args);
-int getFullPath(uint64_t parentID, uint64_t currentID);
-int getLastInode(char* path, uint64_t* lastInode, bool saveLastArg, char* lastArg);
-uint64_t createFile(char* path, uint8_t type, uint64_t size, bool haveDirInode, uint64_t dirInodeID);
-int inodeContainsFile(Inode_p inode, const char* fileName, uint64_t* foundInodeID);
-void initWorkingDirectory();
-int fileOpen(char* file);
-int inodeOpen(Inode_p inode);
-int fileClose(int fd);
-int64_t fileWrite(int fd, uint8_t* buffer, uint64_t length);
-int64_t fileRead(int fd, uint8_t* buffer, uint64_t length);
-int fileSeek(int fd, int64_t offset, uint8_t method);
-void calculateDirSize(Inode_p inode, uint64_t* totalDirSize, uint64_t* totalDirReserved);
-int64_t copyFile(Inode_p srcInode, Inode_p destDirInode, char* fileName);
-int64_t copyDirectory(Inode_p srcDirInode, Inode_p destDirInode, char* fileName);
-
-SuperBlock_p sb = NULL;
-uint8_t* bitVector = NULL;
-WorkingDirectory_p wd = NULL;
-FileDescriptor_p fdTable = NULL;
-
-/** flushes the input buffer */
-static void flushInput() {
-    char c;
-    while ((c = getchar()) != '\n' && c != EOF)
-        ; //discard characters
-}
+int getFullPath(FsVolume_p vol, uint64_t parentID, uint64_t currentID);
+int getLastInode(FsVolume_p vol, char* path, uint64_t* lastInode, bool saveLastArg, char* lastArg);
+uint64_t createFile(FsVolume_p vol, char* path, uint8_t type, uint64_t size, bool haveDirInode, uint64_t dirInodeID);
+int inodeContainsFile(FsVolume_p vol, Inode_p inode, const char* fileName, uint64_t* foundInodeID);
+int64_t listDirectory(FsVolume_p vol, uint64_t dirInodeID, DirEntryCallback callback, void* arg);
+void printEntry(DirEntry_p entry, Inode_p inode, void* arg);
+void initWorkingDirectory(FsVolume_p vol);
+void initFileTables(FsVolume_p vol);
+int loadVolume(FsVolume_p vol);
+int openInodeID(FsVolume_p vol, uint64_t inodeID);
+int fileOpen(FsVolume_p vol, char* file);
+int inodeOpen(FsVolume_p vol, Inode_p inode);
+int fileClose(FsVolume_p vol, int fd);
+int64_t fileWrite(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length);
+int64_t fileRead(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length);
+int64_t filePwrite(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length, uint64_t offset);
+int64_t filePread(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length, uint64_t offset);
+uint64_t vectorLength(FileVector_p vectors, uint32_t count);
+int64_t filePwritev(FsVolume_p vol, int fd, FileVector_p vectors, uint32_t count, uint64_t offset);
+int64_t filePreadv(FsVolume_p vol, int fd, FileVector_p vectors, uint32_t count, uint64_t offset);
+int fileSync(FsVolume_p vol, int fd);
+int fileSetDurability(FsVolume_p vol, int fd, int durability);
+int fileSeek(FsVolume_p vol, int fd, int64_t offset, uint8_t method);
+int64_t copyFile(FsVolume_p vol, Inode_p srcInode, Inode_p destDirInode, char* fileName, bool reflink);
+int64_t copyDirectory(FsVolume_p vol, Inode_p srcDirInode, Inode_p destDirInode, char* fileName, bool reflink);
+int64_t shareFileBlocks(FsVolume_p vol, Inode_p srcInode, Inode_p destInode);
+int runTreeOperation(FsVolume_p vol, TaskFunction function, uint64_t srcInodeID, uint64_t destInodeID, bool reflink);
+void spawnTreeTask(TreeTask_p parent, TaskFunction function, uint64_t srcInodeID, uint64_t destInodeID);
+void deleteTreeTask(void* arg);
+void copyTreeTask(void* arg);
+int copyInRegion(FsVolume_p vol, int hostFD, int fd, uint64_t start, uint64_t end);
+int copyOutRegion(FsVolume_p vol, int fd, int hostFD, uint64_t start, uint64_t end);
+
+/* Everything about one mounted volume, handed to every call as its FsVolume_p */
+struct FsVolume {
+	partition_p partition;					//Partition the volume is stored on
+	partitionInfo_p partInfop;				//Header of the partition, owned by partition
+	SuperBlock_p sb;						//Super block, NULL until the volume is formatted
+	uint8_t* bitVector;
+	uint8_t* bitVectorDirty;				//Blocks of the bitVector that must be written back
+	WorkingDirectory_p wd;
+	FileDescriptor_p fdTable;
+	OpenFile_p openFiles;					//Open files shared by the file descriptors
+	int32_t openFileBuckets[OPEN_FILE_BUCKETS];	//First open file of each bucket, -1 if empty
+	int32_t freeOpenFile;					//First free open file, -1 if none
+	int32_t freeDescriptor;					//First free file descriptor, -1 if none
+	uint32_t* refCounts;					//Extra references to each data block, 0 if unshared
+	uint8_t* refCountDirty;					//Blocks of refCounts that must be written back
+	uint32_t batchDepth;					//Nesting of batches, saveMemory is deferred while above 0
+	bool memoryDirty;						//If saveMemory was deferred during a batch
+	uint64_t memoryDirtySince;				//Milliseconds when saveMemory was first deferred
+	ObjectPool inodePool;					//Inode buffers of the volume
+	ObjectPool blockPool;					//Block sized buffers of the volume
+	AllocStats allocStats;					//Work done by the block allocator, guarded by allocLock
+	LatencyHistogram opStats[FS_OP_COUNT];	//Time taken by each operation, indexed by FS_OP_*
+
+	//Locks that let tree operations run on several threads
+	pthread_mutex_t allocLock;				//Guards the bitVector, reference counts and superblock counts
+	pthread_mutex_t inodeAllocLock;			//Held while finding and claiming a free inode
+	pthread_mutex_t fdLock;					//Guards the file descriptor and open file tables
+	pthread_mutex_t inodeLocks[INODE_LOCKS];
+
+	//Background flusher that writes back what the relaxed durabilities leave unflushed
+	pthread_t flusherThread;
+	bool flusherRunning;					//If flusherThread was started and not stopped
+	bool flusherStopping;					//Tells the flusher to exit
+	WritebackConfig writeback;				//When the flusher writes back
+	pthread_mutex_t flusherLock;			//Guards flusherStopping
+	pthread_cond_t flusherWake;				//Signalled to stop the flusher
+};
+
+const char* fsOpNames[FS_OP_COUNT] = { "format", "mkdir", "mkfile", "rmdir", "rm", "cp", "mv", "cpin", "cpout", "cd",
+	"ls", "listdir", "stat", "resize", "reserve", "open", "close", "read", "write", "seek", "fsync", "sync" };
 
 /**
  * Frees any globals set. This is used when formatting.
+ * @param vol the volume
+ */
+void freeGlobals(FsVolume_p vol) {
+	if (vol->sb != NULL)
+		free(vol->sb);
+	if (vol->bitVector != NULL)
+		free(vol->bitVector);
+	if (vol->bitVectorDirty != NULL)
+		free(vol->bitVectorDirty);
+	vol->bitVector = NULL;
+	vol->bitVectorDirty = NULL;
+	if (vol->wd != NULL)
+		free(vol->wd);
+	if (vol->fdTable != NULL)
+		free(vol->fdTable);
+	if (vol->openFiles != NULL)
+		free(vol->openFiles);
+	vol->fdTable = NULL;
+	vol->openFiles = NULL;
+	if (vol->refCounts != NULL)
+		free(vol->refCounts);
+	if (vol->refCountDirty != NULL)
+		free(vol->refCountDirty);
+	vol->refCounts = NULL;
+	vol->refCountDirty = NULL;
+	destroyObjectPool(&vol->inodePool);
+	destroyObjectPool(&vol->blockPool);
+}
+
+/**
+ * Prepares the inode and block buffer pools for the mounted volume
+ * @param vol the volume
+ */
+void initMemoryPools(FsVolume_p vol) {
+	initObjectPool(&vol->inodePool, sizeof(Inode), INODE_SLAB_SIZE);
+	initObjectPool(&vol->blockPool, vol->partInfop->blocksize, BUFFER_SLAB_SIZE);
+}
+
+/**
+ * Takes an inode buffer from the inode pool. The buffer is not cleared.
+ * @param vol the volume
+ * @returns the inode buffer
+ */
+Inode_p getInodeBuffer(FsVolume_p vol) {
+	return takeObject(&vol->inodePool);
+}
+
+/**
+ * Gives an inode buffer back to the inode pool
+ * @param vol the volume
+ * @param inode the buffer taken by getInodeBuffer or readInode, ignored if NULL
  */
-void freeGlobals() {
-	if (sb != NULL)
-		free(sb);
-	if (bitVector != NULL)
-		free(bitVector);
-	if (wd != NULL)
-		free(wd);
-	if (fdTable != NULL)
-		free(fdTable);
+void putInodeBuffer(FsVolume_p vol, Inode_p inode) {
+	giveObject(&vol->inodePool, inode);
+}
+
+/**
+ * Takes a block sized buffer from the block pool. The buffer is not cleared.
+ * @param vol the volume
+ * @returns the buffer
+ */
+uint8_t* getBlockBuffer(FsVolume_p vol) {
+	return takeObject(&vol->blockPool);
+}
+
+/**
+ * Gives a block sized buffer back to the block pool
+ * @param vol the volume
+ * @param buffer the buffer taken by getBlockBuffer, ignored if NULL
+ */
+void putBlockBuffer(FsVolume_p vol, void* buffer) {
+	giveObject(&vol->blockPool, buffer);
 }
 
 /**
@@ -154,79 +341,728 @@ uint64_t findNextPrime(uint64_t minBlockSize) {
 /**
  * Hashes the name of the file/folder along with the parent
  * inode and should return an unused inode
+ * @param vol the volume
  * @param name the file name
  * @param parentInode the parent inode id
  * @returns the hash
  */
-uint64_t hashInode(char* name, uint64_t parentInode) {
+uint64_t hashInode(FsVolume_p vol, char* name, uint64_t parentInode) {
 	uint64_t hash = 7243;
 
 	while (*name) {
 		hash += (hash << 5) + *name + parentInode;
 		name++;
 	}
-	return hash % sb->numInodes;
+	return hash % vol->sb->numInodes;
+}
+
+/**
+ * Counts the used inodes in a group of the inode table.
+ * @param vol the volume
+ * @param group the group to count
+ * @param buffer a block sized buffer to read the inode table into
+ * @returns the number of used inodes
+ */
+uint64_t countGroupInodes(FsVolume_p vol, uint64_t group, uint8_t* buffer) {
+	LBA_TAG_SCOPE(LBA_TAG_INODE);
+	uint64_t inodesPerBlock = vol->partInfop->blocksize / sizeof(Inode);
+	uint64_t firstID = group * INODE_GROUP_SIZE;
+	uint64_t lastID = firstID + INODE_GROUP_SIZE;
+	uint64_t used = 0;
+
+	if (lastID > vol->sb->numInodes)
+		lastID = vol->sb->numInodes;
+	for (uint64_t id = firstID; id < lastID; id++) {
+		if (id == firstID || id % inodesPerBlock == 0)
+			LBAread(vol->partition, buffer, 1, vol->sb->inodeStart + id / inodesPerBlock);
+		if (buffer[(id % inodesPerBlock) * sizeof(Inode)] == USED_FLAG)
+			used++;
+	}
+	return used;
+}
+
+/**
+ * Picks where the search for a free inode starts. Files and nested directories
+ * start right after their parent so that a directory and its children share
+ * blocks of the inode table. Directories made in the root start a new group,
+ * the emptiest of the few groups after the one their name hashes to, so that
+ * separate trees are spread across the inode table.
+ * @param vol the volume
+ * @param name the name of the file
+ * @param parentInode the parent inode ID
+ * @param type FILE_TYPE or DIRECTORY_TYPE
+ * @returns the inode ID to start searching from
+ */
+uint64_t pickInodeStart(FsVolume_p vol, char* name, uint64_t parentInode, uint8_t type) {
+	if (type != DIRECTORY_TYPE || parentInode != 0)
+		return (parentInode + 1 < vol->sb->numInodes) ? parentInode + 1 : 1;
+
+	uint64_t numGroups = (vol->sb->numInodes + INODE_GROUP_SIZE - 1) / INODE_GROUP_SIZE;
+	uint64_t group = hashInode(vol, name, parentInode) / INODE_GROUP_SIZE;
+	uint64_t bestGroup = group;
+	uint64_t bestUsed = UINT64_MAX;
+	uint64_t used;
+	uint8_t* buffer = getBlockBuffer(vol);
+
+	for (uint64_t i = 0; i < ORLOV_PROBES && i < numGroups; i++) {
+		used = countGroupInodes(vol, (group + i) % numGroups, buffer);
+		if (used < bestUsed) {
+			bestUsed = used;
+			bestGroup = (group + i) % numGroups;
+		}
+		if (used == 0)
+			break;
+	}
+	putBlockBuffer(vol, buffer);
+	return (bestGroup == 0) ? 1 : bestGroup * INODE_GROUP_SIZE;
 }
 
 /**
  * Finds and returns a free inode number in the inode table.
+ * @param vol the volume
  * @param name the name of the file
- * @param the parent inode ID
+ * @param parentInode the parent inode ID
+ * @param type FILE_TYPE or DIRECTORY_TYPE
  * @returns a free inode
  * @returns 0 if unsuccessful
  */
-uint64_t findFreeInode(char* name, uint64_t parentInode) {
-	if (sb->usedInodes >= sb->numInodes)
+uint64_t findFreeInode(FsVolume_p vol, char* name, uint64_t parentInode, uint8_t type) {
+	LBA_TAG_SCOPE(LBA_TAG_INODE);
+	if (vol->sb->usedInodes >= vol->sb->numInodes)
 		return 0;
 
-	//hash the name and parent inode to find the starting point
+	//Start near the parent, or in a new group for a top level directory
 	uint64_t numberSearched = 0;
-	uint64_t inodeID = hashInode(name, parentInode);
-	uint64_t currentID = inodeID;
-
-	//Check from the starting point and loop around until a free inode is found
-	uint8_t* buffer = malloc(partInfop->blocksize * 2);
-	uint64_t byteLocation = inodeID * sizeof(Inode) + partInfop->blocksize * sb->inodeStart;
-	uint64_t blockLocation = byteLocation / partInfop->blocksize;
-	uint64_t offset = byteLocation % partInfop->blocksize;
-	LBAread(&buffer[partInfop->blocksize], 1, blockLocation);
-	blockLocation++;
-	while (numberSearched < sb->numInodes - 1) {
-		memcpy(buffer, &buffer[partInfop->blocksize], partInfop->blocksize);
-		if (blockLocation < sb->bitVectorStart) {
-			LBAread(&buffer[partInfop->blocksize], 1, blockLocation);
+	uint64_t currentID = pickInodeStart(vol, name, parentInode, type);
+	uint64_t inodesPerBlock = vol->partInfop->blocksize / sizeof(Inode);
+	uint64_t heldBlock = vol->sb->inodeStart + vol->sb->blocksUsedByInodes;
+	uint64_t blockLocation;
+
+	//Check from the starting point and loop around until a free inode is found,
+	//reading each block of the inode table once as the search reaches it
+	uint8_t* buffer = getBlockBuffer(vol);
+	while (numberSearched < vol->sb->numInodes - 1) {
+		blockLocation = vol->sb->inodeStart + currentID / inodesPerBlock;
+		if (blockLocation != heldBlock) {
+			LBAread(vol->partition, buffer, 1, blockLocation);
+			heldBlock = blockLocation;
+		}
+		if (buffer[(currentID % inodesPerBlock) * sizeof(Inode)] == UNUSED_FLAG) {
+			putBlockBuffer(vol, buffer);
+			return currentID;
 		}
+		numberSearched++;
+		currentID++;
+		if (currentID >= vol->sb->numInodes)
+			currentID = 1;
+	}
+	putBlockBuffer(vol, buffer);
+	return 0;
+}
 
-		while (offset < partInfop->blocksize * 2 - sizeof(Inode)) {
-			if (buffer[offset] == UNUSED_FLAG) {
-				free(buffer);
-				return currentID;
-			} else {
-				numberSearched++;
-				currentID++;
-				if (currentID >= sb->numInodes) {
-					currentID = 1;
-					offset = sizeof(Inode);
-					break;
-				} else {
-					offset += sizeof(Inode);
-				}
+/**
+ * Prepares a block map for walking the data blocks of an inode.
+ * Indirect blocks are loaded as they are needed and closeBlockMap
+ * must be called to write back any changes.
+ * @param map the block map to initialize
+ * @param inode the inode whose data blocks will be walked
+ */
+void openBlockMap(BlockMap_p map, Inode_p inode) {
+	memset(map, 0, sizeof(BlockMap));
+	map->inode = inode;
+	map->indirectBlock = HOLE_BLOCK;
+	map->doubleIndirectBlock = HOLE_BLOCK;
+}
+
+/**
+ * Writes back any modified indirect blocks held by the block map.
+ * @param vol the volume
+ * @param map the block map to flush
+ */
+void flushBlockMap(FsVolume_p vol, BlockMap_p map) {
+	LBA_TAG_SCOPE(LBA_TAG_INDIRECT);
+	if (map->indirectDirty && map->indirectBlock != HOLE_BLOCK)
+		LBAwrite(vol->partition, map->indirect, 1, map->indirectBlock + vol->sb->rootDataPointer);
+	if (map->doubleIndirectDirty && map->doubleIndirectBlock != HOLE_BLOCK)
+		LBAwrite(vol->partition, map->doubleIndirect, 1, map->doubleIndirectBlock + vol->sb->rootDataPointer);
+	map->indirectDirty = 0;
+	map->doubleIndirectDirty = 0;
+}
+
+/**
+ * Flushes the block map and gives back its buffers. Any blocks left
+ * in the pool are given back to the free blocks. The pool array itself
+ * belongs to the arena of the operation.
+ * @param vol the volume
+ * @param map the block map to close
+ */
+void closeBlockMap(FsVolume_p vol, BlockMap_p map) {
+	flushBlockMap(vol, map);
+	while (map->poolNext < map->poolSize)
+		releaseBlock(vol, map->pool[map->poolNext++]);
+	putBlockBuffer(vol, map->indirect);
+	putBlockBuffer(vol, map->doubleIndirect);
+	map->pool = NULL;
+	map->indirect = NULL;
+	map->doubleIndirect = NULL;
+}
+
+/**
+ * Loads an indirect block into one of the block map buffers. If the buffer
+ * holds a different modified block, it is written back first.
+ * @param vol the volume
+ * @param buffer the buffer to load the block into, allocated if NULL
+ * @param heldBlock the data block currently held in the buffer
+ * @param dirty whether the held block was modified
+ * @param block the data block to load
+ */
+void loadMapBlock(FsVolume_p vol, uint64_t** buffer, uint64_t* heldBlock, uint8_t* dirty, uint64_t block) {
+	LBA_TAG_SCOPE(LBA_TAG_INDIRECT);
+	if (*buffer == NULL)
+		*buffer = (uint64_t*)getBlockBuffer(vol);
+	if (*heldBlock == block)
+		return;
+	if (*dirty && *heldBlock != HOLE_BLOCK)
+		LBAwrite(vol->partition, *buffer, 1, *heldBlock + vol->sb->rootDataPointer);
+	LBAread(vol->partition, *buffer, 1, block + vol->sb->rootDataPointer);
+	*heldBlock = block;
+	*dirty = 0;
+}
+
+/**
+ * Allocates a new indirect block into one of the block map buffers.
+ * Every pointer in the new block starts out as a hole.
+ * @param vol the volume
+ * @param map the block map the indirect block belongs to
+ * @param buffer the buffer to hold the new block
+ * @param heldBlock the data block currently held in the buffer
+ * @param dirty whether the held block was modified
+ * @returns the new data block
+ * @returns HOLE_BLOCK if there are no free blocks
+ */
+uint64_t newMapBlock(FsVolume_p vol, BlockMap_p map, uint64_t** buffer, uint64_t* heldBlock, uint8_t* dirty) {
+	LBA_TAG_SCOPE(LBA_TAG_INDIRECT);
+	uint64_t block = takePoolBlock(vol, map);
+	if (block == HOLE_BLOCK)
+		return HOLE_BLOCK;
+
+	if (*buffer == NULL)
+		*buffer = (uint64_t*)getBlockBuffer(vol);
+	else if (*dirty && *heldBlock != HOLE_BLOCK)
+		LBAwrite(vol->partition, *buffer, 1, *heldBlock + vol->sb->rootDataPointer);
+
+	memset(*buffer, 0xFF, vol->partInfop->blocksize);
+	*heldBlock = block;
+	*dirty = 1;
+	map->inode->blocksIndirect++;
+	return block;
+}
+
+/**
+ * Takes the next free block out of the block map pool. If the pool is
+ * empty a single free block is found instead.
+ * @param vol the volume
+ * @param map the block map to take the block from
+ * @returns the free data block
+ * @returns HOLE_BLOCK if there are no free blocks
+ */
+uint64_t takePoolBlock(FsVolume_p vol, BlockMap_p map) {
+	ARENA_SCOPE(mark);
+	uint64_t* blockLocations = NULL;
+	uint64_t block = HOLE_BLOCK;
+
+	if (map->poolNext < map->poolSize)
+		return map->pool[map->poolNext++];
+
+	if (vol->sb->freeDataBlocks > 0 && findFreeBlocks(vol, 1, &blockLocations, inodeBlockGoal(vol, map->inode->inode)) == 1)
+		block = blockLocations[0];
+	return block;
+}
+
+/**
+ * Finds the data block holding the given block of the file.
+ * @param vol the volume
+ * @param map the block map of the file
+ * @param fileBlock the block number within the file
+ * @returns the data block
+ * @returns HOLE_BLOCK if the block is a hole or outside the block map
+ */
+uint64_t getMapBlock(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock) {
+	Inode_p inode = map->inode;
+	uint64_t leafBlock;
+
+	if (fileBlock >= inode->blocksMapped)
+		return HOLE_BLOCK;
+	if (fileBlock < NUM_DIRECT)
+		return inode->directData[fileBlock];
+
+	//Block is within the first indirect block
+	fileBlock -= NUM_DIRECT;
+	if (fileBlock < vol->sb->pointersPerIndirect) {
+		if (inode->indirectData[0] == HOLE_BLOCK)
+			return HOLE_BLOCK;
+		loadMapBlock(vol, &map->indirect, &map->indirectBlock, &map->indirectDirty, inode->indirectData[0]);
+		return map->indirect[fileBlock];
+	}
+
+	//Block is within one of the blocks pointed to by the double indirect block
+	fileBlock -= vol->sb->pointersPerIndirect;
+	if (inode->indirectData[1] == HOLE_BLOCK)
+		return HOLE_BLOCK;
+	loadMapBlock(vol, &map->doubleIndirect, &map->doubleIndirectBlock, &map->doubleIndirectDirty, inode->indirectData[1]);
+	leafBlock = map->doubleIndirect[fileBlock / vol->sb->pointersPerIndirect];
+	if (leafBlock == HOLE_BLOCK)
+		return HOLE_BLOCK;
+	loadMapBlock(vol, &map->indirect, &map->indirectBlock, &map->indirectDirty, leafBlock);
+	return map->indirect[fileBlock % vol->sb->pointersPerIndirect];
+}
+
+/**
+ * Finds how many blocks of the file starting at the given block are either
+ * all holes or stored one after another in the volume.
+ * @param vol the volume
+ * @param map the block map of the file
+ * @param fileBlock the first block number within the file
+ * @param maxBlocks the most blocks to look at
+ * @param dataBlock set to the data block of the first block, or HOLE_BLOCK
+ * @returns the number of blocks in the run
+ */
+uint64_t getBlockRun(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock, uint64_t maxBlocks, uint64_t* dataBlock) {
+	uint64_t runLength = 1;
+	uint64_t nextBlock;
+
+	*dataBlock = getMapBlock(vol, map, fileBlock);
+	while (runLength < maxBlocks) {
+		nextBlock = getMapBlock(vol, map, fileBlock + runLength);
+		if (*dataBlock == HOLE_BLOCK ? nextBlock != HOLE_BLOCK : nextBlock != *dataBlock + runLength)
+			break;
+		runLength++;
+	}
+	return runLength;
+}
+
+/**
+ * Points the given block of the file at a data block. Indirect blocks
+ * are allocated as they are needed, unless the pointer is a hole. The
+ * data blocks the file reserves are counted as holes are filled or made.
+ * @param vol the volume
+ * @param map the block map of the file
+ * @param fileBlock the block number within the file, must be within the block map
+ * @param dataBlock the data block, or HOLE_BLOCK to make a hole
+ * @returns 1 if successful
+ * @returns 0 if an indirect block could not be allocated
+ */
+int setMapBlock(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock, uint64_t dataBlock) {
+	Inode_p inode = map->inode;
+	uint64_t* leafBlock;
+
+	if (fileBlock >= inode->blocksMapped)
+		return 0;
+	if (fileBlock < NUM_DIRECT) {
+		countMapBlock(inode, inode->directData[fileBlock], dataBlock);
+		inode->directData[fileBlock] = dataBlock;
+		return 1;
+	}
+
+	//Block is within the first indirect block
+	fileBlock -= NUM_DIRECT;
+	if (fileBlock < vol->sb->pointersPerIndirect) {
+		if (inode->indirectData[0] == HOLE_BLOCK) {
+			if (dataBlock == HOLE_BLOCK)
+				return 1;
+			inode->indirectData[0] = newMapBlock(vol, map, &map->indirect, &map->indirectBlock, &map->indirectDirty);
+			if (inode->indirectData[0] == HOLE_BLOCK)
+				return 0;
+		} else {
+			loadMapBlock(vol, &map->indirect, &map->indirectBlock, &map->indirectDirty, inode->indirectData[0]);
+		}
+		countMapBlock(inode, map->indirect[fileBlock], dataBlock);
+		map->indirect[fileBlock] = dataBlock;
+		map->indirectDirty = 1;
+		return 1;
+	}
+
+	//Block is within one of the blocks pointed to by the double indirect block
+	fileBlock -= vol->sb->pointersPerIndirect;
+	if (inode->indirectData[1] == HOLE_BLOCK) {
+		if (dataBlock == HOLE_BLOCK)
+			return 1;
+		inode->indirectData[1] = newMapBlock(vol, map, &map->doubleIndirect, &map->doubleIndirectBlock, &map->doubleIndirectDirty);
+		if (inode->indirectData[1] == HOLE_BLOCK)
+			return 0;
+	} else {
+		loadMapBlock(vol, &map->doubleIndirect, &map->doubleIndirectBlock, &map->doubleIndirectDirty, inode->indirectData[1]);
+	}
+
+	leafBlock = &map->doubleIndirect[fileBlock / vol->sb->pointersPerIndirect];
+	if (*leafBlock == HOLE_BLOCK) {
+		if (dataBlock == HOLE_BLOCK)
+			return 1;
+		*leafBlock = newMapBlock(vol, map, &map->indirect, &map->indirectBlock, &map->indirectDirty);
+		if (*leafBlock == HOLE_BLOCK)
+			return 0;
+		map->doubleIndirectDirty = 1;
+	} else {
+		loadMapBlock(vol, &map->indirect, &map->indirectBlock, &map->indirectDirty, *leafBlock);
+	}
+	countMapBlock(inode, map->indirect[fileBlock % vol->sb->pointersPerIndirect], dataBlock);
+	map->indirect[fileBlock % vol->sb->pointersPerIndirect] = dataBlock;
+	map->indirectDirty = 1;
+	return 1;
+}
+
+/**
+ * Counts the change in data blocks reserved by a file when a pointer of its
+ * block map changes from one block to another.
+ * @param inode the inode of the file
+ * @param oldBlock the data block the pointer held, or HOLE_BLOCK
+ * @param newBlock the data block the pointer holds now, or HOLE_BLOCK
+ */
+void countMapBlock(Inode_p inode, uint64_t oldBlock, uint64_t newBlock) {
+	if (oldBlock == HOLE_BLOCK && newBlock != HOLE_BLOCK)
+		inode->blocksReserved++;
+	else if (oldBlock != HOLE_BLOCK && newBlock == HOLE_BLOCK)
+		inode->blocksReserved--;
+}
+
+/**
+ * Grows the block map of the file without allocating any data blocks.
+ * Every new block is a hole until it is written to.
+ * @param vol the volume
+ * @param map the block map of the file
+ * @param newLength the new number of blocks in the block map
+ */
+void extendBlockMap(FsVolume_p vol, BlockMap_p map, uint64_t newLength) {
+	Inode_p inode = map->inode;
+	uint64_t pointers = vol->sb->pointersPerIndirect;
+	uint64_t fileBlock = inode->blocksMapped;
+	uint64_t relative;
+	uint64_t last;
+
+	if (newLength <= inode->blocksMapped)
+		return;
+	inode->blocksMapped = newLength;
+
+	while (fileBlock < newLength) {
+		//Direct blocks
+		if (fileBlock < NUM_DIRECT) {
+			inode->directData[fileBlock++] = HOLE_BLOCK;
+			continue;
+		}
+
+		//First indirect block. If it is new then all of its pointers are holes.
+		relative = fileBlock - NUM_DIRECT;
+		if (relative < pointers) {
+			if (relative == 0) {
+				inode->indirectData[0] = HOLE_BLOCK;
+			} else if (inode->indirectData[0] != HOLE_BLOCK) {
+				loadMapBlock(vol, &map->indirect, &map->indirectBlock, &map->indirectDirty, inode->indirectData[0]);
+				last = (newLength - NUM_DIRECT < pointers) ? newLength - NUM_DIRECT : pointers;
+				for (uint64_t i = relative; i < last; i++)
+					map->indirect[i] = HOLE_BLOCK;
+				map->indirectDirty = 1;
 			}
+			fileBlock = NUM_DIRECT + pointers;
+			continue;
 		}
-		if (currentID == 1) {
-			blockLocation = sb->inodeStart;
+
+		//Double indirect block. New blocks pointed to by it are holes.
+		relative -= pointers;
+		if (relative == 0) {
+			inode->indirectData[1] = HOLE_BLOCK;
+			break;
+		} else if (inode->indirectData[1] == HOLE_BLOCK) {
+			break;
+		}
+		loadMapBlock(vol, &map->doubleIndirect, &map->doubleIndirectBlock, &map->doubleIndirectDirty, inode->indirectData[1]);
+		if (relative % pointers == 0) {
+			map->doubleIndirect[relative / pointers] = HOLE_BLOCK;
+			map->doubleIndirectDirty = 1;
+		} else if (map->doubleIndirect[relative / pointers] != HOLE_BLOCK) {
+			loadMapBlock(vol, &map->indirect, &map->indirectBlock, &map->indirectDirty, map->doubleIndirect[relative / pointers]);
+			last = newLength - fileBlock + relative % pointers;
+			if (last > pointers)
+				last = pointers;
+			for (uint64_t i = relative % pointers; i < last; i++)
+				map->indirect[i] = HOLE_BLOCK;
+			map->indirectDirty = 1;
+		}
+		fileBlock += pointers - relative % pointers;
+	}
+}
+
+/**
+ * Counts the holes between the given blocks of the file, along with the indirect
+ * blocks needed to point to them, and reserves that many free blocks in the pool.
+ * @param vol the volume
+ * @param map the block map of the file
+ * @param startBlock the first block of the file to fill
+ * @param endBlock one past the last block of the file to fill
+ * @param copyShared whether blocks shared with another file also need a new block
+ * @returns the number of blocks reserved
+ * @returns -1 if there are not enough free blocks
+ */
+int64_t reserveHoles(FsVolume_p vol, BlockMap_p map, uint64_t startBlock, uint64_t endBlock, bool copyShared) {
+	Inode_p inode = map->inode;
+	uint64_t pointers = vol->sb->pointersPerIndirect;
+	uint64_t blocksNeeded = 0;
+	uint64_t lastLeaf = HOLE_BLOCK;
+	uint8_t indirectNeeded = 0;
+	uint8_t doubleIndirectNeeded = 0;
+	uint64_t relative;
+
+	uint64_t block;
+
+	for (uint64_t i = startBlock; i < endBlock; i++) {
+		block = getMapBlock(vol, map, i);
+		if (block != HOLE_BLOCK) {
+			if (copyShared && blockShared(vol, block))
+				blocksNeeded++;
+			continue;
+		}
+		blocksNeeded++;
+		if (i < NUM_DIRECT)
+			continue;
+
+		relative = i - NUM_DIRECT;
+		if (relative < pointers) {
+			if (inode->indirectData[0] == HOLE_BLOCK && !indirectNeeded) {
+				indirectNeeded = 1;
+				blocksNeeded++;
+			}
+			continue;
+		}
+
+		relative -= pointers;
+		if (inode->indirectData[1] == HOLE_BLOCK) {
+			if (!doubleIndirectNeeded) {
+				doubleIndirectNeeded = 1;
+				blocksNeeded++;
+			}
+		} else if (map->doubleIndirect[relative / pointers] != HOLE_BLOCK) {
+			continue;
+		}
+		if (relative / pointers != lastLeaf) {
+			lastLeaf = relative / pointers;
+			blocksNeeded++;
+		}
+	}
+
+	if (blocksNeeded == 0)
+		return 0;
+	if (blocksNeeded > vol->sb->freeDataBlocks) {
+		printf("Not enough free blocks to allocate to file\n");
+		return -1;
+	}
+
+	while (map->poolNext < map->poolSize)
+		releaseBlock(vol, map->pool[map->poolNext++]);
+	map->poolSize = 0;
+	map->poolNext = 0;
+	if (findFreeBlocks(vol, blocksNeeded, &map->pool, mapBlockGoal(vol, map, startBlock)) != blocksNeeded) {
+		printf("Free Blocks not equal to total blocks needed\n");
+		return -1;
+	}
+	map->poolSize = blocksNeeded;
+	return blocksNeeded;
+}
+
+/**
+ * Finds the next offset at or after the given position where data or a hole begins.
+ * The end of the file always counts as the start of a hole.
+ * @param vol the volume
+ * @param inode the inode of the file to search
+ * @param position the byte offset to start searching from
+ * @param findHole 1 to find the next hole, 0 to find the next data
+ * @param foundPosition stores the offset that was found
+ * @returns 1 if found
+ * @returns 0 if there is no data at or after the position
+ */
+int findDataOrHole(FsVolume_p vol, Inode_p inode, uint64_t position, uint8_t findHole, uint64_t* foundPosition) {
+	BlockMap map;
+	uint64_t endBlock = (inode->size + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+	uint64_t isHole;
+	int found = 0;
+
+	if (position >= inode->size)
+		return 0;
+
+	//Inline data has no holes
+	if (inode->inlined) {
+		*foundPosition = findHole ? inode->size : position;
+		return 1;
+	}
+
+	openBlockMap(&map, inode);
+	for (uint64_t i = position / vol->partInfop->blocksize; i < endBlock; i++) {
+		isHole = (getMapBlock(vol, &map, i) == HOLE_BLOCK);
+		if (isHole == findHole) {
+			*foundPosition = (i * vol->partInfop->blocksize > position) ? i * vol->partInfop->blocksize : position;
+			found = 1;
+			break;
+		}
+	}
+	closeBlockMap(vol, &map);
+
+	if (!found && findHole) {
+		*foundPosition = inode->size;
+		found = 1;
+	}
+	return found;
+}
+
+/**
+ * Changes the size of the file. Growing past the reserved blocks extends the
+ * block map with holes, so no data blocks are allocated or wiped.
+ * Shrinking does not deallocate any reserved blocks.
+ * @param vol the volume
+ * @param inode the inode of the file to resize
+ * @param size the new size in bytes
+ * @returns 1 if successful
+ * @returns 0 if the size is larger than the max file size
+ */
+int resizeInode(FsVolume_p vol, Inode_p inode, uint64_t size) {
+	BlockMap map;
+	uint64_t blocksNeeded = (size + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+
+	if (size > vol->sb->maxFileSize)
+		return 0;
+
+	//Inline data that still fits only needs the new bytes zeroed
+	if (inode->inlined && size <= INLINE_DATA_SIZE) {
+		if (size > inode->size)
+			memset(&inode->inlineData[inode->size], 0, size - inode->size);
+		inode->size = size;
+		return 1;
+	}
+	if (inode->inlined && !spillInline(vol, inode))
+		return 0;
+
+	if (blocksNeeded > inode->blocksMapped) {
+		openBlockMap(&map, inode);
+		extendBlockMap(vol, &map, blocksNeeded);
+		closeBlockMap(vol, &map);
+	}
+	inode->size = size;
+	return 1;
+}
+
+/**
+ * Moves the inline data of an inode out to data blocks, so the file can
+ * grow past the space in the inode. The inode is left unchanged if there
+ * are not enough free blocks.
+ * @param vol the volume
+ * @param inode the inode to move the data of
+ * @returns 1 if successful
+ * @returns 0 if there are not enough free blocks
+ */
+int spillInline(FsVolume_p vol, Inode_p inode) {
+	uint8_t data[INLINE_DATA_SIZE];
+	uint64_t length = (inode->size < INLINE_DATA_SIZE) ? inode->size : INLINE_DATA_SIZE;
+
+	//The space of the data becomes the empty block map
+	memcpy(data, inode->inlineData, INLINE_DATA_SIZE);
+	memset(inode->inlineData, 0, INLINE_DATA_SIZE);
+	inode->inlined = 0;
+	inode->blocksMapped = 0;
+	inode->blocksReserved = 0;
+	inode->blocksIndirect = 0;
+	if (length > 0 && writeFile(vol, data, inode, 0, length) == -1) {
+		memcpy(inode->inlineData, data, INLINE_DATA_SIZE);
+		inode->inlined = 1;
+		inode->blocksMapped = 0;
+		inode->blocksReserved = 0;
+		inode->blocksIndirect = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Starts a cursor at the first byte of an array of vectors
+ * @param cursor the cursor to start
+ * @param vectors the vectors to walk through
+ * @param count the number of vectors
+ */
+void openVectorCursor(VectorCursor_p cursor, FileVector_p vectors, uint32_t count) {
+	cursor->vectors = vectors;
+	cursor->count = count;
+	cursor->index = 0;
+	cursor->offset = 0;
+}
+
+/**
+ * Finds how many bytes are left in the vector the cursor is in, skipping
+ * past vectors that are used up or empty.
+ * @param cursor the vector cursor
+ * @returns the number of bytes that can be used at vectorPointer
+ * @returns 0 if every vector is used up
+ */
+uint64_t vectorBytesLeft(VectorCursor_p cursor) {
+	while (cursor->index < cursor->count && cursor->offset >= cursor->vectors[cursor->index].length) {
+		cursor->index++;
+		cursor->offset = 0;
+	}
+	if (cursor->index >= cursor->count)
+		return 0;
+	return cursor->vectors[cursor->index].length - cursor->offset;
+}
+
+/**
+ * Finds the byte the cursor points to. vectorBytesLeft must be called first.
+ * @param cursor the vector cursor
+ * @returns the address of the byte
+ */
+uint8_t* vectorPointer(VectorCursor_p cursor) {
+	return &cursor->vectors[cursor->index].buffer[cursor->offset];
+}
+
+/**
+ * Copies bytes into the vectors and moves the cursor past them
+ * @param cursor the vector cursor
+ * @param source the bytes to copy, NULL to fill with zeros
+ * @param length the number of bytes
+ */
+void scatterToVectors(VectorCursor_p cursor, const uint8_t* source, uint64_t length) {
+	uint64_t bytes;
+
+	while (length > 0 && (bytes = vectorBytesLeft(cursor)) > 0) {
+		if (bytes > length)
+			bytes = length;
+		if (source == NULL) {
+			memset(vectorPointer(cursor), 0, bytes);
 		} else {
-			blockLocation++;
-			offset -= partInfop->blocksize;
+			memcpy(vectorPointer(cursor), source, bytes);
+			source += bytes;
 		}
+		cursor->offset += bytes;
+		length -= bytes;
+	}
+}
+
+/**
+ * Copies bytes out of the vectors and moves the cursor past them
+ * @param cursor the vector cursor
+ * @param destination where to copy the bytes
+ * @param length the number of bytes
+ */
+void gatherFromVectors(VectorCursor_p cursor, uint8_t* destination, uint64_t length) {
+	uint64_t bytes;
+
+	while (length > 0 && (bytes = vectorBytesLeft(cursor)) > 0) {
+		if (bytes > length)
+			bytes = length;
+		memcpy(destination, vectorPointer(cursor), bytes);
+		cursor->offset += bytes;
+		destination += bytes;
+		length -= bytes;
 	}
-	free(buffer);
-	return 0;
 }
 
 /**
  * Writes the buffer to the file data from starting position for length.
- * Will automatically allocate more blocks if writing beyond the reserved block size.
+ * See writeFileVector.
+ * @param vol the volume
  * @param source the source buffer to write from
  * @param inode the inode of the file to write to
  * @param startPos the starting byte to write to
@@ -234,94 +1070,167 @@ uint64_t findFreeInode(char* name, uint64_t parentInode) {
  * @returns number of bytes written
  * @returns -1 if requested writes are too large
  */
-int64_t writeFile(uint8_t* source, Inode_p inode, uint64_t startPos, uint64_t length) {
-	if (inode == NULL || source == NULL)
+int64_t writeFile(FsVolume_p vol, uint8_t* source, Inode_p inode, uint64_t startPos, uint64_t length) {
+	if (source == NULL)
+		return 0;
+
+	FileVector vector = { source, length };
+	return writeFileVector(vol, &vector, 1, inode, startPos);
+}
+
+/**
+ * Writes the vectors one after another to the file data from starting position.
+ * Will automatically allocate more blocks if writing beyond the reserved block size.
+ * Any blocks skipped over when writing past the end of the file are left as holes.
+ * Blocks shared with another file are copied to a new block before being written.
+ * Inline data is written into the inode, and moved out to blocks once it no longer fits.
+ * Whole blocks that lie inside a single vector are written straight from it.
+ * @param vol the volume
+ * @param vectors the buffers to write from
+ * @param count the number of vectors
+ * @param inode the inode of the file to write to
+ * @param startPos the starting byte to write to
+ * @returns number of bytes written
+ * @returns -1 if requested writes are too large
+ */
+int64_t writeFileVector(FsVolume_p vol, FileVector_p vectors, uint32_t count, Inode_p inode, uint64_t startPos) {
+	ARENA_SCOPE(mark);
+	if (inode == NULL || vectors == NULL)
 		return 0;
+	LBA_TAG_SCOPE((inode->type == DIRECTORY_TYPE) ? LBA_TAG_DIRECTORY : LBA_TAG_DATA);
+
+	uint64_t length = 0;
+	for (uint32_t i = 0; i < count; i++)
+		length += vectors[i].length;
 
 	uint64_t maxSize = startPos + length;
-	if (maxSize > sb->maxFileSize)
+	if (maxSize > vol->sb->maxFileSize)
 		return -1;
+	if (length == 0)
+		return 0;
 
-	if (allocateBlocks(inode, maxSize) == -1) {
-		return -1;
+	VectorCursor cursor;
+	openVectorCursor(&cursor, vectors, count);
+
+	//Small files keep their data in the inode, skipped bytes read back as zeros
+	if (inode->inlined && maxSize <= INLINE_DATA_SIZE) {
+		if (startPos > inode->size)
+			memset(&inode->inlineData[inode->size], 0, startPos - inode->size);
+		gatherFromVectors(&cursor, &inode->inlineData[startPos], length);
+		if (maxSize > inode->size)
+			inode->size = maxSize;
+		writeInode(vol, inode);
+		return length;
 	}
-
-	if (maxSize > inode->size)
-		inode->size = maxSize;
+	if (inode->inlined && !spillInline(vol, inode))
+		return -1;
 
 	//Calculate the starting and ending blocks to write to
-	uint64_t startingBlock = startPos / partInfop->blocksize;
-	uint64_t endingBlock = (maxSize + partInfop->blocksize - 1) / partInfop->blocksize;
-	uint8_t* blockBuffer = calloc(1, partInfop->blocksize);
-	uint64_t* indirectBlockBuffer = calloc(NUM_INDIRECT, partInfop->blocksize);
+	BlockMap map;
+	uint64_t startingBlock = startPos / vol->partInfop->blocksize;
+	uint64_t endingBlock = (maxSize + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+	uint64_t mappedBefore = inode->blocksMapped;
+	uint64_t sizeBefore = inode->size;
+	uint64_t position = startPos;
+	uint64_t fileBlock;
+	uint64_t offset;
+	uint64_t bytes;
+	uint64_t contiguous;
 	uint64_t blockToWrite;
-	uint32_t j = 0;
-	uint64_t srcPos = 0;
+	uint64_t oldBlock;
+	uint64_t nextBlock;
+	uint64_t run;
+
+	//Reserve free blocks for every hole that will be written to
+	openBlockMap(&map, inode);
+	extendBlockMap(vol, &map, endingBlock);
+	int64_t blocksAllocated = reserveHoles(vol, &map, startingBlock, endingBlock, true);
+	if (blocksAllocated == -1) {
+		inode->blocksMapped = mappedBefore;
+		map.indirectDirty = 0;
+		map.doubleIndirectDirty = 0;
+		closeBlockMap(vol, &map);
+		return -1;
+	}
+	uint8_t* blockBuffer = getBlockBuffer(vol);
 
 	//Loop through all blocks and write to the correct block
-	for (uint64_t i = startingBlock; i < endingBlock; i++) {
-		//If the block falls within the direct blocks
-		if (i < NUM_DIRECT) {
-			blockToWrite = sb->rootDataPointer + inode->directData[i];
-		//If the block is within the first indirect block
-		} else if (i < NUM_DIRECT + sb->pointersPerIndirect) {
-			if (i == NUM_DIRECT || i == startingBlock)
-				LBAread(indirectBlockBuffer, 1, inode->indirectData[0] + sb->rootDataPointer);
-
-			blockToWrite = indirectBlockBuffer[i-NUM_DIRECT] + sb->rootDataPointer;
-		//Block is in the second indirect block. Calculate which indirect block from the inode indirect block.
-		} else {
-			if (i == NUM_DIRECT + sb->pointersPerIndirect || i == startingBlock) {
-				LBAread(&indirectBlockBuffer[sb->pointersPerIndirect], 1, inode->indirectData[1] + sb->rootDataPointer);
-				if (i == startingBlock)
-					j = (i - NUM_DIRECT - sb->pointersPerIndirect) / sb->pointersPerIndirect;
-				LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[sb->pointersPerIndirect + j] + sb->rootDataPointer);
-			}
+	while (position < maxSize) {
+		fileBlock = position / vol->partInfop->blocksize;
+		offset = position % vol->partInfop->blocksize;
+		bytes = vol->partInfop->blocksize - offset;
+		if (bytes > maxSize - position)
+			bytes = maxSize - position;
+
+		//Fill the hole, or replace the shared block, with one of the reserved blocks
+		oldBlock = getMapBlock(vol, &map, fileBlock);
+		blockToWrite = oldBlock;
+		if (oldBlock == HOLE_BLOCK || blockShared(vol, oldBlock)) {
+			blockToWrite = takePoolBlock(vol, &map);
+			setMapBlock(vol, &map, fileBlock, blockToWrite);
+		}
 
-			if ((i - NUM_DIRECT - sb->pointersPerIndirect) % sb->pointersPerIndirect == 0) {
-				j = (i - NUM_DIRECT - sb->pointersPerIndirect) / sb->pointersPerIndirect;
-				if (j >= sb->pointersPerIndirect) {
-					return 0;
+		//Partial blocks keep the rest of their contents, new blocks start out zeroed
+		contiguous = vectorBytesLeft(&cursor);
+		if (bytes < vol->partInfop->blocksize) {
+			if (oldBlock == HOLE_BLOCK)
+				memset(blockBuffer, 0, vol->partInfop->blocksize);
+			else
+				LBAread(vol->partition, blockBuffer, 1, oldBlock + vol->sb->rootDataPointer);
+			gatherFromVectors(&cursor, &blockBuffer[offset], bytes);
+			LBAwrite(vol->partition, blockBuffer, 1, blockToWrite + vol->sb->rootDataPointer);
+		//A whole block split across vectors is gathered first
+		} else if (contiguous < vol->partInfop->blocksize) {
+			gatherFromVectors(&cursor, blockBuffer, bytes);
+			LBAwrite(vol->partition, blockBuffer, 1, blockToWrite + vol->sb->rootDataPointer);
+		//Write every following whole block that is contiguous on disk and in the vector at once
+		} else {
+			run = 1;
+			while (position + (run + 1) * vol->partInfop->blocksize <= maxSize
+					&& (run + 1) * vol->partInfop->blocksize <= contiguous) {
+				nextBlock = getMapBlock(vol, &map, fileBlock + run);
+				if (nextBlock == HOLE_BLOCK || blockShared(vol, nextBlock)) {
+					if (map.poolNext >= map.poolSize || map.pool[map.poolNext] != blockToWrite + run)
+						break;
+					if (nextBlock != HOLE_BLOCK)
+						releaseBlock(vol, nextBlock);
+					nextBlock = takePoolBlock(vol, &map);
+					setMapBlock(vol, &map, fileBlock + run, nextBlock);
 				}
-
-				LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[sb->pointersPerIndirect + j] + sb->rootDataPointer);
+				if (nextBlock != blockToWrite + run)
+					break;
+				run++;
 			}
-			blockToWrite = indirectBlockBuffer[((i - NUM_DIRECT) % sb->pointersPerIndirect)] + sb->rootDataPointer;
+			bytes = run * vol->partInfop->blocksize;
+			LBAwrite(vol->partition, vectorPointer(&cursor), run, blockToWrite + vol->sb->rootDataPointer);
+			cursor.offset += bytes;
 		}
 
-		//If the bytes to write fit in one block
-		if (startingBlock == (endingBlock - 1)) {
-			LBAread(blockBuffer, 1, blockToWrite);
-			memcpy(&blockBuffer[startPos % partInfop->blocksize], source, length);
-			LBAwrite(blockBuffer, 1, blockToWrite);
-		//If writing the last block
-		} else if (i == endingBlock - 1) {
-			LBAread(blockBuffer, 1, blockToWrite);
-			uint64_t startPart = (length + startPos) % partInfop->blocksize;
-			memcpy(blockBuffer, &source[srcPos], startPart);
-			LBAwrite(blockBuffer, 1, blockToWrite);
-			srcPos += startPart;
-		//If writing the starting block
-		} else if (i == startingBlock) {
-			LBAread(blockBuffer, 1, blockToWrite);
-			uint64_t endPart = partInfop->blocksize - (startPos % partInfop->blocksize);
-			memcpy(&blockBuffer[startPos % partInfop->blocksize], source, endPart);
-			LBAwrite(blockBuffer, 1, blockToWrite);
-			srcPos += endPart;
-		//If writing a full block
-		} else {
-			LBAwrite(&source[srcPos], 1, blockToWrite);
-			srcPos += partInfop->blocksize;
-		}
+		//This file no longer references the shared block it replaced
+		if (oldBlock != HOLE_BLOCK && oldBlock != blockToWrite)
+			releaseBlock(vol, oldBlock);
+		position += bytes;
 	}
-	free(blockBuffer);
-	free(indirectBlockBuffer);
+
+	if (maxSize > inode->size)
+		inode->size = maxSize;
+
+	closeBlockMap(vol, &map);
+
+	//Unless nothing is flushed until a sync, the blocks are marked used on the drive before the inode points at them
+	if (blocksAllocated > 0 && LBAdurability(vol->partition) != DURABILITY_NONE)
+		saveMemory(vol);
+	if (blocksAllocated > 0 || inode->blocksMapped != mappedBefore || inode->size != sizeBefore)
+		writeInode(vol, inode);
+	putBlockBuffer(vol, blockBuffer);
 	return length;
 }
 
 /**
  * Reads the entire data of the file/directory from the filesystem and stores it into the destination.
  * If the pointer is null, then memory will be allocated to hold the file data.
+ * Holes in the file are read back as zeros.
+ * @param vol the volume
  * @param destination the buffer that the file data will be stored in.
  * @param inodeID the inode to read the data from
  * @param startPos the starting byte offset to read from the file
@@ -329,21 +1238,15 @@ int64_t writeFile(uint8_t* source, Inode_p inode, uint64_t startPos, uint64_t le
  * @returns the number of bytes read into destination if successful
  * @returns 0 if unsuccessful
  */
-uint64_t readFile(uint8_t** destination, Inode_p inode, uint64_t startPos, uint64_t length) {
+uint64_t readFile(FsVolume_p vol, uint8_t** destination, Inode_p inode, uint64_t startPos, uint64_t length) {
 	if (inode == NULL || inode->used == UNUSED_FLAG) {
 		return 0;
 	}
 	if (startPos >= inode->size)
 		return 0;
 
-	uint64_t bytesToRead;
-	uint64_t startingBlock;
-	uint64_t endingBlock;
-	uint64_t blockToRead;
-	uint8_t* blockBuffer = calloc(1, partInfop->blocksize);
-	uint64_t* indirectBlockBuffer = calloc(NUM_INDIRECT, partInfop->blocksize);
-
 	//Calculate the number of bytes to read
+	uint64_t bytesToRead;
 	if (length == 0 || length + startPos > inode->size)
 		bytesToRead = inode->size - startPos;
 	else
@@ -352,474 +1255,1067 @@ uint64_t readFile(uint8_t** destination, Inode_p inode, uint64_t startPos, uint6
 	if (*destination == NULL)
 		*destination = calloc(1, bytesToRead);
 
-	//Calculate the starting and ending block
-	startingBlock = startPos / partInfop->blocksize;
-	endingBlock = (startPos + bytesToRead + partInfop->blocksize - 1) / partInfop->blocksize;
-	uint32_t j = 0;
-	uint64_t destPos = 0;
+	FileVector vector = { *destination, bytesToRead };
+	return readFileVector(vol, &vector, 1, inode, startPos);
+}
 
-	//Loop through and read the blocks into the buffer
-	for (uint64_t i = startingBlock; i < endingBlock; i++) {
-		if (i < NUM_DIRECT) {
-			blockToRead = sb->rootDataPointer + inode->directData[i];
-		} else if (i < NUM_DIRECT + sb->pointersPerIndirect) {
-			if (i == NUM_DIRECT || i == startingBlock)
-				LBAread(indirectBlockBuffer, 1, inode->indirectData[0] + sb->rootDataPointer);
-
-			blockToRead = indirectBlockBuffer[i-NUM_DIRECT] + sb->rootDataPointer;
-		} else {
-			if (i == NUM_DIRECT + sb->pointersPerIndirect || i == startingBlock) {
-				LBAread(&indirectBlockBuffer[sb->pointersPerIndirect], 1, inode->indirectData[1] + sb->rootDataPointer);
-				if (i == startingBlock)
-					j = (i - NUM_DIRECT - sb->pointersPerIndirect) / sb->pointersPerIndirect;
-				LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[sb->pointersPerIndirect + j] + sb->rootDataPointer);
-			}
+/**
+ * Reads the file data from the starting position into the vectors one after another,
+ * stopping at the end of the file. Holes in the file are read back as zeros.
+ * Whole blocks that lie inside a single vector are read straight into it.
+ * @param vol the volume
+ * @param vectors the buffers to read into
+ * @param count the number of vectors
+ * @param inode the inode to read the data from
+ * @param startPos the starting byte offset to read from the file
+ * @returns the number of bytes read
+ * @returns 0 if unsuccessful
+ */
+uint64_t readFileVector(FsVolume_p vol, FileVector_p vectors, uint32_t count, Inode_p inode, uint64_t startPos) {
+	if (inode == NULL || inode->used == UNUSED_FLAG) {
+		return 0;
+	}
+	LBA_TAG_SCOPE((inode->type == DIRECTORY_TYPE) ? LBA_TAG_DIRECTORY : LBA_TAG_DATA);
+	if (startPos >= inode->size)
+		return 0;
 
-			if ((i - NUM_DIRECT - sb->pointersPerIndirect) % sb->pointersPerIndirect == 0) {
-				j = (i - NUM_DIRECT - sb->pointersPerIndirect) / sb->pointersPerIndirect;
-				if (j >= sb->pointersPerIndirect) {
-					printf("Error: This filesystem does not support this large of a file size\n");
-					return 0;
-				}
+	BlockMap map;
+	VectorCursor cursor;
+	uint64_t bytesToRead = 0;
+	uint64_t position = startPos;
+	uint64_t fileBlock;
+	uint64_t offset;
+	uint64_t bytes;
+	uint64_t contiguous;
+	uint64_t blockToRead;
+	uint64_t run;
 
-				LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[sb->pointersPerIndirect + j] + sb->rootDataPointer);
-			}
-			blockToRead = indirectBlockBuffer[((i - NUM_DIRECT) % sb->pointersPerIndirect)] + sb->rootDataPointer;
-		}
-		//If the bytes to read fit within one block
-		if (startingBlock == (endingBlock - 1)) {
-			LBAread(blockBuffer, 1, blockToRead);
-			memcpy(&((*destination)[destPos]), &blockBuffer[startPos % partInfop->blocksize], bytesToRead);
-		//If reading the last block
-		} else if (i == endingBlock - 1) {
-			LBAread(blockBuffer, 1, blockToRead);
-			uint64_t startPart = (bytesToRead + startPos) % partInfop->blocksize;
-			memcpy(&((*destination)[destPos]), blockBuffer, startPart);
-			destPos += startPart;
-		//If reading the first block
-		} else if (i == startingBlock) {
-			LBAread(blockBuffer, 1, blockToRead);
-			uint64_t endPart = partInfop->blocksize - (startPos % partInfop->blocksize);
-			memcpy(&((*destination)[destPos]), &blockBuffer[startPos % partInfop->blocksize], endPart);
-			destPos += endPart;
-		//If reading a whole block
+	//Calculate the number of bytes to read
+	for (uint32_t i = 0; i < count; i++)
+		bytesToRead += vectors[i].length;
+	if (bytesToRead > inode->size - startPos)
+		bytesToRead = inode->size - startPos;
+
+	openVectorCursor(&cursor, vectors, count);
+	if (inode->inlined) {
+		scatterToVectors(&cursor, &inode->inlineData[startPos], bytesToRead);
+		return bytesToRead;
+	}
+
+	uint8_t* blockBuffer = getBlockBuffer(vol);
+	openBlockMap(&map, inode);
+
+	//Loop through and read the blocks into the buffer
+	while (position < startPos + bytesToRead) {
+		fileBlock = position / vol->partInfop->blocksize;
+		offset = position % vol->partInfop->blocksize;
+		bytes = vol->partInfop->blocksize - offset;
+		if (bytes > startPos + bytesToRead - position)
+			bytes = startPos + bytesToRead - position;
+
+		blockToRead = getMapBlock(vol, &map, fileBlock);
+		contiguous = vectorBytesLeft(&cursor);
+		if (blockToRead == HOLE_BLOCK) {
+			scatterToVectors(&cursor, NULL, bytes);
+		//If reading part of a block, or a block split across vectors
+		} else if (bytes < vol->partInfop->blocksize || contiguous < vol->partInfop->blocksize) {
+			LBAread(vol->partition, blockBuffer, 1, blockToRead + vol->sb->rootDataPointer);
+			scatterToVectors(&cursor, &blockBuffer[offset], bytes);
+		//Read every following whole block that is contiguous on disk and in the vector at once
 		} else {
-			LBAread(&((*destination)[destPos]), 1, blockToRead);
-			destPos += partInfop->blocksize;
+			run = 1;
+			while (position + (run + 1) * vol->partInfop->blocksize <= startPos + bytesToRead
+					&& (run + 1) * vol->partInfop->blocksize <= contiguous
+					&& getMapBlock(vol, &map, fileBlock + run) == blockToRead + run)
+				run++;
+			bytes = run * vol->partInfop->blocksize;
+			LBAread(vol->partition, vectorPointer(&cursor), run, blockToRead + vol->sb->rootDataPointer);
+			cursor.offset += bytes;
 		}
+		position += bytes;
 	}
-	free(indirectBlockBuffer);
-	free(blockBuffer);
+
+	closeBlockMap(vol, &map);
+	putBlockBuffer(vol, blockBuffer);
 	return bytesToRead;
 }
 
+/**
+ * Locks the block of the inode table holding an inode, so that inodes
+ * sharing a block are not lost when written at the same time.
+ * @param vol the volume
+ * @param blockLocation the block holding the inode
+ */
+void lockInodeBlock(FsVolume_p vol, uint64_t blockLocation) {
+	pthread_mutex_lock(&vol->inodeLocks[blockLocation % INODE_LOCKS]);
+}
+
+/**
+ * Unlocks the block of the inode table locked by lockInodeBlock
+ * @param vol the volume
+ * @param blockLocation the block holding the inode
+ */
+void unlockInodeBlock(FsVolume_p vol, uint64_t blockLocation) {
+	pthread_mutex_unlock(&vol->inodeLocks[blockLocation % INODE_LOCKS]);
+}
+
+/**
+ * Finds where an inode is stored in the inode table. Each block holds a whole
+ * number of inodes, so an inode never spans two blocks.
+ * @param vol the volume
+ * @param inodeID the ID number of the inode
+ * @param blockLocation where to store the block holding the inode
+ * @param offset where to store the byte offset of the inode in that block
+ */
+void locateInode(FsVolume_p vol, uint64_t inodeID, uint64_t* blockLocation, uint64_t* offset) {
+	uint64_t inodesPerBlock = vol->partInfop->blocksize / sizeof(Inode);
+	*blockLocation = vol->sb->inodeStart + inodeID / inodesPerBlock;
+	*offset = (inodeID % inodesPerBlock) * sizeof(Inode);
+}
+
 /**
  * Given an inode number and an Inode_p pointer, readInode
  * will read from the request inode into either a buffer already
- * preallocated, or will allocate a buffer if the pointer is null.
+ * preallocated, or will take a buffer from the inode pool if the pointer
+ * is null. A buffer taken from the pool is given back with putInodeBuffer.
+ * @param vol the volume
  * @param inodeID the ID number of the inode to read
  * @param inodeBuffer the inode buffer to read the inode into
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int readInode(uint64_t inodeID, Inode_p* inodeBuffer) {
-	if (inodeID >= sb->numInodes)
+int readInode(FsVolume_p vol, uint64_t inodeID, Inode_p* inodeBuffer) {
+	LBA_TAG_SCOPE(LBA_TAG_INODE);
+	if (inodeID >= vol->sb->numInodes)
 		return 0;
 
 	if (*inodeBuffer == NULL)
-		*inodeBuffer = calloc(1, sizeof(Inode));
+		*inodeBuffer = getInodeBuffer(vol);
 
 	//Find the block location and offset of the requested inode
-	uint8_t* buffer = calloc(2, partInfop->blocksize);
-	uint64_t byteLocation = inodeID * sizeof(Inode) + partInfop->blocksize * sb->inodeStart;
-	uint64_t blockLocation = byteLocation / partInfop->blocksize;
-	uint64_t offset = byteLocation % partInfop->blocksize;
-	if (offset > partInfop->blocksize - sizeof(Inode))
-		LBAread(buffer, 2, blockLocation);
-	else
-		LBAread(buffer, 1, blockLocation);
+	uint8_t* buffer = getBlockBuffer(vol);
+	uint64_t blockLocation;
+	uint64_t offset;
+	locateInode(vol, inodeID, &blockLocation, &offset);
+	lockInodeBlock(vol, blockLocation);
+	LBAread(vol->partition, buffer, 1, blockLocation);
+	unlockInodeBlock(vol, blockLocation);
 	memcpy(*inodeBuffer, &buffer[offset], sizeof(Inode));
-	free(buffer);
+	putBlockBuffer(vol, buffer);
+	return 1;
+}
+
+/**
+ * Orders inode slots by inode ID, which is also the order of the inode table
+ * @param a the first InodeSlot
+ * @param b the second InodeSlot
+ * @returns less than, equal to or greater than 0 as a is before, at or after b
+ */
+int compareInodeSlots(const void* a, const void* b) {
+	uint64_t first = ((const InodeSlot*)a)->inodeID;
+	uint64_t second = ((const InodeSlot*)b)->inodeID;
+	return (first > second) - (first < second);
+}
+
+/**
+ * Locks a run of neighbouring blocks of the inode table. The stripes are taken in
+ * ascending order so two runs that share stripes can not deadlock.
+ * @param vol the volume
+ * @param blockLocation the first block of the run
+ * @param count the number of blocks, at most INODE_LOCKS
+ */
+void lockInodeRun(FsVolume_p vol, uint64_t blockLocation, uint64_t count) {
+	for (uint64_t stripe = 0; stripe < INODE_LOCKS; stripe++) {
+		if ((stripe + INODE_LOCKS - blockLocation % INODE_LOCKS) % INODE_LOCKS < count)
+			pthread_mutex_lock(&vol->inodeLocks[stripe]);
+	}
+}
+
+/**
+ * Unlocks a run of blocks of the inode table locked by lockInodeRun
+ * @param vol the volume
+ * @param blockLocation the first block of the run
+ * @param count the number of blocks
+ */
+void unlockInodeRun(FsVolume_p vol, uint64_t blockLocation, uint64_t count) {
+	for (uint64_t stripe = 0; stripe < INODE_LOCKS; stripe++) {
+		if ((stripe + INODE_LOCKS - blockLocation % INODE_LOCKS) % INODE_LOCKS < count)
+			pthread_mutex_unlock(&vol->inodeLocks[stripe]);
+	}
+}
+
+/**
+ * Reads several inodes at once. The IDs are sorted by where they are in the
+ * inode table, each block holding one of them is read only once and runs of
+ * neighbouring blocks are read with a single LBAread.
+ * @param vol the volume
+ * @param inodeIDs the IDs of the inodes to read
+ * @param count the number of IDs
+ * @param inodes array of count inodes, filled in the same order as inodeIDs
+ * @returns 1 if successful
+ * @returns 0 if an ID is outside the inode table
+ */
+int readInodes(FsVolume_p vol, uint64_t* inodeIDs, uint64_t count, Inode_p inodes) {
+	LBA_TAG_SCOPE(LBA_TAG_INODE);
+	ARENA_SCOPE(mark);
+	for (uint64_t i = 0; i < count; i++) {
+		if (inodeIDs[i] >= vol->sb->numInodes)
+			return 0;
+	}
+	if (count == 0)
+		return 1;
+
+	InodeSlot_p slots = arenaAlloc(count * sizeof(InodeSlot));
+	for (uint64_t i = 0; i < count; i++) {
+		slots[i].inodeID = inodeIDs[i];
+		slots[i].index = i;
+	}
+	qsort(slots, count, sizeof(InodeSlot), compareInodeSlots);
+
+	uint8_t* buffer = arenaAlloc(PREFETCH_BLOCKS * vol->partInfop->blocksize);
+	uint64_t firstBlock;
+	uint64_t lastBlock;
+	uint64_t blockLocation;
+	uint64_t offset;
+	uint64_t next;
+	for (uint64_t i = 0; i < count; i = next) {
+		//Grow the run while the next inode is in the same or the following block
+		locateInode(vol, slots[i].inodeID, &firstBlock, &offset);
+		lastBlock = firstBlock;
+		for (next = i + 1; next < count; next++) {
+			locateInode(vol, slots[next].inodeID, &blockLocation, &offset);
+			if (blockLocation > lastBlock + 1 || blockLocation - firstBlock >= PREFETCH_BLOCKS)
+				break;
+			lastBlock = blockLocation;
+		}
+
+		lockInodeRun(vol, firstBlock, lastBlock - firstBlock + 1);
+		LBAread(vol->partition, buffer, lastBlock - firstBlock + 1, firstBlock);
+		unlockInodeRun(vol, firstBlock, lastBlock - firstBlock + 1);
+		for (uint64_t j = i; j < next; j++) {
+			locateInode(vol, slots[j].inodeID, &blockLocation, &offset);
+			memcpy(&inodes[slots[j].index], &buffer[(blockLocation - firstBlock) * vol->partInfop->blocksize + offset], sizeof(Inode));
+		}
+	}
 	return 1;
 }
 
 /**
  * Given an Inode_p inode, writeInode will write out the contents
- * of the inode to the disk.
+ * of the inode to the disk. The subtree totals are kept from the disk,
+ * and any change to the size, reserved blocks, used flag or parent of
+ * the inode is passed up to the totals of its ancestors. Changes to the
+ * size and reserved blocks of an open file's inode are kept on the open
+ * file instead, until it is closed or synced.
+ * @param vol the volume
  * @param inode the inode to write back to disk
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int writeInode(Inode_p inode) {
-	if (inode->inode >= sb->numInodes)
+int writeInode(FsVolume_p vol, Inode_p inode) {
+	LBA_TAG_SCOPE(LBA_TAG_INODE);
+	if (inode->inode >= vol->sb->numInodes)
 		return 0;
 
 	//Find the block location and offset of the inode on disk to write to
-	uint8_t* buffer = calloc(2, partInfop->blocksize);
-	uint64_t byteLocation = inode->inode * sizeof(Inode) + partInfop->blocksize * sb->inodeStart;
-	uint64_t blockLocation = byteLocation / partInfop->blocksize;
-	uint64_t offset = byteLocation % partInfop->blocksize;
-
-	//Check if inode spans two blocks
-	if (offset > partInfop->blocksize - sizeof(Inode)) {
-		LBAread(buffer, 2, blockLocation);
-		memcpy(&buffer[offset], inode, sizeof(Inode));
-		LBAwrite(buffer, 2, blockLocation);
+	uint8_t* buffer = getBlockBuffer(vol);
+	uint64_t blockLocation;
+	uint64_t offset;
+	Inode oldInode;
+	locateInode(vol, inode->inode, &blockLocation, &offset);
+	lockInodeBlock(vol, blockLocation);
+	LBAread(vol->partition, buffer, 1, blockLocation);
+	memcpy(&oldInode, &buffer[offset], sizeof(Inode));
+
+	//Subtree totals are only changed by addToAncestors, a newly used inode starts with none
+	if (oldInode.used == USED_FLAG) {
+		inode->subtreeSize = oldInode.subtreeSize;
+		inode->subtreeReserved = oldInode.subtreeReserved;
+		inode->subtreeFiles = oldInode.subtreeFiles;
 	} else {
-		LBAread(buffer, 1, blockLocation);
-		memcpy(&buffer[offset], inode, sizeof(Inode));
-		LBAwrite(buffer, 1, blockLocation);
+		inode->subtreeSize = 0;
+		inode->subtreeReserved = 0;
+		inode->subtreeFiles = 0;
+	}
+	memcpy(&buffer[offset], inode, sizeof(Inode));
+
+	//The blocks the inode points at reach the disk before the inode does
+	LBAwriteMetadata(vol->partition, buffer, 1, blockLocation);
+	unlockInodeBlock(vol, blockLocation);
+	putBlockBuffer(vol, buffer);
+
+	//The root has no ancestors to update
+	if (inode->inode == 0)
+		return 1;
+
+	int64_t size = 0;
+	int64_t reserved = 0;
+	int64_t files = 0;
+	if (oldInode.parentInodeID == inode->parentInodeID) {
+		addInodeTotals(&oldInode, -1, &size, &reserved, &files);
+		addInodeTotals(inode, 1, &size, &reserved, &files);
+
+		//Writes through a file descriptor walk the ancestors once, when the file is closed or synced
+		OpenFile_p openFile = openFileOfInode(vol, inode);
+		if (openFile != NULL && files == 0 && oldInode.used == USED_FLAG && inode->used == USED_FLAG) {
+			__atomic_add_fetch(&openFile->pendingSize, size, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&openFile->pendingReserved, reserved, __ATOMIC_RELAXED);
+			return 1;
+		}
+		takePendingTotals(vol, inode->inode, &size, &reserved);
+		addToAncestors(vol, inode->parentInodeID, size, reserved, files);
+	//A moved inode takes its totals from the old ancestors to the new ones
+	} else {
+		addInodeTotals(&oldInode, -1, &size, &reserved, &files);
+		takePendingTotals(vol, inode->inode, &size, &reserved);
+		addToAncestors(vol, oldInode.parentInodeID, size, reserved, files);
+		size = 0;
+		reserved = 0;
+		files = 0;
+		addInodeTotals(inode, 1, &size, &reserved, &files);
+		addToAncestors(vol, inode->parentInodeID, size, reserved, files);
 	}
-	free(buffer);
 	return 1;
 }
 
 /**
- * Deletes the file. If the file is a directory, it will
- * recursively go through and delete all files and directories.
- * @param inode the inode to delete
+ * Adds what an inode counts for in the subtree totals of its ancestors,
+ * its own size and reserved blocks plus its subtree totals, to the given totals.
+ * An unused inode counts for nothing.
+ * @param inode the inode to count
+ * @param sign 1 to add the inode, -1 to subtract it
+ * @param size the total size to add to
+ * @param reserved the total reserved blocks to add to
+ * @param files the total number of files to add to
  */
-void deleteFile(Inode_p inode) {
-	FCB_p directoryData = NULL;
-	Inode_p newInode = NULL;
+void addInodeTotals(Inode_p inode, int sign, int64_t* size, int64_t* reserved, int64_t* files) {
+	if (inode->used != USED_FLAG)
+		return;
+	*size += sign * (int64_t)(inode->size + inode->subtreeSize);
+	*reserved += sign * (int64_t)(inode->blocksReserved + inode->subtreeReserved);
+	*files += sign * (int64_t)(inode->subtreeFiles + (inode->type == FILE_TYPE ? 1 : 0));
+}
 
-	//If a directory, recursively go through and delete the files
-	if (inode->type == DIRECTORY_TYPE) {
-		readFile((uint8_t**)(&directoryData), inode, 0, 0);
-		uint32_t numberOfEntries = inode->size / sizeof(FCB);
-		for (uint32_t i = 0; i < numberOfEntries; i++) {
-			readInode(directoryData[i].inodeID, &newInode);
-			deleteFile(newInode);
-			free(newInode);
-			newInode = NULL;
+/**
+ * Adds the changes to the subtree totals of a directory and every directory above it,
+ * up to the root. Stops early at a directory that has already been deleted, since its
+ * totals were taken away from its ancestors when it was deleted.
+ * @param vol the volume
+ * @param inodeID the directory to start at
+ * @param size the change in total size
+ * @param reserved the change in total reserved blocks
+ * @param files the change in the number of files
+ */
+void addToAncestors(FsVolume_p vol, uint64_t inodeID, int64_t size, int64_t reserved, int64_t files) {
+	LBA_TAG_SCOPE(LBA_TAG_INODE);
+	if (size == 0 && reserved == 0 && files == 0)
+		return;
+
+	uint8_t* buffer = getBlockBuffer(vol);
+	uint64_t blockLocation;
+	uint64_t offset;
+	Inode ancestor;
+
+	//Each directory is updated under its own lock, the depth limit guards against loops
+	for (uint32_t depth = 0; depth < MAX_DIRECTORIES && inodeID < vol->sb->numInodes; depth++) {
+		locateInode(vol, inodeID, &blockLocation, &offset);
+		lockInodeBlock(vol, blockLocation);
+		LBAread(vol->partition, buffer, 1, blockLocation);
+		memcpy(&ancestor, &buffer[offset], sizeof(Inode));
+		if (ancestor.used != USED_FLAG || ancestor.type != DIRECTORY_TYPE) {
+			unlockInodeBlock(vol, blockLocation);
+			break;
 		}
-		free(directoryData);
+		ancestor.subtreeSize += size;
+		ancestor.subtreeReserved += reserved;
+		ancestor.subtreeFiles += files;
+		memcpy(&buffer[offset], &ancestor, sizeof(Inode));
+		LBAwriteMetadata(vol->partition, buffer, 1, blockLocation);
+		unlockInodeBlock(vol, blockLocation);
+
+		if (inodeID == 0)
+			break;
+		inodeID = ancestor.parentInodeID;
+	}
+	putBlockBuffer(vol, buffer);
+}
+
+/**
+ * Finds the open file whose in memory inode is the given one.
+ * @param vol the volume
+ * @param inode the inode
+ * @returns the open file, NULL if the inode is not the inode of an open file
+ */
+OpenFile_p openFileOfInode(FsVolume_p vol, Inode_p inode) {
+	uintptr_t address = (uintptr_t)inode;
+	if (vol->openFiles == NULL || address < (uintptr_t)vol->openFiles || address >= (uintptr_t)(vol->openFiles + MAX_OPEN_FILES))
+		return NULL;
+	return (OpenFile_p)inode;
+}
+
+/**
+ * Takes the changes to the size and reserved blocks made through an open file
+ * that are not in the totals of its ancestors yet, adding them to the given totals.
+ * @param openFile the open file
+ * @param size the total size to add to
+ * @param reserved the total reserved blocks to add to
+ */
+void takeOpenFileTotals(OpenFile_p openFile, int64_t* size, int64_t* reserved) {
+	*size += __atomic_exchange_n(&openFile->pendingSize, 0, __ATOMIC_RELAXED);
+	*reserved += __atomic_exchange_n(&openFile->pendingReserved, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Takes the changes kept on the open file of an inode, if it is open, so they
+ * reach the ancestors the inode was counted under before it moves or changes.
+ * @param vol the volume
+ * @param inodeID the inode
+ * @param size the total size to add to
+ * @param reserved the total reserved blocks to add to
+ */
+void takePendingTotals(FsVolume_p vol, uint64_t inodeID, int64_t* size, int64_t* reserved) {
+	if (vol->openFiles == NULL)
+		return;
+	pthread_mutex_lock(&vol->fdLock);
+	int32_t openFile = vol->openFileBuckets[inodeID % OPEN_FILE_BUCKETS];
+	while (openFile != -1 && vol->openFiles[openFile].inode.inode != inodeID)
+		openFile = vol->openFiles[openFile].next;
+	if (openFile != -1)
+		takeOpenFileTotals(&vol->openFiles[openFile], size, reserved);
+	pthread_mutex_unlock(&vol->fdLock);
+}
+
+/**
+ * Adds the changes kept on every open file to the totals of their ancestors.
+ * @param vol the volume
+ */
+void applyOpenFileTotals(FsVolume_p vol) {
+	struct { uint64_t parent; int64_t size; int64_t reserved; } pending[MAX_OPEN_FILES];
+	uint32_t count = 0;
+
+	if (vol->openFiles == NULL)
+		return;
+
+	//The ancestors are updated after the lock is dropped, so opening and closing files does not wait for them
+	pthread_mutex_lock(&vol->fdLock);
+	for (int32_t i = 0; i < MAX_OPEN_FILES; i++) {
+		if (vol->openFiles[i].refCount == 0)
+			continue;
+		pending[count].size = 0;
+		pending[count].reserved = 0;
+		takeOpenFileTotals(&vol->openFiles[i], &pending[count].size, &pending[count].reserved);
+		pending[count].parent = vol->openFiles[i].inode.parentInodeID;
+		if (pending[count].size != 0 || pending[count].reserved != 0)
+			count++;
 	}
+	pthread_mutex_unlock(&vol->fdLock);
 
+	for (uint32_t i = 0; i < count; i++)
+		addToAncestors(vol, pending[i].parent, pending[i].size, pending[i].reserved, 0);
+}
+
+/**
+ * Deletes the file. If the file is a directory, all files and directories
+ * within it are deleted by a thread pool, and the bitVector and superblock
+ * are saved once at the end.
+ * @param vol the volume
+ * @param inode the inode to delete
+ */
+void deleteFile(FsVolume_p vol, Inode_p inode) {
+	if (inode->type == DIRECTORY_TYPE) {
+		runTreeOperation(vol, deleteTreeTask, inode->inode, 0, false);
+		inode->size = 0;
+		inode->used = UNUSED_FLAG;
+		return;
+	}
+	freeInode(vol, inode);
+}
+
+/**
+ * Frees the blocks of a single file or directory and marks its inode unused.
+ * Does not touch the files within a directory.
+ * @param vol the volume
+ * @param inode the inode to free
+ */
+void freeInode(FsVolume_p vol, Inode_p inode) {
 	inode->size = 0;
 
-	deallocateBlocks(inode, 0);
+	deallocateBlocks(vol, inode, 0);
 	inode->used = UNUSED_FLAG;
-	sb->usedInodes--;
-	writeInode(inode);
-	saveMemory();
+	writeInode(vol, inode);
+	pthread_mutex_lock(&vol->allocLock);
+	vol->sb->usedInodes--;
+	pthread_mutex_unlock(&vol->allocLock);
+	saveMemory(vol);
 }
 
 /**
- * Adds the new FCB to the directory
- * @param dirInode the directory inode to add the file control block
- * @param newFile the file control block of the file to add
+ * Adds an entry for the file to the end of the directory
+ * @param vol the volume
+ * @param dirInode the directory inode to add the entry to
+ * @param inodeID the inode of the file
+ * @param type the type of the file
+ * @param name the name of the file
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int addToDirectory(Inode_p dirInode, FCB_p newFile) {
-	FCB_p directoryData = NULL;
-	dirInode->size += sizeof(FCB);
-	if (allocateBlocks(dirInode, dirInode->size) == -1) {
-		dirInode->size -= sizeof(FCB);
+int addToDirectory(FsVolume_p vol, Inode_p dirInode, uint64_t inodeID, uint8_t type, const char* name) {
+	uint8_t record[MAX_ENTRY_SIZE];
+	uint64_t length = writeEntry(vol, record, inodeID, type, name);
+
+	if (writeFile(vol, record, dirInode, dirInode->size, length) == -1) {
 		printf("Can not add to directory, not enough free blocks\n");
 		return 0;
 	}
-
-	if (!readFile((uint8_t**)(&directoryData), dirInode, 0, 0))
-		return 0;
-
-	uint32_t numberOfEntries = dirInode->size / sizeof(FCB);
-	memcpy(&directoryData[numberOfEntries - 1], newFile, sizeof(FCB));
-	writeFile((uint8_t*)directoryData, dirInode, 0, dirInode->size);
 	dirInode->dateModified = time(NULL);
-	writeInode(dirInode);
-	free(directoryData);
+	writeInode(vol, dirInode);
 	return 1;
 }
 
 /**
  * Removes the file from the directory. Does not delete/free allocated blocks.
- * Use deleteFile to delete and free the blocks. Moves the last FCB into the slot.
- * @param dirInode the directory to remove the file's control block from
+ * Use deleteFile to delete and free the blocks. The entries after it are moved
+ * down to fill the gap.
+ * @param vol the volume
+ * @param dirInode the directory to remove the file's entry from
  * @param fileInodeID the file's inode ID
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int removeFromDirectory(Inode_p dirInode, uint64_t fileInodeID) {
-	FCB_p directoryData = NULL;
+int removeFromDirectory(FsVolume_p vol, Inode_p dirInode, uint64_t fileInodeID) {
+	ARENA_SCOPE(mark);
+	uint8_t* tail = NULL;
+	uint64_t length;
+	uint64_t tailLength;
+
+	DirIterator_p iterator = dirOpen(vol, dirInode);
+	int64_t position = dirFind(vol, iterator, NULL, fileInodeID, NULL, &length);
+	dirClose(vol, iterator);
+	if (position == -1)
+		return 0;
+
+	//Only the entries after the removed one are read and moved down
+	tailLength = dirInode->size - position - length;
+	if (tailLength > 0) {
+		tail = arenaAlloc(tailLength);
+		readFile(vol, &tail, dirInode, position + length, tailLength);
+	}
+	dirInode->dateModified = time(NULL);
+	dirInode->size -= length;
+	deallocateBlocks(vol, dirInode, vol->partInfop->blocksize);
+	writeInode(vol, dirInode);
+	if (tailLength > 0)
+		writeFile(vol, tail, dirInode, position, tailLength);
+	return 1;
+}
+
+/**
+ * Hashes a file name for the compact directory entries.
+ * @param name the name to hash
+ * @returns the hash
+ */
+uint32_t hashName(const char* name) {
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Writes a directory entry in the directory format of the volume.
+ * @param vol the volume
+ * @param record the buffer to write to, must hold MAX_ENTRY_SIZE bytes
+ * @param inodeID the inode of the file
+ * @param type the type of the file
+ * @param name the name of the file
+ * @returns the length of the entry in bytes
+ */
+uint64_t writeEntry(FsVolume_p vol, uint8_t* record, uint64_t inodeID, uint8_t type, const char* name) {
+	if (vol->sb->directoryFormat == DIR_FORMAT_FIXED) {
+		FCB_p fcb = (FCB_p)record;
+		memset(fcb, 0, sizeof(FCB));
+		fcb->inodeID = inodeID;
+		strcpy(fcb->name, name);
+		return sizeof(FCB);
+	}
+
+	CompactEntry_p entry = (CompactEntry_p)record;
+	uint64_t nameLength = strlen(name);
+	entry->inodeID = inodeID;
+	entry->nameHash = hashName(name);
+	entry->type = type;
+	entry->nameLength = nameLength;
+	entry->recordLength = (sizeof(CompactEntry) + nameLength + 7) & ~7;
+	memcpy(&record[sizeof(CompactEntry)], name, nameLength);
+	memset(&record[sizeof(CompactEntry) + nameLength], 0, entry->recordLength - sizeof(CompactEntry) - nameLength);
+	return entry->recordLength;
+}
+
+/**
+ * Reads the directory entry at the start of the record.
+ * @param vol the volume
+ * @param record the directory data starting at the entry
+ * @param remaining the number of bytes of directory data from the entry on
+ * @param entry where to store the entry
+ * @returns the length of the entry in bytes
+ * @returns 0 if there is no valid entry
+ */
+uint64_t readEntry(FsVolume_p vol, uint8_t* record, uint64_t remaining, DirEntry_p entry) {
+	if (vol->sb->directoryFormat == DIR_FORMAT_FIXED) {
+		if (remaining < sizeof(FCB))
+			return 0;
+		FCB_p fcb = (FCB_p)record;
+		entry->inodeID = fcb->inodeID;
+		entry->type = 0;
+		memcpy(entry->name, fcb->name, MAX_NAME_SIZE);
+		entry->name[MAX_NAME_SIZE - 1] = '\0';
+		return sizeof(FCB);
+	}
+
+	CompactEntry_p compact = (CompactEntry_p)record;
+	if (remaining < sizeof(CompactEntry) || compact->recordLength > remaining
+			|| compact->recordLength < sizeof(CompactEntry) + compact->nameLength)
+		return 0;
+	entry->inodeID = compact->inodeID;
+	entry->type = compact->type;
+	memcpy(entry->name, &record[sizeof(CompactEntry)], compact->nameLength);
+	entry->name[compact->nameLength] = '\0';
+	return compact->recordLength;
+}
+
+/**
+ * Starts reading the entries of a directory. Only a block of the directory is held
+ * in memory at a time, so a lookup that finds its entry early stops reading there.
+ * The iterator is allocated from the arena of the caller.
+ * @param vol the volume
+ * @param dirInode the directory to read, copied so it can be freed while reading
+ * @returns the iterator, passed to dirRead, dirFind and dirClose
+ */
+DirIterator_p dirOpen(FsVolume_p vol, Inode_p dirInode) {
+	DirIterator_p iterator = arenaAlloc(sizeof(DirIterator));
+	memcpy(&iterator->dirInode, dirInode, sizeof(Inode));
+	openBlockMap(&iterator->map, &iterator->dirInode);
+	iterator->window = arenaAlloc(vol->partInfop->blocksize + MAX_ENTRY_SIZE);
+	iterator->windowStart = 0;
+	iterator->windowLength = 0;
+	iterator->position = 0;
+	return iterator;
+}
+
+/**
+ * Makes sure the window holds a whole entry from the current position, unless the
+ * directory ends first. The unread end of the window is kept and the following
+ * blocks of the directory are read in after it.
+ * @param vol the volume
+ * @param iterator the directory iterator
+ */
+void fillDirWindow(FsVolume_p vol, DirIterator_p iterator) {
+	LBA_TAG_SCOPE(LBA_TAG_DIRECTORY);
+	Inode_p dirInode = &iterator->dirInode;
+	uint64_t kept = iterator->windowStart + iterator->windowLength - iterator->position;
+	uint64_t readStart = iterator->windowStart + iterator->windowLength;
+	uint64_t bytes;
+	uint64_t block;
+
+	if (kept >= MAX_ENTRY_SIZE || readStart >= dirInode->size)
+		return;
+
+	memmove(iterator->window, &iterator->window[iterator->position - iterator->windowStart], kept);
+	iterator->windowStart = iterator->position;
+	iterator->windowLength = kept;
+
+	//Reads always end on a block boundary, so each read is one whole block
+	while (iterator->windowLength < MAX_ENTRY_SIZE && readStart < dirInode->size) {
+		bytes = vol->partInfop->blocksize - readStart % vol->partInfop->blocksize;
+		if (bytes > dirInode->size - readStart)
+			bytes = dirInode->size - readStart;
+
+		if (dirInode->inlined) {
+			memcpy(&iterator->window[iterator->windowLength], &dirInode->inlineData[readStart], bytes);
+		} else {
+			block = getMapBlock(vol, &iterator->map, readStart / vol->partInfop->blocksize);
+			if (block == HOLE_BLOCK)
+				memset(&iterator->window[iterator->windowLength], 0, vol->partInfop->blocksize);
+			else
+				LBAread(vol->partition, &iterator->window[iterator->windowLength], 1, block + vol->sb->rootDataPointer);
+		}
+		iterator->windowLength += bytes;
+		readStart += bytes;
+	}
+}
 
-	if (!readFile((uint8_t**)(&directoryData), dirInode, 0, 0))
+/**
+ * Reads the next entry of a directory
+ * @param vol the volume
+ * @param iterator the directory iterator
+ * @param entry where to store the entry
+ * @returns 1 if an entry was read
+ * @returns 0 if there are no more entries
+ */
+int dirRead(FsVolume_p vol, DirIterator_p iterator, DirEntry_p entry) {
+	uint64_t length;
+
+	if (iterator->position >= iterator->dirInode.size)
+		return 0;
+	fillDirWindow(vol, iterator);
+	length = readEntry(vol, &iterator->window[iterator->position - iterator->windowStart],
+		iterator->windowStart + iterator->windowLength - iterator->position, entry);
+	if (length == 0)
 		return 0;
+	iterator->position += length;
+	return 1;
+}
 
-	//Loop through the directory to find the FCB to remove
-	uint64_t numberOfFiles = dirInode->size / sizeof(FCB);
-	for (uint64_t i = 0; i < numberOfFiles; i++) {
-		if (directoryData[i].inodeID == fileInodeID) {
-			if (i != numberOfFiles - 1) {
-				memcpy(&directoryData[i], &directoryData[numberOfFiles - 1], sizeof(FCB));
+/**
+ * Searches the rest of a directory for the entry of a name, or of an inode if the name
+ * is NULL. Compact entries are skipped on their hash, length or inode without reading the name.
+ * @param vol the volume
+ * @param iterator the directory iterator
+ * @param name the name to find, NULL to find inodeID instead
+ * @param inodeID the inode to find if name is NULL
+ * @param entry where to store the entry found, can be NULL
+ * @param length where to store the length of the entry found, can be NULL
+ * @returns the byte position of the entry in the directory
+ * @returns -1 if not found
+ */
+int64_t dirFind(FsVolume_p vol, DirIterator_p iterator, const char* name, uint64_t inodeID, DirEntry_p entry, uint64_t* length) {
+	uint32_t hash = (name != NULL) ? hashName(name) : 0;
+	uint64_t nameLength = (name != NULL) ? strlen(name) : 0;
+	uint64_t remaining;
+	uint64_t recordLength;
+	uint8_t* record;
+	CompactEntry_p compact;
+	DirEntry found;
+
+	while (iterator->position < iterator->dirInode.size) {
+		fillDirWindow(vol, iterator);
+		record = &iterator->window[iterator->position - iterator->windowStart];
+		remaining = iterator->windowStart + iterator->windowLength - iterator->position;
+		if (vol->sb->directoryFormat == DIR_FORMAT_COMPACT) {
+			compact = (CompactEntry_p)record;
+			if (remaining < sizeof(CompactEntry) || compact->recordLength < sizeof(CompactEntry))
+				break;
+			if ((name != NULL && (compact->nameHash != hash || compact->nameLength != nameLength))
+					|| (name == NULL && compact->inodeID != inodeID)) {
+				iterator->position += compact->recordLength;
+				continue;
 			}
-			memset(&directoryData[numberOfFiles - 1], 0, sizeof(FCB));
-			dirInode->dateModified = time(NULL);
-			dirInode->size -= sizeof(FCB);
-			deallocateBlocks(dirInode, partInfop->blocksize);
-			writeInode(dirInode);
-			writeFile((uint8_t*)directoryData, dirInode, 0, dirInode->size);
-			free(directoryData);
-			return 1;
+		}
+
+		recordLength = readEntry(vol, record, remaining, &found);
+		if (recordLength == 0)
+			break;
+		iterator->position += recordLength;
+		if ((name != NULL && strcmp(found.name, name) == 0) || (name == NULL && found.inodeID == inodeID)) {
+			if (entry != NULL)
+				*entry = found;
+			if (length != NULL)
+				*length = recordLength;
+			return iterator->position - recordLength;
 		}
 	}
-	free(directoryData);
-	return 0;
+	return -1;
+}
+
+/**
+ * Stops reading a directory and gives back the buffers of its block map.
+ * The iterator itself is given back with the arena.
+ * @param vol the volume
+ * @param iterator the directory iterator
+ */
+void dirClose(FsVolume_p vol, DirIterator_p iterator) {
+	closeBlockMap(vol, &iterator->map);
+}
+
+/**
+ * Reads the next batch of entries of a directory
+ * @param vol the volume
+ * @param iterator the directory iterator
+ * @param entries array to store the entries in
+ * @param maxEntries the most entries to read
+ * @returns the number of entries read
+ * @returns 0 if there are no more entries
+ */
+uint64_t readEntries(FsVolume_p vol, DirIterator_p iterator, DirEntry_p entries, uint64_t maxEntries) {
+	uint64_t count = 0;
+
+	while (count < maxEntries && dirRead(vol, iterator, &entries[count]))
+		count++;
+	return count;
 }
 
 /**
  * Attempts to free up the blocks down to the new given byte size.
  * If size is less than inode size then it will deallocate down to inode size.
+ * Holes within the freed blocks have no data block to give back.
+ * @param vol the volume
  * @param inode the inode of the file to deallocate blocks from
  * @param size the size in bytes to try to reduce the reserved blocks down to
  * @returns number of blocks deallocated
  */
-uint64_t deallocateBlocks(Inode_p inode, uint64_t size) {
+uint64_t deallocateBlocks(FsVolume_p vol, Inode_p inode, uint64_t size) {
 	if (inode == NULL)
 		return 0;
 	if (size < inode->size)
 		size = inode->size;
 
 	//Calculate the ending block from the given size
-	uint64_t endBlock = (size + partInfop->blocksize - 1) / partInfop->blocksize;
-	if (endBlock >= inode->blocksReserved)
-		return 0;
-
-	uint64_t blocksToFree = inode->blocksReserved - endBlock;
-	if (blocksToFree == 0)
+	uint64_t endBlock = (size + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+	if (endBlock >= inode->blocksMapped)
 		return 0;
 
-	uint64_t* indirectBlockBuffer = calloc(NUM_INDIRECT, partInfop->blocksize);
-	uint64_t indirectLocation;
+	BlockMap map;
+	uint64_t pointers = vol->sb->pointersPerIndirect;
 	uint64_t blocksFreed = 0;
-
-	//Loop through all the blocks to free. Find their location, set the bit free, and decrement blocks in inode
-	for (uint64_t i = 0; i < blocksToFree; i++) {
-		//If the block falls in the second indirect data block pointer
-		if (inode->blocksReserved > NUM_DIRECT + sb->pointersPerIndirect) {
-			indirectLocation = inode->blocksReserved - NUM_DIRECT - sb->pointersPerIndirect - 1;
-
-			if (i == 0) {
-				LBAread(&indirectBlockBuffer[sb->pointersPerIndirect], 1, inode->indirectData[1] + sb->rootDataPointer);
-				LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[indirectLocation / sb->pointersPerIndirect + sb->pointersPerIndirect] + sb->rootDataPointer);
-			}
-			setBitOff(indirectBlockBuffer[indirectLocation % sb->pointersPerIndirect]);
+	uint64_t block;
+	uint64_t relative;
+
+	//Loop backwards through all the blocks to free. Indirect blocks are freed along
+	//with the first block they point to.
+	openBlockMap(&map, inode);
+	for (uint64_t i = inode->blocksMapped; i-- > endBlock;) {
+		block = getMapBlock(vol, &map, i);
+		if (block != HOLE_BLOCK) {
+			releaseBlock(vol, block);
 			inode->blocksReserved--;
-			sb->freeDataBlocks++;
 			blocksFreed++;
-			if (indirectLocation % sb->pointersPerIndirect == 0) {
-				setBitOff(indirectBlockBuffer[sb->pointersPerIndirect + indirectLocation / sb->pointersPerIndirect]);
-				inode->blocksIndirect--;
-				sb->freeDataBlocks++;
-				blocksFreed++;
-				if (indirectLocation == 0) {
-					setBitOff(inode->indirectData[1]);
+		}
+
+		//If the block is the first in the first indirect block
+		if (i == NUM_DIRECT && inode->indirectData[0] != HOLE_BLOCK) {
+			releaseBlock(vol, inode->indirectData[0]);
+			inode->blocksIndirect--;
+			blocksFreed++;
+		//If the block is the first in one of the blocks of the double indirect block
+		} else if (i >= NUM_DIRECT + pointers && inode->indirectData[1] != HOLE_BLOCK) {
+			relative = i - NUM_DIRECT - pointers;
+			if (relative % pointers == 0) {
+				loadMapBlock(vol, &map.doubleIndirect, &map.doubleIndirectBlock, &map.doubleIndirectDirty, inode->indirectData[1]);
+				if (map.doubleIndirect[relative / pointers] != HOLE_BLOCK) {
+					releaseBlock(vol, map.doubleIndirect[relative / pointers]);
+					inode->blocksIndirect--;
+					blocksFreed++;
+				}
+				if (relative == 0) {
+					releaseBlock(vol, inode->indirectData[1]);
 					inode->blocksIndirect--;
-					sb->freeDataBlocks++;
 					blocksFreed++;
-				} else {
-					LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[(indirectLocation - 1) / sb->pointersPerIndirect + sb->pointersPerIndirect] + sb->rootDataPointer);
 				}
 			}
-		//If the block is in the first indirect pointer
-		} else if (inode->blocksReserved > NUM_DIRECT) {
-			indirectLocation = inode->blocksReserved - NUM_DIRECT - 1;
-			if (i == 0 || inode->blocksReserved == NUM_DIRECT + sb->pointersPerIndirect) {
-				LBAread(indirectBlockBuffer, 1, inode->indirectData[0] + sb->rootDataPointer);
-			}
-			setBitOff(indirectBlockBuffer[indirectLocation % sb->pointersPerIndirect]);
-			inode->blocksReserved--;
-			sb->freeDataBlocks++;
-			blocksFreed++;
-			if (indirectLocation == 0) {
-				setBitOff(inode->indirectData[0]);
-				inode->blocksIndirect--;
-				sb->freeDataBlocks++;
-				blocksFreed++;
-			}
-		//If the block is in a direct pointer
-		} else {
-			setBitOff(inode->directData[inode->blocksReserved - 1]);
-			inode->blocksReserved--;
-			sb->freeDataBlocks++;
-			blocksFreed++;
 		}
 	}
-	saveMemory();
-	free(indirectBlockBuffer);
+	inode->blocksMapped = endBlock;
+	closeBlockMap(vol, &map);
+	saveMemory(vol);
 	return blocksFreed;
 }
 
 /**
  * Given the total size of bytes required, will allocate additional blocks
  * up to the total needed for the total bytes and assign them to the inode.
+ * @param vol the volume
  * @param inode the inode to allocate blocks to
  * @param size the size in bytes to calculate the number of blocks to allocate
  * @returns the number of new blocks assigned
  * @returns -1 if not enough free blocks
  */
-int64_t allocateBlocks(Inode_p inode, uint64_t size) {
+int64_t allocateBlocks(FsVolume_p vol, Inode_p inode, uint64_t size) {
 	if (inode == NULL)
 		return 0;
 
 	//Check if it larger than the max file size for this filesystem
-	if (size > sb->maxFileSize) {
+	if (size > vol->sb->maxFileSize) {
 		printf("Requested filesize is larger than max file size\n");
 		return -1;
 	}
 
+	//Inline data needs no blocks while it fits in the inode
+	if (inode->inlined && size <= INLINE_DATA_SIZE)
+		return 0;
+
 	//Calculate the number of blocks needed
-	int64_t totalBlocksNeeded = (size + partInfop->blocksize - 1) / partInfop->blocksize;
+	uint64_t totalBlocksNeeded = (size + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
 	if (totalBlocksNeeded == 0)
 		totalBlocksNeeded = 1;
 
-
-	if (totalBlocksNeeded <= inode->blocksReserved)
+	if (totalBlocksNeeded <= inode->blocksMapped)
 		return 0;
 
-	//Add the additional blocks needed for indirect pointers if needed
-	if (totalBlocksNeeded > NUM_DIRECT + sb->pointersPerIndirect) {
-		totalBlocksNeeded += 2 + ((totalBlocksNeeded - NUM_DIRECT - 1) / sb->pointersPerIndirect) - inode->blocksIndirect;
-	} else if (totalBlocksNeeded > NUM_DIRECT) {
-		totalBlocksNeeded += 1 - inode->blocksIndirect;
-	}
-
-	//Subtract the blocks already reserved
-	totalBlocksNeeded -= inode->blocksReserved;
-
-	//Check if there are enough free blocks to allocate
-	if (totalBlocksNeeded > sb->freeDataBlocks) {
-		printf("Not enough free blocks to allocate to file\n");
-		return -1;
-	}
-
-	uint64_t* blockLocations = NULL;
-	bool needToWrite = false;
-	uint64_t indirectLocation;
-	uint64_t lastBlockRead;
-	uint64_t i = 0;
-
-	//Check if there are enough free blocks
-	if (findFreeBlocks(totalBlocksNeeded, &blockLocations) != totalBlocksNeeded) {
-		printf("Free Blocks not equal to total blocks needed\n");
-		if (blockLocations != NULL)
-			free(blockLocations);
-		return -1;
-	}
-
-	uint64_t* clearBlock = calloc(1, partInfop->blocksize);
-	uint64_t* indirectBlockBuffer = calloc(NUM_INDIRECT, partInfop->blocksize);
+	return fillBlocks(vol, inode, inode->blocksMapped, totalBlocksNeeded, true);
+}
 
-	//Fill the direct data blocks
-	while (inode->blocksReserved < NUM_DIRECT && i < totalBlocksNeeded) {
-		inode->directData[inode->blocksReserved] = blockLocations[i];
-		LBAwrite(clearBlock, 1, blockLocations[i] + sb->rootDataPointer);
-		inode->blocksReserved++;
-		i++;
-	}
-	//Fill the first indirect data block
-	while (inode->blocksReserved < NUM_DIRECT + sb->pointersPerIndirect && i < totalBlocksNeeded) {
-		if (inode->blocksIndirect < 1) {
-			inode->indirectData[0] = blockLocations[i];
-			LBAwrite(clearBlock, 1, blockLocations[i] + sb->rootDataPointer);
-			inode->blocksIndirect++;
-			i++;
-		}
-		if (i == 0 || inode->blocksReserved == NUM_DIRECT)
-			LBAread(indirectBlockBuffer, 1, inode->indirectData[0] + sb->rootDataPointer);
+/**
+ * Assigns free blocks to every hole between the given blocks of the file,
+ * extending the block map if needed. New blocks can be left unwiped when
+ * the caller is about to overwrite all of them.
+ * @param vol the volume
+ * @param inode the inode to assign blocks to
+ * @param startBlock the first block of the file to fill
+ * @param endBlock one past the last block of the file to fill
+ * @param wipe whether to zero the new blocks
+ * @returns the number of new blocks assigned
+ * @returns -1 if not enough free blocks
+ */
+int64_t fillBlocks(FsVolume_p vol, Inode_p inode, uint64_t startBlock, uint64_t endBlock, bool wipe) {
+	ARENA_SCOPE(mark);
+	BlockMap map;
+	uint64_t oldLength = inode->blocksMapped;
+	uint64_t runStart = HOLE_BLOCK;
+	uint64_t runLength = 0;
+	uint64_t block;
+
+	if (inode->inlined) {
+		if (!spillInline(vol, inode))
+			return -1;
+		oldLength = inode->blocksMapped;
+	}
 
-		indirectBlockBuffer[inode->blocksReserved - NUM_DIRECT % sb->pointersPerIndirect] = blockLocations[i];
-		LBAwrite(clearBlock, 1, blockLocations[i] + sb->rootDataPointer);
-		inode->blocksReserved++;
-		i++;
-		needToWrite = true;
-	}
-	if (needToWrite) {
-		LBAwrite(indirectBlockBuffer, 1, inode->indirectData[0] + sb->rootDataPointer);
-		needToWrite = false;
-	}
-	//Calculate the correct indirect data block pointed to from the second indirect data block and fill
-	while (i < totalBlocksNeeded) {
-		if (inode->blocksIndirect < 2) {
-			inode->indirectData[1] = blockLocations[i];
-			LBAwrite(clearBlock, 1, blockLocations[i] + sb->rootDataPointer);
-			inode->blocksIndirect++;
-			i++;
-		}
+	//Extend the block map with holes and reserve enough free blocks to fill them
+	openBlockMap(&map, inode);
+	extendBlockMap(vol, &map, endBlock);
+	int64_t blocksAllocated = reserveHoles(vol, &map, startBlock, endBlock, false);
+	if (blocksAllocated == -1) {
+		inode->blocksMapped = oldLength;
+		map.indirectDirty = 0;
+		map.doubleIndirectDirty = 0;
+		closeBlockMap(vol, &map);
+		return -1;
+	}
 
-		if (i == 0 || inode->blocksReserved == NUM_DIRECT + sb->pointersPerIndirect) {
-			LBAread(&indirectBlockBuffer[sb->pointersPerIndirect], 1, inode->indirectData[1] + sb->rootDataPointer);
+	//Fill the holes and wipe them, wiping contiguous blocks together
+	for (uint64_t i = startBlock; i < endBlock; i++) {
+		if (getMapBlock(vol, &map, i) != HOLE_BLOCK)
+			continue;
+		block = takePoolBlock(vol, &map);
+		setMapBlock(vol, &map, i, block);
+		if (!wipe)
+			continue;
+		if (runLength > 0 && block == runStart + runLength) {
+			runLength++;
+		} else {
+			if (runLength > 0)
+				wipeBlocks(vol, runStart, runLength);
+			runStart = block;
+			runLength = 1;
 		}
+	}
+	if (runLength > 0)
+		wipeBlocks(vol, runStart, runLength);
 
-		indirectLocation = (inode->blocksReserved - NUM_DIRECT - sb->pointersPerIndirect);
-		if (i == 0 || (indirectLocation % sb->pointersPerIndirect == 0)) {
-			indirectLocation /= sb->pointersPerIndirect;
+	closeBlockMap(vol, &map);
+	if (blocksAllocated > 0 || inode->blocksMapped != oldLength)
+		writeInode(vol, inode);
+	return blocksAllocated;
+}
 
-			if (inode->blocksIndirect < 3 + indirectLocation) {
-				indirectBlockBuffer[sb->pointersPerIndirect + indirectLocation] = blockLocations[i];
-				LBAwrite(clearBlock, 1, blockLocations[i] + sb->rootDataPointer);
-				LBAwrite(&indirectBlockBuffer[sb->pointersPerIndirect], 1, inode->indirectData[1] + sb->rootDataPointer);
-				inode->blocksIndirect++;
-				i++;
-			}
-			indirectLocation += sb->pointersPerIndirect;
-			if (needToWrite) {
-				LBAwrite(indirectBlockBuffer, 1, indirectBlockBuffer[indirectLocation - 1] + sb->rootDataPointer);
-				needToWrite = false;
-			}
-			LBAread(indirectBlockBuffer, 1, indirectBlockBuffer[indirectLocation] + sb->rootDataPointer);
-			lastBlockRead = indirectLocation;
-		}
-		indirectBlockBuffer[(inode->blocksReserved - NUM_DIRECT - sb->pointersPerIndirect) % sb->pointersPerIndirect] = blockLocations[i];
-		LBAwrite(clearBlock, 1, blockLocations[i] + sb->rootDataPointer);
-		inode->blocksReserved++;
-		i++;
-		needToWrite = true;
-	}
-	if (needToWrite) {
-		LBAwrite(indirectBlockBuffer, 1, indirectBlockBuffer[lastBlockRead] + sb->rootDataPointer);
-	}
+/**
+ * Finds the data block an inode's data should be placed near. The data area is
+ * laid out in the same order as the inode table, so inodes that are close
+ * together keep their data close together.
+ * @param vol the volume
+ * @param inodeID the ID of the inode
+ * @returns the data block to start searching from
+ */
+uint64_t inodeBlockGoal(FsVolume_p vol, uint64_t inodeID) {
+	return inodeID * vol->sb->totalDataBlocks / vol->sb->numInodes;
+}
 
-	writeInode(inode);
-	free(blockLocations);
-	free(clearBlock);
-	free(indirectBlockBuffer);
-	return totalBlocksNeeded;
+/**
+ * Finds the data block a block of a file should be placed near, right after
+ * the block before it if that block is allocated.
+ * @param vol the volume
+ * @param map the block map of the file
+ * @param fileBlock the block number within the file
+ * @returns the data block to start searching from
+ */
+uint64_t mapBlockGoal(FsVolume_p vol, BlockMap_p map, uint64_t fileBlock) {
+	uint64_t previous = HOLE_BLOCK;
+
+	if (fileBlock > 0 && fileBlock <= map->inode->blocksMapped)
+		previous = getMapBlock(vol, map, fileBlock - 1);
+	if (previous != HOLE_BLOCK && previous + 1 < vol->sb->totalDataBlocks)
+		return previous + 1;
+	return inodeBlockGoal(vol, map->inode->inode);
 }
 
 /**
  * Looks for the given number of freeblocks and returns an array
- * with the blocks that are free.
+ * with the blocks that are free. Safe to call from several threads.
+ * @param vol the volume
+ * @param numberBlocksRequired the number of blocks requested
+ * @param blockLocations set to an array of the block locations, allocated from the arena
+ * @param goal the data block to start searching from
+ * @returns number of blocks found
+ * @returns 0 if unsuccessful
+ */
+uint64_t findFreeBlocks(FsVolume_p vol, uint64_t numberBlocksRequired, uint64_t** blockLocations, uint64_t goal) {
+	pthread_mutex_lock(&vol->allocLock);
+	uint64_t start = statNow();
+	uint64_t holes = vol->allocStats.holes;
+	uint64_t numberBlocksFound = searchFreeBlocks(vol, numberBlocksRequired, blockLocations, goal);
+	uint64_t elapsed = statNow() - start;
+	vol->allocStats.calls++;
+	vol->allocStats.blocks += numberBlocksFound;
+	vol->allocStats.nanoseconds += elapsed;
+	if (elapsed > vol->allocStats.maxNanoseconds)
+		vol->allocStats.maxNanoseconds = elapsed;
+	if (vol->allocStats.holes - holes > 1)
+		vol->allocStats.fallbacks++;
+	if (numberBlocksFound > 0)
+		markMemoryDirty(vol);
+	pthread_mutex_unlock(&vol->allocLock);
+	return numberBlocksFound;
+}
+
+/**
+ * Searches the bitVector for free blocks and marks them used. The search starts
+ * at the byte of the bitVector holding the goal and wraps around to the start.
+ * The caller must hold allocLock.
+ * @param vol the volume
  * @param numberBlocksRequired the number of blocks requested
- * @param blockLocations NULL buffer that will store the block locations
+ * @param blockLocations set to an array of the block locations, allocated from the arena
+ * @param goal the data block to start searching from
  * @returns number of blocks found
  * @returns 0 if unsuccessful
  */
-uint64_t findFreeBlocks(uint64_t numberBlocksRequired, uint64_t** blockLocations) {
-	if (numberBlocksRequired > sb->freeDataBlocks) {
+uint64_t searchFreeBlocks(FsVolume_p vol, uint64_t numberBlocksRequired, uint64_t** blockLocations, uint64_t goal) {
+	if (numberBlocksRequired > vol->sb->freeDataBlocks) {
 		printf("Error: Number of blocks required exceeds number of free blocks\n");
 		return 0;
 	}
 
-	if (*blockLocations != NULL)
-		free(*blockLocations);
-
-	*blockLocations = calloc(numberBlocksRequired, sizeof(uint64_t));
+	*blockLocations = arenaAlloc(numberBlocksRequired * sizeof(uint64_t));
 
 	uint64_t numberBlocksFound = 0;
 	uint64_t largestHolePos = 0;
 	uint64_t largestHoleLength = 0;
 	uint64_t currentHolePos = 0;
 	uint64_t currentHoleLength = 0;
-	uint64_t currentBit = 0;
+	uint64_t startByte = (goal < vol->sb->totalDataBlocks) ? goal / 8 : 0;
+	uint64_t currentBit = startByte * 8;
+	uint64_t i;
 	//Iterate through bitvector to find the first set of requested contiguous blocks
 	//If there isn't a large enough set of contiguous blocks, use the largest sets
 	//until all blocks have been allocated.
 	while (numberBlocksFound < numberBlocksRequired) {
-		for (uint64_t i = 0; i < sb->bytesUsedByBitVector; i++) {
+		for (uint64_t n = 0; n < vol->sb->bytesUsedByBitVector; n++) {
+			i = (startByte + n) % vol->sb->bytesUsedByBitVector;
+			vol->allocStats.bitsExamined += 8;
+			//A hole can not run past the end of the bitVector into the start
+			if (i == 0 && n > 0) {
+				if (currentHoleLength > largestHoleLength) {
+					largestHolePos = currentHolePos;
+					largestHoleLength = currentHoleLength;
+				}
+				currentHolePos = 0;
+				currentHoleLength = 0;
+				currentBit = 0;
+			}
 			//Check if entire byte is used
-			if (bitVector[i] == USED_FLAG) {
+			if (vol->bitVector[i] == USED_FLAG) {
 				currentBit += 8;
 				if (currentHoleLength > largestHoleLength) {
 					largestHolePos = currentHolePos;
@@ -828,7 +2324,7 @@ uint64_t findFreeBlocks(uint64_t numberBlocksRequired, uint64_t** blockLocations
 				currentHolePos = 0;
 				currentHoleLength = 0;
 			//Check if entire byte is unused
-			} else if (bitVector[i] == UNUSED_FLAG) {
+			} else if (vol->bitVector[i] == UNUSED_FLAG) {
 				if (currentHolePos == 0) {
 					currentHolePos = currentBit;
 				}
@@ -839,14 +2335,15 @@ uint64_t findFreeBlocks(uint64_t numberBlocksRequired, uint64_t** blockLocations
 					currentHoleLength += numberBlocksRequired - numberBlocksFound - currentHoleLength;
 					fillArray(&((*blockLocations)[numberBlocksFound]), currentHolePos, currentHoleLength);
 					for (uint64_t j = numberBlocksFound; j < numberBlocksRequired; j++)
-						setBitOn((*blockLocations)[j]);
-					sb->freeDataBlocks -= currentHoleLength;
+						setBitOn(vol, (*blockLocations)[j]);
+					vol->sb->freeDataBlocks -= currentHoleLength;
+					vol->allocStats.holes++;
 					return numberBlocksFound + currentHoleLength;
 				}
 			//Partial byte is used, iterate through byte
 			} else {
-				for (; currentBit < (i+1) * 8 && currentBit < sb->totalDataBlocks; currentBit++) {
-					if (!bitUsed(currentBit)) {
+				for (; currentBit < (i+1) * 8 && currentBit < vol->sb->totalDataBlocks; currentBit++) {
+					if (!bitUsed(vol, currentBit)) {
 						if (currentHolePos == 0) {
 							currentHolePos = currentBit;
 						}
@@ -854,8 +2351,9 @@ uint64_t findFreeBlocks(uint64_t numberBlocksRequired, uint64_t** blockLocations
 						if (currentHoleLength == numberBlocksRequired - numberBlocksFound) {
 							fillArray(&((*blockLocations)[numberBlocksFound]), currentHolePos, currentHoleLength);
 							for (uint64_t j = numberBlocksFound; j < numberBlocksRequired; j++)
-								setBitOn((*blockLocations)[j]);
-							sb->freeDataBlocks -= currentHoleLength;
+								setBitOn(vol, (*blockLocations)[j]);
+							vol->sb->freeDataBlocks -= currentHoleLength;
+							vol->allocStats.holes++;
 							return numberBlocksFound + currentHoleLength;
 						}
 					} else {
@@ -879,16 +2377,17 @@ uint64_t findFreeBlocks(uint64_t numberBlocksRequired, uint64_t** blockLocations
 		if (largestHoleLength != 0) {
 			fillArray(&((*blockLocations)[numberBlocksFound]), largestHolePos, largestHoleLength);
 			for (uint64_t j = numberBlocksFound; j < numberBlocksFound + largestHoleLength; j++)
-				setBitOn((*blockLocations)[j]);
+				setBitOn(vol, (*blockLocations)[j]);
 			numberBlocksFound += largestHoleLength;
-			sb->freeDataBlocks -= largestHoleLength;
+			vol->sb->freeDataBlocks -= largestHoleLength;
+			vol->allocStats.holes++;
 		} else {
 			printf("Error: Problem with finding free blocks\n");
 			return 0;
 		}
 		largestHolePos = 0;
 		largestHoleLength = 0;
-		currentBit = 0;
+		currentBit = startByte * 8;
 	}
 	return 0;
 }
@@ -908,59 +2407,177 @@ void fillArray(uint64_t* blockLocations, uint64_t startValue, uint64_t length) {
 
 /**
  * Returns whether the bit is set or not
+ * @param vol the volume
  * @param bit the bit to check
  * @returns 1 if set
  * @returns 0 if not set
  */
-int bitUsed(uint64_t bit) {
-	return bitVector[bit / 8] & (1 << (bit % 8));
+int bitUsed(FsVolume_p vol, uint64_t bit) {
+	return vol->bitVector[bit / 8] & (1 << (bit % 8));
 }
 
 /**
  * Sets the bit to one/used
+ * @param vol the volume
  * @param bitToSet the bit to set
  */
-void setBitOn(uint64_t bitToSet) {
-	bitVector[bitToSet / 8] |= (1 << (bitToSet % 8));
+void setBitOn(FsVolume_p vol, uint64_t bitToSet) {
+	vol->bitVector[bitToSet / 8] |= (1 << (bitToSet % 8));
+	vol->bitVectorDirty[bitToSet / 8 / vol->partInfop->blocksize] = 1;
 }
 
 /**
  * Sets the bit to zero/free
+ * @param vol the volume
  * @param bitToSet the bit to set
  */
-void setBitOff(uint64_t bitToSet) {
-	bitVector[bitToSet / 8] &= ~(1 << (bitToSet % 8));
+void setBitOff(FsVolume_p vol, uint64_t bitToSet) {
+	vol->bitVector[bitToSet / 8] &= ~(1 << (bitToSet % 8));
+	vol->bitVectorDirty[bitToSet / 8 / vol->partInfop->blocksize] = 1;
+}
+
+/**
+ * Drops one reference to the data block. The block is given back
+ * to the free blocks once no other file shares it.
+ * @param vol the volume
+ * @param block the data block to free
+ */
+void releaseBlock(FsVolume_p vol, uint64_t block) {
+	pthread_mutex_lock(&vol->allocLock);
+	if (vol->refCounts[block] > 0) {
+		setRefCount(vol, block, vol->refCounts[block] - 1);
+	} else {
+		setBitOff(vol, block);
+		vol->sb->freeDataBlocks++;
+	}
+	markMemoryDirty(vol);
+	pthread_mutex_unlock(&vol->allocLock);
+}
+
+/**
+ * Returns whether the data block is referenced by more than one file
+ * @param vol the volume
+ * @param block the data block to check
+ * @returns true if shared
+ */
+bool blockShared(FsVolume_p vol, uint64_t block) {
+	return vol->refCounts[block] > 0;
+}
+
+/**
+ * Adds a reference to a data block that is already in use
+ * @param vol the volume
+ * @param block the data block to share
+ */
+void shareBlock(FsVolume_p vol, uint64_t block) {
+	pthread_mutex_lock(&vol->allocLock);
+	setRefCount(vol, block, vol->refCounts[block] + 1);
+	markMemoryDirty(vol);
+	pthread_mutex_unlock(&vol->allocLock);
+}
+
+/**
+ * Sets the number of extra references to the data block and marks
+ * its part of the reference counts to be written back.
+ * @param vol the volume
+ * @param block the data block to set
+ * @param count the number of references beyond the first
+ */
+void setRefCount(FsVolume_p vol, uint64_t block, uint32_t count) {
+	vol->refCounts[block] = count;
+	vol->refCountDirty[block * sizeof(uint32_t) / vol->partInfop->blocksize] = 1;
 }
 
 /**
  * Allocates memory for bit vector and reads the bit vector from
  * the drive.
+ * @param vol the volume
+ */
+void readBitVector(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_BITMAP);
+	vol->bitVector = calloc(vol->sb->blocksUsedByBitVector, vol->partInfop->blocksize);
+	vol->bitVectorDirty = calloc(vol->sb->blocksUsedByBitVector, 1);
+	LBAread(vol->partition, vol->bitVector, vol->sb->blocksUsedByBitVector, vol->sb->bitVectorStart);
+}
+
+/**
+ * Allocates memory for the reference counts and reads them from the drive.
+ * Volumes formatted without reference counts start with none shared.
+ * @param vol the volume
  */
-void readBitVector() {
-	bitVector = calloc(sb->blocksUsedByBitVector, partInfop->blocksize);
-	LBAread(bitVector, sb->blocksUsedByBitVector, sb->bitVectorStart);
+void readRefCounts(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_BITMAP);
+	uint64_t blocks = (vol->sb->totalDataBlocks * sizeof(uint32_t) + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+	if (vol->sb->refCountStart != 0)
+		blocks = vol->sb->blocksUsedByRefCount;
+	vol->refCounts = calloc(blocks, vol->partInfop->blocksize);
+	vol->refCountDirty = calloc(blocks, 1);
+	if (vol->sb->refCountStart != 0)
+		LBAread(vol->partition, vol->refCounts, vol->sb->blocksUsedByRefCount, vol->sb->refCountStart);
 }
 
 /**
- * Writes the current bitVector to drive
+ * Writes the modified blocks of the reference counts to drive,
+ * writing contiguous modified blocks together.
+ * @param vol the volume
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int writeBitVector() {
-	if (LBAwrite(bitVector, sb->blocksUsedByBitVector, sb->bitVectorStart) == 0) {
-		printf("Could not write bit vector to drive\n");
-		return 0;
+int writeRefCounts(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_BITMAP);
+	uint64_t runStart;
+
+	if (vol->sb->refCountStart == 0)
+		return 1;
+
+	for (uint64_t i = 0; i < vol->sb->blocksUsedByRefCount; i++) {
+		if (!vol->refCountDirty[i])
+			continue;
+		runStart = i;
+		while (i < vol->sb->blocksUsedByRefCount && vol->refCountDirty[i])
+			vol->refCountDirty[i++] = 0;
+		if (LBAwriteMetadata(vol->partition, (uint8_t*)vol->refCounts + runStart * vol->partInfop->blocksize, i - runStart, vol->sb->refCountStart + runStart) == 0) {
+			printf("Could not write reference counts to drive\n");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Writes the modified blocks of the bitVector to drive,
+ * writing contiguous modified blocks together.
+ * @param vol the volume
+ * @returns 1 if successful
+ * @returns 0 if unsuccessful
+ */
+int writeBitVector(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_BITMAP);
+	uint64_t runStart;
+
+	for (uint64_t i = 0; i < vol->sb->blocksUsedByBitVector; i++) {
+		if (!vol->bitVectorDirty[i])
+			continue;
+		runStart = i;
+		while (i < vol->sb->blocksUsedByBitVector && vol->bitVectorDirty[i])
+			vol->bitVectorDirty[i++] = 0;
+		if (LBAwriteMetadata(vol->partition, vol->bitVector + runStart * vol->partInfop->blocksize, i - runStart, vol->sb->bitVectorStart + runStart) == 0) {
+			printf("Could not write bit vector to drive\n");
+			return 0;
+		}
 	}
 	return 1;
 }
 
 /**
  * Writes the current superblock to drive
+ * @param vol the volume
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int writeSuperBlock() {
-	if (LBAwrite(sb, 1, 0) == 0) {
+int writeSuperBlock(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_SUPER);
+	if (LBAwriteMetadata(vol->partition, vol->sb, 1, 0) == 0) {
 		printf("Could not write super block to drive\n");
 		return 0;
 	}
@@ -968,31 +2585,249 @@ int writeSuperBlock() {
 }
 
 /**
- * Writes bitVector and SuperBlock to drive
+ * Writes the modified parts of the bitVector and reference counts and the
+ * SuperBlock to drive. The caller must hold allocLock.
+ * @param vol the volume
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int saveMemory() {
-	if (!writeSuperBlock() || !writeBitVector()) {
+int writeMemory(FsVolume_p vol) {
+	vol->memoryDirty = false;
+	if (!writeSuperBlock(vol) || !writeBitVector(vol) || !writeRefCounts(vol)) {
 		printf("Could not save memory\n");
 		return 0;
 	}
 	return 1;
 }
 
+/**
+ * Notes that the bitVector, reference counts or SuperBlock changed and are
+ * not on the drive yet, so a sync or the flusher writes them. The caller
+ * must hold allocLock.
+ * @param vol the volume
+ */
+void markMemoryDirty(FsVolume_p vol) {
+	if (!vol->memoryDirty)
+		vol->memoryDirtySince = currentMillis();
+	vol->memoryDirty = true;
+}
+
+/**
+ * Writes bitVector, reference counts and SuperBlock to drive.
+ * During a batch the write is deferred until endBatch.
+ * @param vol the volume
+ * @returns 1 if successful
+ * @returns 0 if unsuccessful
+ */
+int saveMemory(FsVolume_p vol) {
+	int result = 1;
+
+	pthread_mutex_lock(&vol->allocLock);
+	if (vol->batchDepth > 0) {
+		markMemoryDirty(vol);
+	} else {
+		result = writeMemory(vol);
+	}
+	pthread_mutex_unlock(&vol->allocLock);
+	return result;
+}
+
+/**
+ * Saves the totals changed through open files, the bitVector, reference
+ * counts and superblock, even during a batch, and flushes every write made
+ * so far to the disk.
+ * @param vol the volume
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsSync(FsVolume_p vol) {
+	STAT_SCOPE(&vol->opStats[FS_OP_SYNC]);
+	RECORD_SCOPE(vol, FS_OP_SYNC, NULL, NULL, -1, 0, 0);
+	int saved = 1;
+
+	//An unformatted partition has no memory to save
+	if (vol->sb != NULL) {
+		applyOpenFileTotals(vol);
+		pthread_mutex_lock(&vol->allocLock);
+		saved = writeMemory(vol);
+		pthread_mutex_unlock(&vol->allocLock);
+	}
+	if (!saved)
+		return -1;
+	return LBAsync(vol->partition);
+}
+
+/**
+ * Returns the time in milliseconds from a fixed point, unaffected by changes to the clock
+ * @returns the time in milliseconds
+ */
+uint64_t currentMillis() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Writes back what has waited too long or what has built up past the
+ * background ratio. The totals changed through open files reach their
+ * ancestors, memory deferred by a batch is written once it is as old as
+ * the expiry, and the unflushed blocks are flushed in block order.
+ * @param vol the volume
+ */
+void writeBack(FsVolume_p vol) {
+	uint64_t backgroundBlocks = vol->partInfop->numberOfBlocks * vol->writeback.backgroundRatio / 100;
+
+	if (vol->sb != NULL)
+		applyOpenFileTotals(vol);
+
+	pthread_mutex_lock(&vol->allocLock);
+	if (vol->memoryDirty && currentMillis() - vol->memoryDirtySince >= vol->writeback.expireMs)
+		writeMemory(vol);
+	pthread_mutex_unlock(&vol->allocLock);
+
+	if (LBAdirtyAge(vol->partition) >= vol->writeback.expireMs || LBAdirtyBlocks(vol->partition) > backgroundBlocks)
+		LBAsync(vol->partition);
+}
+
+/**
+ * Runs the flusher of a volume, waking every interval to write back until stopWriteback.
+ * @param arg the volume
+ * @returns NULL
+ */
+void* runFlusher(void* arg) {
+	FsVolume_p vol = arg;
+	struct timespec wake;
+
+	pthread_mutex_lock(&vol->flusherLock);
+	while (!vol->flusherStopping) {
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec += vol->writeback.intervalMs / 1000;
+		wake.tv_nsec += (vol->writeback.intervalMs % 1000) * 1000000L;
+		if (wake.tv_nsec >= 1000000000L) {
+			wake.tv_sec++;
+			wake.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&vol->flusherWake, &vol->flusherLock, &wake);
+		if (vol->flusherStopping)
+			break;
+		pthread_mutex_unlock(&vol->flusherLock);
+		writeBack(vol);
+		pthread_mutex_lock(&vol->flusherLock);
+	}
+	pthread_mutex_unlock(&vol->flusherLock);
+	return NULL;
+}
+
+/**
+ * Starts the background flusher of the mounted volume, restarting it if it
+ * is already running. Writers that leave more than the hard ratio of the
+ * volume unflushed flush it themselves.
+ * @param vol the volume
+ * @param config when to write back, NULL for the defaults
+ * @returns 0 if successful
+ * @returns -1 if the flusher could not be started
+ */
+int startWriteback(FsVolume_p vol, WritebackConfig_p config) {
+	stopWriteback(vol);
+
+	if (config != NULL) {
+		vol->writeback = *config;
+	} else {
+		vol->writeback.intervalMs = WRITEBACK_INTERVAL_MS;
+		vol->writeback.expireMs = WRITEBACK_EXPIRE_MS;
+		vol->writeback.backgroundRatio = WRITEBACK_BACKGROUND_RATIO;
+		vol->writeback.hardRatio = WRITEBACK_HARD_RATIO;
+	}
+	if (vol->writeback.intervalMs == 0)
+		vol->writeback.intervalMs = WRITEBACK_INTERVAL_MS;
+	LBAsetDirtyLimit(vol->partition, vol->partInfop->numberOfBlocks * vol->writeback.hardRatio / 100);
+
+	vol->flusherStopping = false;
+	if (pthread_create(&vol->flusherThread, NULL, runFlusher, vol) != 0) {
+		LBAsetDirtyLimit(vol->partition, 0);
+		return -1;
+	}
+	vol->flusherRunning = true;
+	return 0;
+}
+
+/**
+ * Stops the background flusher, if it is running, and writes back
+ * everything it was holding. Must be called before the partition is closed.
+ * @param vol the volume
+ */
+void stopWriteback(FsVolume_p vol) {
+	if (!vol->flusherRunning)
+		return;
+
+	pthread_mutex_lock(&vol->flusherLock);
+	vol->flusherStopping = true;
+	pthread_cond_signal(&vol->flusherWake);
+	pthread_mutex_unlock(&vol->flusherLock);
+	pthread_join(vol->flusherThread, NULL);
+	vol->flusherRunning = false;
+
+	LBAsetDirtyLimit(vol->partition, 0);
+	fsSync(vol);
+}
+
+/**
+ * Starts a batch of changes. Until the matching endBatch, saveMemory only
+ * remembers that memory needs saving. Batches must be started and ended
+ * outside of any thread pool.
+ * @param vol the volume
+ */
+void beginBatch(FsVolume_p vol) {
+	vol->batchDepth++;
+}
+
+/**
+ * Ends a batch of changes and saves memory if anything in the batch changed it.
+ * @param vol the volume
+ * @returns 1 if successful
+ * @returns 0 if unsuccessful
+ */
+int endBatch(FsVolume_p vol) {
+	if (vol->batchDepth > 0)
+		vol->batchDepth--;
+	if (vol->batchDepth == 0 && vol->memoryDirty)
+		return saveMemory(vol);
+	return 1;
+}
+
 /**
  * Sets the entire partition to 0
+ * @param vol the volume
  */
-void wipePartition() {
+void wipePartition(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_OTHER);
 	printf("Please wait, wiping partition....");
 	fflush(stdout);
-	uint8_t* buffer = calloc(1, partInfop->blocksize);
-	for (uint64_t i = 0; i < partInfop->numberOfBlocks; i++)
-		LBAwrite(buffer, 1, i);
+	uint8_t* buffer = calloc(1, vol->partInfop->blocksize);
+	for (uint64_t i = 0; i < vol->partInfop->numberOfBlocks; i++)
+		LBAwrite(vol->partition, buffer, 1, i);
 	free(buffer);
 	printf("Done!\n");
 }
 
+/**
+ * Sets the given run of contiguous data blocks to 0
+ * @param vol the volume
+ * @param startBlock the first data block to wipe
+ * @param count the number of data blocks to wipe
+ */
+void wipeBlocks(FsVolume_p vol, uint64_t startBlock, uint64_t count) {
+	LBA_TAG_SCOPE(LBA_TAG_DATA);
+	uint64_t blocksPerWrite = (count < WIPE_BLOCKS) ? count : WIPE_BLOCKS;
+	uint8_t* buffer = calloc(blocksPerWrite, vol->partInfop->blocksize);
+	for (uint64_t i = 0; i < count; i += blocksPerWrite) {
+		if (count - i < blocksPerWrite)
+			blocksPerWrite = count - i;
+		LBAwrite(vol->partition, buffer, blocksPerWrite, startBlock + i + vol->sb->rootDataPointer);
+	}
+	free(buffer);
+}
+
 /**
  * Parse path string into separate arguments
  * @param path the path to parse
@@ -1001,10 +2836,11 @@ void wipePartition() {
  */
 uint32_t parsePath(char* path, char** args) {
 	uint32_t i = 0;
-    char* token = strtok(path, "/");
+	char* save;
+    char* token = strtok_r(path, "/", &save);
     while (token != NULL) {
         args[i] = token;
-        token = strtok(NULL, "/");
+        token = strtok_r(NULL, "/", &save);
         i++;
     }
     args[i] = NULL;
@@ -1013,56 +2849,51 @@ uint32_t parsePath(char* path, char** args) {
 
 /**
  * Get working directory full path through recursion
+ * @param vol the volume
  * @param parentID the parent inode ID of the current directory
  * @param currentID the inode ID of the current directory
  * @returns the length of the pathname
  * @returns 0 if failed
  */
-int getFullPath(uint64_t parentID, uint64_t currentID) {
+int getFullPath(FsVolume_p vol, uint64_t parentID, uint64_t currentID) {
+	ARENA_SCOPE(mark);
 	int retval;
 	//Base case
 	if (currentID == 0) {
-		strcpy(wd->wdPath, "/");
+		strcpy(vol->wd->wdPath, "/");
 		return 1;
 	}
 
 	//Recursively call getFullPath
 	Inode_p inode = NULL;
-	readInode(parentID, &inode);
-	retval = getFullPath(inode->parentInodeID, parentID);
+	readInode(vol, parentID, &inode);
+	retval = getFullPath(vol, inode->parentInodeID, parentID);
 	if (retval == 0) {
 		return 0;
 	}
 
 	//Find name of file
-	FCB_p directoryData = NULL;
-	int fcbLocation = -1;
-	readFile((uint8_t**)(&directoryData), inode, 0, 0);
-	uint32_t numberOfEntries = inode->size / sizeof(FCB);
-	for (uint32_t i = 0; i < numberOfEntries; i++) {
-		if (currentID == directoryData[i].inodeID) {
-			fcbLocation = i;
-			break;
-		}
-	}
-	if (fcbLocation == -1) {
+	DirEntry entry;
+	DirIterator_p iterator = dirOpen(vol, inode);
+	int64_t found = dirFind(vol, iterator, NULL, currentID, &entry, NULL);
+	dirClose(vol, iterator);
+	if (found == -1) {
+		putInodeBuffer(vol, inode);
 		return 0;
 	}
 
 	//Check if the path name is too long
-	int length = strlen(directoryData[fcbLocation].name);
+	int length = strlen(entry.name);
 	if (length + retval > MAX_PATH_NAME) {
-		free(inode);
-		free(directoryData);
+		putInodeBuffer(vol, inode);
 		printf("Error path is too long\n");
 		return retval;
 	}
 
-	strcat(wd->wdPath, directoryData[fcbLocation].name);
-	if (directoryData[fcbLocation].inodeID != wd->inodeID)
-		strcat(wd->wdPath, "/");
-	free(inode);
-	free(directoryData);
+	strcat(vol->wd->wdPath, entry.name);
+	if (entry.inodeID != vol->wd->inodeID)
+		strcat(vol->wd->wdPath, "/");
+	putInodeBuffer(vol, inode);
 	return length + retval;
 }
 
@@ -1070,6 +2901,7 @@ int getFullPath(uint64_t parentID, uint64_t currentID) {
  * Traverses the given path and sets the last inode to lastInode. If saveLastArg
  * is true, then lastArg will be set to the last arg and the last inode id will be the directory
  * containing the lastArg.
+ * @param vol the volume
  * @param path the path to parse and traverse
  * @param lastInode a provided uint64_t to store the last inode ID
  * @param saveLastArg whether to save the last argument in lastArg
@@ -1077,7 +2909,8 @@ int getFullPath(uint64_t parentID, uint64_t currentID) {
  * @returns 1 if found
  * @returns 0 if not found
  */
-int getLastInode(char* path, uint64_t* lastInode, bool saveLastArg, char* lastArg) {
+int getLastInode(FsVolume_p vol, char* path, uint64_t* lastInode, bool saveLastArg, char* lastArg) {
+	ARENA_SCOPE(mark);
 	char* args[MAX_DIRECTORIES] = {NULL};
 	Inode_p currentInode = NULL;
 	uint32_t numArgs = 0;
@@ -1088,13 +2921,13 @@ int getLastInode(char* path, uint64_t* lastInode, bool saveLastArg, char* lastAr
 	if (path == NULL || path[0] == '/') {
 		*lastInode = 0;
 	} else {
-		*lastInode = wd->inodeID;
+		*lastInode = vol->wd->inodeID;
 	}
 
 	//Make a copy of the path string
 	if (path != NULL) {
 		strlength = strlen(path) + 1;
-		pathCopy = malloc(strlength);
+		pathCopy = arenaAlloc(strlength);
 		memcpy(pathCopy, path, strlength);
 		numArgs = parsePath(pathCopy, args);
 		if (saveLastArg)
@@ -1103,13 +2936,12 @@ int getLastInode(char* path, uint64_t* lastInode, bool saveLastArg, char* lastAr
 
 	//Iterate through all arguments to find next inode
 	for (uint32_t i = 0; i < numArgs; i++) {
-		readInode(*lastInode, &currentInode);
+		readInode(vol, *lastInode, &currentInode);
 		//If we're saving the last argument, then all arguments must be directories
 		//If we're not saving, then all arguments except the last must be directories
 		if (currentInode->type != DIRECTORY_TYPE) {
 			if (saveLastArg || i != numArgs - 1) {
-				free(currentInode);
-				free(pathCopy);
+				putInodeBuffer(vol, currentInode);
 				return 0;
 			}
 		}
@@ -1120,32 +2952,30 @@ int getLastInode(char* path, uint64_t* lastInode, bool saveLastArg, char* lastAr
 			*lastInode = currentInode->parentInodeID;
 		} else {
 			//Check if the folder contains the file or directory
-			if (inodeContainsFile(currentInode, args[i], lastInode) == 0) {
-				free(currentInode);
-				free(pathCopy);
+			if (inodeContainsFile(vol, currentInode, args[i], lastInode) == 0) {
+				putInodeBuffer(vol, currentInode);
 				return 0;
 			}
 		}
 	}
 	if (currentInode != NULL)
-		free(currentInode);
+		putInodeBuffer(vol, currentInode);
 
 	//Save last argument if requested
 	if (path != NULL && saveLastArg && lastArg != NULL) {
 		if (strlen(args[numArgs]) + 1 > MAX_NAME_SIZE) {
 			printf("Name is too long, max size is:%d\n", MAX_NAME_SIZE);
-			free(pathCopy);
 			return 0;
 		}
 		strcpy(lastArg, args[numArgs]);
 	}
-	free(pathCopy);
 	return 1;
 }
 
 /**
  * Creates the file type at the given path and reserves enough blocks for the size.
  * If file already exists or there are not sufficient free blocks, will return.
+ * @param vol the volume
  * @param path the path to parse, with the name of the file or directory to place the file in
  * @param type the type of file (file or directory)
  * @param size the size in bytes to calculate the number of blocks to reserve
@@ -1154,85 +2984,85 @@ int getLastInode(char* path, uint64_t* lastInode, bool saveLastArg, char* lastAr
  * @returns the inodeID of the new file
  * @returns 0 if unsuccessful
  */
-uint64_t createFile(char* path, uint8_t type, uint64_t size, bool haveDirInode, uint64_t dirInodeID) {
+uint64_t createFile(FsVolume_p vol, char* path, uint8_t type, uint64_t size, bool haveDirInode, uint64_t dirInodeID) {
 	uint64_t lastInode;
 	uint64_t newInodeID;
 	char fileName[MAX_NAME_SIZE];
 	Inode_p newInode = NULL;
 	Inode_p previousInode = NULL;
-	FCB_p directoryData = NULL;
 
 	//If directory is already given
 	if (haveDirInode) {
 		lastInode = dirInodeID;
 		strcpy(fileName, path);
-	} else if (!getLastInode(path, &lastInode, true, fileName)) {
+	} else if (!getLastInode(vol, path, &lastInode, true, fileName)) {
 		printf("Could not find %s\n", path);
 		return 0;
 	}
 
 	//Check if filename is already in the directory
-	readInode(lastInode, &previousInode);
-	if (inodeContainsFile(previousInode, fileName, &newInodeID)) {
-		free(previousInode);
+	readInode(vol, lastInode, &previousInode);
+	if (inodeContainsFile(vol, previousInode, fileName, &newInodeID)) {
+		putInodeBuffer(vol, previousInode);
 		return 0;
 	}
 
-	//Get a new inode ID for new file
-	newInodeID = findFreeInode(fileName, lastInode);
-	if (newInodeID == 0)
-		return 0;
-
-	//Create new file, allocate blocks, and put the file in the directory
-	FCB_p newFCB = calloc(1, sizeof(FCB));
-	newFCB->inodeID = newInodeID;
-	strcpy(newFCB->name, fileName);
-	previousInode->size += sizeof(FCB);
-	if (allocateBlocks(previousInode, previousInode->size) == -1) {
-		free(previousInode);
-		free(newFCB);
+	//Get a new inode ID for new file and claim it before another thread can
+	pthread_mutex_lock(&vol->inodeAllocLock);
+	newInodeID = findFreeInode(vol, fileName, lastInode, type);
+	if (newInodeID == 0) {
+		pthread_mutex_unlock(&vol->inodeAllocLock);
+		putInodeBuffer(vol, previousInode);
 		return 0;
 	}
-	previousInode->dateModified = time(NULL);
-	readFile((uint8_t**)(&directoryData), previousInode, 0, 0);
-	uint32_t numberOfEntries = previousInode->size / sizeof(FCB);
-	memcpy(&directoryData[numberOfEntries - 1], newFCB, sizeof(FCB));
-
-	writeFile((uint8_t*)directoryData, previousInode, 0, previousInode->size);
-	writeInode(previousInode);
-
-	//Create and set the new inode of the file
-	newInode = calloc(1, sizeof(Inode));
+	newInode = getInodeBuffer(vol);
+	memset(newInode, 0, sizeof(Inode));
 	newInode->used = USED_FLAG;
 	newInode->type = type;
-	newInode->dateModified = time(NULL);
 	newInode->inode = newInodeID;
 	newInode->parentInodeID = lastInode;
+	newInode->inlined = 1;
+	writeInode(vol, newInode);
+	pthread_mutex_unlock(&vol->inodeAllocLock);
+	pthread_mutex_lock(&vol->allocLock);
+	vol->sb->usedInodes++;
+	pthread_mutex_unlock(&vol->allocLock);
+
+	//Put the new file in the directory
+	if (!addToDirectory(vol, previousInode, newInodeID, type, fileName)) {
+		freeInode(vol, newInode);
+		putInodeBuffer(vol, newInode);
+		putInodeBuffer(vol, previousInode);
+		return 0;
+	}
+
+	//Set the new inode of the file
+	newInode->dateModified = time(NULL);
 	newInode->size = 0;
+	newInode->blocksMapped = 0;
 	newInode->blocksReserved = 0;
 	newInode->blocksIndirect = 0;
-	allocateBlocks(newInode, size);
-	writeInode(newInode);
-	sb->usedInodes++;
-	saveMemory();
-
-	free(newFCB);
-	free(directoryData);
-	free(newInode);
-	free(previousInode);
+	allocateBlocks(vol, newInode, size);
+	writeInode(vol, newInode);
+	saveMemory(vol);
+
+	putInodeBuffer(vol, newInode);
+	putInodeBuffer(vol, previousInode);
 	return newInodeID;
 }
 
 /**
  * Checks if the inode directory contains the filename, returns if the inode is found.
  * If the inode is found, it will update the foundInodeID with the ID number.
+ * @param vol the volume
  * @param inode the directory inode to search
  * @param fileName the name of the file to search for
  * @param foundInodeID if the name is found, will store the inode id of the file here
  * @returns 1 if found
  * @returns 0 if not found or error
  */
-int inodeContainsFile(Inode_p inode, const char* fileName, uint64_t* foundInodeID) {
+int inodeContainsFile(FsVolume_p vol, Inode_p inode, const char* fileName, uint64_t* foundInodeID) {
+	ARENA_SCOPE(mark);
 	if (inode == NULL) {
 		printf("Inode is null\n");
 		return 0;
@@ -1246,172 +3076,401 @@ int inodeContainsFile(Inode_p inode, const char* fileName, uint64_t* foundInodeI
 		return 0;
 	}
 
-	//Check directory for fileName
-	FCB_p currentDirectoryData = NULL;
-	readFile((uint8_t**)(&currentDirectoryData), inode, 0, 0);
-	uint64_t numberOfFiles = inode->size / sizeof(FCB);
-	for (uint64_t i = 0; i < numberOfFiles; i++) {
-		if (strcmp(currentDirectoryData[i].name, fileName) == 0) {
-			*foundInodeID = currentDirectoryData[i].inodeID;
-			free(currentDirectoryData);
-			return 1;
-		}
-	}
-	free(currentDirectoryData);
-	return 0;
+	//Check directory for fileName, stopping at the block that holds it
+	DirEntry entry;
+	DirIterator_p iterator = dirOpen(vol, inode);
+	int64_t found = dirFind(vol, iterator, fileName, 0, &entry, NULL);
+	dirClose(vol, iterator);
+	if (found == -1)
+		return 0;
+	*foundInodeID = entry.inodeID;
+	return 1;
 }
 
 /**
  * Initializes the working directory to root
+ * @param vol the volume
  */
-void initWorkingDirectory() {
-	wd = calloc(1, sizeof(WorkingDirectory));
-	wd->inodeID = 0;
-	strcpy(wd->wdPath, "/");
-	wd->pathLength = strlen(wd->wdPath);
+void initWorkingDirectory(FsVolume_p vol) {
+	vol->wd = calloc(1, sizeof(WorkingDirectory));
+	vol->wd->inodeID = 0;
+	strcpy(vol->wd->wdPath, "/");
+	vol->wd->pathLength = strlen(vol->wd->wdPath);
 }
 
 /**
- * Finds the file at the given path and copies the inode
- * to the file descriptor table.
- * @param file the path or filename of the file to open
+ * Creates empty file descriptor and open file tables, with every entry on the free lists
+ * @param vol the volume
+ */
+void initFileTables(FsVolume_p vol) {
+	vol->fdTable = calloc(MAX_OPEN_FILES, sizeof(FileDescriptor));
+	vol->openFiles = calloc(MAX_OPEN_FILES, sizeof(OpenFile));
+	for (int32_t i = 0; i < MAX_OPEN_FILES; i++) {
+		vol->fdTable[i].nextFree = (i + 1 < MAX_OPEN_FILES) ? i + 1 : -1;
+		vol->openFiles[i].next = (i + 1 < MAX_OPEN_FILES) ? i + 1 : -1;
+	}
+	for (int32_t i = 0; i < OPEN_FILE_BUCKETS; i++)
+		vol->openFileBuckets[i] = -1;
+	vol->freeDescriptor = 0;
+	vol->freeOpenFile = 0;
+}
+
+/**
+ * Opens a file descriptor on the inode. Every file descriptor open on the same
+ * inode shares one open file, so they all see the same size and blocks.
+ * @param vol the volume
+ * @param inodeID the inode to open
  * @returns the file descriptor index in the file descriptor table
  * @returns -1 if unsuccessful
  */
-int fileOpen(char* file) {
-	int32_t i = 0;
-	uint64_t inodeID;
+int openInodeID(FsVolume_p vol, uint64_t inodeID) {
 	Inode_p inode = NULL;
+	int32_t bucket = inodeID % OPEN_FILE_BUCKETS;
+	int32_t openFile;
+	int32_t fd;
 
-	//Get the inode ID of the file
-	if (!getLastInode(file, &inodeID, false, NULL))
+	//Read the inode before taking the lock, it is thrown away if the file is already open
+	if (!readInode(vol, inodeID, &inode)) {
+		putInodeBuffer(vol, inode);
 		return -1;
+	}
 
-	//Get the inode of the file
-	if (!readInode(inodeID, &inode)) {
-		free(inode);
+	pthread_mutex_lock(&vol->fdLock);
+	if (vol->freeDescriptor == -1) {
+		pthread_mutex_unlock(&vol->fdLock);
+		putInodeBuffer(vol, inode);
 		return -1;
 	}
 
-	while (i < MAX_OPEN_FILES && fdTable[i].used == USED_FLAG)
-		i++;
-
-	if (i >= MAX_OPEN_FILES) {
-		free(inode);
-		return -1;
+	openFile = vol->openFileBuckets[bucket];
+	while (openFile != -1 && vol->openFiles[openFile].inode.inode != inodeID)
+		openFile = vol->openFiles[openFile].next;
+
+	//There is always a free open file while there is a free file descriptor
+	if (openFile == -1) {
+		openFile = vol->freeOpenFile;
+		vol->freeOpenFile = vol->openFiles[openFile].next;
+		memcpy(&vol->openFiles[openFile].inode, inode, sizeof(Inode));
+		vol->openFiles[openFile].refCount = 0;
+		vol->openFiles[openFile].durability = DURABILITY_DEFAULT;
+		vol->openFiles[openFile].pendingSize = 0;
+		vol->openFiles[openFile].pendingReserved = 0;
+		vol->openFiles[openFile].next = vol->openFileBuckets[bucket];
+		vol->openFileBuckets[bucket] = openFile;
 	}
+	vol->openFiles[openFile].refCount++;
 
 	//Set and return the file descriptor in the table
-	fdTable[i].used = USED_FLAG;
-	fdTable[i].byteOffset = 0;
-	fdTable[i].inode = inode;
-	return i;
+	fd = vol->freeDescriptor;
+	vol->freeDescriptor = vol->fdTable[fd].nextFree;
+	vol->fdTable[fd].used = USED_FLAG;
+	vol->fdTable[fd].byteOffset = 0;
+	vol->fdTable[fd].openFile = openFile;
+	vol->fdTable[fd].inode = &vol->openFiles[openFile].inode;
+	pthread_mutex_unlock(&vol->fdLock);
+	putInodeBuffer(vol, inode);
+	return fd;
 }
 
 /**
- * Copies the inode to the file descriptor table.
- * @param inode the inode to open
+ * Finds the file at the given path and opens a file descriptor on it.
+ * @param vol the volume
+ * @param file the path or filename of the file to open
  * @returns the file descriptor index in the file descriptor table
  * @returns -1 if unsuccessful
  */
-int inodeOpen(Inode_p inode) {
-	uint64_t i = 0;
-	Inode_p thisInode = NULL;
-	readInode(inode->inode, &thisInode);
-
-	while (i < MAX_OPEN_FILES && fdTable[i].used == USED_FLAG)
-		i++;
+int fileOpen(FsVolume_p vol, char* file) {
+	STAT_SCOPE(&vol->opStats[FS_OP_OPEN]);
+	RECORD_SCOPE(vol, FS_OP_OPEN, file, NULL, -1, 0, 0);
+	uint64_t inodeID;
 
-	if (i >= MAX_OPEN_FILES) {
-		free(thisInode);
+	//Get the inode ID of the file
+	if (!getLastInode(vol, file, &inodeID, false, NULL))
 		return -1;
-	}
+	opRecord.fd = openInodeID(vol, inodeID);
+	return opRecord.fd;
+}
 
-	//Set and return the file descriptor in the table
-	fdTable[i].used = USED_FLAG;
-	fdTable[i].byteOffset = 0;
-	fdTable[i].inode = thisInode;
-	return i;
+/**
+ * Opens a file descriptor on the inode.
+ * @param vol the volume
+ * @param inode the inode to open
+ * @returns the file descriptor index in the file descriptor table
+ * @returns -1 if unsuccessful
+ */
+int inodeOpen(FsVolume_p vol, Inode_p inode) {
+	return openInodeID(vol, inode->inode);
 }
 
 /**
- * Closes the file and removes it from the file descriptor table
+ * Closes the file and removes it from the file descriptor table. The open file
+ * is freed once its last file descriptor is closed.
+ * @param vol the volume
  * @param fd the file descriptor to close
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int fileClose(int fd) {
-	if (fdTable[fd].used == UNUSED_FLAG)
+int fileClose(FsVolume_p vol, int fd) {
+	STAT_SCOPE(&vol->opStats[FS_OP_CLOSE]);
+	RECORD_SCOPE(vol, FS_OP_CLOSE, NULL, NULL, fd, 0, 0);
+	int32_t openFile;
+	int32_t* link;
+	int64_t size = 0;
+	int64_t reserved = 0;
+	uint64_t parent;
+
+	if (fd < 0 || fd >= MAX_OPEN_FILES)
+		return 0;
+
+	pthread_mutex_lock(&vol->fdLock);
+	if (vol->fdTable[fd].used == UNUSED_FLAG) {
+		pthread_mutex_unlock(&vol->fdLock);
 		return 0;
+	}
 
-	if (fdTable[fd].inode != NULL) {
-		free(fdTable[fd].inode);
-		fdTable[fd].inode = NULL;
+	openFile = vol->fdTable[fd].openFile;
+	takeOpenFileTotals(&vol->openFiles[openFile], &size, &reserved);
+	parent = vol->openFiles[openFile].inode.parentInodeID;
+	vol->openFiles[openFile].refCount--;
+	if (vol->openFiles[openFile].refCount == 0) {
+		link = &vol->openFileBuckets[vol->openFiles[openFile].inode.inode % OPEN_FILE_BUCKETS];
+		while (*link != openFile)
+			link = &vol->openFiles[*link].next;
+		*link = vol->openFiles[openFile].next;
+		vol->openFiles[openFile].next = vol->freeOpenFile;
+		vol->freeOpenFile = openFile;
 	}
 
-	fdTable[fd].used = UNUSED_FLAG;
+	vol->fdTable[fd].used = UNUSED_FLAG;
+	vol->fdTable[fd].inode = NULL;
+	vol->fdTable[fd].nextFree = vol->freeDescriptor;
+	vol->freeDescriptor = fd;
+	pthread_mutex_unlock(&vol->fdLock);
+
+	//The writes made through the file reach the totals of its ancestors
+	addToAncestors(vol, parent, size, reserved, 0);
 	return 1;
 }
 
 /**
  * Writes to the file in the file descriptor, length in bytes
  * from the given buffer.
+ * @param vol the volume
+ * @param fd the file descriptor to write to
+ * @param buffer the source data to write from
+ * @param length the number of bytes to write
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t fileWrite(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length) {
+	if (fd < 0 || fd >= MAX_OPEN_FILES || vol->fdTable[fd].used == UNUSED_FLAG)
+		return -1;
+	RECORD_SCOPE(vol, FS_OP_WRITE, NULL, NULL, fd, length, vol->fdTable[fd].byteOffset);
+	opRecord.flags = RECORD_ADVANCE;
+	int64_t bytesWritten = filePwrite(vol, fd, buffer, length, vol->fdTable[fd].byteOffset);
+	if (bytesWritten == -1)
+		return -1;
+	vol->fdTable[fd].byteOffset += bytesWritten;
+	return bytesWritten;
+}
+
+/**
+ * Reads from the file in the file descriptor, length in bytes
+ * from the given buffer.
+ * @param vol the volume
+ * @param fd the file descriptor to read from
+ * @param buffer the buffer to store the read bytes
+ * @param length the number of bytes to read
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t fileRead(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length) {
+	if (fd < 0 || fd >= MAX_OPEN_FILES || vol->fdTable[fd].used == UNUSED_FLAG)
+		return -1;
+	RECORD_SCOPE(vol, FS_OP_READ, NULL, NULL, fd, length, vol->fdTable[fd].byteOffset);
+	opRecord.flags = RECORD_ADVANCE;
+	int64_t bytesRead = filePread(vol, fd, buffer, length, vol->fdTable[fd].byteOffset);
+	if (bytesRead == -1)
+		return -1;
+	vol->fdTable[fd].byteOffset += bytesRead;
+	return bytesRead;
+}
+
+/**
+ * Writes to the file in the file descriptor at the given offset,
+ * without using or moving the file descriptor's offset.
+ * @param vol the volume
  * @param fd the file descriptor to write to
  * @param buffer the source data to write from
  * @param length the number of bytes to write
+ * @param offset the byte offset in the file to write at
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t filePwrite(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length, uint64_t offset) {
+	FileVector vector = { buffer, length };
+	return filePwritev(vol, fd, &vector, 1, offset);
+}
+
+/**
+ * Reads from the file in the file descriptor at the given offset,
+ * without using or moving the file descriptor's offset. Several threads
+ * can read the same file descriptor at once.
+ * @param vol the volume
+ * @param fd the file descriptor to read from
+ * @param buffer the buffer to store the read bytes
+ * @param length the number of bytes to read
+ * @param offset the byte offset in the file to read from
+ * @returns the number of bytes read, 0 at the end of the file
+ * @returns -1 if error
+ */
+int64_t filePread(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length, uint64_t offset) {
+	FileVector vector = { buffer, length };
+	return filePreadv(vol, fd, &vector, 1, offset);
+}
+
+/**
+ * Adds up the bytes of the vectors
+ * @param vectors the buffers
+ * @param count the number of vectors
+ * @returns the bytes of every vector
+ */
+uint64_t vectorLength(FileVector_p vectors, uint32_t count) {
+	uint64_t length = 0;
+	for (uint32_t i = 0; i < count; i++)
+		length += vectors[i].length;
+	return length;
+}
+
+/**
+ * Writes the vectors one after another to the file in the file descriptor
+ * at the given offset, without using or moving the file descriptor's offset.
+ * @param vol the volume
+ * @param fd the file descriptor to write to
+ * @param vectors the buffers to write from
+ * @param count the number of vectors
+ * @param offset the byte offset in the file to write at
  * @returns the number of bytes written
  * @returns -1 if error
  */
-int64_t fileWrite(int fd, uint8_t* buffer, uint64_t length) {
-	if (fdTable[fd].used == UNUSED_FLAG || length == 0)
-		return 0;
+int64_t filePwritev(FsVolume_p vol, int fd, FileVector_p vectors, uint32_t count, uint64_t offset) {
+	STAT_SCOPE(&vol->opStats[FS_OP_WRITE]);
+	RECORD_SCOPE(vol, FS_OP_WRITE, NULL, NULL, fd, vectorLength(vectors, count), offset);
+	if (fd < 0 || fd >= MAX_OPEN_FILES || vol->fdTable[fd].used == UNUSED_FLAG)
+		return -1;
+
+	//A file with its own durability overrides the partition's for the writes it makes
+	int8_t durability = vol->openFiles[vol->fdTable[fd].openFile].durability;
+	if (durability != DURABILITY_DEFAULT)
+		LBAsetThreadDurability(durability);
+	int64_t bytesWritten = writeFileVector(vol, vectors, count, vol->fdTable[fd].inode, offset);
+	if (durability != DURABILITY_DEFAULT)
+		LBAsetThreadDurability(DURABILITY_DEFAULT);
+	return bytesWritten;
+}
+
+/**
+ * Reads from the file in the file descriptor into the vectors one after another,
+ * starting at the given offset, without using or moving the file descriptor's offset.
+ * @param vol the volume
+ * @param fd the file descriptor to read from
+ * @param vectors the buffers to read into
+ * @param count the number of vectors
+ * @param offset the byte offset in the file to read from
+ * @returns the number of bytes read, 0 at the end of the file
+ * @returns -1 if error
+ */
+int64_t filePreadv(FsVolume_p vol, int fd, FileVector_p vectors, uint32_t count, uint64_t offset) {
+	STAT_SCOPE(&vol->opStats[FS_OP_READ]);
+	RECORD_SCOPE(vol, FS_OP_READ, NULL, NULL, fd, vectorLength(vectors, count), offset);
+	if (fd < 0 || fd >= MAX_OPEN_FILES || vol->fdTable[fd].used == UNUSED_FLAG)
+		return -1;
+	return readFileVector(vol, vectors, count, vol->fdTable[fd].inode, offset);
+}
+
+/**
+ * Writes the bitVector, reference counts and SuperBlock, then the inode of
+ * the file in the file descriptor and the changes it made to the totals of
+ * its ancestors, and flushes every write made so far to the disk.
+ * @param vol the volume
+ * @param fd the file descriptor to sync
+ * @returns 0 if successful
+ * @returns -1 if error
+ */
+int fileSync(FsVolume_p vol, int fd) {
+	STAT_SCOPE(&vol->opStats[FS_OP_FSYNC]);
+	RECORD_SCOPE(vol, FS_OP_FSYNC, NULL, NULL, fd, 0, 0);
+	if (fd < 0 || fd >= MAX_OPEN_FILES || vol->fdTable[fd].used == UNUSED_FLAG)
+		return -1;
 
-	uint64_t bytesWritten = writeFile(buffer, fdTable[fd].inode, fdTable[fd].byteOffset, length);
-	if (bytesWritten == -1)
+	//The blocks the file was given must be marked used on the drive too
+	pthread_mutex_lock(&vol->allocLock);
+	int saved = writeMemory(vol);
+	pthread_mutex_unlock(&vol->allocLock);
+	if (!saved || !writeInode(vol, vol->fdTable[fd].inode))
 		return -1;
-	fdTable[fd].byteOffset += bytesWritten;
-	return bytesWritten;
+
+	int64_t size = 0;
+	int64_t reserved = 0;
+	pthread_mutex_lock(&vol->fdLock);
+	OpenFile_p openFile = &vol->openFiles[vol->fdTable[fd].openFile];
+	takeOpenFileTotals(openFile, &size, &reserved);
+	uint64_t parent = openFile->inode.parentInodeID;
+	pthread_mutex_unlock(&vol->fdLock);
+	addToAncestors(vol, parent, size, reserved, 0);
+	return LBAsync(vol->partition);
 }
 
 /**
- * Reads from the file in the file descriptor, length in bytes
- * from the given buffer.
- * @param fd the file descriptor to read from
- * @param buffer the buffer to store the read bytes
- * @param length the number of bytes to read
- * @returns the number of bytes written
+ * Sets when the writes made through the file are flushed, for every file
+ * descriptor open on the file, until the last of them is closed.
+ * @param vol the volume
+ * @param fd a file descriptor of the file
+ * @param durability DURABILITY_NONE, DURABILITY_ORDERED, DURABILITY_FULL,
+ * or DURABILITY_DEFAULT to follow the partition
+ * @returns 0 if successful
  * @returns -1 if error
  */
-int64_t fileRead(int fd, uint8_t* buffer, uint64_t length) {
-	if (fdTable[fd].used == UNUSED_FLAG || length == 0)
-		return 0;
-
-	uint64_t bytesRead = readFile(&buffer, fdTable[fd].inode, fdTable[fd].byteOffset, length);
-	if (bytesRead == -1)
+int fileSetDurability(FsVolume_p vol, int fd, int durability) {
+	if (fd < 0 || fd >= MAX_OPEN_FILES || vol->fdTable[fd].used == UNUSED_FLAG)
 		return -1;
-	fdTable[fd].byteOffset += bytesRead;
-	return bytesRead;
+	if (durability < DURABILITY_DEFAULT || durability > DURABILITY_FULL)
+		return -1;
+	pthread_mutex_lock(&vol->fdLock);
+	vol->openFiles[vol->fdTable[fd].openFile].durability = durability;
+	pthread_mutex_unlock(&vol->fdLock);
+	return 0;
 }
 
 /**
- * Moves the file pointer to the given offset from the position
+ * Moves the file pointer to the given offset from the position.
+ * Seeking to data or a hole searches from the given offset, the end
+ * of the file counts as a hole.
+ * @param vol the volume
  * @param fd the file descriptor to modify
  * @param offset the number of bytes to offset from the method
- * @param method the method (start, end, cur) to initially set the pointer
+ * @param method the method (start, end, cur, data, hole) to initially set the pointer
  * @returns 1 if successful
  * @returns 0 if unsuccessful
  */
-int fileSeek(int fd, int64_t offset, uint8_t method) {
-	if (fdTable[fd].used == UNUSED_FLAG)
+int fileSeek(FsVolume_p vol, int fd, int64_t offset, uint8_t method) {
+	STAT_SCOPE(&vol->opStats[FS_OP_SEEK]);
+	RECORD_SCOPE(vol, FS_OP_SEEK, NULL, NULL, fd, method, offset);
+	if (vol->fdTable[fd].used == UNUSED_FLAG)
 		return 0;
 
 	int64_t newPosition;
+	uint64_t foundPosition;
 	if (method == FS_SEEK_SET) {
 		newPosition = offset;
 	} else if (method == FS_SEEK_END) {
-		newPosition = fdTable[fd].inode->size + offset;
+		newPosition = vol->fdTable[fd].inode->size + offset;
 	} else if (method == FS_SEEK_CUR) {
-		newPosition = fdTable[fd].byteOffset + offset;
+		newPosition = vol->fdTable[fd].byteOffset + offset;
+	} else if (method == FS_SEEK_DATA || method == FS_SEEK_HOLE) {
+		if (offset < 0 || !findDataOrHole(vol, vol->fdTable[fd].inode, offset, method == FS_SEEK_HOLE, &foundPosition))
+			return 0;
+		newPosition = foundPosition;
 	} else {
 		printf("fileSeek method is not valid\n");
 		return 0;
@@ -1419,60 +3478,204 @@ int fileSeek(int fd, int64_t offset, uint8_t method) {
 
 	//Check if the position is negative
 	if (newPosition < 0)
-		fdTable[fd].byteOffset = 0;
+		vol->fdTable[fd].byteOffset = 0;
 	else
-		fdTable[fd].byteOffset = newPosition;
+		vol->fdTable[fd].byteOffset = newPosition;
 
 	return 1;
 }
 
 /**
- * Checks for the filesystem on this partition, by checking the signatures of the first block for a match.
+ * Opens the partition in the file and loads the file system on it, if it has one.
+ * A file that does not exist is created, see startPartitionSystem. Any number of
+ * volumes can be mounted at once, each with its own locks, buffers and flusher.
+ * @param fileName the file holding the partition
+ * @param volumeSize the size of a new partition, set to the size of the partition
+ * @param blockSize the block size of a new partition, set to the block size of the partition
+ * @param durability when writes are flushed, DURABILITY_NONE, DURABILITY_ORDERED or DURABILITY_FULL
+ * @returns the volume, which must be formatted before use if check_fs returns 0
+ * @returns NULL if the partition could not be opened
+ */
+FsVolume_p fs_mount(char* fileName, uint64_t* volumeSize, uint64_t* blockSize, int durability) {
+	FsVolume_p vol = calloc(1, sizeof(FsVolume));
+	if (vol == NULL)
+		return NULL;
+	if (startPartitionSystem(fileName, volumeSize, blockSize, durability, &vol->partition) != 0) {
+		free(vol);
+		return NULL;
+	}
+	vol->partInfop = LBAinfo(vol->partition);
+	vol->freeOpenFile = -1;
+	vol->freeDescriptor = -1;
+	pthread_mutex_init(&vol->allocLock, NULL);
+	pthread_mutex_init(&vol->inodeAllocLock, NULL);
+	pthread_mutex_init(&vol->fdLock, NULL);
+	for (uint32_t i = 0; i < INODE_LOCKS; i++)
+		pthread_mutex_init(&vol->inodeLocks[i], NULL);
+	pthread_mutex_init(&vol->flusherLock, NULL);
+	pthread_cond_init(&vol->flusherWake, NULL);
+	loadVolume(vol);
+	return vol;
+}
+
+/**
+ * Stops the flusher and any recording of the volume, writes everything back,
+ * closes the partition and frees the volume. Open files are dropped.
+ * @param vol the volume, not used again
+ */
+void fs_unmount(FsVolume_p vol) {
+	fs_recordStop(vol);
+	stopWriteback(vol);
+
+	//Without a flusher nothing else has written the volume back
+	fsSync(vol);
+	freeGlobals(vol);
+	closeObjectPool(&vol->inodePool);
+	closeObjectPool(&vol->blockPool);
+	closePartitionSystem(vol->partition);
+	pthread_mutex_destroy(&vol->allocLock);
+	pthread_mutex_destroy(&vol->inodeAllocLock);
+	pthread_mutex_destroy(&vol->fdLock);
+	for (uint32_t i = 0; i < INODE_LOCKS; i++)
+		pthread_mutex_destroy(&vol->inodeLocks[i]);
+	pthread_mutex_destroy(&vol->flusherLock);
+	pthread_cond_destroy(&vol->flusherWake);
+	free(vol);
+}
+
+/**
+ * Checks if the volume holds a file system, found when it was mounted or made by fs_format.
+ * @param vol the volume
+ * @returns 1 if filesystem exists
+ * @returns 0 if filesystem does not exist.
+ */
+int check_fs(FsVolume_p vol) {
+	return vol->sb != NULL;
+}
+
+/**
+ * Returns the full path of the working directory.
+ * @param vol the volume
+ * @returns the path, valid until the next call that changes directory
+ * @returns NULL if the volume is not formatted
+ */
+char* fs_getcwd(FsVolume_p vol) {
+	return (vol->wd != NULL) ? vol->wd->wdPath : NULL;
+}
+
+/**
+ * Copies the size and use of the volume.
+ * @param vol the volume
+ * @param info where to copy them
+ */
+void fs_volumeInfo(FsVolume_p vol, VolumeInfo_p info) {
+	memset(info, 0, sizeof(VolumeInfo));
+	info->blockSize = vol->partInfop->blocksize;
+	info->numberOfBlocks = vol->partInfop->numberOfBlocks;
+	pthread_mutex_lock(&vol->allocLock);
+	if (vol->sb != NULL) {
+		info->totalDataBlocks = vol->sb->totalDataBlocks;
+		info->freeDataBlocks = vol->sb->freeDataBlocks;
+		info->numInodes = vol->sb->numInodes;
+		info->usedInodes = vol->sb->usedInodes;
+	}
+	pthread_mutex_unlock(&vol->allocLock);
+}
+
+/**
+ * Returns the partition the volume is stored on, for the LBA functions such as tracing.
+ * @param vol the volume
+ * @returns the partition
+ */
+partition_p fs_partition(FsVolume_p vol) {
+	return vol->partition;
+}
+
+/**
+ * Loads the file system on the partition of a volume being mounted, if the
+ * signatures of the first block match.
+ * @param vol the volume
  * @returns 1 if filesystem exists
  * @returns 0 if filesystem does not exist.
  */
-int check_fs() {
-	SuperBlock_p buffer = malloc(partInfop->blocksize);
-	LBAread(buffer, 1, 0);
+int loadVolume(FsVolume_p vol) {
+	LBA_TAG_SCOPE(LBA_TAG_SUPER);
+	SuperBlock_p buffer = malloc(vol->partInfop->blocksize);
+	LBAread(vol->partition, buffer, 1, 0);
 	if (buffer->superSignature != SUPER_SIGNATURE || buffer->superSignature2 != SUPER_SIGNATURE2) {
 		free(buffer);
 		return 0;
 	}
-	sb = malloc(sizeof(SuperBlock));
-	memcpy(sb, buffer, sizeof(SuperBlock));
-	readBitVector();
-	initWorkingDirectory();
-	fdTable = calloc(MAX_OPEN_FILES, sizeof(FileDescriptor));
+	if (buffer->inodeSize != sizeof(Inode) || buffer->inodeVersion != INODE_VERSION) {
+		printf("Partition was formatted with a different inode layout.\n");
+		free(buffer);
+		return 0;
+	}
+	if (buffer->directoryFormat != DIR_FORMAT_FIXED && buffer->directoryFormat != DIR_FORMAT_COMPACT) {
+		printf("Partition uses an unknown directory format.\n");
+		free(buffer);
+		return 0;
+	}
+	vol->sb = calloc(1, vol->partInfop->blocksize);	//Whole block since the superblock is written as one block
+	memcpy(vol->sb, buffer, sizeof(SuperBlock));
+	initMemoryPools(vol);
+	readBitVector(vol);
+	readRefCounts(vol);
+	initWorkingDirectory(vol);
+	initFileTables(vol);
 	free(buffer);
 	return 1;
 }
 
 /**
  * Formats the current partition and installs a new filesystem.
+ * @param vol the volume
+ * @param directoryFormat the format of directory entries, DIR_FORMAT_FIXED or DIR_FORMAT_COMPACT
  * @returns 0 if format was successful
  * @returns -1 if format was unsuccessful
  */
-int fs_format() {
+int fs_format(FsVolume_p vol, uint8_t directoryFormat) {
+	LBA_TAG_SCOPE(LBA_TAG_SUPER);
+	STAT_SCOPE(&vol->opStats[FS_OP_FORMAT]);
+	RECORD_SCOPE(vol, FS_OP_FORMAT, NULL, NULL, -1, directoryFormat, 0);
+	//Inodes are packed whole into blocks, so a block must hold at least one
+	if (vol->partInfop->blocksize < sizeof(Inode)) {
+		printf("Block size must be at least %lu bytes.\n", sizeof(Inode));
+		return -1;
+	}
+
+	//The flusher is stopped while the globals it writes back are replaced
+	bool restartWriteback = vol->flusherRunning;
+	stopWriteback(vol);
+
 	//Write 0s to entire partition and free all globals
-	wipePartition();
-	freeGlobals();
+	wipePartition(vol);
+	freeGlobals(vol);
+	initMemoryPools(vol);
 
-	SuperBlock_p buffer = calloc(1, partInfop->blocksize);
+	SuperBlock_p buffer = calloc(1, vol->partInfop->blocksize);
 	buffer->superSignature = SUPER_SIGNATURE;
 	//For every BLOCKS_PER_INODE there is one Inode. Set to a prime number to make the hash more efficient
-	buffer->numInodes = findNextPrime(partInfop->numberOfBlocks / BLOCKS_PER_INODE);
+	buffer->numInodes = findNextPrime(vol->partInfop->numberOfBlocks / BLOCKS_PER_INODE);
+	buffer->inodeSize = sizeof(Inode);
+	buffer->inodeVersion = INODE_VERSION;
+	buffer->directoryFormat = directoryFormat;
 	buffer->inodeStart = 1;	//Inode blocks start right after superblock
 
 	//Free Blocks starts at one block after blocks used by inodes and block used by superblock
-	buffer->bitVectorStart = ((buffer->numInodes * sizeof(Inode) + partInfop->blocksize - 1) / partInfop->blocksize) + buffer->inodeStart;
+	uint64_t inodesPerBlock = vol->partInfop->blocksize / sizeof(Inode);
+	buffer->bitVectorStart = ((buffer->numInodes + inodesPerBlock - 1) / inodesPerBlock) + buffer->inodeStart;
 	//Total Free Blocks = Total number of blocks - total blocks used by inodes - block used by superblock - blocks used by freeblocks
-	uint64_t unusedDataBlocks = partInfop->numberOfBlocks - (buffer->bitVectorStart - 1);
+	uint64_t unusedDataBlocks = vol->partInfop->numberOfBlocks - buffer->bitVectorStart;
 	buffer->bytesUsedByBitVector = (unusedDataBlocks + 8 - 1) / 8;
-	buffer->blocksUsedByBitVector = (buffer->bytesUsedByBitVector + partInfop->blocksize - 1) / partInfop->blocksize;
-	buffer->freeDataBlocks = unusedDataBlocks - buffer->blocksUsedByBitVector;
+	buffer->blocksUsedByBitVector = (buffer->bytesUsedByBitVector + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+	//Every data block has a reference count after the bitVector
+	buffer->refCountStart = buffer->bitVectorStart + buffer->blocksUsedByBitVector;
+	buffer->blocksUsedByRefCount = (unusedDataBlocks * sizeof(uint32_t) + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
+	buffer->freeDataBlocks = unusedDataBlocks - buffer->blocksUsedByBitVector - buffer->blocksUsedByRefCount;
 	buffer->totalDataBlocks = buffer->freeDataBlocks;
 	buffer->blocksUsedByInodes = buffer->bitVectorStart - buffer->inodeStart;
-	buffer->pointersPerIndirect = partInfop->blocksize / sizeof(uint64_t);
+	buffer->pointersPerIndirect = vol->partInfop->blocksize / sizeof(uint64_t);
 	buffer->maxBlocksPerFile = NUM_DIRECT;
 	for (uint32_t i = 0; i < NUM_INDIRECT; i++) {
 		uint64_t pointers = buffer->pointersPerIndirect;
@@ -1481,158 +3684,370 @@ int fs_format() {
 		buffer->maxBlocksPerFile += pointers;
 	}
 
-	buffer->maxFileSize = buffer->maxBlocksPerFile * partInfop->blocksize;
-	buffer->rootDataPointer = buffer->bitVectorStart + buffer->blocksUsedByBitVector;
+	buffer->maxFileSize = buffer->maxBlocksPerFile * vol->partInfop->blocksize;
+	buffer->rootDataPointer = buffer->refCountStart + buffer->blocksUsedByRefCount;
 	buffer->superSignature2 = SUPER_SIGNATURE2;
 
-	if (LBAwrite(buffer, 1, 0) == 0) {
+	if (LBAwrite(vol->partition, buffer, 1, 0) == 0) {
 		free(buffer);
 		return -1;
 	}
-	sb = malloc(sizeof(SuperBlock));
-	memcpy(sb, buffer, sizeof(SuperBlock));
+	vol->sb = calloc(1, vol->partInfop->blocksize);	//Whole block since the superblock is written as one block
+	memcpy(vol->sb, buffer, sizeof(SuperBlock));
 	free(buffer);
 
 	//Initialize root and working directory
-	Inode_p root = calloc(1, sizeof(Inode));
+	Inode_p root = getInodeBuffer(vol);
+	memset(root, 0, sizeof(Inode));
 	root->used = USED_FLAG;
 	root->type = DIRECTORY_TYPE;
 	root->inode = 0;
 	root->dateModified = time(NULL);
 	root->parentInodeID = 0;
-	root->directData[0] = 0;
+	root->inlined = 1;
 	root->size = 0;
-	root->blocksReserved = 1;
+	root->blocksMapped = 0;
+	root->blocksReserved = 0;
 	root->blocksIndirect = 0;
-	readBitVector();
-	setBitOn(0);
-	writeInode(root);
-	initWorkingDirectory();
-	fdTable = calloc(MAX_OPEN_FILES, sizeof(FileDescriptor));
-	sb->usedInodes++;
-	sb->freeDataBlocks--;
-	saveMemory();
-	free(root);
+	readBitVector(vol);
+	readRefCounts(vol);
+	//Data block 0 is never handed out, searchFreeBlocks uses position 0 to mean no hole
+	setBitOn(vol, 0);
+	//Bits past the last data block in the final byte are never free
+	for (uint64_t i = vol->sb->totalDataBlocks; i < vol->sb->bytesUsedByBitVector * 8; i++)
+		setBitOn(vol, i);
+	writeInode(vol, root);
+	initWorkingDirectory(vol);
+	initFileTables(vol);
+	vol->sb->usedInodes++;
+	vol->sb->freeDataBlocks--;
+	saveMemory(vol);
+	putInodeBuffer(vol, root);
+	if (restartWriteback)
+		startWriteback(vol, &vol->writeback);
 	return 0;
 }
 
 /** Outputs data about the current filesystem */
-void fs_lsfs() {
-	printf("Volume name:        %s\n", partInfop->volumeName);
-	printf("Volume size:        %lu\n", partInfop->volumesize);
-	printf("Block size:         %lu\n", partInfop->blocksize);
-	printf("Blocks:             %lu\n", partInfop->numberOfBlocks);
-	printf("Inodes:             %lu\n", sb->numInodes);
-	printf("Free Inodes:        %lu\n", (sb->numInodes - sb->usedInodes));
-	printf("Used Inodes:        %lu\n", sb->usedInodes);
-	printf("Inode index:        %lu\n", sb->inodeStart);
-	printf("Inode Blocks:       %lu\n", sb->blocksUsedByInodes);
-	printf("BitVector index:    %lu\n", sb->bitVectorStart);
-	printf("BitVector Blocks:   %lu\n", sb->blocksUsedByBitVector);
-	printf("Total Data Blocks:  %lu\n", sb->totalDataBlocks);
-	printf("Free Data Blocks:   %lu\n", sb->freeDataBlocks);
-	printf("Used Data Blocks:   %lu\n", (sb->totalDataBlocks - sb->freeDataBlocks));
-	printf("Root Data index:    %lu\n", sb->rootDataPointer);
-	printf("FS Max File Size:   %lu\n", sb->maxFileSize);
-	printf("FS Max Blocks/File: %lu\n", sb->maxBlocksPerFile);
-}
-
-/**
- * Adds the entire size and reserved size of all files and folders
- * within a folder.
- * @param totalDirSize where to store the total size
- * @param totalDirReserved where to store the total reserved
- */
-void calculateDirSize(Inode_p inode, uint64_t* totalDirSize, uint64_t* totalDirReserved) {
-	Inode_p currentInode = NULL;
-	FCB_p currentDirectoryData = NULL;
-	readFile((uint8_t**)(&currentDirectoryData), inode, 0, 0);
-	uint64_t numberOfFiles = inode->size / sizeof(FCB);
-	for (uint64_t i = 0; i < numberOfFiles; i++) {
-		readInode(currentDirectoryData[i].inodeID, &currentInode);
-		*totalDirSize += currentInode->size;
-		*totalDirReserved += currentInode->blocksReserved;
-		if (currentInode->type == DIRECTORY_TYPE) {
-			calculateDirSize(currentInode, totalDirSize, totalDirReserved);
-		}
+void fs_lsfs(FsVolume_p vol) {
+	printf("Volume name:        %s\n", vol->partInfop->volumeName);
+	printf("Volume size:        %lu\n", vol->partInfop->volumesize);
+	printf("Block size:         %lu\n", vol->partInfop->blocksize);
+	printf("Blocks:             %lu\n", vol->partInfop->numberOfBlocks);
+	printf("Inodes:             %lu\n", vol->sb->numInodes);
+	printf("Free Inodes:        %lu\n", (vol->sb->numInodes - vol->sb->usedInodes));
+	printf("Used Inodes:        %lu\n", vol->sb->usedInodes);
+	printf("Inode index:        %lu\n", vol->sb->inodeStart);
+	printf("Inode Blocks:       %lu\n", vol->sb->blocksUsedByInodes);
+	printf("BitVector index:    %lu\n", vol->sb->bitVectorStart);
+	printf("BitVector Blocks:   %lu\n", vol->sb->blocksUsedByBitVector);
+	printf("RefCount index:     %lu\n", vol->sb->refCountStart);
+	printf("RefCount Blocks:    %lu\n", vol->sb->blocksUsedByRefCount);
+	printf("Directory format:   %s\n", (vol->sb->directoryFormat == DIR_FORMAT_COMPACT) ? "compact" : "fixed");
+	printf("Total Data Blocks:  %lu\n", vol->sb->totalDataBlocks);
+	printf("Free Data Blocks:   %lu\n", vol->sb->freeDataBlocks);
+	printf("Used Data Blocks:   %lu\n", (vol->sb->totalDataBlocks - vol->sb->freeDataBlocks));
+	printf("Root Data index:    %lu\n", vol->sb->rootDataPointer);
+	printf("FS Max File Size:   %lu\n", vol->sb->maxFileSize);
+	printf("FS Max Blocks/File: %lu\n", vol->sb->maxBlocksPerFile);
+}
+
+/**
+ * Calls the callback with every entry of the directory and the entry's inode.
+ * The inodes of each batch of entries are read together instead of one at a time.
+ * @param vol the volume
+ * @param dirInodeID the inode ID of the directory
+ * @param callback the function called for each entry
+ * @param arg passed to the callback
+ * @returns the number of entries
+ */
+int64_t listDirectory(FsVolume_p vol, uint64_t dirInodeID, DirEntryCallback callback, void* arg) {
+	ARENA_SCOPE(mark);
+	Inode_p dirInode = NULL;
+	readInode(vol, dirInodeID, &dirInode);
+	DirIterator_p iterator = dirOpen(vol, dirInode);
+	DirEntry_p entries = arenaAlloc(INODE_BATCH_SIZE * sizeof(DirEntry));
+	Inode_p inodes = arenaAlloc(INODE_BATCH_SIZE * sizeof(Inode));
+	uint64_t inodeIDs[INODE_BATCH_SIZE];
+	uint64_t count;
+	int64_t total = 0;
+
+	while ((count = readEntries(vol, iterator, entries, INODE_BATCH_SIZE)) > 0) {
+		for (uint64_t i = 0; i < count; i++)
+			inodeIDs[i] = entries[i].inodeID;
+		readInodes(vol, inodeIDs, count, inodes);
+
+		for (uint64_t i = 0; i < count; i++)
+			callback(&entries[i], &inodes[i], arg);
+		total += count;
 	}
-	if (currentInode != NULL)
-		free(currentInode);
-	free(currentDirectoryData);
-}
-
-/** Lists the files in the current directory */
-void fs_ls() {
-	uint64_t totalDirSize;
-	uint64_t totalDirReserved;
-	FCB_p currentDirectory = NULL;
-	Inode_p wdInode = NULL;
-	readInode(wd->inodeID, &wdInode);
-	readFile((uint8_t**)(&currentDirectory), wdInode, 0, 0);
-	Inode_p currentInode = calloc(1, sizeof(Inode));
-	uint64_t numberOfFiles = wdInode->size / sizeof(FCB);
-	struct tm* timeInfo;
+
+	dirClose(vol, iterator);
+	putInodeBuffer(vol, dirInode);
+	return total;
+}
+
+/**
+ * Prints one line of fs_ls
+ * @param entry the directory entry
+ * @param inode the inode of the entry
+ * @param arg the volume
+ */
+void printEntry(DirEntry_p entry, Inode_p inode, void* arg) {
+	FsVolume_p vol = arg;
+	struct tm timeInfo;
 	char date[20];
-		printf("| Type | File Size | Reserved | Last Modified | File Name\n");
-	for (uint64_t i = 0; i < numberOfFiles; i++) {
-		readInode(currentDirectory[i].inodeID, &currentInode);
-		timeInfo = localtime(&(currentInode->dateModified));
-		strftime(date, 13, "%b%e %R", timeInfo);
-		if (currentInode->type == DIRECTORY_TYPE) {
-			totalDirSize = currentInode->size;
-			totalDirReserved = currentInode->blocksReserved;
-			calculateDirSize(currentInode, &totalDirSize, &totalDirReserved);
-			printf("   %d     %10lu %10lu   %s    %s", currentInode->type, totalDirSize, (totalDirReserved * partInfop->blocksize), date, currentDirectory[i].name);
-		}
-		else
-			printf("   %d     %10lu %10lu   %s    %s", currentInode->type, currentInode->size, (currentInode->blocksReserved * partInfop->blocksize), date, currentDirectory[i].name);
 
-		if (currentInode->type == DIRECTORY_TYPE)
-			printf("/\n");
-		else
-			printf("\n");
+	localtime_r(&(inode->dateModified), &timeInfo);
+	strftime(date, 13, "%b%e %R", &timeInfo);
+	if (inode->type == DIRECTORY_TYPE)
+		printf("   %d     %10lu %10lu %7lu   %s    %s", inode->type, inode->size + inode->subtreeSize,
+			((inode->blocksReserved + inode->subtreeReserved) * vol->partInfop->blocksize), inode->subtreeFiles, date, entry->name);
+	else
+		printf("   %d     %10lu %10lu %7d   %s    %s", inode->type, inode->size, (inode->blocksReserved * vol->partInfop->blocksize), 1, date, entry->name);
+
+	if (inode->type == DIRECTORY_TYPE)
+		printf("/\n");
+	else
+		printf("\n");
+}
+
+/**
+ * Lists the files in the current directory. Directories show the totals of
+ * everything below them, which are kept in the directory inode.
+ * @param vol the volume
+ */
+void fs_ls(FsVolume_p vol) {
+	STAT_SCOPE(&vol->opStats[FS_OP_LS]);
+	RECORD_SCOPE(vol, FS_OP_LS, NULL, NULL, -1, 0, 0);
+	printf("| Type | File Size | Reserved |  Files | Last Modified | File Name\n");
+	listDirectory(vol, vol->wd->inodeID, printEntry, vol);
+}
+
+/**
+ * Calls the callback with every entry of the directory and the entry's inode.
+ * @param vol the volume
+ * @param path the path of the directory
+ * @param callback the function called for each entry
+ * @param arg passed to the callback
+ * @returns the number of entries
+ * @returns -1 if the path does not exist or is not a directory
+ */
+int64_t fs_listdir(FsVolume_p vol, char* path, DirEntryCallback callback, void* arg) {
+	STAT_SCOPE(&vol->opStats[FS_OP_LISTDIR]);
+	RECORD_SCOPE(vol, FS_OP_LISTDIR, path, NULL, -1, 0, 0);
+	ARENA_SCOPE(mark);
+	uint64_t dirInodeID;
+	Inode_p dirInode = NULL;
+
+	if (!getLastInode(vol, path, &dirInodeID, false, NULL))
+		return -1;
+	readInode(vol, dirInodeID, &dirInode);
+	uint8_t type = dirInode->type;
+	putInodeBuffer(vol, dirInode);
+	if (type != DIRECTORY_TYPE)
+		return -1;
+	return listDirectory(vol, dirInodeID, callback, arg);
+}
+
+/**
+ * Copies the inode of the file or directory at the path.
+ * @param vol the volume
+ * @param path the path of the file or directory
+ * @param inode where to copy the inode
+ * @returns 0 if successful
+ * @returns -1 if the path does not exist
+ */
+int fs_stat(FsVolume_p vol, char* path, Inode_p inode) {
+	STAT_SCOPE(&vol->opStats[FS_OP_STAT]);
+	RECORD_SCOPE(vol, FS_OP_STAT, path, NULL, -1, 0, 0);
+	ARENA_SCOPE(mark);
+	uint64_t inodeID;
+
+	if (!getLastInode(vol, path, &inodeID, false, NULL))
+		return -1;
+	if (!readInode(vol, inodeID, &inode))
+		return -1;
+	return 0;
+}
+
+/**
+ * Counts the fragments of a file, the runs of consecutive data blocks
+ * its blocks are stored in. Holes are not counted.
+ * @param vol the volume
+ * @param path the path of the file or directory
+ * @returns the number of fragments, 0 if the data is inline or all holes
+ * @returns -1 if the path does not exist
+ */
+int64_t fs_fragments(FsVolume_p vol, char* path) {
+	ARENA_SCOPE(mark);
+	uint64_t inodeID;
+	Inode_p inode = NULL;
+	BlockMap map;
+	uint64_t dataBlock;
+	int64_t fragments = 0;
+
+	if (!getLastInode(vol, path, &inodeID, false, NULL))
+		return -1;
+	if (!readInode(vol, inodeID, &inode))
+		return -1;
+	if (inode->inlined) {
+		putInodeBuffer(vol, inode);
+		return 0;
+	}
+
+	openBlockMap(&map, inode);
+	for (uint64_t block = 0; block < inode->blocksMapped;) {
+		block += getBlockRun(vol, &map, block, inode->blocksMapped - block, &dataBlock);
+		if (dataBlock != HOLE_BLOCK)
+			fragments++;
+	}
+	closeBlockMap(vol, &map);
+	putInodeBuffer(vol, inode);
+	return fragments;
+}
+
+/**
+ * Counts the runs of free data blocks by length. Runs of length 2^i up to
+ * 2^(i+1) - 1 are counted in histogram[i], and longer runs in the last bucket.
+ * @param vol the volume
+ * @param histogram where to count the runs
+ * @param buckets the number of buckets in the histogram
+ * @param largestRun set to the length of the longest run
+ * @returns the number of runs
+ */
+uint64_t fs_freeRuns(FsVolume_p vol, uint64_t* histogram, uint32_t buckets, uint64_t* largestRun) {
+	uint64_t runs = 0;
+	uint64_t runLength = 0;
+
+	memset(histogram, 0, buckets * sizeof(uint64_t));
+	*largestRun = 0;
+	pthread_mutex_lock(&vol->allocLock);
+	//One more pass than there are blocks ends the last run
+	for (uint64_t block = 0; block <= vol->sb->totalDataBlocks; block++) {
+		//Skip whole bytes that continue the current run
+		if (block % 8 == 0 && block + 8 <= vol->sb->totalDataBlocks &&
+				vol->bitVector[block / 8] == (runLength > 0 ? UNUSED_FLAG : USED_FLAG)) {
+			if (runLength > 0)
+				runLength += 8;
+			block += 7;
+			continue;
+		}
+		if (block < vol->sb->totalDataBlocks && !bitUsed(vol, block)) {
+			runLength++;
+			continue;
+		}
+		if (runLength > 0) {
+			uint32_t bucket = 0;
+			while (bucket + 1 < buckets && runLength >> (bucket + 1) > 0)
+				bucket++;
+			histogram[bucket]++;
+			runs++;
+			if (runLength > *largestRun)
+				*largestRun = runLength;
+			runLength = 0;
+		}
 	}
+	pthread_mutex_unlock(&vol->allocLock);
+	return runs;
+}
+
+/**
+ * Copies the work done by the block allocator.
+ * @param vol the volume
+ * @param stats where to copy the stats
+ * @param reset 1 to start counting again from zero
+ */
+void fs_allocStats(FsVolume_p vol, AllocStats_p stats, uint8_t reset) {
+	pthread_mutex_lock(&vol->allocLock);
+	*stats = vol->allocStats;
+	if (reset)
+		memset(&vol->allocStats, 0, sizeof(AllocStats));
+	pthread_mutex_unlock(&vol->allocLock);
+}
+
+/**
+ * Copies the counts and latency histograms of the operations, the work done
+ * by the LBA functions and the work done by the block allocator.
+ * @param vol the volume
+ * @param stats where to copy the stats
+ * @param reset 1 to start counting again from zero
+ */
+void fs_stats(FsVolume_p vol, FsStats_p stats, uint8_t reset) {
+	for (uint32_t op = 0; op < FS_OP_COUNT; op++)
+		histogramSnapshot(&vol->opStats[op], &stats->ops[op], reset);
+	LBAstats(vol->partition, &stats->lba, reset);
+	fs_allocStats(vol, &stats->alloc, reset);
+}
+
+/**
+ * Starts recording the operations called, with their arguments and timing, to a
+ * log for fsreplay. The log starts with a cd to the working directory, so the
+ * relative paths that follow replay against the same directory.
+ * @param vol the volume
+ * @param fileName the log to create, replaced if it exists
+ * @returns 0 if successful
+ * @returns -1 if a volume is already being recorded or the log could not be created
+ */
+int fs_recordStart(FsVolume_p vol, char* fileName) {
+	if (recordStart(vol, fileName) == -1)
+		return -1;
+	OpRecord cd = recordBegin(vol, FS_OP_CD, vol->wd->wdPath, NULL, -1, 0, 0);
+	recordEnd(&cd);
+	return 0;
+}
 
-	free(wdInode);
-	free(currentInode);
-	free(currentDirectory);
+/**
+ * Stops recording the operations and closes the log, if the volume is the one being recorded.
+ * @param vol the volume
+ */
+void fs_recordStop(FsVolume_p vol) {
+	recordStop(vol);
 }
 
 /**
  * Changes directory to the given path.
  * "cd /" or "cd" to go to root
+ * @param vol the volume
  * @param path the path to parse and change directory to
  * @returns 0 if successful
  * @returns -1 if unsuccessful
  */
-int fs_cd(char* path) {
+int fs_cd(FsVolume_p vol, char* path) {
+	STAT_SCOPE(&vol->opStats[FS_OP_CD]);
+	RECORD_SCOPE(vol, FS_OP_CD, path, NULL, -1, 0, 0);
+	ARENA_SCOPE(mark);
 	uint64_t pathInode;
 	Inode_p inode = NULL;
-	if (getLastInode(path, &pathInode, false, NULL) == 0)
+	if (getLastInode(vol, path, &pathInode, false, NULL) == 0)
 		return -2;
 
-	readInode(pathInode, &inode);
+	readInode(vol, pathInode, &inode);
 	if (inode->type != DIRECTORY_TYPE) {
-		free(inode);
+		putInodeBuffer(vol, inode);
 		return -2;
 	}
 
-	wd->inodeID = pathInode;
-	getFullPath(inode->parentInodeID, pathInode);
-	wd->pathLength = strlen(wd->wdPath);
+	vol->wd->inodeID = pathInode;
+	getFullPath(vol, inode->parentInodeID, pathInode);
+	vol->wd->pathLength = strlen(vol->wd->wdPath);
 	if (inode != NULL)
-		free(inode);
+		putInodeBuffer(vol, inode);
 	return 0;
 }
 
 /**
  * Creates a directory of the given name.
+ * @param vol the volume
  * @param directoryName the name of the directory to create
  * @returns 0 if sucessful
  * @returns -1 if it could not create directory
  */
-int fs_mkdir(char* directoryName) {
-	if (createFile(directoryName, DIRECTORY_TYPE, 0, false, 0)) {
+int fs_mkdir(FsVolume_p vol, char* directoryName) {
+	STAT_SCOPE(&vol->opStats[FS_OP_MKDIR]);
+	RECORD_SCOPE(vol, FS_OP_MKDIR, directoryName, NULL, -1, 0, 0);
+	ARENA_SCOPE(mark);
+	if (createFile(vol, directoryName, DIRECTORY_TYPE, 0, false, 0)) {
 		return 0;
 	}
 	return -1;
@@ -1640,158 +4055,386 @@ int fs_mkdir(char* directoryName) {
 
 /**
  * Creates a file of the given name and size
+ * @param vol the volume
  * @param fileName the name of the file to create
  * @param size the size in bytes to determine the number of blocks to reserve
  * @returns 0 if sucessful
  * @returns -1 if it could not create file
  */
-int fs_mkfile(char* fileName, uint64_t size) {
-	if (createFile(fileName, FILE_TYPE, size, false, 0)) {
+int fs_mkfile(FsVolume_p vol, char* fileName, uint64_t size) {
+	STAT_SCOPE(&vol->opStats[FS_OP_MKFILE]);
+	RECORD_SCOPE(vol, FS_OP_MKFILE, fileName, NULL, -1, size, 0);
+	ARENA_SCOPE(mark);
+	if (createFile(vol, fileName, FILE_TYPE, size, false, 0)) {
 		return 0;
 	}
 	return -1;
 }
 
 /**
- * Deletes the directory with the given name.
+ * Deletes the directory with the given name and everything in it, without
+ * asking. Callers that want a confirmation ask before calling.
+ * @param vol the volume
  * @param directoryName the name of the directory to delete
  * @returns 1 if successful
  * @returns 0 if it could not delete directory
  * @returns -1 if not a directory
  */
-int fs_rmdir(char* directoryName) {
+int fs_rmdir(FsVolume_p vol, char* directoryName) {
+	STAT_SCOPE(&vol->opStats[FS_OP_RMDIR]);
+	RECORD_SCOPE(vol, FS_OP_RMDIR, directoryName, NULL, -1, 0, 0);
+	ARENA_SCOPE(mark);
 	uint64_t directoryID;
 	Inode_p dirInode = NULL;
-	char answer;
 
 	//Get the last inode id of the directory
-	if (!getLastInode(directoryName, &directoryID, false, NULL)) {
+	if (!getLastInode(vol, directoryName, &directoryID, false, NULL)) {
 		printf("Could not find directory name\n");
 		return 0;
 	}
 
 	//Make sure the inode is a directory type
-	readInode(directoryID, &dirInode);
+	readInode(vol, directoryID, &dirInode);
 	if (dirInode->type != DIRECTORY_TYPE) {
 		printf("File is not a directory\n");
-		free(dirInode);
+		putInodeBuffer(vol, dirInode);
 		return -1;
 	}
 
-	//Double check that the user wants to delete all files and folders in the directory
-	printf("This will delete all files located within the directory.\n");
-	printf("Do you want to continue? (y/n): ");
-	scanf(" %c", &answer);
-	flushInput();
-	if (answer == 'y' || answer == 'Y') {
-		deleteFile(dirInode);
-		readInode(dirInode->parentInodeID, &dirInode);
-
-		if (!removeFromDirectory(dirInode, directoryID)) {
-			printf("Error: Didn't remove from directory!\n");
-			free(dirInode);
-			return 0;
-		}
+	deleteFile(vol, dirInode);
+	readInode(vol, dirInode->parentInodeID, &dirInode);
+	if (!removeFromDirectory(vol, dirInode, directoryID)) {
+		printf("Error: Didn't remove from directory!\n");
+		putInodeBuffer(vol, dirInode);
+		return 0;
 	}
 
-	free(dirInode);
+	putInodeBuffer(vol, dirInode);
 	return 1;
 }
 
 /**
- * Copies the directory and all files within that directory to the new location
+ * Copies the directory and all files within that directory to the new location.
+ * Subdirectories are copied in parallel by a thread pool.
+ * @param vol the volume
  * @param srcDirInode the directory inode to copy
  * @param destDirInode the directory inode to copy to
  * @param fileName the name of the new directory
+ * @param reflink whether the files share their data blocks with the source files
  * @returns the directory's new inode id
  * @returns -1 if could not copy directory
  */
-int64_t copyDirectory(Inode_p srcDirInode, Inode_p destDirInode, char* fileName) {
+int64_t copyDirectory(FsVolume_p vol, Inode_p srcDirInode, Inode_p destDirInode, char* fileName, bool reflink) {
 	int64_t newInodeID;
-	Inode_p currentInode = NULL;
-	FCB_p currentDirectoryData = NULL;
-	Inode_p currentDestDirInode = NULL;
 
-	newInodeID = createFile(fileName, DIRECTORY_TYPE, srcDirInode->size, true, destDirInode->inode);
-	if (newInodeID == -1)
+	newInodeID = createFile(vol, fileName, DIRECTORY_TYPE, srcDirInode->size, true, destDirInode->inode);
+	if (newInodeID == 0)
 		return -1;
 
-	readInode(newInodeID, &currentDestDirInode);
-	readFile((uint8_t**)(&currentDirectoryData), srcDirInode, 0, 0);
-	uint64_t numberOfFiles = srcDirInode->size / sizeof(FCB);
-	for (uint64_t i = 0; i < numberOfFiles; i++) {
-		readInode(currentDirectoryData[i].inodeID, &currentInode);
-		if (currentInode->type == DIRECTORY_TYPE) {
-			if(copyDirectory(currentInode, currentDestDirInode, currentDirectoryData[i].name) == -1)
-				return -1;
-		} else {
-			if (copyFile(currentInode, currentDestDirInode, currentDirectoryData[i].name) == -1)
-				return -1;
+	if (runTreeOperation(vol, copyTreeTask, srcDirInode->inode, newInodeID, reflink) == -1)
+		return -1;
+	return newInodeID;
+}
+
+/**
+ * Runs a copy or delete of a directory tree on a thread pool. Each directory is
+ * handled by one task, which hands its subdirectories to new tasks that idle
+ * threads steal. The bitVector and superblock are saved once when all tasks finish.
+ * @param vol the volume
+ * @param function the task to run on the top directory
+ * @param srcInodeID the directory to copy or delete
+ * @param destInodeID the directory to copy into, unused when deleting
+ * @param reflink whether copied files share the data blocks of the source
+ * @returns 0 if successful
+ * @returns -1 if any part of the tree failed
+ */
+int runTreeOperation(FsVolume_p vol, TaskFunction function, uint64_t srcInodeID, uint64_t destInodeID, bool reflink) {
+	uint8_t failed = 0;
+	TreeTask_p task = malloc(sizeof(TreeTask));
+
+	task->pool = createThreadPool(0);
+	task->volume = vol;
+	task->srcInodeID = srcInodeID;
+	task->destInodeID = destInodeID;
+	task->reflink = reflink;
+	task->failed = &failed;
+
+	beginBatch(vol);
+	if (task->pool == NULL) {
+		function(task);
+	} else {
+		ThreadPool_p pool = task->pool;
+		submitTask(pool, function, task);
+		waitThreadPool(pool);
+		destroyThreadPool(pool);
+	}
+	endBatch(vol);
+	return failed ? -1 : 0;
+}
+
+/**
+ * Starts a task for a subdirectory on the same pool as its parent task,
+ * or runs it right away if there is no pool.
+ * @param parent the task that found the subdirectory
+ * @param function the task to run
+ * @param srcInodeID the subdirectory to copy or delete
+ * @param destInodeID the directory to copy into, unused when deleting
+ */
+void spawnTreeTask(TreeTask_p parent, TaskFunction function, uint64_t srcInodeID, uint64_t destInodeID) {
+	TreeTask_p task = malloc(sizeof(TreeTask));
+	memcpy(task, parent, sizeof(TreeTask));
+	task->srcInodeID = srcInodeID;
+	task->destInodeID = destInodeID;
+
+	if (parent->pool == NULL)
+		function(task);
+	else
+		submitTask(parent->pool, function, task);
+}
+
+/**
+ * Deletes a directory. Files are deleted by this task and subdirectories are
+ * handed to new tasks, since nothing else refers to them once this directory is gone.
+ * @param arg the TreeTask of the directory, freed when done
+ */
+void deleteTreeTask(void* arg) {
+	ARENA_SCOPE(mark);
+	TreeTask_p task = arg;
+	FsVolume_p vol = task->volume;
+	Inode_p dirInode = NULL;
+	DirEntry_p entries = arenaAlloc(INODE_BATCH_SIZE * sizeof(DirEntry));
+	Inode_p inodes = arenaAlloc(INODE_BATCH_SIZE * sizeof(Inode));
+	uint64_t inodeIDs[INODE_BATCH_SIZE];
+	uint64_t count;
+	uint64_t numberToRead;
+
+	readInode(vol, task->srcInodeID, &dirInode);
+	DirIterator_p iterator = dirOpen(vol, dirInode);
+	while ((count = readEntries(vol, iterator, entries, INODE_BATCH_SIZE)) > 0) {
+		//Compact entries know their type, so a subdirectory is handed off without reading its inode here
+		numberToRead = 0;
+		for (uint64_t i = 0; i < count; i++) {
+			if (entries[i].type == DIRECTORY_TYPE)
+				spawnTreeTask(task, deleteTreeTask, entries[i].inodeID, 0);
+			else
+				inodeIDs[numberToRead++] = entries[i].inodeID;
+		}
+
+		readInodes(vol, inodeIDs, numberToRead, inodes);
+		for (uint64_t i = 0; i < numberToRead; i++) {
+			if (inodes[i].type == DIRECTORY_TYPE)
+				spawnTreeTask(task, deleteTreeTask, inodes[i].inode, 0);
+			else
+				freeInode(vol, &inodes[i]);
 		}
 	}
+	dirClose(vol, iterator);
+	freeInode(vol, dirInode);
+	putInodeBuffer(vol, dirInode);
+	free(task);
+}
 
-	if (currentInode != NULL)
-		free(currentInode);
-	free(currentDirectoryData);
-	return newInodeID;
+/**
+ * Copies the contents of a directory into an already created directory. Files are
+ * copied by this task. Subdirectories are created here and filled by new tasks, so
+ * only one task ever adds entries to a directory.
+ * @param arg the TreeTask of the directories, freed when done
+ */
+void copyTreeTask(void* arg) {
+	RECORD_INNER_SCOPE();
+	ARENA_SCOPE(mark);
+	TreeTask_p task = arg;
+	FsVolume_p vol = task->volume;
+	Inode_p srcDirInode = NULL;
+	Inode_p destDirInode = NULL;
+	Inode_p currentInode;
+	DirEntry_p entries = arenaAlloc(INODE_BATCH_SIZE * sizeof(DirEntry));
+	Inode_p inodes = arenaAlloc(INODE_BATCH_SIZE * sizeof(Inode));
+	uint64_t inodeIDs[INODE_BATCH_SIZE];
+	uint64_t count;
+	uint64_t newInodeID;
+
+	readInode(vol, task->srcInodeID, &srcDirInode);
+	readInode(vol, task->destInodeID, &destDirInode);
+	DirIterator_p iterator = dirOpen(vol, srcDirInode);
+	while ((count = readEntries(vol, iterator, entries, INODE_BATCH_SIZE)) > 0) {
+		for (uint64_t i = 0; i < count; i++)
+			inodeIDs[i] = entries[i].inodeID;
+		readInodes(vol, inodeIDs, count, inodes);
+
+		for (uint64_t i = 0; i < count; i++) {
+			currentInode = &inodes[i];
+			if (currentInode->type == DIRECTORY_TYPE) {
+				newInodeID = createFile(vol, entries[i].name, DIRECTORY_TYPE, currentInode->size, true, destDirInode->inode);
+				if (newInodeID == 0)
+					__atomic_store_n(task->failed, 1, __ATOMIC_RELAXED);
+				else
+					spawnTreeTask(task, copyTreeTask, currentInode->inode, newInodeID);
+			} else if (copyFile(vol, currentInode, destDirInode, entries[i].name, task->reflink) == -1) {
+				__atomic_store_n(task->failed, 1, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	dirClose(vol, iterator);
+	putInodeBuffer(vol, srcDirInode);
+	putInodeBuffer(vol, destDirInode);
+	free(task);
 }
 
 /**
  * Copies the file from the source inode to the directory inode
+ * @param vol the volume
  * @param srcInode the file inode to copy
  * @param destDirInode the directory inode to copy to
  * @param fileName the name of the new file
+ * @param reflink whether the new file shares the data blocks of the source
  * @returns the file's new inode ID
  * @returns -1 if could not copy file
  */
-int64_t copyFile(Inode_p srcInode, Inode_p destDirInode, char* fileName) {
+int64_t copyFile(FsVolume_p vol, Inode_p srcInode, Inode_p destDirInode, char* fileName, bool reflink) {
 	Inode_p destInode = NULL;
 	uint8_t* fileBuffer = NULL;
 	int64_t newInodeID;
 
+	//Reference counts only persist on volumes that were formatted with them
+	if (reflink && vol->sb->refCountStart == 0) {
+		printf("Volume has no reference counts, reformat to use reflink copies\n");
+		return -1;
+	}
+
 	//Create file in the directory
-	newInodeID = createFile(fileName, srcInode->type, (srcInode->blocksReserved * partInfop->blocksize), true, destDirInode->inode);
+	newInodeID = createFile(vol, fileName, srcInode->type, (reflink ? 0 : srcInode->blocksMapped * vol->partInfop->blocksize), true, destDirInode->inode);
 
 	if (newInodeID == 0) {
 		return -1;
 	}
 
+	//Point the new file at the same data blocks instead of copying them
+	if (reflink) {
+		readInode(vol, newInodeID, &destInode);
+		if (shareFileBlocks(vol, srcInode, destInode) == -1) {
+			readInode(vol, destDirInode->inode, &destDirInode);
+			deleteFile(vol, destInode);
+			removeFromDirectory(vol, destDirInode, destInode->inode);
+			newInodeID = -1;
+		}
+		saveMemory(vol);
+		putInodeBuffer(vol, destInode);
+		return newInodeID;
+	}
+
 	//Copy the file contents over
-	readInode(newInodeID, &destInode);
-	fileBuffer = malloc(partInfop->blocksize);
-	int srcFD = inodeOpen(srcInode);
-	int destFD = inodeOpen(destInode);
+	readInode(vol, newInodeID, &destInode);
+	fileBuffer = getBlockBuffer(vol);
+	int srcFD = inodeOpen(vol, srcInode);
+	int destFD = inodeOpen(vol, destInode);
 
 	uint64_t bytesToTransfer;
 
 	do {
-		bytesToTransfer = fileRead(srcFD, fileBuffer, partInfop->blocksize);
+		bytesToTransfer = fileRead(vol, srcFD, fileBuffer, vol->partInfop->blocksize);
 		if (bytesToTransfer == -1)
 			break;
-		if (fileWrite(destFD, fileBuffer, bytesToTransfer) == -1)
+		if (fileWrite(vol, destFD, fileBuffer, bytesToTransfer) == -1)
 			break;
-	} while (bytesToTransfer == partInfop->blocksize);
+	} while (bytesToTransfer == vol->partInfop->blocksize);
 
-	fdTable[destFD].inode->dateModified = time(NULL);
-	writeInode(fdTable[destFD].inode);
+	vol->fdTable[destFD].inode->dateModified = time(NULL);
+	writeInode(vol, vol->fdTable[destFD].inode);
 
-	fileClose(srcFD);
-	fileClose(destFD);
-	saveMemory();
-	free(destInode);
-	free(fileBuffer);
+	fileClose(vol, srcFD);
+	fileClose(vol, destFD);
+	saveMemory(vol);
+	putInodeBuffer(vol, destInode);
+	putBlockBuffer(vol, fileBuffer);
 	return newInodeID;
 }
 
 /**
- * Copies the file from source to destination
+ * Gives the destination file the same block map as the source file. Every data block
+ * gains a reference instead of being copied, while the destination gets its own
+ * indirect blocks. Any blocks the destination already had are freed first.
+ * Inline data has no blocks to share and is copied into the destination inode.
+ * @param vol the volume
+ * @param srcInode the file inode to share the blocks of
+ * @param destInode the file inode to share the blocks with
+ * @returns the number of data blocks shared
+ * @returns -1 if there are not enough free blocks for the indirect blocks
+ */
+int64_t shareFileBlocks(FsVolume_p vol, Inode_p srcInode, Inode_p destInode) {
+	ARENA_SCOPE(mark);
+	BlockMap srcMap;
+	BlockMap destMap;
+	uint64_t blocksShared = 0;
+	uint64_t runLength;
+	uint64_t dataBlock;
+
+	destInode->size = 0;
+	deallocateBlocks(vol, destInode, 0);
+
+	if (srcInode->inlined) {
+		memcpy(destInode->inlineData, srcInode->inlineData, INLINE_DATA_SIZE);
+		destInode->inlined = 1;
+		destInode->size = srcInode->size;
+		destInode->dateModified = time(NULL);
+		writeInode(vol, destInode);
+		return 0;
+	}
+	if (destInode->inlined)
+		spillInline(vol, destInode);
+
+	//Reserve enough blocks for the indirect blocks, unused ones are given back
+	openBlockMap(&srcMap, srcInode);
+	openBlockMap(&destMap, destInode);
+	if (srcInode->blocksIndirect > 0) {
+		if (srcInode->blocksIndirect > vol->sb->freeDataBlocks
+				|| findFreeBlocks(vol, srcInode->blocksIndirect, &destMap.pool, inodeBlockGoal(vol, destInode->inode)) != srcInode->blocksIndirect) {
+			printf("Not enough free blocks to allocate to file\n");
+			closeBlockMap(vol, &srcMap);
+			closeBlockMap(vol, &destMap);
+			writeInode(vol, destInode);
+			return -1;
+		}
+		destMap.poolSize = srcInode->blocksIndirect;
+	}
+	extendBlockMap(vol, &destMap, srcInode->blocksMapped);
+
+	for (uint64_t i = 0; i < srcInode->blocksMapped; i += runLength) {
+		runLength = getBlockRun(vol, &srcMap, i, srcInode->blocksMapped - i, &dataBlock);
+		if (dataBlock == HOLE_BLOCK)
+			continue;
+		for (uint64_t j = 0; j < runLength; j++) {
+			shareBlock(vol, dataBlock + j);
+			setMapBlock(vol, &destMap, i + j, dataBlock + j);
+		}
+		blocksShared += runLength;
+	}
+
+	closeBlockMap(vol, &srcMap);
+	closeBlockMap(vol, &destMap);
+	destInode->size = srcInode->size;
+	destInode->dateModified = time(NULL);
+	writeInode(vol, destInode);
+	return blocksShared;
+}
+
+/**
+ * Copies the file from source to destination. A reflink copy shares the data
+ * blocks of the source instead of copying them, and a block is only copied
+ * once either file writes to it.
+ * @param vol the volume
  * @param sourceFile the source file to copy from
  * @param destFile the destination file to copy to
+ * @param reflink 1 to share the data blocks, 0 to copy them
  * @returns 0 if successful
  * @returns -1 if could not copy file
  * @returns -2 if source file does not exist
  */
-int fs_cp(char* sourceFile, char* destFile) {
+int fs_cp(FsVolume_p vol, char* sourceFile, char* destFile, uint8_t reflink) {
+	STAT_SCOPE(&vol->opStats[FS_OP_CP]);
+	RECORD_SCOPE(vol, FS_OP_CP, sourceFile, destFile, -1, reflink, 0);
+	ARENA_SCOPE(mark);
 	int retval;
 	uint64_t foundInodeID;
 	uint64_t srcDirInodeID;
@@ -1809,70 +4452,70 @@ int fs_cp(char* sourceFile, char* destFile) {
 		return -1;
 
 	//Get the filename and source directory inode id
-	if (!getLastInode(sourceFile, &srcDirInodeID, true, srcFileName))
+	if (!getLastInode(vol, sourceFile, &srcDirInodeID, true, srcFileName))
 		return -2;
 
 	//read source directory inode
-	readInode(srcDirInodeID, &srcDirInode);
+	readInode(vol, srcDirInodeID, &srcDirInode);
 
 	//Check if source directory contains the filename
-	if (!inodeContainsFile(srcDirInode, srcFileName, &srcInodeID))
+	if (!inodeContainsFile(vol, srcDirInode, srcFileName, &srcInodeID))
 		return -2;
 
 	//read the source inode
-	readInode(srcInodeID, &srcInode);
+	readInode(vol, srcInodeID, &srcInode);
 
 	//Get the filename and destination directory inode id
-	if (!getLastInode(destFile, &destDirInodeID, true, destFileName))
+	if (!getLastInode(vol, destFile, &destDirInodeID, true, destFileName))
 		return -1;
 
 	//read destination directory inode
-	readInode(destDirInodeID, &destDirInode);
+	readInode(vol, destDirInodeID, &destDirInode);
 
 	//Check if file exists. If it is a directory, add file to directory.
 	//If it is a file, delete file, and copy inode to that file.
-	if (inodeContainsFile(destDirInode, destFileName, &foundInodeID)) {
-		readInode(foundInodeID, &destInode);
+	if (inodeContainsFile(vol, destDirInode, destFileName, &foundInodeID)) {
+		readInode(vol, foundInodeID, &destInode);
 
 		if (destInode->type == DIRECTORY_TYPE) {
 			useSrcFileName = true;
 			//Set the destination directory to the directory
-			readInode(foundInodeID, &destDirInode);
+			readInode(vol, foundInodeID, &destDirInode);
 			//If a directory, check if filename exists inside directory
-			if (inodeContainsFile(destDirInode, srcFileName, &foundInodeID)) {
+			if (inodeContainsFile(vol, destDirInode, srcFileName, &foundInodeID)) {
 				Inode_p fileToDelete = NULL;
-				readInode(foundInodeID, &fileToDelete);
-				deleteFile(fileToDelete);
-				removeFromDirectory(destDirInode, fileToDelete->inode);
-				free(fileToDelete);
+				readInode(vol, foundInodeID, &fileToDelete);
+				deleteFile(vol, fileToDelete);
+				removeFromDirectory(vol, destDirInode, fileToDelete->inode);
+				putInodeBuffer(vol, fileToDelete);
 			}
 		//If only a file then delete
 		} else {
-			deleteFile(destInode);
-			removeFromDirectory(destDirInode, destInode->inode);
+			deleteFile(vol, destInode);
+			removeFromDirectory(vol, destDirInode, destInode->inode);
 		}
 	}
 
 	if (srcInode->type == FILE_TYPE) {
 		//Create file in the directory
 		if (useSrcFileName) {
-			retval = copyFile(srcInode, destDirInode, srcFileName);
+			retval = copyFile(vol, srcInode, destDirInode, srcFileName, reflink);
 		} else {
-			retval = copyFile(srcInode, destDirInode, destFileName);
+			retval = copyFile(vol, srcInode, destDirInode, destFileName, reflink);
 		}
 	} else {
 		if (useSrcFileName) {
-			retval = copyDirectory(srcInode, destDirInode, srcFileName);
+			retval = copyDirectory(vol, srcInode, destDirInode, srcFileName, reflink);
 		} else {
-			retval = copyDirectory(srcInode, destDirInode, destFileName);
+			retval = copyDirectory(vol, srcInode, destDirInode, destFileName, reflink);
 		}
 	}
 
-	free(srcDirInode);
-	free(srcInode);
-	free(destDirInode);
+	putInodeBuffer(vol, srcDirInode);
+	putInodeBuffer(vol, srcInode);
+	putInodeBuffer(vol, destDirInode);
 	if (destInode != NULL)
-		free(destInode);
+		putInodeBuffer(vol, destInode);
 
 	return retval;
 }
@@ -1881,13 +4524,17 @@ int fs_cp(char* sourceFile, char* destFile) {
  * Moves the file from source to destination. If the destination is a directory
  * file will be moved into the directory. If the destination is a file, the file will
  * be overwritten by source file.
+ * @param vol the volume
  * @param sourceFile the source file to move
  * @param destFile the destination of the file
  * @returns 0 if successful
  * @returns -1 if could not move file
  * @returns -2 if source file does not exist
  */
-int fs_mv(char* sourceFile, char* destFile) {
+int fs_mv(FsVolume_p vol, char* sourceFile, char* destFile) {
+	STAT_SCOPE(&vol->opStats[FS_OP_MV]);
+	RECORD_SCOPE(vol, FS_OP_MV, sourceFile, destFile, -1, 0, 0);
+	ARENA_SCOPE(mark);
 	uint64_t foundInodeID;
 	uint64_t srcDirInodeID;
 	uint64_t srcInodeID;
@@ -1904,116 +4551,111 @@ int fs_mv(char* sourceFile, char* destFile) {
 		return -1;
 
 	//Get the filename and source directory inode id
-	if (!getLastInode(sourceFile, &srcDirInodeID, true, srcFileName))
+	if (!getLastInode(vol, sourceFile, &srcDirInodeID, true, srcFileName))
 		return -2;
 
 	//read source directory inode
-	readInode(srcDirInodeID, &srcDirInode);
+	readInode(vol, srcDirInodeID, &srcDirInode);
 
 	//Check if source directory contains the filename
-	if (!inodeContainsFile(srcDirInode, srcFileName, &srcInodeID))
+	if (!inodeContainsFile(vol, srcDirInode, srcFileName, &srcInodeID))
 		return -2;
 
 	//read the source inode
-	readInode(srcInodeID, &srcInode);
+	readInode(vol, srcInodeID, &srcInode);
 
 	//Get the filename and destination directory inode id
-	if (!getLastInode(destFile, &destDirInodeID, true, destFileName))
+	if (!getLastInode(vol, destFile, &destDirInodeID, true, destFileName))
 		return -1;
 
 	//read destination directory inode
-	readInode(destDirInodeID, &destDirInode);
+	readInode(vol, destDirInodeID, &destDirInode);
 
 	//Check if file exists. If it is a directory, add file to directory.
 	//If it is a file, delete file, and copy inode to that file.
-	if (inodeContainsFile(destDirInode, destFileName, &foundInodeID)) {
-		readInode(foundInodeID, &destInode);
+	if (inodeContainsFile(vol, destDirInode, destFileName, &foundInodeID)) {
+		readInode(vol, foundInodeID, &destInode);
 		if (destInode->type == DIRECTORY_TYPE) {
 			useSrcFileName = true;
 			//Set the destination directory to the directory
-			readInode(foundInodeID, &destDirInode);
+			readInode(vol, foundInodeID, &destDirInode);
 			//If a directory, check if filename exists inside directory
-			if (inodeContainsFile(destDirInode, srcFileName, &foundInodeID)) {
+			if (inodeContainsFile(vol, destDirInode, srcFileName, &foundInodeID)) {
 				Inode_p fileToDelete = NULL;
-				readInode(foundInodeID, &fileToDelete);
-				deleteFile(fileToDelete);
-				removeFromDirectory(destDirInode, fileToDelete->inode);
-				free(fileToDelete);
+				readInode(vol, foundInodeID, &fileToDelete);
+				deleteFile(vol, fileToDelete);
+				removeFromDirectory(vol, destDirInode, fileToDelete->inode);
+				putInodeBuffer(vol, fileToDelete);
 			}
 		//If only a file then delete
 		} else {
-			deleteFile(destInode);
-			removeFromDirectory(destDirInode, destInode->inode);
+			deleteFile(vol, destInode);
+			removeFromDirectory(vol, destDirInode, destInode->inode);
 		}
 	}
 
-	//Create new file FCB
-	FCB_p newFCB = calloc(1, sizeof(FCB));
-	newFCB->inodeID = srcInode->inode;
-	if (useSrcFileName) {
-		strcpy(newFCB->name, srcFileName);
-	}
-	else {
-		strcpy(newFCB->name, destFileName);
-	}
-
-	addToDirectory(destDirInode, newFCB);
+	//Add the file to its new directory
+	addToDirectory(vol, destDirInode, srcInode->inode, srcInode->type, useSrcFileName ? srcFileName : destFileName);
 	srcInode->parentInodeID = destDirInode->inode;
 	srcInode->dateModified = time(NULL);
 
 	//Remove from old directory
-	readInode(srcDirInodeID, &srcDirInode);
-	removeFromDirectory(srcDirInode, srcInode->inode);
-	writeInode(srcInode);
-	saveMemory();
+	readInode(vol, srcDirInodeID, &srcDirInode);
+	removeFromDirectory(vol, srcDirInode, srcInode->inode);
+	writeInode(vol, srcInode);
+	saveMemory(vol);
 
 	//Free memory
-	free(newFCB);
-	free(srcDirInode);
-	free(srcInode);
-	free(destDirInode);
+	putInodeBuffer(vol, srcDirInode);
+	putInodeBuffer(vol, srcInode);
+	putInodeBuffer(vol, destDirInode);
 	if (destInode != NULL)
-		free(destInode);
+		putInodeBuffer(vol, destInode);
 	return 0;
 }
 
 /**
  * Deletes the file with the given name. Frees up any allocated blocks
  * and removes the file from the directory.
+ * @param vol the volume
  * @param filename the name of the file to remove
  * @returns 0 if successful
  * @returns -1 if could not delete file
  * @returns -2 if file does not exist
  */
-int fs_rm(char* filename) {
+int fs_rm(FsVolume_p vol, char* filename) {
+	STAT_SCOPE(&vol->opStats[FS_OP_RM]);
+	RECORD_SCOPE(vol, FS_OP_RM, filename, NULL, -1, 0, 0);
+	ARENA_SCOPE(mark);
 	uint64_t fileID;
 	Inode_p fileInode = NULL;
 
-	if (!getLastInode(filename, &fileID, false, NULL))
+	if (!getLastInode(vol, filename, &fileID, false, NULL))
 		return -2;
 
-	readInode(fileID, &fileInode);
+	readInode(vol, fileID, &fileInode);
 	if (fileInode->type != FILE_TYPE) {
 		printf("Error: Not a file, use rmdir\n");
-		free(fileInode);
+		putInodeBuffer(vol, fileInode);
 		return -1;
 	}
 
-	deleteFile(fileInode);
-	readInode(fileInode->parentInodeID, &fileInode);
+	deleteFile(vol, fileInode);
+	readInode(vol, fileInode->parentInodeID, &fileInode);
 
-	if (!removeFromDirectory(fileInode, fileID)) {
-		free(fileInode);
+	if (!removeFromDirectory(vol, fileInode, fileID)) {
+		putInodeBuffer(vol, fileInode);
 		return -1;
 	}
 
-	free(fileInode);
+	putInodeBuffer(vol, fileInode);
 	return 0;
 }
 
 /**
  * Copies a file from another filesystem to destination
  * in current filesystem.
+ * @param vol the volume
  * @param sourceFile the source file from another file system to copy from
  * @param destFile the destination file in this file system to copy the file to
  * @returns 0 if successful
@@ -2021,11 +4663,17 @@ int fs_rm(char* filename) {
  * @returns -2 if could not open source file
  * @returns -3 if could not open destination file
  */
-int fs_cpin(char* sourceFile, char* destFile) {
+int fs_cpin(FsVolume_p vol, char* sourceFile, char* destFile) {
+	STAT_SCOPE(&vol->opStats[FS_OP_CPIN]);
+	RECORD_SCOPE(vol, FS_OP_CPIN, sourceFile, destFile, -1, 0, 0);
+	ARENA_SCOPE(mark);
 	int srcFD;
 	int destFD;
 	struct stat statBuffer;
 	size_t fileLength;
+	off_t dataStart;
+	off_t dataEnd;
+	bool findsHoles = true;
 	uint64_t foundInodeID;
 	uint64_t destDirInodeID;
 	char destFileName[MAX_NAME_SIZE];
@@ -2043,88 +4691,192 @@ int fs_cpin(char* sourceFile, char* destFile) {
 
 	//Parse source string to get source filename
 	uint32_t strlength = strlen(sourceFile) + 1;
-	char* strCopy = malloc(strlength);
+	char* strCopy = arenaAlloc(strlength);
 	memcpy(strCopy, sourceFile, strlength);
-    char* token = strtok(strCopy, "/");
+	char* save;
+    char* token = strtok_r(strCopy, "/", &save);
     char* srcFileName;
     while (token != NULL) {
         srcFileName = token;
-        token = strtok(NULL, "/");
+        token = strtok_r(NULL, "/", &save);
     }
 
 	//Get the filename and destination directory inode id
-	if (!getLastInode(destFile, &destDirInodeID, true, destFileName))
+	if (!getLastInode(vol, destFile, &destDirInodeID, true, destFileName)) {
+		close(srcFD);
 		return -1;
+	}
 
 	//read destination directory inode
-	readInode(destDirInodeID, &destDirInode);
+	readInode(vol, destDirInodeID, &destDirInode);
 
 	//Check if file exists. If it is a directory, add file to directory.
 	//If it is a file, delete file, and copy inode to that file.
-	if (inodeContainsFile(destDirInode, destFileName, &foundInodeID)) {
-		readInode(foundInodeID, &destInode);
+	if (inodeContainsFile(vol, destDirInode, destFileName, &foundInodeID)) {
+		readInode(vol, foundInodeID, &destInode);
 
 		if (destInode->type == DIRECTORY_TYPE) {
 			useSrcFileName = true;
 			//Set the destination directory to the directory
-			readInode(foundInodeID, &destDirInode);
+			readInode(vol, foundInodeID, &destDirInode);
 			//If a directory, check if filename exists inside directory
-			if (inodeContainsFile(destDirInode, srcFileName, &foundInodeID)) {
+			if (inodeContainsFile(vol, destDirInode, srcFileName, &foundInodeID)) {
 				Inode_p fileToDelete = NULL;
-				readInode(foundInodeID, &fileToDelete);
-				deleteFile(fileToDelete);
-				removeFromDirectory(destDirInode, fileToDelete->inode);
-				free(fileToDelete);
+				readInode(vol, foundInodeID, &fileToDelete);
+				deleteFile(vol, fileToDelete);
+				removeFromDirectory(vol, destDirInode, fileToDelete->inode);
+				putInodeBuffer(vol, fileToDelete);
 			}
 		//If only a file then delete
 		} else {
-			deleteFile(destInode);
-			removeFromDirectory(destDirInode, destInode->inode);
+			deleteFile(vol, destInode);
+			removeFromDirectory(vol, destDirInode, destInode->inode);
 		}
 	}
 
-	//Create file in the directory
+	//Create file in the directory. Blocks are assigned as each region is copied in.
 	if (useSrcFileName) {
-		newInodeID = createFile(srcFileName, FILE_TYPE, fileLength, true, destDirInode->inode);
+		newInodeID = createFile(vol, srcFileName, FILE_TYPE, 0, true, destDirInode->inode);
 	} else {
-		newInodeID = createFile(destFileName, FILE_TYPE, fileLength, true, destDirInode->inode);
+		newInodeID = createFile(vol, destFileName, FILE_TYPE, 0, true, destDirInode->inode);
 	}
 	if (newInodeID == 0) {
-		free(strCopy);
-		free(destDirInode);
-		free(destInode);
+		close(srcFD);
+		putInodeBuffer(vol, destDirInode);
+		putInodeBuffer(vol, destInode);
 		return -1;
 	}
 
 	//Copy the file contents over
-	readInode(newInodeID, &destInode);
-	uint8_t* fileBuffer = malloc(partInfop->blocksize);
-	destFD = inodeOpen(destInode);
+	readInode(vol, newInodeID, &destInode);
+	destFD = inodeOpen(vol, destInode);
+	bool copied = destFD != -1;
+
+	//Find the first data in the source. If holes can't be found, copy the whole file.
+	dataStart = lseek(srcFD, 0, SEEK_DATA);
+	if (dataStart == -1 && errno == EINVAL) {
+		findsHoles = false;
+		dataStart = 0;
+	}
 
-	uint64_t bytesToTransfer;
+	//Copy each data region of the source, leaving its holes as holes
+	while (copied && dataStart != -1 && dataStart < fileLength) {
+		dataEnd = findsHoles ? lseek(srcFD, dataStart, SEEK_HOLE) : -1;
+		if (dataEnd == -1 || dataEnd > fileLength)
+			dataEnd = fileLength;
+		copied = copyInRegion(vol, srcFD, destFD, dataStart, dataEnd) != -1;
+		dataStart = findsHoles ? lseek(srcFD, dataEnd, SEEK_DATA) : -1;
+	}
 
-	do {
-		bytesToTransfer = read(srcFD, fileBuffer, partInfop->blocksize);
-		if (fileWrite(destFD, fileBuffer, bytesToTransfer) == -1)
-			break;
-	} while (bytesToTransfer == partInfop->blocksize);
+	//Remove a partial copy rather than leave a file whose missing regions read back as zeros
+	if (!copied) {
+		close(srcFD);
+		fileClose(vol, destFD);
+		readInode(vol, newInodeID, &destInode);
+		deleteFile(vol, destInode);
+		readInode(vol, destInode->parentInodeID, &destDirInode);
+		removeFromDirectory(vol, destDirInode, newInodeID);
+		saveMemory(vol);
+
+		putInodeBuffer(vol, destDirInode);
+		putInodeBuffer(vol, destInode);
+		return -1;
+	}
 
-	fdTable[destFD].inode->dateModified = time(NULL);
-	writeInode(fdTable[destFD].inode);
+	//A hole at the end of the source still counts toward its size
+	if (vol->fdTable[destFD].inode->size < fileLength)
+		resizeInode(vol, vol->fdTable[destFD].inode, fileLength);
+
+	vol->fdTable[destFD].inode->dateModified = time(NULL);
+	writeInode(vol, vol->fdTable[destFD].inode);
 
 	close(srcFD);
-	fileClose(destFD);
-	saveMemory();
+	fileClose(vol, destFD);
+	saveMemory(vol);
 
-	free(strCopy);
-	free(destDirInode);
-	free(destInode);
-	free(fileBuffer);
+	putInodeBuffer(vol, destDirInode);
+	putInodeBuffer(vol, destInode);
 	return 0;
 }
 
+/**
+ * Copies a region of a file in another filesystem into an open file. Whole blocks
+ * are assigned up front and copied straight into the volume one contiguous run
+ * at a time. Partial blocks at either end go through filePwrite.
+ * @param vol the volume
+ * @param hostFD the file descriptor of the file in the other filesystem
+ * @param fd the file descriptor of the file in this filesystem
+ * @param start the byte offset of the start of the region
+ * @param end the byte offset one past the end of the region
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int copyInRegion(FsVolume_p vol, int hostFD, int fd, uint64_t start, uint64_t end) {
+	LBA_TAG_SCOPE(LBA_TAG_DATA);
+	Inode_p inode = vol->fdTable[fd].inode;
+	uint64_t blockSize = vol->partInfop->blocksize;
+	uint64_t wholeStart = (start + blockSize - 1) / blockSize;
+	uint64_t wholeEnd = end / blockSize;
+	uint64_t headEnd = end;
+	uint8_t* fileBuffer = getBlockBuffer(vol);
+	int64_t bytesToTransfer;
+	int result = 0;
+
+	if (wholeStart < wholeEnd)
+		headEnd = wholeStart * blockSize;
+
+	//Copy a partial block at the start, or the whole region if it has no whole blocks
+	while (start < headEnd) {
+		bytesToTransfer = (headEnd - start < blockSize) ? headEnd - start : blockSize;
+		bytesToTransfer = pread(hostFD, fileBuffer, bytesToTransfer, start);
+		if (bytesToTransfer <= 0 || filePwrite(vol, fd, fileBuffer, bytesToTransfer, start) == -1) {
+			putBlockBuffer(vol, fileBuffer);
+			return -1;
+		}
+		start += bytesToTransfer;
+	}
+
+	//Copy the whole blocks straight into the volume
+	if (wholeStart < wholeEnd) {
+		if (fillBlocks(vol, inode, wholeStart, wholeEnd, false) == -1) {
+			putBlockBuffer(vol, fileBuffer);
+			return -1;
+		}
+
+		BlockMap map;
+		uint64_t runLength;
+		uint64_t dataBlock;
+
+		openBlockMap(&map, inode);
+		for (uint64_t i = wholeStart; i < wholeEnd; i += runLength) {
+			runLength = getBlockRun(vol, &map, i, wholeEnd - i, &dataBlock);
+			if (LBAcopyIn(vol->partition, hostFD, i * blockSize, runLength * blockSize, dataBlock + vol->sb->rootDataPointer) != runLength * blockSize) {
+				result = -1;
+				break;
+			}
+			if ((i + runLength) * blockSize > inode->size)
+				inode->size = (i + runLength) * blockSize;
+		}
+		closeBlockMap(vol, &map);
+		start = wholeEnd * blockSize;
+	}
+
+	//Copy a partial block at the end
+	while (result == 0 && start < end) {
+		bytesToTransfer = pread(hostFD, fileBuffer, end - start, start);
+		if (bytesToTransfer <= 0 || filePwrite(vol, fd, fileBuffer, bytesToTransfer, start) == -1)
+			result = -1;
+		else
+			start += bytesToTransfer;
+	}
+
+	putBlockBuffer(vol, fileBuffer);
+	return result;
+}
+
 /**
  * Copies a file from this filesystem to another filesystem
+ * @param vol the volume
  * @param sourceFile the source file in this file system to copy from
  * @param destFile the destination file in another file system to copy the file to
  * @returns 0 if successful
@@ -2132,81 +4884,143 @@ int fs_cpin(char* sourceFile, char* destFile) {
  * @returns -2 if could not open source file
  * @returns -3 if could not open destination file
  */
-int fs_cpout(char* sourceFile, char* destFile) {
+int fs_cpout(FsVolume_p vol, char* sourceFile, char* destFile) {
+	STAT_SCOPE(&vol->opStats[FS_OP_CPOUT]);
+	RECORD_SCOPE(vol, FS_OP_CPOUT, sourceFile, destFile, -1, 0, 0);
+	ARENA_SCOPE(mark);
 	int srcFD;
 	int destFD;
 
-	srcFD = fileOpen(sourceFile);
+	srcFD = fileOpen(vol, sourceFile);
 	if (srcFD == -1)
 		return -2;
 
-    destFD = open(destFile, O_WRONLY | O_CREAT);
-    if (destFD == -1)
+    destFD = open(destFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (destFD == -1) {
+        fileClose(vol, srcFD);
         return -3;
+    }
 
-    uint8_t* fileBuffer = malloc(partInfop->blocksize);
-	uint32_t bytesToTransfer;
+	uint64_t dataStart = 0;
+	uint64_t dataEnd;
 
-	do {
-		bytesToTransfer = fileRead(srcFD, fileBuffer, partInfop->blocksize);
-		if (bytesToTransfer == -1) {
-			printf("reading file error\n");
-			break;
-		}
-		if (write(destFD, fileBuffer, bytesToTransfer) == -1) {
+	//Copy each data region of the file, leaving its holes as holes in the destination
+	while (fileSeek(vol, srcFD, dataStart, FS_SEEK_DATA)) {
+		dataStart = vol->fdTable[srcFD].byteOffset;
+		fileSeek(vol, srcFD, dataStart, FS_SEEK_HOLE);
+		dataEnd = vol->fdTable[srcFD].byteOffset;
+		if (copyOutRegion(vol, srcFD, destFD, dataStart, dataEnd) == -1) {
 			printf("writing file error\n");
 			break;
 		}
-	} while (bytesToTransfer == partInfop->blocksize);
+		dataStart = dataEnd;
+	}
 
-    fileClose(srcFD);
+	//Holes at the end of the file are kept by setting the size
+	if (ftruncate(destFD, vol->fdTable[srcFD].inode->size) == -1)
+		printf("writing file error\n");
+
+    fileClose(vol, srcFD);
     close(destFD);
-    free(fileBuffer);
 	return 0;
 }
 
+/**
+ * Copies a region of an open file into a file in another filesystem. Each
+ * contiguous run of blocks is copied straight out of the volume, and a
+ * region that does not start on a block boundary goes through filePread.
+ * @param vol the volume
+ * @param fd the file descriptor of the file in this filesystem
+ * @param hostFD the file descriptor of the file in the other filesystem
+ * @param start the byte offset of the start of the region
+ * @param end the byte offset one past the end of the region
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int copyOutRegion(FsVolume_p vol, int fd, int hostFD, uint64_t start, uint64_t end) {
+	LBA_TAG_SCOPE(LBA_TAG_DATA);
+	uint64_t blockSize = vol->partInfop->blocksize;
+	int64_t bytesToTransfer;
+	int result = 0;
+
+	//Copy up to the first block boundary through a buffer, or all of the data of an inline file,
+	//which always fits in a block since a block holds a whole inode
+	if (start % blockSize != 0 || vol->fdTable[fd].inode->inlined) {
+		uint8_t* fileBuffer = getBlockBuffer(vol);
+		bytesToTransfer = vol->fdTable[fd].inode->inlined ? end - start : blockSize - start % blockSize;
+		if (bytesToTransfer > end - start)
+			bytesToTransfer = end - start;
+		bytesToTransfer = filePread(vol, fd, fileBuffer, bytesToTransfer, start);
+		if (bytesToTransfer <= 0 || pwrite(hostFD, fileBuffer, bytesToTransfer, start) != bytesToTransfer)
+			result = -1;
+		start += bytesToTransfer;
+		putBlockBuffer(vol, fileBuffer);
+	}
+
+	BlockMap map;
+	uint64_t runLength;
+	uint64_t dataBlock;
+
+	openBlockMap(&map, vol->fdTable[fd].inode);
+	while (result == 0 && start < end) {
+		runLength = getBlockRun(vol, &map, start / blockSize, (end - start + blockSize - 1) / blockSize, &dataBlock);
+		bytesToTransfer = (runLength * blockSize < end - start) ? runLength * blockSize : end - start;
+		if (dataBlock != HOLE_BLOCK
+			&& LBAcopyOut(vol->partition, hostFD, start, bytesToTransfer, dataBlock + vol->sb->rootDataPointer) != bytesToTransfer)
+			result = -1;
+		start += bytesToTransfer;
+	}
+	closeBlockMap(vol, &map);
+	return result;
+}
+
 /**
  * Prints the full working directory
+ * @param vol the volume
  */
-void fs_pwd() {
-	printf("%s\n", wd->wdPath);
+void fs_pwd(FsVolume_p vol) {
+	ARENA_SCOPE(mark);
+	printf("%s\n", vol->wd->wdPath);
 }
 
 /**
- * Resizes the file. Can not resize directories. Maximum is capped by the number of available
- * blocks to hold the requested size. When increasing the size, if the size is greater than
- * the currently allocated blocks, new blocks will be wiped and allocated to the file.
+ * Resizes the file. Can not resize directories. Maximum is capped by the max file size.
+ * When increasing the size, if the size is greater than the currently reserved blocks,
+ * the new blocks are left as holes that read as zeros and are allocated when written to.
  * Resize does not deallocate blocks, reserve command must be used.
+ * @param vol the volume
  * @param file the file to resize
  * @param size the size in bytes to resize to
  * @returns 0 if successful
  * @returns -1 if could not resize file
  * @returns -2 if file could not be found
  */
-int fs_resize(char* file, uint64_t size) {
+int fs_resize(FsVolume_p vol, char* file, uint64_t size) {
+	STAT_SCOPE(&vol->opStats[FS_OP_RESIZE]);
+	RECORD_SCOPE(vol, FS_OP_RESIZE, file, NULL, -1, size, 0);
+	ARENA_SCOPE(mark);
 	uint64_t fileID;
 	Inode_p fileInode = NULL;
 
-	if (!getLastInode(file, &fileID, false, NULL))
+	if (!getLastInode(vol, file, &fileID, false, NULL))
 		return -2;
 
-	readInode(fileID, &fileInode);
+	readInode(vol, fileID, &fileInode);
 	if (fileInode->type != FILE_TYPE) {
-		free(fileInode);
+		putInodeBuffer(vol, fileInode);
 		return -1;
 	}
 
-	//Check if the size is larger than the current file size. Allocate blocks if needed.
-	if ((size > fileInode->size) && allocateBlocks(fileInode, size) == -1) {
-		free(fileInode);
+	//Growing past the reserved blocks leaves the new blocks as holes
+	if (!resizeInode(vol, fileInode, size)) {
+		putInodeBuffer(vol, fileInode);
 		return -1;
 	}
 
-	fileInode->size = size;
 	fileInode->dateModified = time(NULL);
-	writeInode(fileInode);
-	saveMemory();
-	free(fileInode);
+	writeInode(vol, fileInode);
+	saveMemory(vol);
+	putInodeBuffer(vol, fileInode);
 	return 0;
 }
 
@@ -2214,37 +5028,41 @@ int fs_resize(char* file, uint64_t size) {
  * Resizes the reserved blocks to hold the number of bytes requested. Minimum reserved is one block
  * or the minium blocks needed to hold the current size of the file. Maximum blocks are limited by
  * the number of available free blocks to be allocated.
+ * @param vol the volume
  * @param file the file to change the reserved block size
  * @param size the size in bytes to calculate the number of blocks to reserve
  * @returns 0 if successful
  * @returns -1 if could not resize file
  * @returns -2 if file could not be found
  */
-int fs_reserve(char* file, uint64_t size) {
+int fs_reserve(FsVolume_p vol, char* file, uint64_t size) {
+	STAT_SCOPE(&vol->opStats[FS_OP_RESERVE]);
+	RECORD_SCOPE(vol, FS_OP_RESERVE, file, NULL, -1, size, 0);
+	ARENA_SCOPE(mark);
 	uint64_t fileID;
 	Inode_p fileInode = NULL;
 
-	if (!getLastInode(file, &fileID, false, NULL))
+	if (!getLastInode(vol, file, &fileID, false, NULL))
 		return -2;
 
-	readInode(fileID, &fileInode);
-	uint64_t neededBlocks = (size + partInfop->blocksize - 1) / partInfop->blocksize;
+	readInode(vol, fileID, &fileInode);
+	uint64_t neededBlocks = (size + vol->partInfop->blocksize - 1) / vol->partInfop->blocksize;
 	if (size < 1)
 		size = 1;
 
 
-	if (neededBlocks > fileInode->blocksReserved) {
-		if (allocateBlocks(fileInode, size) == -1) {
-			free(fileInode);
+	if (neededBlocks > fileInode->blocksMapped) {
+		if (allocateBlocks(vol, fileInode, size) == -1) {
+			putInodeBuffer(vol, fileInode);
 			return -1;
 		}
-	} else if (neededBlocks < fileInode->blocksReserved) {
-		deallocateBlocks(fileInode, size);
+	} else if (neededBlocks < fileInode->blocksMapped) {
+		deallocateBlocks(vol, fileInode, size);
 	}
 
 	fileInode->dateModified = time(NULL);
-	writeInode(fileInode);
-	saveMemory();
-	free(fileInode);
+	writeInode(vol, fileInode);
+	saveMemory(vol);
+	putInodeBuffer(vol, fileInode);
 	return 0;
 }
@@ -9,7 +9,11 @@
 *
 * Description: This header file contains the defined macros,
 *	file system structures, and prototypes for functions
-*	used by a driver/shell for this file system.
+*	used by a driver/shell for this file system. Every call
+*	takes the FsVolume returned by fs_mount, so a program can
+*	mount several volumes at once. The makefile builds the
+*	file system as libfs.a and libfs.so for programs that
+*	embed it.
 ****************************************************************/
 
 #ifndef FILE_SYSTEM_H
@@ -21,12 +25,34 @@
 #include <time.h>
 
 #include "fsLow.h"
+#include "ThreadPool.h"
+#include "MemoryPool.h"
+#include "Stats.h"
 
 #define SUPER_SIGNATURE 0x44616c6541726d73
 #define SUPER_SIGNATURE2 0x736d7241656c6144
 #define NUM_DIRECT 10				//Number of direct pointers to data blocks per file
 #define NUM_INDIRECT 2				//Number of indirect pointer to data blocks per file
 #define BLOCKS_PER_INODE 2			//Used to determine number of inodes
+#define HOLE_BLOCK UINT64_MAX		//Block pointer of an unallocated hole, reads back as zeros
+#define WIPE_BLOCKS 64				//Max blocks wiped by a single write
+#define INODE_LOCKS 64				//Number of locks striped across the blocks of the inode table
+#define INODE_GROUP_SIZE 256		//Number of inodes in a group of the inode table
+#define ORLOV_PROBES 4				//Groups checked when placing a directory made in the root
+#define INODE_SIZE 256				//Size of an inode on disk, a power of two so a block holds a whole number of inodes
+#define INODE_VERSION 3				//Layout of the inode, changed whenever its fields move
+#define INLINE_DATA_SIZE 184		//Bytes of data stored in the inode itself, fills the inode to INODE_SIZE
+#define PREFETCH_BLOCKS 16			//Most neighbouring inode table blocks read together by readInodes
+#define INODE_BATCH_SIZE 256		//Most directory entries whose inodes are read together
+#define INODE_SLAB_SIZE 64			//Inode buffers allocated together by the inode pool
+#define BUFFER_SLAB_SIZE 16			//Block buffers allocated together by the block pool
+#define WRITEBACK_INTERVAL_MS 250	//Default time between checks of the background flusher
+#define WRITEBACK_EXPIRE_MS 3000	//Default age at which unflushed writes are written back
+#define WRITEBACK_BACKGROUND_RATIO 10	//Default percent of the volume left unflushed before the flusher writes back
+#define WRITEBACK_HARD_RATIO 30		//Default percent of the volume left unflushed before writers flush themselves
+
+#define DIR_FORMAT_FIXED 1			//Directory entries are fixed size FCBs
+#define DIR_FORMAT_COMPACT 2		//Directory entries are variable length CompactEntry records
 
 #define DIRECTORY_TYPE 1			//Used to signify directories
 #define FILE_TYPE 2					//Used to signify files
@@ -37,10 +63,42 @@
 #define MAX_PATH_NAME 4096			//Max size of the path name
 #define MAX_NAME_SIZE 128			//Max size of a file name
 #define MAX_OPEN_FILES 256			//Max size of file descriptor table
+#define OPEN_FILE_BUCKETS 64		//Hash buckets used to find an open file by its inode
+#define MAX_ENTRY_SIZE 144			//Largest directory entry of either format
 
 #define FS_SEEK_SET 1				//Start of file
 #define FS_SEEK_END 2				//End of file
 #define FS_SEEK_CUR 3				//Current position
+#define FS_SEEK_DATA 4				//Next data at or after offset
+#define FS_SEEK_HOLE 5				//Next hole at or after offset
+
+//Operations timed by fs_stats and recorded by fs_recordStart
+#define FS_OP_FORMAT 0			//fs_format
+#define FS_OP_MKDIR 1			//fs_mkdir
+#define FS_OP_MKFILE 2			//fs_mkfile
+#define FS_OP_RMDIR 3			//fs_rmdir
+#define FS_OP_RM 4				//fs_rm
+#define FS_OP_CP 5				//fs_cp
+#define FS_OP_MV 6				//fs_mv
+#define FS_OP_CPIN 7			//fs_cpin
+#define FS_OP_CPOUT 8			//fs_cpout
+#define FS_OP_CD 9				//fs_cd
+#define FS_OP_LS 10				//fs_ls
+#define FS_OP_LISTDIR 11		//fs_listdir
+#define FS_OP_STAT 12			//fs_stat
+#define FS_OP_RESIZE 13			//fs_resize
+#define FS_OP_RESERVE 14		//fs_reserve
+#define FS_OP_OPEN 15			//fileOpen
+#define FS_OP_CLOSE 16			//fileClose
+#define FS_OP_READ 17			//Every read of file data
+#define FS_OP_WRITE 18			//Every write of file data
+#define FS_OP_SEEK 19			//fileSeek
+#define FS_OP_FSYNC 20			//fileSync
+#define FS_OP_SYNC 21			//fsSync
+#define FS_OP_COUNT 22
+
+/* A mounted volume, see fs_mount. Every call on the file system takes one */
+typedef struct FsVolume FsVolume, *FsVolume_p;
 
 /* Volume Control Block */
 typedef struct SuperBlock {
@@ -59,127 +117,395 @@ typedef struct SuperBlock {
     uint64_t maxBlocksPerFile;		//Max blocks per file
     uint64_t rootDataPointer;		//Pointer to root data block, also start of data blocks
     uint64_t superSignature2;		//Second signature for file system
+    uint64_t refCountStart;			//Pointer to block reference counts, 0 if the volume has none
+    uint64_t blocksUsedByRefCount;	//Number of blocks reserved by reference counts
+    uint64_t inodeSize;				//Size of an inode on disk, must match sizeof(Inode)
+    uint64_t directoryFormat;		//Format of directory entries, DIR_FORMAT_FIXED or DIR_FORMAT_COMPACT
+    uint64_t inodeVersion;			//Layout of an inode on disk, must match INODE_VERSION
 } SuperBlock, *SuperBlock_p;
 
-/* Inodes to point to data */
+/* Inodes to point to data, the fields read on every lookup share the first 8 bytes and the header has no padding */
 typedef struct Inode {
-	uint8_t used;						//Whether this Inode is in use
+	uint8_t used;						//Whether this Inode is in use, must stay the first byte
 	uint8_t type;						//File or Directory
+	uint8_t inlined;					//If the data is stored in inlineData instead of data blocks
+	uint8_t blocksIndirect;				//Number of blocks reserved for indirect blocks
+	uint32_t blocksReserved;			//Number of data blocks reserved for data, holes are not counted
+	uint64_t size;						//Size of file in bytes
 	uint64_t inode;						//Inode number
 	uint64_t parentInodeID;				//Pointer to parent inode
-	uint64_t size;						//Size of file in bytes
-	uint32_t blocksReserved;			//Number of blocks reserved for data
-	uint8_t blocksIndirect;				//Number of blocks reserved for indirect blocks
 	time_t dateModified;				//Date when the file/directory was last modified
-	uint64_t directData[NUM_DIRECT]; 	//Pointers directly to data blocks
-	uint64_t indirectData[NUM_INDIRECT];//Pointers to data block that points to other data blocks
+	uint64_t subtreeSize;				//Total size of every file and directory below this directory
+	uint64_t subtreeReserved;			//Total blocks reserved by every file and directory below this directory
+	uint64_t subtreeFiles;				//Number of files below this directory
+	uint64_t blocksMapped;				//Number of blocks covered by the block map, holes included
+	union {
+		struct {
+			uint64_t directData[NUM_DIRECT]; 	//Pointers directly to data blocks
+			uint64_t indirectData[NUM_INDIRECT];//Pointers to data block that points to other data blocks
+		};
+		uint8_t inlineData[INLINE_DATA_SIZE];	//Data of a small file or directory
+	};
 } Inode, *Inode_p;
 
-/* File Control Block */
+_Static_assert(sizeof(Inode) == INODE_SIZE, "Inode must be exactly INODE_SIZE bytes");
+
+/* File Control Block, the directory entry of DIR_FORMAT_FIXED */
 typedef struct FCB {
 	uint64_t inodeID;					//Number of inode
 	char name[MAX_NAME_SIZE];			//Name of file
 } FCB, *FCB_p;
 
+/* Directory entry of DIR_FORMAT_COMPACT. The name follows without a terminator,
+ * and the record is padded to a multiple of 8 bytes. */
+typedef struct CompactEntry {
+	uint64_t inodeID;					//Number of inode
+	uint32_t nameHash;					//Hash of the name, compared before the name itself
+	uint8_t type;						//File or Directory
+	uint8_t nameLength;					//Length of the name
+	uint16_t recordLength;				//Bytes from the start of this entry to the next
+} CompactEntry, *CompactEntry_p;
+
+/* A directory entry read from either format */
+typedef struct DirEntry {
+	uint64_t inodeID;					//Number of inode
+	uint8_t type;						//File or Directory, 0 if the format does not store it
+	char name[MAX_NAME_SIZE];			//Name of file
+} DirEntry, *DirEntry_p;
+
+/* Called with each entry of a directory and the entry's inode, see fs_listdir */
+typedef void (*DirEntryCallback)(DirEntry_p entry, Inode_p inode, void* arg);
+
+/* An inode requested from readInodes, sorted by ID to read the inode table in order */
+typedef struct InodeSlot {
+	uint64_t inodeID;					//Number of inode
+	uint64_t index;						//Position of the inode in the caller's array
+} InodeSlot, *InodeSlot_p;
+
+/* Cached indirect blocks used while walking the block map of an inode */
+typedef struct BlockMap {
+	Inode_p inode;						//Inode the block map belongs to
+	uint64_t* indirect;					//Single indirect block currently loaded
+	uint64_t indirectBlock;				//Data block held in indirect, HOLE_BLOCK if none
+	uint8_t indirectDirty;				//If indirect must be written back
+	uint64_t* doubleIndirect;			//Double indirect block currently loaded
+	uint64_t doubleIndirectBlock;		//Data block held in doubleIndirect, HOLE_BLOCK if none
+	uint8_t doubleIndirectDirty;		//If doubleIndirect must be written back
+	uint64_t* pool;						//Free blocks reserved for filling holes
+	uint64_t poolSize;					//Number of blocks in the pool
+	uint64_t poolNext;					//Next unused block in the pool
+} BlockMap, *BlockMap_p;
+
+/* Reads the entries of a directory a block at a time, see dirOpen */
+typedef struct DirIterator {
+	Inode dirInode;						//Copy of the directory being read
+	BlockMap map;						//Block map of dirInode
+	uint8_t* window;					//Part of the directory held in memory, a block plus the largest entry
+	uint64_t windowStart;				//Byte offset in the directory of the start of window
+	uint64_t windowLength;				//Number of bytes held in window
+	uint64_t position;					//Byte offset in the directory of the next entry
+} DirIterator, *DirIterator_p;
+
+/* Work handed to the thread pool when copying or deleting a directory tree */
+typedef struct TreeTask {
+	FsVolume_p volume;					//Volume holding the tree
+	ThreadPool_p pool;					//Pool running the tree operation, NULL to run on this thread
+	uint64_t srcInodeID;				//Directory to copy or delete
+	uint64_t destInodeID;				//Directory to copy into
+	uint8_t reflink;					//If copied files share the data blocks of the source
+	uint8_t* failed;					//Set if any part of the tree operation failed
+} TreeTask, *TreeTask_p;
+
+/* An open file, shared by every file descriptor open on the same inode */
+typedef struct OpenFile {
+	Inode inode;						//In memory inode used by all of the file descriptors
+	uint32_t refCount;					//Number of file descriptors using the open file
+	int8_t durability;					//Durability of writes to the file, DURABILITY_DEFAULT to follow the partition
+	int64_t pendingSize;				//Change in size not yet added to the totals of the ancestors
+	int64_t pendingReserved;			//Change in reserved blocks not yet added to the totals of the ancestors
+	int32_t next;						//Next open file in the same bucket, or the next free open file
+} OpenFile, *OpenFile_p;
+
 /* File Descriptor */
 typedef struct FileDescriptor {
 	uint8_t used;						//If file descriptor is in use
-	Inode_p inode;
+	Inode_p inode;						//Inode of the shared open file
 	uint64_t byteOffset;				//Pointer where to start read/write
+	int32_t openFile;					//Index of the open file in the open file table
+	int32_t nextFree;					//Next free file descriptor while this one is unused
 } FileDescriptor, *FileDescriptor_p;
 
+/* A buffer for the vectored reads and writes, like struct iovec */
+typedef struct FileVector {
+	uint8_t* buffer;					//Start of the buffer
+	uint64_t length;					//Number of bytes in the buffer
+} FileVector, *FileVector_p;
+
+/* Position within an array of FileVectors */
+typedef struct VectorCursor {
+	FileVector_p vectors;				//Vectors being walked through
+	uint32_t count;						//Number of vectors
+	uint32_t index;						//Vector the cursor is in
+	uint64_t offset;					//Byte offset within that vector
+} VectorCursor, *VectorCursor_p;
+
+/* When the background flusher writes back */
+typedef struct WritebackConfig {
+	uint32_t intervalMs;				//Time between checks for anything to write back
+	uint32_t expireMs;					//Age at which unflushed writes and deferred memory are written back
+	uint32_t backgroundRatio;			//Percent of the volume left unflushed before the flusher writes back
+	uint32_t hardRatio;					//Percent of the volume left unflushed before writers flush themselves, 0 for no limit
+} WritebackConfig, *WritebackConfig_p;
+
+/* Work done by the block allocator since the program started or the stats were reset */
+typedef struct AllocStats {
+	uint64_t calls;						//Searches for free blocks
+	uint64_t blocks;					//Blocks handed out by the searches
+	uint64_t bitsExamined;				//Bits of the bitVector looked at by the searches
+	uint64_t holes;						//Holes the blocks were taken from
+	uint64_t fallbacks;					//Searches that found no hole large enough and took several
+	uint64_t nanoseconds;				//Time spent searching
+	uint64_t maxNanoseconds;			//Longest search
+} AllocStats, *AllocStats_p;
+
+/* Snapshot of the work done by the file system, see fs_stats */
+typedef struct FsStats {
+	LatencyHistogram ops[FS_OP_COUNT];	//Nanoseconds taken by each operation, indexed by FS_OP_*
+	lbaStats_t lba;						//Work done by the LBA functions
+	AllocStats alloc;					//Work done by the block allocator
+} FsStats, *FsStats_p;
+
 typedef struct WorkingDirectory {
 	uint64_t inodeID;					//Inode ID of the current directory
 	char wdPath[MAX_PATH_NAME];			//Full path name to current directory
 	uint32_t pathLength;				//Stored path length
 } WorkingDirectory, *WorkingDirectory_p;
 
-extern SuperBlock_p sb;					//Global super block
-extern uint8_t* bitVector;				//Global bit vector
-extern WorkingDirectory_p wd;			//Global working directory
-extern FileDescriptor_p fdTable;		//Global file table
+/* Size and use of a mounted volume, see fs_volumeInfo */
+typedef struct VolumeInfo {
+	uint64_t blockSize;					//Bytes in a block
+	uint64_t numberOfBlocks;			//Blocks of the partition
+	uint64_t totalDataBlocks;			//Blocks that can hold data, 0 until the volume is formatted
+	uint64_t freeDataBlocks;			//Data blocks not in use
+	uint64_t numInodes;					//Total number of inodes
+	uint64_t usedInodes;				//Number of used inodes
+} VolumeInfo, *VolumeInfo_p;
+
+extern const char* fsOpNames[FS_OP_COUNT];	//Name of each operation timed by fs_stats
+
+/**
+ * Opens the partition in the file and loads the file system on it, if it has one.
+ * A file that does not exist is created, see startPartitionSystem. Any number of
+ * volumes can be mounted at once, each with its own locks, buffers and flusher.
+ * @param fileName the file holding the partition
+ * @param volumeSize the size of a new partition, set to the size of the partition
+ * @param blockSize the block size of a new partition, set to the block size of the partition
+ * @param durability when writes are flushed, DURABILITY_NONE, DURABILITY_ORDERED or DURABILITY_FULL
+ * @returns the volume, which must be formatted before use if check_fs returns 0
+ * @returns NULL if the partition could not be opened
+ */
+FsVolume_p fs_mount(char* fileName, uint64_t* volumeSize, uint64_t* blockSize, int durability);
 
 /**
- * Checks for the filesystem on this partition, by checking the signatures of the first block for a match.
+ * Stops the flusher and any recording of the volume, writes everything back,
+ * closes the partition and frees the volume. Open files are dropped.
+ * @param vol the volume, not used again
+ */
+void fs_unmount(FsVolume_p vol);
+
+/**
+ * Checks if the volume holds a file system, found when it was mounted or made by fs_format.
+ * @param vol the volume
  * @returns 1 if filesystem exists
  * @returns 0 if filesystem does not exist.
  */
-int check_fs();
+int check_fs(FsVolume_p vol);
+
+/**
+ * Returns the full path of the working directory.
+ * @param vol the volume
+ * @returns the path, valid until the next call that changes directory
+ * @returns NULL if the volume is not formatted
+ */
+char* fs_getcwd(FsVolume_p vol);
+
+/**
+ * Copies the size and use of the volume.
+ * @param vol the volume
+ * @param info where to copy them
+ */
+void fs_volumeInfo(FsVolume_p vol, VolumeInfo_p info);
+
+/**
+ * Returns the partition the volume is stored on, for the LBA functions such as tracing.
+ * @param vol the volume
+ * @returns the partition
+ */
+partition_p fs_partition(FsVolume_p vol);
 
 /**
  * Formats the current partition and installs a new filesystem.
+ * @param vol the volume
+ * @param directoryFormat the format of directory entries, DIR_FORMAT_FIXED or DIR_FORMAT_COMPACT
  * @returns 0 if format was successful
  * @returns -1 if format was unsuccessful
  */
-int fs_format();
+int fs_format(FsVolume_p vol, uint8_t directoryFormat);
 
 /** Outputs data about the current filesystem */
-void fs_lsfs();
+void fs_lsfs(FsVolume_p vol);
 
 /** Lists the files in the current directory */
-void fs_ls();
+void fs_ls(FsVolume_p vol);
+
+/**
+ * Calls the callback with every entry of the directory and the entry's inode.
+ * @param vol the volume
+ * @param path the path of the directory
+ * @param callback the function called for each entry
+ * @param arg passed to the callback
+ * @returns the number of entries
+ * @returns -1 if the path does not exist or is not a directory
+ */
+int64_t fs_listdir(FsVolume_p vol, char* path, DirEntryCallback callback, void* arg);
+
+/**
+ * Copies the inode of the file or directory at the path.
+ * @param vol the volume
+ * @param path the path of the file or directory
+ * @param inode where to copy the inode
+ * @returns 0 if successful
+ * @returns -1 if the path does not exist
+ */
+int fs_stat(FsVolume_p vol, char* path, Inode_p inode);
+
+/**
+ * Counts the fragments of a file, the runs of consecutive data blocks
+ * its blocks are stored in. Holes are not counted.
+ * @param vol the volume
+ * @param path the path of the file or directory
+ * @returns the number of fragments, 0 if the data is inline or all holes
+ * @returns -1 if the path does not exist
+ */
+int64_t fs_fragments(FsVolume_p vol, char* path);
+
+/**
+ * Counts the runs of free data blocks by length. Runs of length 2^i up to
+ * 2^(i+1) - 1 are counted in histogram[i], and longer runs in the last bucket.
+ * @param vol the volume
+ * @param histogram where to count the runs
+ * @param buckets the number of buckets in the histogram
+ * @param largestRun set to the length of the longest run
+ * @returns the number of runs
+ */
+uint64_t fs_freeRuns(FsVolume_p vol, uint64_t* histogram, uint32_t buckets, uint64_t* largestRun);
+
+/**
+ * Copies the work done by the block allocator.
+ * @param vol the volume
+ * @param stats where to copy the stats
+ * @param reset 1 to start counting again from zero
+ */
+void fs_allocStats(FsVolume_p vol, AllocStats_p stats, uint8_t reset);
+
+/**
+ * Copies the counts and latency histograms of the operations, the work done
+ * by the LBA functions and the work done by the block allocator.
+ * @param vol the volume
+ * @param stats where to copy the stats
+ * @param reset 1 to start counting again from zero
+ */
+void fs_stats(FsVolume_p vol, FsStats_p stats, uint8_t reset);
+
+/**
+ * Starts recording the operations called, with their arguments and timing, to a
+ * log for fsreplay. The log starts with a cd to the working directory, so the
+ * relative paths that follow replay against the same directory.
+ * @param vol the volume
+ * @param fileName the log to create, replaced if it exists
+ * @returns 0 if successful
+ * @returns -1 if a volume is already being recorded or the log could not be created
+ */
+int fs_recordStart(FsVolume_p vol, char* fileName);
+
+/**
+ * Stops recording the operations and closes the log.
+ * @param vol the volume
+ */
+void fs_recordStop(FsVolume_p vol);
 
 /**
  * Creates a directory of the given name.
+ * @param vol the volume
  * @param directoryName the name of the directory to create
  * @returns 0 if sucessful
  * @returns -1 if it could not create directory
  */
-int fs_mkdir(char* directoryName);
+int fs_mkdir(FsVolume_p vol, char* directoryName);
 
 /**
  * Creates a file of the given name and size
+ * @param vol the volume
  * @param fileName the name of the file to create
  * @param size the size in bytes to determine the number of blocks to reserve
  * @returns 0 if sucessful
  * @returns -1 if it could not create file
  */
-int fs_mkfile(char* fileName, uint64_t size);
+int fs_mkfile(FsVolume_p vol, char* fileName, uint64_t size);
 
 /**
- * Deletes the directory with the given name.
+ * Deletes the directory with the given name and everything in it, without
+ * asking. Callers that want a confirmation ask before calling.
+ * @param vol the volume
  * @param directoryName the name of the directory to delete
  * @returns 1 if successful
  * @returns 0 if it could not delete directory
  * @returns -1 if not a directory
  */
-int fs_rmdir(char* directoryName);
+int fs_rmdir(FsVolume_p vol, char* directoryName);
 
 /**
- * Copies the file from source to destination
+ * Copies the file from source to destination. A reflink copy shares the data
+ * blocks of the source instead of copying them, and a block is only copied
+ * once either file writes to it.
+ * @param vol the volume
  * @param sourceFile the source file to copy from
  * @param destFile the destination file to copy to
+ * @param reflink 1 to share the data blocks, 0 to copy them
  * @returns 0 if successful
  * @returns -1 if could not copy file
  * @returns -2 if source file does not exist
  */
-int fs_cp(char* sourceFile, char* destFile);
+int fs_cp(FsVolume_p vol, char* sourceFile, char* destFile, uint8_t reflink);
 
 /**
  * Moves the file from source to destination. If the destination is a directory
  * file will be moved into the directory. If the destination is a file, the file will
  * be overwritten by source file.
+ * @param vol the volume
  * @param sourceFile the source file to move
  * @param destFile the destination of the file
  * @returns 0 if successful
  * @returns -1 if could not move file
  * @returns -2 if source file does not exist
  */
-int fs_mv(char* sourceFile, char* destFile);
+int fs_mv(FsVolume_p vol, char* sourceFile, char* destFile);
 
 /**
  * Deletes the file with the given name. Frees up any allocated blocks
  * and removes the file from the directory.
+ * @param vol the volume
  * @param filename the name of the file to remove
  * @returns 0 if successful
  * @returns -1 if could not delete file
  * @returns -2 if file does not exist
  */
-int fs_rm(char* filename);
+int fs_rm(FsVolume_p vol, char* filename);
 
 /**
  * Copies a file from another filesystem to destination
  * in current filesystem.
+ * @param vol the volume
  * @param sourceFile the source file from another file system to copy from
  * @param destFile the destination file in this file system to copy the file to
  * @returns 0 if successful
@@ -187,10 +513,11 @@ int fs_rm(char* filename);
  * @returns -2 if could not open source file
  * @returns -3 if could not open destination file
  */
-int fs_cpin(char* sourceFile, char* destFile);
+int fs_cpin(FsVolume_p vol, char* sourceFile, char* destFile);
 
 /**
  * Copies a file from this filesystem to another filesystem
+ * @param vol the volume
  * @param sourceFile the source file in this file system to copy from
  * @param destFile the destination file in another file system to copy the file to
  * @returns 0 if successful
@@ -198,45 +525,207 @@ int fs_cpin(char* sourceFile, char* destFile);
  * @returns -2 if could not open source file
  * @returns -3 if could not open destination file
  */
-int fs_cpout(char* sourceFile, char* destFile);
+int fs_cpout(FsVolume_p vol, char* sourceFile, char* destFile);
 
 /**
  * Changes directory to the given path.
  * "cd /" or "cd" to go to root
+ * @param vol the volume
  * @param path the path to parse and change directory to
  * @returns 0 if successful
  * @returns -1 if unsuccessful
  */
-int fs_cd(char* path);
+int fs_cd(FsVolume_p vol, char* path);
 
 /**
  * Prints the full working directory
+ * @param vol the volume
  */
-void fs_pwd();
+void fs_pwd(FsVolume_p vol);
 
 /**
- * Resizes the file. Maximum is capped by the number of available blocks to hold the requested size.
- * When increasing the size, if the size is greater than the currently allocated blocks,
- * new blocks will be wiped and allocated to the file.
+ * Resizes the file. Maximum is capped by the max file size.
+ * When increasing the size, if the size is greater than the currently reserved blocks,
+ * the new blocks are left as holes that read as zeros and are allocated when written to.
  * Resize does not deallocate blocks, reserve command must be used.
+ * @param vol the volume
  * @param file the file to resize
  * @param value the number of bytes to resize to
  * @returns 0 if successful
  * @returns -1 if could not resize file
  * @returns -2 if file could not be found
  */
-int fs_resize(char* file, uint64_t size);
+int fs_resize(FsVolume_p vol, char* file, uint64_t size);
 
 /**
  * Resizes the reserved blocks to hold the number of bytes requested. Minimum reserved is one block
  * or the minium blocks needed to hold the current size of the file. Maximum blocks are limited by
  * the number of available free blocks to be allocated.
+ * @param vol the volume
  * @param file the file to change the reserved block size
  * @param value the size in bytes to calculate the number of blocks to reserve
  * @returns 0 if successful
  * @returns -1 if could not resize file
  * @returns -2 if file could not be found
  */
-int fs_reserve(char* file, uint64_t size);
+int fs_reserve(FsVolume_p vol, char* file, uint64_t size);
+
+/**
+ * Finds the file at the given path and copies the inode
+ * to the file descriptor table.
+ * @param vol the volume
+ * @param file the path or filename of the file to open
+ * @returns the file descriptor index in the file descriptor table
+ * @returns -1 if unsuccessful
+ */
+int fileOpen(FsVolume_p vol, char* file);
+
+/**
+ * Closes the file and removes it from the file descriptor table
+ * @param vol the volume
+ * @param fd the file descriptor to close
+ * @returns 1 if successful
+ * @returns 0 if unsuccessful
+ */
+int fileClose(FsVolume_p vol, int fd);
+
+/**
+ * Writes to the file in the file descriptor, length in bytes
+ * from the given buffer.
+ * @param vol the volume
+ * @param fd the file descriptor to write to
+ * @param buffer the source data to write from
+ * @param length the number of bytes to write
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t fileWrite(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length);
+
+/**
+ * Reads from the file in the file descriptor, length in bytes
+ * from the given buffer.
+ * @param vol the volume
+ * @param fd the file descriptor to read from
+ * @param buffer the buffer to store the read bytes
+ * @param length the number of bytes to read
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t fileRead(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length);
+
+/**
+ * Moves the file pointer to the given offset from the position.
+ * Seeking to data or a hole searches from the given offset, the end
+ * of the file counts as a hole.
+ * @param vol the volume
+ * @param fd the file descriptor to modify
+ * @param offset the number of bytes to offset from the method
+ * @param method the method (start, end, cur, data, hole) to initially set the pointer
+ * @returns 1 if successful
+ * @returns 0 if unsuccessful
+ */
+int fileSeek(FsVolume_p vol, int fd, int64_t offset, uint8_t method);
+
+/**
+ * Writes to the file in the file descriptor at the given offset,
+ * without using or moving the file descriptor's offset.
+ * @param vol the volume
+ * @param fd the file descriptor to write to
+ * @param buffer the source data to write from
+ * @param length the number of bytes to write
+ * @param offset the byte offset in the file to write at
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t filePwrite(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length, uint64_t offset);
+
+/**
+ * Reads from the file in the file descriptor at the given offset,
+ * without using or moving the file descriptor's offset. Several threads
+ * can read the same file descriptor at once.
+ * @param vol the volume
+ * @param fd the file descriptor to read from
+ * @param buffer the buffer to store the read bytes
+ * @param length the number of bytes to read
+ * @param offset the byte offset in the file to read from
+ * @returns the number of bytes read, 0 at the end of the file
+ * @returns -1 if error
+ */
+int64_t filePread(FsVolume_p vol, int fd, uint8_t* buffer, uint64_t length, uint64_t offset);
+
+/**
+ * Writes the vectors one after another to the file in the file descriptor
+ * at the given offset, without using or moving the file descriptor's offset.
+ * @param vol the volume
+ * @param fd the file descriptor to write to
+ * @param vectors the buffers to write from
+ * @param count the number of vectors
+ * @param offset the byte offset in the file to write at
+ * @returns the number of bytes written
+ * @returns -1 if error
+ */
+int64_t filePwritev(FsVolume_p vol, int fd, FileVector_p vectors, uint32_t count, uint64_t offset);
+
+/**
+ * Reads from the file in the file descriptor into the vectors one after another,
+ * starting at the given offset, without using or moving the file descriptor's offset.
+ * @param vol the volume
+ * @param fd the file descriptor to read from
+ * @param vectors the buffers to read into
+ * @param count the number of vectors
+ * @param offset the byte offset in the file to read from
+ * @returns the number of bytes read, 0 at the end of the file
+ * @returns -1 if error
+ */
+int64_t filePreadv(FsVolume_p vol, int fd, FileVector_p vectors, uint32_t count, uint64_t offset);
+
+/**
+ * Writes the bitVector, reference counts and SuperBlock, then the inode of
+ * the file in the file descriptor, and flushes every write made so far to the disk.
+ * @param vol the volume
+ * @param fd the file descriptor to sync
+ * @returns 0 if successful
+ * @returns -1 if error
+ */
+int fileSync(FsVolume_p vol, int fd);
+
+/**
+ * Sets when the writes made through the file are flushed, for every file
+ * descriptor open on the file, until the last of them is closed.
+ * @param vol the volume
+ * @param fd a file descriptor of the file
+ * @param durability DURABILITY_NONE, DURABILITY_ORDERED, DURABILITY_FULL,
+ * or DURABILITY_DEFAULT to follow the partition
+ * @returns 0 if successful
+ * @returns -1 if error
+ */
+int fileSetDurability(FsVolume_p vol, int fd, int durability);
+
+/**
+ * Saves the bitVector, reference counts and superblock, even during a
+ * batch, and flushes every write made so far to the disk.
+ * @param vol the volume
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsSync(FsVolume_p vol);
+
+/**
+ * Starts the background flusher of the mounted volume, restarting it if it
+ * is already running. Writers that leave more than the hard ratio of the
+ * volume unflushed flush it themselves.
+ * @param vol the volume
+ * @param config when to write back, NULL for the defaults
+ * @returns 0 if successful
+ * @returns -1 if the flusher could not be started
+ */
+int startWriteback(FsVolume_p vol, WritebackConfig_p config);
+
+/**
+ * Stops the background flusher, if it is running, and writes back
+ * everything it was holding. Must be called before the partition is closed.
+ * @param vol the volume
+ */
+void stopWriteback(FsVolume_p vol);
 
 #endif
@@ -0,0 +1,421 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: FsClient.c
+*
+* Description: This file contains the implementation of the
+*	client library of fsserver, which queues requests, sends
+*	them in batches and reads back the answers in order.
+****************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "FsClient.h"
+
+#define CLIENT_BUFFER_SIZE 65536		//Starting size of the buffers, they grow to fit larger messages
+
+/* A connection to fsserver */
+struct FsClient {
+	int socket;
+	uint64_t nextID;					//Id of the next request
+	uint64_t pending;					//Requests queued or sent that have not been answered
+	uint8_t* out;						//Requests queued and not yet sent
+	uint64_t outLength;
+	uint64_t outCapacity;
+	uint8_t* in;						//Bytes received and not yet handed out
+	uint64_t inStart;					//First byte not handed out
+	uint64_t inLength;					//Bytes of in that were received
+	uint64_t inCapacity;
+};
+
+/**
+ * Connects to a server.
+ * @param socketPath the socket the server listens on
+ * @returns the connection
+ * @returns NULL if the server could not be reached
+ */
+FsClient_p fsc_connect(const char* socketPath) {
+	struct sockaddr_un address;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+		return NULL;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return NULL;
+	if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	FsClient_p client = calloc(1, sizeof(FsClient));
+	client->socket = fd;
+	client->outCapacity = CLIENT_BUFFER_SIZE;
+	client->out = malloc(client->outCapacity);
+	client->inCapacity = CLIENT_BUFFER_SIZE;
+	client->in = malloc(client->inCapacity);
+	return client;
+}
+
+/**
+ * Closes the connection. The server closes the files it left open.
+ * @param client the connection, not used again
+ */
+void fsc_disconnect(FsClient_p client) {
+	close(client->socket);
+	free(client->out);
+	free(client->in);
+	free(client);
+}
+
+/**
+ * Queues a request to be sent by the next fsc_flush. Requests are answered
+ * in the order they were queued, so many can be in flight at once.
+ * @param client the connection
+ * @param op the operation, see FSP_*
+ * @param path the path, NULL if none
+ * @param fd the file descriptor, -1 if none
+ * @param size bytes to read or reserve, by operation
+ * @param offset offset of a read or write, -1 for the file descriptor's offset
+ * @param data the data written, NULL if none
+ * @param dataLength bytes of data, at most FSP_MAX_DATA
+ * @returns the id of the request
+ * @returns -1 if the request is too large
+ */
+int64_t fsc_send(FsClient_p client, uint8_t op, char* path, int32_t fd, uint64_t size, int64_t offset,
+		const void* data, uint32_t dataLength) {
+	FsRequest request;
+	size_t pathLength = (path != NULL) ? strlen(path) : 0;
+
+	if (pathLength >= MAX_PATH_NAME || dataLength > FSP_MAX_DATA || (op == FSP_READ && size > FSP_MAX_DATA))
+		return -1;
+
+	memset(&request, 0, sizeof(FsRequest));
+	request.id = client->nextID++;
+	request.size = size;
+	request.offset = offset;
+	request.fd = fd;
+	request.dataLength = dataLength;
+	request.pathLength = pathLength;
+	request.op = op;
+
+	uint64_t length = sizeof(FsRequest) + pathLength + dataLength;
+	if (client->outLength + length > client->outCapacity) {
+		while (client->outLength + length > client->outCapacity)
+			client->outCapacity *= 2;
+		client->out = realloc(client->out, client->outCapacity);
+	}
+	memcpy(client->out + client->outLength, &request, sizeof(FsRequest));
+	if (pathLength > 0)
+		memcpy(client->out + client->outLength + sizeof(FsRequest), path, pathLength);
+	if (dataLength > 0)
+		memcpy(client->out + client->outLength + sizeof(FsRequest) + pathLength, data, dataLength);
+	client->outLength += length;
+	client->pending++;
+	return request.id;
+}
+
+/**
+ * Sends every queued request to the server in one write.
+ * @param client the connection
+ * @returns 0 if successful
+ * @returns -1 if the connection was lost
+ */
+int fsc_flush(FsClient_p client) {
+	uint64_t sent = 0;
+
+	while (sent < client->outLength) {
+		ssize_t written = send(client->socket, client->out + sent, client->outLength - sent, MSG_NOSIGNAL);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		sent += written;
+	}
+	client->outLength = 0;
+	return 0;
+}
+
+/**
+ * Reads from the server until at least the given number of bytes are waiting to
+ * be handed out. Reads as much as the buffer holds, so answers sent together are
+ * received together.
+ * @param client the connection
+ * @param needed the bytes needed after inStart
+ * @returns 0 if successful
+ * @returns -1 if the connection was lost
+ */
+static int fillInput(FsClient_p client, uint64_t needed) {
+	if (client->inStart + needed > client->inCapacity) {
+		//Move what is left to the front, then grow the buffer if it still does not fit
+		memmove(client->in, client->in + client->inStart, client->inLength - client->inStart);
+		client->inLength -= client->inStart;
+		client->inStart = 0;
+		if (needed > client->inCapacity) {
+			while (needed > client->inCapacity)
+				client->inCapacity *= 2;
+			client->in = realloc(client->in, client->inCapacity);
+		}
+	}
+	while (client->inLength - client->inStart < needed) {
+		ssize_t received = recv(client->socket, client->in + client->inLength, client->inCapacity - client->inLength, 0);
+		if (received == -1 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return -1;
+		client->inLength += received;
+	}
+	return 0;
+}
+
+/**
+ * Waits for the answer to the oldest request sent and not yet answered.
+ * @param client the connection
+ * @param reply where to store the answer
+ * @returns 0 if successful
+ * @returns -1 if the connection was lost or no request is waiting for an answer
+ */
+int fsc_receive(FsClient_p client, FsReply_p reply) {
+	FsResponse response;
+
+	if (client->pending == 0)
+		return -1;
+	if (client->outLength > 0 && fsc_flush(client) == -1)
+		return -1;
+	if (fillInput(client, sizeof(FsResponse)) == -1)
+		return -1;
+	memcpy(&response, client->in + client->inStart, sizeof(FsResponse));
+	if (fillInput(client, sizeof(FsResponse) + response.dataLength) == -1)
+		return -1;
+
+	reply->id = response.id;
+	reply->result = response.result;
+	reply->data = client->in + client->inStart + sizeof(FsResponse);
+	reply->dataLength = response.dataLength;
+	client->inStart += sizeof(FsResponse) + response.dataLength;
+	client->pending--;
+	return 0;
+}
+
+/**
+ * Counts the requests queued or sent that have not been answered yet.
+ * @param client the connection
+ * @returns the number of requests
+ */
+uint64_t fsc_pending(FsClient_p client) {
+	return client->pending;
+}
+
+/**
+ * Sends one request and waits for its answer.
+ * @param client the connection
+ * @param reply where to store the answer
+ * @param op the operation, see FSP_*
+ * @param path the path, NULL if none
+ * @param fd the file descriptor, -1 if none
+ * @param size bytes to read or reserve, by operation
+ * @param offset offset of a read or write
+ * @param data the data written, NULL if none
+ * @param dataLength bytes of data
+ * @returns the result of the operation
+ * @returns -1 if unsuccessful or other requests are waiting for an answer
+ */
+static int64_t callServer(FsClient_p client, FsReply_p reply, uint8_t op, char* path, int32_t fd, uint64_t size,
+		int64_t offset, const void* data, uint32_t dataLength) {
+	if (client->pending > 0)
+		return -1;
+	if (fsc_send(client, op, path, fd, size, offset, data, dataLength) == -1)
+		return -1;
+	if (fsc_receive(client, reply) == -1)
+		return -1;
+	return reply->result;
+}
+
+/**
+ * Opens a file on the server.
+ * @param client the connection
+ * @param path the path of the file
+ * @returns the file descriptor
+ * @returns -1 if unsuccessful
+ */
+int fsc_open(FsClient_p client, char* path) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_OPEN, path, -1, 0, 0, NULL, 0);
+}
+
+/**
+ * Closes a file descriptor opened by this connection.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_close(FsClient_p client, int fd) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_CLOSE, NULL, fd, 0, 0, NULL, 0);
+}
+
+/**
+ * Reads from a file.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @param buffer where to store the data
+ * @param length bytes to read, at most FSP_MAX_DATA
+ * @param offset where to read from, -1 to read from the file descriptor's offset and move it
+ * @returns the number of bytes read
+ * @returns -1 if unsuccessful
+ */
+int64_t fsc_read(FsClient_p client, int fd, void* buffer, uint64_t length, int64_t offset) {
+	FsReply reply;
+	int64_t result = callServer(client, &reply, FSP_READ, NULL, fd, length, offset, NULL, 0);
+	if (result > 0)
+		memcpy(buffer, reply.data, reply.dataLength);
+	return result;
+}
+
+/**
+ * Writes to a file.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @param buffer the data to write
+ * @param length bytes to write, at most FSP_MAX_DATA
+ * @param offset where to write, -1 to write at the file descriptor's offset and move it
+ * @returns the number of bytes written
+ * @returns -1 if unsuccessful
+ */
+int64_t fsc_write(FsClient_p client, int fd, const void* buffer, uint64_t length, int64_t offset) {
+	FsReply reply;
+	if (length > FSP_MAX_DATA)
+		return -1;
+	return callServer(client, &reply, FSP_WRITE, NULL, fd, 0, offset, buffer, length);
+}
+
+/**
+ * Copies the inode of a file or directory.
+ * @param client the connection
+ * @param path the path of the file or directory
+ * @param inode where to copy the inode
+ * @returns 0 if successful
+ * @returns -1 if the path does not exist
+ */
+int fsc_stat(FsClient_p client, char* path, Inode_p inode) {
+	FsReply reply;
+	int64_t result = callServer(client, &reply, FSP_STAT, path, -1, 0, 0, NULL, 0);
+	if (result == 0 && reply.dataLength == sizeof(Inode))
+		memcpy(inode, reply.data, sizeof(Inode));
+	return (result == 0 && reply.dataLength == sizeof(Inode)) ? 0 : -1;
+}
+
+/**
+ * Calls the callback with every entry of a directory.
+ * @param client the connection
+ * @param path the path of the directory
+ * @param callback the function called for each entry
+ * @param arg passed to the callback
+ * @returns the number of entries
+ * @returns -1 if the path does not exist or is not a directory
+ */
+int64_t fsc_readdir(FsClient_p client, char* path, FsEntryCallback callback, void* arg) {
+	FsReply reply;
+	FsWireEntry wire;
+	FsEntry entry;
+
+	int64_t result = callServer(client, &reply, FSP_READDIR, path, -1, 0, 0, NULL, 0);
+	if (result == -1)
+		return -1;
+	for (uint32_t position = 0; position + sizeof(FsWireEntry) <= reply.dataLength; ) {
+		memcpy(&wire, reply.data + position, sizeof(FsWireEntry));
+		uint16_t nameLength = (wire.nameLength < MAX_NAME_SIZE) ? wire.nameLength : MAX_NAME_SIZE - 1;
+		entry.inodeID = wire.inodeID;
+		entry.size = wire.size;
+		entry.type = wire.type;
+		memcpy(entry.name, reply.data + position + sizeof(FsWireEntry), nameLength);
+		entry.name[nameLength] = '\0';
+		callback(&entry, arg);
+		position += sizeof(FsWireEntry) + wire.nameLength;
+	}
+	return result;
+}
+
+/**
+ * Creates a file.
+ * @param client the connection
+ * @param path the path of the file
+ * @param size the bytes to reserve blocks for
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_create(FsClient_p client, char* path, uint64_t size) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_CREATE, path, -1, size, 0, NULL, 0);
+}
+
+/**
+ * Creates a directory.
+ * @param client the connection
+ * @param path the path of the directory
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_mkdir(FsClient_p client, char* path) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_MKDIR, path, -1, 0, 0, NULL, 0);
+}
+
+/**
+ * Removes a file.
+ * @param client the connection
+ * @param path the path of the file
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_remove(FsClient_p client, char* path) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_REMOVE, path, -1, 0, 0, NULL, 0);
+}
+
+/**
+ * Removes a directory and everything in it.
+ * @param client the connection
+ * @param path the path of the directory
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_rmdir(FsClient_p client, char* path) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_RMDIR, path, -1, 0, 0, NULL, 0);
+}
+
+/**
+ * Writes back a file and flushes the volume to the disk.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_fsync(FsClient_p client, int fd) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_FSYNC, NULL, fd, 0, 0, NULL, 0);
+}
+
+/**
+ * Writes back and flushes the whole volume to the disk.
+ * @param client the connection
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_sync(FsClient_p client) {
+	FsReply reply;
+	return callServer(client, &reply, FSP_SYNC, NULL, -1, 0, 0, NULL, 0);
+}
@@ -0,0 +1,276 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: FsClient.h
+*
+* Description: This header file contains the protocol spoken
+*	between fsserver and its clients over a Unix domain socket,
+*	and the prototypes of the client library. fsserver owns one
+*	volume, so processes that share the volume through it see
+*	one set of inodes, bit vector and open files.
+*
+*	A request is an FsRequest followed by pathLength bytes of its
+*	path, without a terminator, and dataLength bytes of data. The
+*	server answers the requests of a connection in the order they
+*	were sent, each with an FsResponse followed by dataLength bytes
+*	of data, so a client may send many requests before reading any
+*	answer, and may send several in one write.
+****************************************************************/
+
+#ifndef FS_CLIENT_H
+#define FS_CLIENT_H
+
+#include <stdint.h>
+#include "FileSystem.h"
+
+#define FSP_DEFAULT_SOCKET "fsserver.sock"	//Socket fsserver listens on unless told otherwise
+#define FSP_MAX_DATA (1 << 20)			//Most bytes read or written by one request
+
+//Operations of a request
+#define FSP_OPEN 0						//Opens path, returns the file descriptor
+#define FSP_CLOSE 1						//Closes fd
+#define FSP_READ 2						//Reads size bytes of fd at offset, or at its offset if -1, returns the bytes read
+#define FSP_WRITE 3						//Writes the data to fd at offset, or at its offset if -1, returns the bytes written
+#define FSP_STAT 4						//Returns the Inode of path as data
+#define FSP_READDIR 5					//Returns an FsWireEntry for every entry of the directory at path, and their number
+#define FSP_CREATE 6					//Creates a file at path reserving size bytes
+#define FSP_MKDIR 7						//Creates a directory at path
+#define FSP_REMOVE 8					//Removes the file at path
+#define FSP_RMDIR 9						//Removes the directory at path and everything in it
+#define FSP_FSYNC 10					//Writes back fd and flushes the volume
+#define FSP_SYNC 11						//Writes back and flushes the whole volume
+#define FSP_OP_COUNT 12
+
+/* A request sent to the server, followed by its path and data */
+typedef struct FsRequest {
+	uint64_t id;						//Chosen by the client, returned in the response
+	uint64_t size;						//Bytes to read or reserve, by operation
+	int64_t offset;						//Offset of a read or write, -1 for the file descriptor's offset
+	int32_t fd;							//File descriptor used, -1 if none
+	uint32_t dataLength;				//Bytes of data after the path
+	uint16_t pathLength;				//Bytes of the path
+	uint8_t op;							//Operation, see FSP_*
+	uint8_t padding[5];
+} FsRequest, *FsRequest_p;
+
+/* A response from the server, followed by its data */
+typedef struct FsResponse {
+	uint64_t id;						//Id of the request answered
+	int64_t result;						//Result of the operation, -1 if it failed
+	uint32_t dataLength;				//Bytes of data after the response
+	uint32_t padding;
+} FsResponse, *FsResponse_p;
+
+/* An entry of a FSP_READDIR response, followed by nameLength bytes of its name */
+typedef struct FsWireEntry {
+	uint64_t inodeID;					//Number of inode
+	uint64_t size;						//Bytes in the file, or below the directory
+	uint16_t nameLength;				//Bytes of the name
+	uint8_t type;						//FILE_TYPE or DIRECTORY_TYPE
+	uint8_t padding[5];
+} FsWireEntry, *FsWireEntry_p;
+
+/* A connection to fsserver */
+typedef struct FsClient FsClient, *FsClient_p;
+
+/* The answer to a request, see fsc_receive */
+typedef struct FsReply {
+	uint64_t id;						//Id returned by fsc_send for the request
+	int64_t result;						//Result of the operation, -1 if it failed
+	uint8_t* data;						//Data of the response, valid until the next fsc_receive
+	uint32_t dataLength;				//Bytes of data
+} FsReply, *FsReply_p;
+
+/* An entry listed by fsc_readdir */
+typedef struct FsEntry {
+	uint64_t inodeID;					//Number of inode
+	uint64_t size;						//Bytes in the file, or below the directory
+	uint8_t type;						//FILE_TYPE or DIRECTORY_TYPE
+	char name[MAX_NAME_SIZE];			//Name of the entry
+} FsEntry, *FsEntry_p;
+
+/* Called with each entry of a directory, see fsc_readdir */
+typedef void (*FsEntryCallback)(FsEntry_p entry, void* arg);
+
+/**
+ * Connects to a server.
+ * @param socketPath the socket the server listens on
+ * @returns the connection
+ * @returns NULL if the server could not be reached
+ */
+FsClient_p fsc_connect(const char* socketPath);
+
+/**
+ * Closes the connection. The server closes the files it left open.
+ * @param client the connection, not used again
+ */
+void fsc_disconnect(FsClient_p client);
+
+/**
+ * Queues a request to be sent by the next fsc_flush. Requests are answered
+ * in the order they were queued, so many can be in flight at once.
+ * @param client the connection
+ * @param op the operation, see FSP_*
+ * @param path the path, NULL if none
+ * @param fd the file descriptor, -1 if none
+ * @param size bytes to read or reserve, by operation
+ * @param offset offset of a read or write, -1 for the file descriptor's offset
+ * @param data the data written, NULL if none
+ * @param dataLength bytes of data, at most FSP_MAX_DATA
+ * @returns the id of the request
+ * @returns -1 if the request is too large
+ */
+int64_t fsc_send(FsClient_p client, uint8_t op, char* path, int32_t fd, uint64_t size, int64_t offset,
+	const void* data, uint32_t dataLength);
+
+/**
+ * Sends every queued request to the server in one write.
+ * @param client the connection
+ * @returns 0 if successful
+ * @returns -1 if the connection was lost
+ */
+int fsc_flush(FsClient_p client);
+
+/**
+ * Waits for the answer to the oldest request sent and not yet answered.
+ * @param client the connection
+ * @param reply where to store the answer
+ * @returns 0 if successful
+ * @returns -1 if the connection was lost or no request is waiting for an answer
+ */
+int fsc_receive(FsClient_p client, FsReply_p reply);
+
+/**
+ * Counts the requests queued or sent that have not been answered yet.
+ * @param client the connection
+ * @returns the number of requests
+ */
+uint64_t fsc_pending(FsClient_p client);
+
+/*
+ * The calls below send one request and wait for its answer. They fail
+ * while requests queued with fsc_send are still waiting for an answer.
+ */
+
+/**
+ * Opens a file on the server.
+ * @param client the connection
+ * @param path the path of the file
+ * @returns the file descriptor
+ * @returns -1 if unsuccessful
+ */
+int fsc_open(FsClient_p client, char* path);
+
+/**
+ * Closes a file descriptor opened by this connection.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_close(FsClient_p client, int fd);
+
+/**
+ * Reads from a file.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @param buffer where to store the data
+ * @param length bytes to read, at most FSP_MAX_DATA
+ * @param offset where to read from, -1 to read from the file descriptor's offset and move it
+ * @returns the number of bytes read
+ * @returns -1 if unsuccessful
+ */
+int64_t fsc_read(FsClient_p client, int fd, void* buffer, uint64_t length, int64_t offset);
+
+/**
+ * Writes to a file.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @param buffer the data to write
+ * @param length bytes to write, at most FSP_MAX_DATA
+ * @param offset where to write, -1 to write at the file descriptor's offset and move it
+ * @returns the number of bytes written
+ * @returns -1 if unsuccessful
+ */
+int64_t fsc_write(FsClient_p client, int fd, const void* buffer, uint64_t length, int64_t offset);
+
+/**
+ * Copies the inode of a file or directory.
+ * @param client the connection
+ * @param path the path of the file or directory
+ * @param inode where to copy the inode
+ * @returns 0 if successful
+ * @returns -1 if the path does not exist
+ */
+int fsc_stat(FsClient_p client, char* path, Inode_p inode);
+
+/**
+ * Calls the callback with every entry of a directory.
+ * @param client the connection
+ * @param path the path of the directory
+ * @param callback the function called for each entry
+ * @param arg passed to the callback
+ * @returns the number of entries
+ * @returns -1 if the path does not exist or is not a directory
+ */
+int64_t fsc_readdir(FsClient_p client, char* path, FsEntryCallback callback, void* arg);
+
+/**
+ * Creates a file.
+ * @param client the connection
+ * @param path the path of the file
+ * @param size the bytes to reserve blocks for
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_create(FsClient_p client, char* path, uint64_t size);
+
+/**
+ * Creates a directory.
+ * @param client the connection
+ * @param path the path of the directory
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_mkdir(FsClient_p client, char* path);
+
+/**
+ * Removes a file.
+ * @param client the connection
+ * @param path the path of the file
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_remove(FsClient_p client, char* path);
+
+/**
+ * Removes a directory and everything in it.
+ * @param client the connection
+ * @param path the path of the directory
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_rmdir(FsClient_p client, char* path);
+
+/**
+ * Writes back a file and flushes the volume to the disk.
+ * @param client the connection
+ * @param fd the file descriptor
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_fsync(FsClient_p client, int fd);
+
+/**
+ * Writes back and flushes the whole volume to the disk.
+ * @param client the connection
+ * @returns 0 if successful
+ * @returns -1 if unsuccessful
+ */
+int fsc_sync(FsClient_p client);
+
+#endif
@@ -0,0 +1,294 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: MemoryPool.c
+*
+* Description: This file contains the implementation of the
+*	object pools and arenas used for the inodes, block buffers
+*	and temporary memory of the file system.
+****************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "MemoryPool.h"
+
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t arenaKey;		//Arena of each thread
+
+/**
+ * Gives the objects of a thread's cache back to their pool when the thread exits.
+ * @param arg the cache of the thread
+ */
+static void releaseObjectCache(void* arg) {
+	ObjectCache_p cache = arg;
+	ObjectPool_p pool = cache->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	if (cache->generation == pool->generation) {
+		for (uint32_t i = 0; i < cache->count; i++) {
+			*(void**)cache->objects[i] = pool->freeList;
+			pool->freeList = cache->objects[i];
+		}
+	}
+	if (cache->prev != NULL)
+		cache->prev->next = cache->next;
+	else
+		pool->caches = cache->next;
+	if (cache->next != NULL)
+		cache->next->prev = cache->prev;
+	pthread_mutex_unlock(&pool->lock);
+	free(cache);
+}
+
+/**
+ * Finds the calling thread's cache for the pool, creating it if needed.
+ * Objects cached before the pool was destroyed are dropped.
+ * @param pool the pool of the cache
+ * @returns the cache
+ */
+static ObjectCache_p getObjectCache(ObjectPool_p pool) {
+	ObjectCache_p cache = pthread_getspecific(pool->cacheKey);
+	if (cache == NULL) {
+		cache = calloc(1, sizeof(ObjectCache));
+		cache->pool = pool;
+		pthread_mutex_lock(&pool->lock);
+		cache->generation = pool->generation;
+		cache->next = pool->caches;
+		if (pool->caches != NULL)
+			pool->caches->prev = cache;
+		pool->caches = cache;
+		pthread_mutex_unlock(&pool->lock);
+		pthread_setspecific(pool->cacheKey, cache);
+	} else if (cache->generation != pool->generation) {
+		cache->count = 0;
+		cache->generation = pool->generation;
+	}
+	return cache;
+}
+
+/**
+ * Prepares an object pool. A pool that was already in use is destroyed first.
+ * @param pool the pool to prepare
+ * @param objectSize the size of each object, at least the size of a pointer
+ * @param objectsPerSlab the number of objects allocated together
+ */
+void initObjectPool(ObjectPool_p pool, uint64_t objectSize, uint64_t objectsPerSlab) {
+	if (pool->keyCreated) {
+		destroyObjectPool(pool);
+	} else {
+		pthread_mutex_init(&pool->lock, NULL);
+		pthread_key_create(&pool->cacheKey, releaseObjectCache);
+		pool->keyCreated = 1;
+	}
+	pool->objectSize = (objectSize + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+	pool->objectsPerSlab = objectsPerSlab;
+}
+
+/**
+ * Frees every slab of the pool. Objects still handed out become invalid and
+ * the objects cached by threads are dropped the next time the thread uses the pool.
+ * @param pool the pool to destroy
+ */
+void destroyObjectPool(ObjectPool_p pool) {
+	if (!pool->keyCreated)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->slabs != NULL) {
+		Slab_p slab = pool->slabs;
+		pool->slabs = slab->next;
+		free(slab);
+	}
+	pool->freeList = NULL;
+	pool->generation++;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Destroys the pool and frees the caches of every thread, so the memory
+ * holding the pool can be freed. The pool must not be in use by any thread.
+ * @param pool the pool to close, prepared again by initObjectPool
+ */
+void closeObjectPool(ObjectPool_p pool) {
+	if (!pool->keyCreated)
+		return;
+	destroyObjectPool(pool);
+
+	//Deleting the key first keeps threads that exit later from giving their caches back
+	pthread_key_delete(pool->cacheKey);
+	while (pool->caches != NULL) {
+		ObjectCache_p cache = pool->caches;
+		pool->caches = cache->next;
+		free(cache);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pool->keyCreated = 0;
+}
+
+/**
+ * Takes an object from the pool. The object is not cleared.
+ * @param pool the pool to take from
+ * @returns the object
+ */
+void* takeObject(ObjectPool_p pool) {
+	ObjectCache_p cache = getObjectCache(pool);
+
+	//Refill half of the cache at once so the lock is taken once for several objects
+	if (cache->count == 0) {
+		pthread_mutex_lock(&pool->lock);
+		while (cache->count < OBJECT_CACHE_SIZE / 2) {
+			if (pool->freeList == NULL) {
+				Slab_p slab = malloc(sizeof(Slab) + pool->objectSize * pool->objectsPerSlab);
+				slab->next = pool->slabs;
+				pool->slabs = slab;
+				for (uint64_t i = 0; i < pool->objectsPerSlab; i++) {
+					void* object = &slab->objects[i * pool->objectSize];
+					*(void**)object = pool->freeList;
+					pool->freeList = object;
+				}
+			}
+			cache->objects[cache->count++] = pool->freeList;
+			pool->freeList = *(void**)pool->freeList;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return cache->objects[--cache->count];
+}
+
+/**
+ * Gives an object back to the pool it was taken from.
+ * @param pool the pool the object belongs to
+ * @param object the object, ignored if NULL
+ */
+void giveObject(ObjectPool_p pool, void* object) {
+	if (object == NULL)
+		return;
+	ObjectCache_p cache = getObjectCache(pool);
+
+	//Move half of a full cache to the shared free list
+	if (cache->count == OBJECT_CACHE_SIZE) {
+		pthread_mutex_lock(&pool->lock);
+		while (cache->count > OBJECT_CACHE_SIZE / 2) {
+			void* freed = cache->objects[--cache->count];
+			*(void**)freed = pool->freeList;
+			pool->freeList = freed;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	cache->objects[cache->count++] = object;
+}
+
+/**
+ * Frees every chunk of a thread's arena when the thread exits.
+ * @param arg the arena of the thread
+ */
+static void freeArena(void* arg) {
+	Arena_p arena = arg;
+	while (arena->first != NULL) {
+		ArenaChunk_p chunk = arena->first;
+		arena->first = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+/** Creates the key holding each thread's arena */
+static void createArenaKey() {
+	pthread_key_create(&arenaKey, freeArena);
+}
+
+/**
+ * Finds the calling thread's arena, creating it if needed.
+ * @returns the arena
+ */
+static Arena_p getArena() {
+	pthread_once(&arenaOnce, createArenaKey);
+	Arena_p arena = pthread_getspecific(arenaKey);
+	if (arena == NULL) {
+		arena = calloc(1, sizeof(Arena));
+		pthread_setspecific(arenaKey, arena);
+	}
+	return arena;
+}
+
+/**
+ * Allocates temporary memory from the calling thread's arena. The memory
+ * is not cleared and stays valid until the enclosing arenaRelease.
+ * @param size the number of bytes needed
+ * @returns the memory
+ */
+void* arenaAlloc(uint64_t size) {
+	Arena_p arena = getArena();
+	void* memory;
+
+	//The first chunk is never freed, so it always has the normal size
+	if (arena->first == NULL) {
+		arena->first = malloc(sizeof(ArenaChunk) + ARENA_CHUNK_SIZE);
+		arena->first->next = NULL;
+		arena->first->size = ARENA_CHUNK_SIZE;
+		arena->first->used = 0;
+		arena->current = arena->first;
+	}
+	ArenaChunk_p chunk = arena->current;
+	size = (size == 0) ? ARENA_ALIGNMENT : (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+	if (chunk->size - chunk->used >= size) {
+		memory = &chunk->data[chunk->used];
+		chunk->used += size;
+		return memory;
+	}
+
+	//Move on to the next chunk if it is big enough, otherwise put a new chunk in front of it
+	ArenaChunk_p next = chunk->next;
+	if (next == NULL || next->size < size) {
+		uint64_t chunkSize = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+		ArenaChunk_p newChunk = malloc(sizeof(ArenaChunk) + chunkSize);
+		newChunk->size = chunkSize;
+		newChunk->next = next;
+		chunk->next = newChunk;
+		next = newChunk;
+	}
+	next->used = size;
+	arena->current = next;
+	return next->data;
+}
+
+/**
+ * Marks how much of the calling thread's arena is handed out.
+ * @returns the mark to pass to arenaRelease
+ */
+ArenaMark arenaMark() {
+	Arena_p arena = getArena();
+	ArenaMark mark = { arena->current, (arena->current != NULL) ? arena->current->used : 0 };
+	return mark;
+}
+
+/**
+ * Gives back everything the calling thread allocated from its arena since the mark.
+ * The chunks are kept for the next allocations, except that an arena with nothing
+ * left handed out keeps only its first chunk, so one large operation does not hold
+ * on to its memory. The first chunk stays since an outer mark may point at it.
+ * @param mark the mark taken by arenaMark
+ */
+void arenaRelease(ArenaMark_p mark) {
+	Arena_p arena = getArena();
+
+	if (mark->chunk == NULL) {
+		arena->current = arena->first;
+		if (arena->first != NULL)
+			arena->first->used = 0;
+	} else {
+		arena->current = mark->chunk;
+		arena->current->used = mark->used;
+	}
+
+	if (arena->current != NULL && arena->current == arena->first && arena->current->used == 0) {
+		while (arena->first->next != NULL) {
+			ArenaChunk_p chunk = arena->first->next;
+			arena->first->next = chunk->next;
+			free(chunk);
+		}
+	}
+}
@@ -0,0 +1,140 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: MemoryPool.h
+*
+* Description: This header file contains the structures and
+*	prototypes for the memory pools of a mounted file system.
+*	Object pools hand out fixed size objects, such as inodes
+*	and block buffers, from slabs and keep a small cache of
+*	free objects for every thread. Arenas hand out temporary
+*	memory that is all given back in one step when the
+*	operation that used it finishes.
+****************************************************************/
+
+#ifndef MEMORY_POOL_H
+#define MEMORY_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define OBJECT_CACHE_SIZE 16		//Most free objects a thread keeps for itself, per pool
+#define ARENA_CHUNK_SIZE 65536		//Smallest chunk an arena allocates
+#define ARENA_ALIGNMENT 16			//Alignment of every arena allocation
+
+/* A block of memory holding objectsPerSlab objects */
+typedef struct Slab {
+	struct Slab* next;					//Next slab of the pool
+	uint64_t padding;					//Keeps the objects aligned to 16 bytes
+	uint8_t objects[];					//The objects of the slab
+} Slab, *Slab_p;
+
+/* Fixed size objects handed out from slabs. A free object holds a pointer to the next free object */
+typedef struct ObjectPool {
+	pthread_mutex_t lock;				//Guards the free list and slabs
+	pthread_key_t cacheKey;				//Cache of free objects of each thread
+	uint8_t keyCreated;					//If cacheKey has been created
+	uint32_t generation;				//Changed whenever the pool is destroyed, so stale thread caches are dropped
+	uint64_t objectSize;				//Size of each object
+	uint64_t objectsPerSlab;			//Objects allocated together in one slab
+	void* freeList;						//First free object, NULL if none
+	Slab_p slabs;						//Every slab of the pool, freed when it is destroyed
+	struct ObjectCache* caches;			//Cache of every thread that used the pool, freed when it is closed
+} ObjectPool, *ObjectPool_p;
+
+/* Free objects of one pool kept by one thread, taken and given back without locking */
+typedef struct ObjectCache {
+	ObjectPool_p pool;					//Pool the objects belong to
+	struct ObjectCache* next;			//Next cache of the pool
+	struct ObjectCache* prev;			//Previous cache of the pool, NULL for the first
+	uint32_t generation;				//Generation of the pool the objects came from
+	uint32_t count;						//Number of objects in the cache
+	void* objects[OBJECT_CACHE_SIZE];	//The free objects
+} ObjectCache, *ObjectCache_p;
+
+/* A chunk of memory handed out by an arena from the front */
+typedef struct ArenaChunk {
+	struct ArenaChunk* next;			//Next chunk, every chunk after the current one is unused
+	uint64_t size;						//Bytes the chunk holds
+	uint64_t used;						//Bytes handed out from the front of the chunk
+	uint64_t padding;					//Keeps the data aligned to 16 bytes
+	uint8_t data[];						//Memory of the chunk
+} ArenaChunk, *ArenaChunk_p;
+
+/* Temporary memory of one thread */
+typedef struct Arena {
+	ArenaChunk_p first;					//First chunk, NULL until something is allocated
+	ArenaChunk_p current;				//Chunk allocations are taken from
+} Arena, *Arena_p;
+
+/* How much of an arena was handed out at some point, everything after it is given back by arenaRelease */
+typedef struct ArenaMark {
+	ArenaChunk_p chunk;					//Current chunk at the mark, NULL if nothing was allocated yet
+	uint64_t used;						//Bytes used of that chunk
+} ArenaMark, *ArenaMark_p;
+
+/* Declares a mark that gives back everything allocated after it when it goes out of scope */
+#define ARENA_SCOPE(mark) ArenaMark mark __attribute__((cleanup(arenaRelease))) = arenaMark()
+
+/**
+ * Prepares an object pool. A pool that was already in use is destroyed first.
+ * @param pool the pool to prepare
+ * @param objectSize the size of each object, at least the size of a pointer
+ * @param objectsPerSlab the number of objects allocated together
+ */
+void initObjectPool(ObjectPool_p pool, uint64_t objectSize, uint64_t objectsPerSlab);
+
+/**
+ * Frees every slab of the pool. Objects still handed out become invalid and
+ * the objects cached by threads are dropped the next time the thread uses the pool.
+ * @param pool the pool to destroy
+ */
+void destroyObjectPool(ObjectPool_p pool);
+
+/**
+ * Destroys the pool and frees the caches of every thread, so the memory
+ * holding the pool can be freed. The pool must not be in use by any thread.
+ * @param pool the pool to close, prepared again by initObjectPool
+ */
+void closeObjectPool(ObjectPool_p pool);
+
+/**
+ * Takes an object from the pool. The object is not cleared.
+ * @param pool the pool to take from
+ * @returns the object
+ */
+void* takeObject(ObjectPool_p pool);
+
+/**
+ * Gives an object back to the pool it was taken from.
+ * @param pool the pool the object belongs to
+ * @param object the object, ignored if NULL
+ */
+void giveObject(ObjectPool_p pool, void* object);
+
+/**
+ * Allocates temporary memory from the calling thread's arena. The memory
+ * is not cleared and stays valid until the enclosing arenaRelease.
+ * @param size the number of bytes needed
+ * @returns the memory
+ */
+void* arenaAlloc(uint64_t size);
+
+/**
+ * Marks how much of the calling thread's arena is handed out.
+ * @returns the mark to pass to arenaRelease
+ */
+ArenaMark arenaMark();
+
+/**
+ * Gives back everything the calling thread allocated from its arena since the mark.
+ * The chunks are kept for the next allocations.
+ * @param mark the mark taken by arenaMark
+ */
+void arenaRelease(ArenaMark_p mark);
+
+#endif
@@ -0,0 +1,145 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: Record.c
+*
+* Description: This file contains the implementation of the
+*	recording of the operations called on the file system.
+****************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "Record.h"
+#include "Stats.h"
+
+static FILE* recordFile = NULL;					//Log being written, guarded by recordLock
+static const void* recordOwner = NULL;			//Volume being recorded, guarded by recordLock
+static pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+static int recording = 0;						//If operations are recorded
+static uint64_t recordBase = 0;					//Nanoseconds when the recording started
+static uint16_t recordThreads = 0;				//Threads given a number so far
+static __thread uint32_t recordDepth = 0;		//Operations of this thread running inside each other
+static __thread int32_t recordThread = -1;		//Number of this thread in the logs, -1 until it records
+
+/**
+ * Starts recording the operations of an owner to a log.
+ * @param owner the volume whose operations are recorded
+ * @param fileName the log to create, replaced if it exists
+ * @returns 0 if successful
+ * @returns -1 if already recording or the log could not be created
+ */
+int recordStart(const void* owner, char* fileName) {
+	RecordHeader header = { RECORD_MAGIC, RECORD_VERSION };
+
+	pthread_mutex_lock(&recordLock);
+	if (recordFile != NULL) {
+		pthread_mutex_unlock(&recordLock);
+		return -1;
+	}
+	recordFile = fopen(fileName, "wb");
+	if (recordFile == NULL || fwrite(&header, sizeof(RecordHeader), 1, recordFile) != 1) {
+		if (recordFile != NULL)
+			fclose(recordFile);
+		recordFile = NULL;
+		pthread_mutex_unlock(&recordLock);
+		return -1;
+	}
+	recordBase = statNow();
+	__atomic_store_n(&recordOwner, owner, __ATOMIC_RELAXED);
+	__atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&recordLock);
+	return 0;
+}
+
+/**
+ * Stops recording and closes the log, if the owner is the one being recorded.
+ * Operations still running are left out.
+ * @param owner the volume that started the recording
+ */
+void recordStop(const void* owner) {
+	pthread_mutex_lock(&recordLock);
+	if (recordFile == NULL || recordOwner != owner) {
+		pthread_mutex_unlock(&recordLock);
+		return;
+	}
+	__atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&recordOwner, NULL, __ATOMIC_RELAXED);
+	fclose(recordFile);
+	recordFile = NULL;
+	pthread_mutex_unlock(&recordLock);
+}
+
+/**
+ * Starts an operation, see RECORD_SCOPE.
+ * @param owner the volume the operation is called on, NULL for a scope that is never recorded
+ * @param op the operation, RECORD_NO_OP for a scope that is never recorded
+ * @param path the first path, NULL if none
+ * @param path2 the second path, NULL if none
+ * @param fd the file descriptor used, -1 if none
+ * @param size bytes, size, reflink, seek method or directory format, by operation
+ * @param offset offset of a read, write or seek
+ * @returns the operation
+ */
+OpRecord recordBegin(const void* owner, uint8_t op, char* path, char* path2, int32_t fd, uint64_t size, int64_t offset) {
+	OpRecord record = { 0, path, path2, size, offset, fd, op, 0, 0 };
+
+	//Nested operations are part of the outer one, whether or not recording was on when it started
+	if (recordDepth++ == 0 && op != RECORD_NO_OP && __atomic_load_n(&recording, __ATOMIC_ACQUIRE) &&
+			__atomic_load_n(&recordOwner, __ATOMIC_RELAXED) == owner) {
+		record.active = 1;
+		record.start = statNow();
+	}
+	return record;
+}
+
+/**
+ * Copies a path into an entry being built, cut short at RECORD_MAX_PATH
+ * @param destination where to copy the path
+ * @param path the path, NULL if none
+ * @returns the bytes copied
+ */
+static uint16_t copyPath(uint8_t* destination, char* path) {
+	if (path == NULL)
+		return 0;
+	size_t length = strnlen(path, RECORD_MAX_PATH);
+	memcpy(destination, path, length);
+	return length;
+}
+
+/**
+ * Writes the operation to the log if it is recorded, called when a RECORD_SCOPE ends.
+ * @param record the operation
+ */
+void recordEnd(OpRecord_p record) {
+	recordDepth--;
+	if (!record->active)
+		return;
+
+	uint64_t end = statNow();
+	uint8_t buffer[sizeof(RecordEntry) + 2 * RECORD_MAX_PATH];
+	RecordEntry_p entry = (RecordEntry_p)buffer;
+	if (recordThread == -1)
+		recordThread = __atomic_fetch_add(&recordThreads, 1, __ATOMIC_RELAXED);
+	entry->latency = end - record->start;
+	entry->size = record->size;
+	entry->offset = record->offset;
+	entry->fd = record->fd;
+	entry->thread = recordThread;
+	entry->op = record->op;
+	entry->flags = record->flags;
+	entry->pathLength = copyPath(buffer + sizeof(RecordEntry), record->path);
+	entry->path2Length = copyPath(buffer + sizeof(RecordEntry) + entry->pathLength, record->path2);
+
+	//A recording stopped and started again while the operation ran does not get it
+	pthread_mutex_lock(&recordLock);
+	if (recordFile != NULL && record->start >= recordBase) {
+		entry->start = record->start - recordBase;
+		fwrite(buffer, sizeof(RecordEntry) + entry->pathLength + entry->path2Length, 1, recordFile);
+	}
+	pthread_mutex_unlock(&recordLock);
+}
@@ -0,0 +1,112 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: Record.h
+*
+* Description: This header file contains the structures and
+*	prototypes for recording the operations called on the file
+*	system, with their arguments and timing, to a log that
+*	fsreplay can run again against a volume. One volume is recorded
+*	at a time, the owner given to recordStart. Only the outermost
+*	operation of a thread is recorded, so an operation built on
+*	others, such as a cpout reading through its file descriptor,
+*	is one record.
+*
+*	A log is a RecordHeader followed by RecordEntry structures,
+*	each followed by its paths without terminators. Entries are
+*	written as operations end, so they are not in order of start.
+****************************************************************/
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+#define RECORD_MAGIC 0x44524F4345525346	//"FSRECORD"
+#define RECORD_VERSION 1
+#define RECORD_MAX_PATH 4096			//Longest path kept, longer paths are cut short
+#define RECORD_NO_OP 0xFF				//Operation of a scope that is never recorded
+
+//Flags of an entry
+#define RECORD_ADVANCE 0x01				//The read or write used and moved the file descriptor's offset
+
+/* Start of a log */
+typedef struct RecordHeader {
+	uint64_t magic;						//RECORD_MAGIC
+	uint64_t version;					//RECORD_VERSION
+} RecordHeader, *RecordHeader_p;
+
+/* An operation in the log, followed by pathLength and path2Length bytes of its paths */
+typedef struct RecordEntry {
+	uint64_t start;						//Nanoseconds from the start of the recording to the start of the operation
+	uint64_t latency;					//Nanoseconds the operation took
+	uint64_t size;						//Bytes, size, reflink, seek method or directory format, by operation
+	int64_t offset;						//Offset of a read, write or seek
+	int32_t fd;							//File descriptor used, or opened by an open
+	uint16_t thread;					//Recording thread that called the operation
+	uint8_t op;							//Operation called, see FS_OP_*
+	uint8_t flags;						//RECORD_* flags
+	uint16_t pathLength;				//Bytes of the first path
+	uint16_t path2Length;				//Bytes of the second path
+} RecordEntry, *RecordEntry_p;
+
+/* An operation being timed, written to the log when its scope ends */
+typedef struct OpRecord {
+	uint64_t start;						//Nanoseconds when the operation started
+	char* path;							//First path, NULL if none
+	char* path2;						//Second path, NULL if none
+	uint64_t size;
+	int64_t offset;
+	int32_t fd;							//Set by an open to the file descriptor it opened
+	uint8_t op;
+	uint8_t flags;
+	uint8_t active;						//If the operation is written to the log
+} OpRecord, *OpRecord_p;
+
+/* Records the operation, with its arguments, when it is the outermost one of the thread and ends */
+#define RECORD_SCOPE(owner, op, path, path2, fd, size, offset) \
+	OpRecord opRecord __attribute__((cleanup(recordEnd))) = recordBegin(owner, op, path, path2, fd, size, offset)
+
+/* Keeps the operations called in the scope out of the log, for work handed to other threads by a recorded operation */
+#define RECORD_INNER_SCOPE() RECORD_SCOPE(NULL, RECORD_NO_OP, NULL, NULL, -1, 0, 0)
+
+/**
+ * Starts recording the operations of an owner to a log.
+ * @param owner the volume whose operations are recorded
+ * @param fileName the log to create, replaced if it exists
+ * @returns 0 if successful
+ * @returns -1 if already recording or the log could not be created
+ */
+int recordStart(const void* owner, char* fileName);
+
+/**
+ * Stops recording and closes the log, if the owner is the one being recorded.
+ * Operations still running are left out.
+ * @param owner the volume that started the recording
+ */
+void recordStop(const void* owner);
+
+/**
+ * Starts an operation, see RECORD_SCOPE.
+ * @param owner the volume the operation is called on, NULL for a scope that is never recorded
+ * @param op the operation, RECORD_NO_OP for a scope that is never recorded
+ * @param path the first path, NULL if none
+ * @param path2 the second path, NULL if none
+ * @param fd the file descriptor used, -1 if none
+ * @param size bytes, size, reflink, seek method or directory format, by operation
+ * @param offset offset of a read, write or seek
+ * @returns the operation
+ */
+OpRecord recordBegin(const void* owner, uint8_t op, char* path, char* path2, int32_t fd, uint64_t size, int64_t offset);
+
+/**
+ * Writes the operation to the log if it is recorded, called when a RECORD_SCOPE ends.
+ * @param record the operation
+ */
+void recordEnd(OpRecord_p record);
+
+#endif
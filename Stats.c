@@ -0,0 +1,138 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: Stats.c
+*
+* Description: This file contains the implementation of the
+*	latency histograms kept by the file system at run time.
+****************************************************************/
+
+#include <time.h>
+#include "Stats.h"
+
+/**
+ * Returns the time in nanoseconds from a fixed point, unaffected by changes to the clock
+ * @returns the time in nanoseconds
+ */
+uint64_t statNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Finds the bucket of a value. Values below STAT_SUB_BUCKETS have a bucket
+ * each, and every power of two above is split into STAT_SUB_BUCKETS buckets.
+ * @param value the value
+ * @returns the index of the bucket
+ */
+static uint32_t bucketIndex(uint64_t value) {
+	if (value < STAT_SUB_BUCKETS)
+		return value;
+	uint32_t highBit = 63 - __builtin_clzll(value);
+	if (highBit >= STAT_MAX_BITS)
+		return STAT_BUCKETS - 1;
+	uint32_t shift = highBit - STAT_SUB_BITS;
+	return (shift + 1) * STAT_SUB_BUCKETS + ((value >> shift) & (STAT_SUB_BUCKETS - 1));
+}
+
+/**
+ * Returns the largest value that falls in a bucket
+ * @param index the index of the bucket
+ * @returns the largest value of the bucket
+ */
+static uint64_t bucketTop(uint32_t index) {
+	if (index < STAT_SUB_BUCKETS)
+		return index;
+	uint32_t shift = index / STAT_SUB_BUCKETS - 1;
+	uint64_t bottom = (uint64_t)(STAT_SUB_BUCKETS + index % STAT_SUB_BUCKETS) << shift;
+	return bottom + ((uint64_t)1 << shift) - 1;
+}
+
+/**
+ * Records a value in the histogram. Safe to call from several threads.
+ * @param histogram the histogram to record in
+ * @param value the value to record
+ */
+void histogramRecord(LatencyHistogram_p histogram, uint64_t value) {
+	__atomic_add_fetch(&histogram->counts[bucketIndex(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->total, value, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Copies a counter that other threads may be adding to.
+ * @param counter the counter to copy
+ * @param reset 1 to set the counter back to 0
+ * @returns the value of the counter
+ */
+static uint64_t takeCounter(uint64_t* counter, uint8_t reset) {
+	if (reset)
+		return __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED);
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copies a histogram that other threads may be recording in.
+ * @param histogram the histogram to copy
+ * @param copy where to copy the histogram
+ * @param reset 1 to empty the histogram, without losing values recorded while it is copied
+ */
+void histogramSnapshot(LatencyHistogram_p histogram, LatencyHistogram_p copy, uint8_t reset) {
+	for (uint32_t i = 0; i < STAT_BUCKETS; i++)
+		copy->counts[i] = takeCounter(&histogram->counts[i], reset);
+	copy->count = takeCounter(&histogram->count, reset);
+	copy->total = takeCounter(&histogram->total, reset);
+	copy->max = takeCounter(&histogram->max, reset);
+}
+
+/**
+ * Returns the value below which the given fraction of the recorded values fall,
+ * rounded up to the top of its bucket.
+ * @param histogram a histogram no other thread is recording in, such as a snapshot
+ * @param fraction the fraction of values, such as 0.99
+ * @returns the value, 0 if the histogram is empty
+ */
+uint64_t histogramPercentile(LatencyHistogram_p histogram, double fraction) {
+	uint64_t recorded = 0;
+	for (uint32_t i = 0; i < STAT_BUCKETS; i++)
+		recorded += histogram->counts[i];
+	if (recorded == 0)
+		return 0;
+
+	uint64_t wanted = (uint64_t)(fraction * recorded);
+	if (wanted >= recorded)
+		wanted = recorded - 1;
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < STAT_BUCKETS; i++) {
+		seen += histogram->counts[i];
+		if (seen > wanted)
+			return (bucketTop(i) < histogram->max) ? bucketTop(i) : histogram->max;
+	}
+	return histogram->max;
+}
+
+/**
+ * Starts a timer of a scope, see STAT_SCOPE.
+ * @param histogram where the time is recorded
+ * @returns the timer
+ */
+StatTimer statTimerStart(LatencyHistogram_p histogram) {
+	StatTimer timer = { histogram, statNow() };
+	return timer;
+}
+
+/**
+ * Records the time since the timer started, called when a STAT_SCOPE ends.
+ * @param timer the timer
+ */
+void statTimerEnd(StatTimer_p timer) {
+	histogramRecord(timer->histogram, statNow() - timer->start);
+}
@@ -0,0 +1,88 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: Stats.h
+*
+* Description: This header file contains the structures and
+*	prototypes for the latency histograms kept by the file system
+*	at run time. A histogram has a fixed number of buckets, the
+*	same as an HDR histogram with 4 bits of precision, so a value
+*	is recorded with a few atomic adds and no locks, and every
+*	percentile is within about 6% of the true latency.
+****************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#define STAT_SUB_BITS 4				//Bits of precision kept for each power of two
+#define STAT_SUB_BUCKETS (1 << STAT_SUB_BITS)
+#define STAT_MAX_BITS 40			//Values of 2^40 or more, about 18 minutes in nanoseconds, share the last buckets
+#define STAT_BUCKETS ((STAT_MAX_BITS - STAT_SUB_BITS + 1) * STAT_SUB_BUCKETS)
+
+/* Counts of the latencies recorded in each range */
+typedef struct LatencyHistogram {
+	uint64_t counts[STAT_BUCKETS];		//Values recorded in each bucket
+	uint64_t count;						//Values recorded
+	uint64_t total;						//Sum of the values recorded
+	uint64_t max;						//Largest value recorded
+} LatencyHistogram, *LatencyHistogram_p;
+
+/* Times a scope and records it in a histogram when the scope ends */
+typedef struct StatTimer {
+	LatencyHistogram_p histogram;		//Where the time is recorded
+	uint64_t start;						//Nanoseconds when the scope started
+} StatTimer, *StatTimer_p;
+
+/* Declares a timer that records the time until it goes out of scope in the histogram */
+#define STAT_SCOPE(histogram) StatTimer statTimer __attribute__((cleanup(statTimerEnd))) = statTimerStart(histogram)
+
+/**
+ * Returns the time in nanoseconds from a fixed point, unaffected by changes to the clock
+ * @returns the time in nanoseconds
+ */
+uint64_t statNow();
+
+/**
+ * Records a value in the histogram. Safe to call from several threads.
+ * @param histogram the histogram to record in
+ * @param value the value to record
+ */
+void histogramRecord(LatencyHistogram_p histogram, uint64_t value);
+
+/**
+ * Copies a histogram that other threads may be recording in.
+ * @param histogram the histogram to copy
+ * @param copy where to copy the histogram
+ * @param reset 1 to empty the histogram, without losing values recorded while it is copied
+ */
+void histogramSnapshot(LatencyHistogram_p histogram, LatencyHistogram_p copy, uint8_t reset);
+
+/**
+ * Returns the value below which the given fraction of the recorded values fall,
+ * rounded up to the top of its bucket.
+ * @param histogram a histogram no other thread is recording in, such as a snapshot
+ * @param fraction the fraction of values, such as 0.99
+ * @returns the value, 0 if the histogram is empty
+ */
+uint64_t histogramPercentile(LatencyHistogram_p histogram, double fraction);
+
+/**
+ * Starts a timer of a scope, see STAT_SCOPE.
+ * @param histogram where the time is recorded
+ * @returns the timer
+ */
+StatTimer statTimerStart(LatencyHistogram_p histogram);
+
+/**
+ * Records the time since the timer started, called when a STAT_SCOPE ends.
+ * @param timer the timer
+ */
+void statTimerEnd(StatTimer_p timer);
+
+#endif
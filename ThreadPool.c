@@ -0,0 +1,243 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: ThreadPool.c
+*
+* Description: This file contains the implementation of the
+*	work stealing thread pool used for directory tree copies
+*	and deletes.
+****************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ThreadPool.h"
+
+/* Arguments handed to a new worker thread */
+typedef struct Worker {
+	ThreadPool_p pool;
+	uint32_t index;
+} Worker, *Worker_p;
+
+static __thread ThreadPool_p currentPool = NULL;	//Pool the calling thread works for
+static __thread uint32_t currentWorker = 0;			//Queue of the calling worker
+
+/**
+ * Adds a task to the tail of the queue, growing the queue if it is full.
+ * @param queue the queue to add to
+ * @param task the task to add
+ */
+static void pushTask(TaskQueue_p queue, Task task) {
+	pthread_mutex_lock(&queue->lock);
+	if (queue->tail - queue->head == queue->capacity) {
+		Task_p tasks = malloc(queue->capacity * 2 * sizeof(Task));
+		for (uint64_t i = queue->head; i < queue->tail; i++)
+			tasks[i - queue->head] = queue->tasks[i % queue->capacity];
+		free(queue->tasks);
+		queue->tasks = tasks;
+		queue->tail -= queue->head;
+		queue->head = 0;
+		queue->capacity *= 2;
+	}
+	queue->tasks[queue->tail % queue->capacity] = task;
+	queue->tail++;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Takes a task from the queue.
+ * @param queue the queue to take from
+ * @param steal 1 to take the oldest task, 0 to take the newest
+ * @param task where to store the task
+ * @returns 1 if a task was taken
+ * @returns 0 if the queue is empty
+ */
+static int takeTask(TaskQueue_p queue, int steal, Task_p task) {
+	int found = 0;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->head != queue->tail) {
+		if (steal) {
+			*task = queue->tasks[queue->head % queue->capacity];
+			queue->head++;
+		} else {
+			queue->tail--;
+			*task = queue->tasks[queue->tail % queue->capacity];
+		}
+		found = 1;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return found;
+}
+
+/**
+ * Finds the next task for a worker. The worker's own newest task is run first,
+ * otherwise the oldest task of another worker is stolen.
+ * @param pool the pool the worker belongs to
+ * @param index the worker's queue
+ * @param task where to store the task
+ * @returns 1 if a task was found
+ * @returns 0 if every queue is empty
+ */
+static int findTask(ThreadPool_p pool, uint32_t index, Task_p task) {
+	if (takeTask(&pool->queues[index], 0, task))
+		return 1;
+	for (uint32_t i = 1; i < pool->numThreads; i++) {
+		if (takeTask(&pool->queues[(index + i) % pool->numThreads], 1, task))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Runs tasks until the pool shuts down, sleeping while there is no work.
+ * @param arg the worker's pool and queue
+ * @returns NULL
+ */
+static void* runWorker(void* arg) {
+	Worker_p worker = arg;
+	ThreadPool_p pool = worker->pool;
+	uint32_t index = worker->index;
+	Task task;
+	free(worker);
+
+	currentPool = pool;
+	currentWorker = index;
+	while (1) {
+		if (findTask(pool, index, &task)) {
+			pthread_mutex_lock(&pool->lock);
+			pool->queuedTasks--;
+			pthread_mutex_unlock(&pool->lock);
+
+			task.function(task.arg);
+
+			pthread_mutex_lock(&pool->lock);
+			pool->pendingTasks--;
+			if (pool->pendingTasks == 0)
+				pthread_cond_broadcast(&pool->allDone);
+			pthread_mutex_unlock(&pool->lock);
+			continue;
+		}
+
+		//Nothing to run or steal, sleep until a task is submitted
+		pthread_mutex_lock(&pool->lock);
+		while (pool->queuedTasks == 0 && !pool->shutdown)
+			pthread_cond_wait(&pool->workAvailable, &pool->lock);
+		if (pool->shutdown && pool->queuedTasks == 0) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Creates a thread pool and starts its workers.
+ * @param numThreads the number of workers, 0 to use one per processor
+ * @returns the thread pool
+ * @returns NULL if the pool could not be created
+ */
+ThreadPool_p createThreadPool(uint32_t numThreads) {
+	if (numThreads == 0) {
+		long processors = sysconf(_SC_NPROCESSORS_ONLN);
+		numThreads = (processors > 0) ? processors : 1;
+	}
+	if (numThreads > MAX_WORKER_THREADS)
+		numThreads = MAX_WORKER_THREADS;
+
+	ThreadPool_p pool = calloc(1, sizeof(ThreadPool));
+	pool->numThreads = numThreads;
+	pool->threads = calloc(numThreads, sizeof(pthread_t));
+	pool->queues = calloc(numThreads, sizeof(TaskQueue));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->workAvailable, NULL);
+	pthread_cond_init(&pool->allDone, NULL);
+	for (uint32_t i = 0; i < numThreads; i++) {
+		pthread_mutex_init(&pool->queues[i].lock, NULL);
+		pool->queues[i].capacity = TASK_QUEUE_SIZE;
+		pool->queues[i].tasks = malloc(TASK_QUEUE_SIZE * sizeof(Task));
+	}
+
+	for (uint32_t i = 0; i < numThreads; i++) {
+		Worker_p worker = malloc(sizeof(Worker));
+		worker->pool = pool;
+		worker->index = i;
+		if (pthread_create(&pool->threads[i], NULL, runWorker, worker) != 0) {
+			free(worker);
+			pool->numThreads = i;
+			destroyThreadPool(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+/**
+ * Adds a task to the pool. A task submitted by one of the pool's workers goes on that
+ * worker's own queue, other tasks are spread across the queues.
+ * @param pool the pool to run the task
+ * @param function the function to run
+ * @param arg the argument passed to the function
+ */
+void submitTask(ThreadPool_p pool, TaskFunction function, void* arg) {
+	Task task = { function, arg };
+	uint32_t index;
+
+	//Count the task as queued before it can be taken, so a worker never takes it from a count of zero
+	pthread_mutex_lock(&pool->lock);
+	pool->pendingTasks++;
+	pool->queuedTasks++;
+	if (currentPool == pool) {
+		index = currentWorker;
+	} else {
+		index = pool->nextQueue;
+		pool->nextQueue = (pool->nextQueue + 1) % pool->numThreads;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	pushTask(&pool->queues[index], task);
+
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->workAvailable);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Waits until every task submitted to the pool, including the tasks they submit, has finished.
+ * @param pool the pool to wait for
+ */
+void waitThreadPool(ThreadPool_p pool) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pendingTasks > 0)
+		pthread_cond_wait(&pool->allDone, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Stops the workers once they are idle and frees the pool.
+ * @param pool the pool to destroy
+ */
+void destroyThreadPool(ThreadPool_p pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->workAvailable);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint32_t i = 0; i < pool->numThreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for (uint32_t i = 0; i < pool->numThreads; i++) {
+		pthread_mutex_destroy(&pool->queues[i].lock);
+		free(pool->queues[i].tasks);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->workAvailable);
+	pthread_cond_destroy(&pool->allDone);
+	free(pool->queues);
+	free(pool->threads);
+	free(pool);
+}
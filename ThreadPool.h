@@ -0,0 +1,84 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: ThreadPool.h
+*
+* Description: This header file contains the structures and
+*	prototypes for a work stealing thread pool. Every worker
+*	has its own queue of tasks, and workers with an empty queue
+*	steal tasks from the other workers.
+****************************************************************/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define MAX_WORKER_THREADS 8		//Most threads a pool will start
+#define TASK_QUEUE_SIZE 64			//Starting number of tasks per worker queue
+
+typedef void (*TaskFunction)(void* arg);
+
+/* A function to run along with its argument */
+typedef struct Task {
+	TaskFunction function;				//Function to run
+	void* arg;							//Argument passed to the function
+} Task, *Task_p;
+
+/* Tasks of a single worker. The owner takes from the tail, thieves take from the head */
+typedef struct TaskQueue {
+	pthread_mutex_t lock;				//Guards the queue
+	Task_p tasks;						//Circular buffer of tasks
+	uint64_t capacity;					//Number of tasks the buffer can hold
+	uint64_t head;						//Oldest task, stolen first
+	uint64_t tail;						//One past the newest task, run first by the owner
+} TaskQueue, *TaskQueue_p;
+
+typedef struct ThreadPool {
+	uint32_t numThreads;				//Number of worker threads
+	pthread_t* threads;					//Worker threads
+	TaskQueue_p queues;					//One queue per worker
+	uint32_t nextQueue;					//Queue that gets the next task submitted from outside the pool
+	pthread_mutex_t lock;				//Guards the counts below
+	pthread_cond_t workAvailable;		//Signaled when a task is submitted or the pool shuts down
+	pthread_cond_t allDone;				//Signaled when the last pending task finishes
+	uint64_t queuedTasks;				//Tasks waiting in a queue
+	uint64_t pendingTasks;				//Tasks submitted but not finished
+	uint8_t shutdown;					//Set when the workers should exit
+} ThreadPool, *ThreadPool_p;
+
+/**
+ * Creates a thread pool and starts its workers.
+ * @param numThreads the number of workers, 0 to use one per processor
+ * @returns the thread pool
+ * @returns NULL if the pool could not be created
+ */
+ThreadPool_p createThreadPool(uint32_t numThreads);
+
+/**
+ * Adds a task to the pool. A task submitted by one of the pool's workers goes on that
+ * worker's own queue, other tasks are spread across the queues.
+ * @param pool the pool to run the task
+ * @param function the function to run
+ * @param arg the argument passed to the function
+ */
+void submitTask(ThreadPool_p pool, TaskFunction function, void* arg);
+
+/**
+ * Waits until every task submitted to the pool, including the tasks they submit, has finished.
+ * @param pool the pool to wait for
+ */
+void waitThreadPool(ThreadPool_p pool);
+
+/**
+ * Stops the workers once they are idle and frees the pool.
+ * @param pool the pool to destroy
+ */
+void destroyThreadPool(ThreadPool_p pool);
+
+#endif
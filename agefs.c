@@ -0,0 +1,606 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: agefs.c
+*
+* Description: This file ages a volume with create, append and
+*	delete churn so benchmarks and allocator changes can be tried
+*	on a volume that looks used instead of a freshly formatted one.
+*	It formats a fresh volume and then either replays a recorded
+*	workload or runs a synthetic one:
+*	The synthetic workload creates files and appends to them until
+*	the volume is as full as the target, then keeps it there by
+*	deleting a file whenever it is over the target. It stops once
+*	the files average the target number of fragments, or after the
+*	given number of operations.
+*	A recorded workload is a text file with one operation a line:
+*	create <path> <bytes>
+*	append <path> <bytes>
+*	delete <path>
+*	The synthetic workload can be recorded in this form with -w.
+*	Afterwards it reports the latency of each kind of operation,
+*	the fragments of the files, the runs of free blocks by length
+*	and the work done by the block allocator. The volume is kept.
+*
+*	Usage: ./agefs [options]
+*	-f <file>		volume to create, replaced if it exists (aged.vol)
+*	-s <bytes>		volume size (67108864)
+*	-b <bytes>		block size (512)
+*	-u <percent>	target fullness of the volume (80)
+*	-g <fragments>	stop once files average this many fragments, 0 to run every operation (0)
+*	-o <ops>		most operations of the synthetic workload (200000)
+*	-z <min,max>	range of the size of a created file (512,262144)
+*	-a <bytes>		largest append (16384)
+*	-c <percent>	percent of operations under the target that create a file, the rest append (30)
+*	-D <dirs>		directories the files are spread across (16)
+*	-t <file>		replay the recorded workload instead of a synthetic one
+*	-w <file>		record the synthetic workload to the file
+*	-F <file>		write the size and fragments of every file to the file
+*	-d <mode>		durability, none, ordered or full (none)
+*	-r <seed>		seed of the synthetic workload (1)
+*	-j <file>		also write the results as JSON to the file
+****************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileSystem.h"
+#include "Bench.h"
+
+#define AGE_PATH_SIZE 256				//Max size of a path made or replayed by the tool
+#define WRITE_CHUNK (1024 * 1024)		//Most bytes handed to fileWrite at once
+#define HISTOGRAM_BUCKETS 24			//Power of two buckets of the histograms
+#define CHECK_INTERVAL 1000				//Operations between checks of the fragmentation target
+#define NUM_OPS 3
+
+enum { OP_CREATE, OP_APPEND, OP_DELETE };
+
+/* Settings of a run of the tool */
+typedef struct AgeConfig {
+	char* volumeFile;
+	uint64_t volumeSize;
+	uint64_t blockSize;
+	uint64_t fullness;
+	double fragments;
+	uint64_t ops;
+	uint64_t minSize;
+	uint64_t maxSize;
+	uint64_t maxAppend;
+	uint64_t createPercent;
+	uint64_t directories;
+	char* traceFile;
+	char* recordFile;
+	char* fragmentFile;
+	int durability;
+	char* durabilityName;
+	uint32_t seed;
+	char* jsonFile;
+} AgeConfig, *AgeConfig_p;
+
+/* A file made by the synthetic workload */
+typedef struct AgedFile {
+	uint64_t id;						//Number in the name of the file
+	uint64_t size;						//Bytes written to the file
+} AgedFile, *AgedFile_p;
+
+/* Latencies and system calls of each kind of operation */
+typedef struct AgeResults {
+	BenchPhase phases[NUM_OPS];
+	uint64_t busy[NUM_OPS];				//Nanoseconds spent in each kind of operation
+	uint64_t syscalls[NUM_OPS];			//System calls made by each kind of operation
+} AgeResults, *AgeResults_p;
+
+/* Files found under the directories, with their fragments */
+typedef struct FragmentScan {
+	FILE* out;							//Where to write each file, NULL for none
+	char* directory;					//Directory being listed
+	uint64_t files;
+	uint64_t fragments;
+	uint64_t maxFragments;
+	uint64_t histogram[HISTOGRAM_BUCKETS];
+} FragmentScan, *FragmentScan_p;
+
+const char* opNames[NUM_OPS] = { "create", "append", "delete" };
+uint8_t* writeBuffer;
+FsVolume_p vol;							//Volume being aged
+
+void usage();
+int parseOptions(int argc, char** argv, AgeConfig_p config);
+uint64_t randomRange(uint64_t min, uint64_t max);
+uint64_t usedPercent();
+void agedPath(char* path, AgeConfig_p config, uint64_t id);
+int writeBytes(char* path, uint64_t bytes, int create);
+int runOp(AgeResults_p results, int op, char* path, uint64_t bytes);
+uint64_t runSynthetic(AgeConfig_p config, AgeResults_p results, FILE* record);
+uint64_t runTrace(AgeConfig_p config, AgeResults_p results, FILE* trace);
+void collectFiles(DirEntry_p entry, Inode_p inode, void* arg);
+void scanFragments(AgeConfig_p config, FragmentScan_p scan);
+void printHistogram(const char* title, const char* unit, uint64_t* histogram, uint32_t buckets);
+
+int main(int argc, char** argv) {
+	AgeConfig config;
+	AgeResults results;
+	FragmentScan scan;
+	AllocStats alloc;
+	uint64_t freeHistogram[HISTOGRAM_BUCKETS];
+	uint64_t largestRun;
+	char path[AGE_PATH_SIZE];
+
+	if (!parseOptions(argc, argv, &config)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	srand(config.seed);
+
+	FILE* trace = NULL;
+	FILE* record = NULL;
+	if (config.traceFile != NULL && (trace = fopen(config.traceFile, "r")) == NULL) {
+		printf("Could not open %s\n", config.traceFile);
+		exit(EXIT_FAILURE);
+	}
+	if (config.recordFile != NULL && (record = fopen(config.recordFile, "w")) == NULL) {
+		printf("Could not open %s\n", config.recordFile);
+		exit(EXIT_FAILURE);
+	}
+
+	if (unlink(config.volumeFile) == -1 && errno != ENOENT) {
+		printf("Could not replace %s\n", config.volumeFile);
+		exit(EXIT_FAILURE);
+	}
+	vol = fs_mount(config.volumeFile, &config.volumeSize, &config.blockSize, config.durability);
+	if (vol == NULL) {
+		printf("Error: opening partition %s\n", config.volumeFile);
+		exit(EXIT_FAILURE);
+	}
+	if (fs_format(vol, DIR_FORMAT_COMPACT) != 0) {
+		printf("Format failed!\n");
+		fs_unmount(vol);
+		exit(EXIT_FAILURE);
+	}
+	startWriteback(vol, NULL);
+	for (uint64_t d = 0; d < config.directories; d++) {
+		snprintf(path, AGE_PATH_SIZE, "d%lu", d);
+		fs_mkdir(vol, path);
+	}
+
+	writeBuffer = malloc(WRITE_CHUNK);
+	for (uint64_t i = 0; i < WRITE_CHUNK; i++)
+		writeBuffer[i] = i * 31 + 7;
+	memset(&results, 0, sizeof(AgeResults));
+	for (int op = 0; op < NUM_OPS; op++)
+		beginPhase(&results.phases[op], fs_partition(vol), opNames[op], 1024);
+	fs_allocStats(vol, &alloc, 1);
+
+	uint64_t ops = (trace != NULL) ? runTrace(&config, &results, trace) : runSynthetic(&config, &results, record);
+
+	//A phase spans only the time spent in its own operations
+	for (int op = 0; op < NUM_OPS; op++) {
+		endPhase(&results.phases[op]);
+		results.phases[op].elapsed = results.busy[op];
+		results.phases[op].syscalls = results.syscalls[op];
+	}
+	fs_allocStats(vol, &alloc, 0);
+	fsSync(vol);
+
+	scan.out = NULL;
+	if (config.fragmentFile != NULL && (scan.out = fopen(config.fragmentFile, "w")) == NULL)
+		printf("Could not open %s\n", config.fragmentFile);
+	scanFragments(&config, &scan);
+	if (scan.out != NULL)
+		fclose(scan.out);
+	VolumeInfo info;
+	fs_volumeInfo(vol, &info);
+	uint64_t freeRuns = fs_freeRuns(vol, freeHistogram, HISTOGRAM_BUCKETS, &largestRun);
+	uint64_t meanFragmentsx100 = (scan.files > 0) ? scan.fragments * 100 / scan.files : 0;
+	char meanFragments[32];
+	snprintf(meanFragments, sizeof(meanFragments), "%lu.%02lu", meanFragmentsx100 / 100, meanFragmentsx100 % 100);
+
+	BenchParam params[] = {
+		{ "volume_size", NULL, config.volumeSize },
+		{ "block_size", NULL, config.blockSize },
+		{ "workload", (trace != NULL) ? config.traceFile : "synthetic", 0 },
+		{ "target_fullness", NULL, config.fullness },
+		{ "seed", NULL, config.seed },
+		{ "durability", config.durabilityName, 0 },
+		{ "operations", NULL, ops },
+		{ "used_percent", NULL, usedPercent() },
+		{ "files", NULL, scan.files },
+		{ "mean_fragments", meanFragments, 0 },
+		{ "max_fragments", NULL, scan.maxFragments },
+		{ "free_blocks", NULL, info.freeDataBlocks },
+		{ "free_runs", NULL, freeRuns },
+		{ "largest_free_run", NULL, largestRun },
+		{ "alloc_calls", NULL, alloc.calls },
+		{ "alloc_blocks", NULL, alloc.blocks },
+		{ "alloc_holes", NULL, alloc.holes },
+		{ "alloc_fallbacks", NULL, alloc.fallbacks },
+		{ "alloc_mean_ns", NULL, (alloc.calls > 0) ? alloc.nanoseconds / alloc.calls : 0 },
+		{ "alloc_max_ns", NULL, alloc.maxNanoseconds }
+	};
+	uint32_t paramCount = sizeof(params) / sizeof(BenchParam);
+	printf("\n");
+	printBenchText(stdout, params, paramCount, results.phases, NUM_OPS);
+	printHistogram("Fragments per file", "fragments", scan.histogram, HISTOGRAM_BUCKETS);
+	printHistogram("Free runs by length", "blocks", freeHistogram, HISTOGRAM_BUCKETS);
+	if (config.jsonFile != NULL) {
+		FILE* json = fopen(config.jsonFile, "w");
+		if (json == NULL) {
+			printf("Could not open %s\n", config.jsonFile);
+		} else {
+			printBenchJson(json, "agefs", params, paramCount, results.phases, NUM_OPS);
+			fclose(json);
+		}
+	}
+
+	fs_unmount(vol);
+	for (int op = 0; op < NUM_OPS; op++)
+		freePhase(&results.phases[op]);
+	free(writeBuffer);
+	if (trace != NULL)
+		fclose(trace);
+	if (record != NULL)
+		fclose(record);
+	return 0;
+}
+
+/** Prints the options of the tool */
+void usage() {
+	printf("Usage: ./agefs [options]\n");
+	printf("  -f <file>       volume to create, replaced if it exists (aged.vol)\n");
+	printf("  -s <bytes>      volume size (67108864)\n");
+	printf("  -b <bytes>      block size (512)\n");
+	printf("  -u <percent>    target fullness of the volume (80)\n");
+	printf("  -g <fragments>  stop once files average this many fragments, 0 to run every operation (0)\n");
+	printf("  -o <ops>        most operations of the synthetic workload (200000)\n");
+	printf("  -z <min,max>    range of the size of a created file (512,262144)\n");
+	printf("  -a <bytes>      largest append (16384)\n");
+	printf("  -c <percent>    percent of operations under the target that create a file (30)\n");
+	printf("  -D <dirs>       directories the files are spread across (16)\n");
+	printf("  -t <file>       replay the recorded workload instead of a synthetic one\n");
+	printf("  -w <file>       record the synthetic workload to the file\n");
+	printf("  -F <file>       write the size and fragments of every file to the file\n");
+	printf("  -d <mode>       durability, none, ordered or full (none)\n");
+	printf("  -r <seed>       seed of the synthetic workload (1)\n");
+	printf("  -j <file>       also write the results as JSON to the file\n");
+}
+
+/**
+ * Reads the options into the config, starting from the defaults.
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config where to store the settings
+ * @returns 1 if successful
+ * @returns 0 if an option is unknown or invalid
+ */
+int parseOptions(int argc, char** argv, AgeConfig_p config) {
+	int option;
+	char* end;
+
+	config->volumeFile = "aged.vol";
+	config->volumeSize = 64 * 1024 * 1024;
+	config->blockSize = 512;
+	config->fullness = 80;
+	config->fragments = 0;
+	config->ops = 200000;
+	config->minSize = 512;
+	config->maxSize = 256 * 1024;
+	config->maxAppend = 16 * 1024;
+	config->createPercent = 30;
+	config->directories = 16;
+	config->traceFile = NULL;
+	config->recordFile = NULL;
+	config->fragmentFile = NULL;
+	config->durability = DURABILITY_NONE;
+	config->durabilityName = "none";
+	config->seed = 1;
+	config->jsonFile = NULL;
+
+	while ((option = getopt(argc, argv, "f:s:b:u:g:o:z:a:c:D:t:w:F:d:r:j:h")) != -1) {
+		switch (option) {
+		case 'f': config->volumeFile = optarg; break;
+		case 's': config->volumeSize = strtoull(optarg, NULL, 10); break;
+		case 'b': config->blockSize = strtoull(optarg, NULL, 10); break;
+		case 'u': config->fullness = strtoull(optarg, NULL, 10); break;
+		case 'g': config->fragments = strtod(optarg, NULL); break;
+		case 'o': config->ops = strtoull(optarg, NULL, 10); break;
+		case 'a': config->maxAppend = strtoull(optarg, NULL, 10); break;
+		case 'c': config->createPercent = strtoull(optarg, NULL, 10); break;
+		case 'D': config->directories = strtoull(optarg, NULL, 10); break;
+		case 't': config->traceFile = optarg; break;
+		case 'w': config->recordFile = optarg; break;
+		case 'F': config->fragmentFile = optarg; break;
+		case 'r': config->seed = strtoul(optarg, NULL, 10); break;
+		case 'j': config->jsonFile = optarg; break;
+		case 'z':
+			config->minSize = strtoull(optarg, &end, 10);
+			if (*end != ',')
+				return 0;
+			config->maxSize = strtoull(end + 1, NULL, 10);
+			break;
+		case 'd':
+			config->durabilityName = optarg;
+			if (strcmp(optarg, "none") == 0)
+				config->durability = DURABILITY_NONE;
+			else if (strcmp(optarg, "ordered") == 0)
+				config->durability = DURABILITY_ORDERED;
+			else if (strcmp(optarg, "full") == 0)
+				config->durability = DURABILITY_FULL;
+			else
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	return optind == argc && config->fullness > 0 && config->fullness < 100 && config->minSize > 0 &&
+		config->minSize <= config->maxSize && config->maxAppend > 0 && config->createPercent <= 100 &&
+		config->directories > 0;
+}
+
+/**
+ * Returns a random number in a range
+ * @param min the smallest number
+ * @param max the largest number
+ * @returns the number
+ */
+uint64_t randomRange(uint64_t min, uint64_t max) {
+	return min + ((uint64_t)rand() * RAND_MAX + rand()) % (max - min + 1);
+}
+
+/**
+ * Returns the percent of the data blocks in use
+ * @returns the percent used
+ */
+uint64_t usedPercent() {
+	VolumeInfo info;
+	fs_volumeInfo(vol, &info);
+	return (info.totalDataBlocks - info.freeDataBlocks) * 100 / info.totalDataBlocks;
+}
+
+/**
+ * Makes the path of a file of the synthetic workload
+ * @param path where to write the path, at least AGE_PATH_SIZE bytes
+ * @param config the settings of the run
+ * @param id the number of the file
+ */
+void agedPath(char* path, AgeConfig_p config, uint64_t id) {
+	snprintf(path, AGE_PATH_SIZE, "d%lu/f%lu", id % config->directories, id);
+}
+
+/**
+ * Writes bytes to the end of a file, creating it first if asked.
+ * @param path the path of the file
+ * @param bytes the number of bytes to write
+ * @param create 1 to create the file
+ * @returns 1 if successful
+ * @returns 0 if the file could not be made or written
+ */
+int writeBytes(char* path, uint64_t bytes, int create) {
+	if (create && fs_mkfile(vol, path, 0) != 0)
+		return 0;
+	int fd = fileOpen(vol, path);
+	if (fd == -1)
+		return 0;
+
+	int success = fileSeek(vol, fd, 0, FS_SEEK_END);
+	for (uint64_t written = 0; success && written < bytes; written += WRITE_CHUNK) {
+		uint64_t length = (bytes - written < WRITE_CHUNK) ? bytes - written : WRITE_CHUNK;
+		success = fileWrite(vol, fd, writeBuffer, length) == length;
+	}
+	fileClose(vol, fd);
+	return success;
+}
+
+/**
+ * Runs and times one operation.
+ * @param results where to record the operation
+ * @param op OP_CREATE, OP_APPEND or OP_DELETE
+ * @param path the path of the file
+ * @param bytes the bytes to write, unused by OP_DELETE
+ * @returns 1 if successful
+ * @returns 0 if the operation failed
+ */
+int runOp(AgeResults_p results, int op, char* path, uint64_t bytes) {
+	uint64_t syscalls = LBAsyscalls(fs_partition(vol));
+	uint64_t start = benchNow();
+	int success;
+
+	if (op == OP_DELETE)
+		success = fs_rm(vol, path) == 0;
+	else
+		success = writeBytes(path, bytes, op == OP_CREATE);
+
+	recordOp(&results->phases[op], start, !success);
+	results->busy[op] += benchNow() - start;
+	results->syscalls[op] += LBAsyscalls(fs_partition(vol)) - syscalls;
+	if (success && op != OP_DELETE)
+		results->phases[op].bytes += bytes;
+	return success;
+}
+
+/**
+ * Runs the synthetic workload. Under the target fullness it creates and
+ * appends to files, and over it deletes a random file.
+ * @param config the settings of the run
+ * @param results where to record the operations
+ * @param record where to record the workload, NULL for nowhere
+ * @returns the number of operations run
+ */
+uint64_t runSynthetic(AgeConfig_p config, AgeResults_p results, FILE* record) {
+	AgedFile_p files = NULL;
+	uint64_t fileCount = 0;
+	uint64_t fileCapacity = 0;
+	uint64_t nextID = 0;
+	uint64_t ops;
+	char path[AGE_PATH_SIZE];
+	FragmentScan scan;
+
+	for (ops = 0; ops < config->ops; ops++) {
+		int op;
+		uint64_t index = 0;
+		uint64_t bytes = 0;
+
+		if (usedPercent() >= config->fullness && fileCount > 0)
+			op = OP_DELETE;
+		else if (fileCount == 0 || randomRange(1, 100) <= config->createPercent)
+			op = OP_CREATE;
+		else
+			op = OP_APPEND;
+
+		if (op == OP_CREATE) {
+			if (fileCount == fileCapacity) {
+				fileCapacity = (fileCapacity > 0) ? fileCapacity * 2 : 1024;
+				files = realloc(files, fileCapacity * sizeof(AgedFile));
+			}
+			index = fileCount++;
+			files[index].id = nextID++;
+			files[index].size = 0;
+			bytes = randomRange(config->minSize, config->maxSize);
+		} else {
+			index = randomRange(0, fileCount - 1);
+			if (op == OP_APPEND)
+				bytes = randomRange(1, config->maxAppend);
+		}
+
+		agedPath(path, config, files[index].id);
+		if (record != NULL) {
+			if (op == OP_DELETE)
+				fprintf(record, "delete %s\n", path);
+			else
+				fprintf(record, "%s %s %lu\n", opNames[op], path, bytes);
+		}
+		if (runOp(results, op, path, bytes))
+			files[index].size += bytes;
+		if (op == OP_DELETE)
+			files[index] = files[--fileCount];
+
+		if (config->fragments > 0 && ops % CHECK_INTERVAL == CHECK_INTERVAL - 1) {
+			scan.out = NULL;
+			scanFragments(config, &scan);
+			if (scan.files > 0 && scan.fragments >= config->fragments * scan.files) {
+				ops++;
+				break;
+			}
+		}
+	}
+	free(files);
+	return ops;
+}
+
+/**
+ * Replays a recorded workload.
+ * @param config the settings of the run
+ * @param results where to record the operations
+ * @param trace the recorded workload
+ * @returns the number of operations run
+ */
+uint64_t runTrace(AgeConfig_p config, AgeResults_p results, FILE* trace) {
+	char line[AGE_PATH_SIZE + 64];
+	char command[16];
+	char path[AGE_PATH_SIZE];
+	uint64_t bytes;
+	uint64_t ops = 0;
+	uint64_t lineNumber = 0;
+
+	while (fgets(line, sizeof(line), trace) != NULL) {
+		lineNumber++;
+		bytes = 0;
+		int fields = sscanf(line, "%15s %255s %lu", command, path, &bytes);
+		if (fields <= 0 || command[0] == '#')
+			continue;
+
+		int op = -1;
+		for (int i = 0; i < NUM_OPS; i++) {
+			if (strcmp(command, opNames[i]) == 0)
+				op = i;
+		}
+		if (op == -1 || fields < ((op == OP_DELETE) ? 2 : 3)) {
+			printf("Skipping line %lu of %s\n", lineNumber, config->traceFile);
+			continue;
+		}
+		runOp(results, op, path, bytes);
+		ops++;
+	}
+	return ops;
+}
+
+/**
+ * Counts the fragments of a file found while listing a directory
+ * @param entry the directory entry of the file
+ * @param inode the inode of the file
+ * @param arg the FragmentScan
+ */
+void collectFiles(DirEntry_p entry, Inode_p inode, void* arg) {
+	FragmentScan_p scan = arg;
+	char path[AGE_PATH_SIZE];
+
+	if (inode->type != FILE_TYPE)
+		return;
+	snprintf(path, AGE_PATH_SIZE, "%s/%s", scan->directory, entry->name);
+	int64_t fragments = fs_fragments(vol, path);
+	if (fragments < 0)
+		return;
+
+	uint32_t bucket = 0;
+	while (bucket + 1 < HISTOGRAM_BUCKETS && (uint64_t)fragments >> (bucket + 1) > 0)
+		bucket++;
+	if (fragments > 0)
+		scan->histogram[bucket]++;
+	scan->files++;
+	scan->fragments += fragments;
+	if ((uint64_t)fragments > scan->maxFragments)
+		scan->maxFragments = fragments;
+	if (scan->out != NULL)
+		fprintf(scan->out, "%s %lu %ld\n", path, inode->size, fragments);
+}
+
+/**
+ * Counts the fragments of every file in the directories of the tool
+ * @param config the settings of the run
+ * @param scan where to count, with out set
+ */
+void scanFragments(AgeConfig_p config, FragmentScan_p scan) {
+	char directory[AGE_PATH_SIZE];
+
+	scan->directory = directory;
+	scan->files = 0;
+	scan->fragments = 0;
+	scan->maxFragments = 0;
+	memset(scan->histogram, 0, sizeof(scan->histogram));
+	for (uint64_t d = 0; d < config->directories; d++) {
+		snprintf(directory, AGE_PATH_SIZE, "d%lu", d);
+		fs_listdir(vol, directory, collectFiles, scan);
+	}
+}
+
+/**
+ * Prints the non empty buckets of a power of two histogram
+ * @param title the heading of the histogram
+ * @param unit what the buckets count
+ * @param histogram the histogram
+ * @param buckets the number of buckets
+ */
+void printHistogram(const char* title, const char* unit, uint64_t* histogram, uint32_t buckets) {
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < buckets; i++)
+		total += histogram[i];
+
+	printf("\n%s\n", title);
+	for (uint32_t i = 0; i < buckets; i++) {
+		if (histogram[i] == 0)
+			continue;
+		uint64_t low = (uint64_t)1 << i;
+		if (i + 1 == buckets)
+			printf("  %10lu+       %-10s %10lu %6.1f%%\n", low, unit, histogram[i], histogram[i] * 100.0 / total);
+		else
+			printf("  %10lu-%-10lu %-10s %10lu %6.1f%%\n", low, (low << 1) - 1, unit, histogram[i], histogram[i] * 100.0 / total);
+	}
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -11,7 +13,90 @@
 #include <math.h>
 #include "fsLow.h"
 
-partitionInfo_p partInfop = NULL;
+static __thread int threadDurability = DURABILITY_DEFAULT;	//Override for writes of this thread
+static __thread int threadTag = LBA_TAG_OTHER;	//Caller tag of the traced calls of this thread
+
+// A run of blocks written since the last flush
+typedef struct dirtyRange {
+	uint64_t	start;
+	uint64_t	count;
+	} dirtyRange_t;
+
+// A metadata block held by LBAwriteMetadata until the data written before it is flushed
+typedef struct heldBlock {
+	struct heldBlock *	next;			//Next held block in the same bucket
+	uint64_t			lba;
+	uint64_t			epoch;			//flushEpoch when data was written, flushes started later write it
+	uint8_t *			data;			//Latest content of the block
+	uint8_t *			older;			//Content written before the running flush started, NULL if none
+	int					tag;			//Caller tag of the write, for the trace of the write that releases it
+	uint8_t				buffers[];		//Room for data and older
+	} heldBlock_t;
+
+// A partition opened by startPartitionSystem. Each has its own locks and
+// counters, so partitions used by different threads never share a lock.
+struct partition {
+	partitionInfo_p	info;				//Header of the partition, with its file descriptor
+	int				durability;			//Durability chosen when the partition started
+	pthread_mutex_t	dirtyLock;			//Guards the dirty fields below
+	dirtyRange_t	dirtyRanges[DIRTY_RANGE_LIMIT];	//Runs written since the last flush, in write order
+	uint32_t		dirtyRangeCount;
+	int				dirtyOverflow;		//Set when more runs were written than dirtyRanges holds
+	uint64_t		dirtyBlocks;		//Blocks written since the last flush
+	uint64_t		dirtySince;			//Milliseconds at the oldest write that is not flushed
+	uint64_t		dirtyLimit;			//Blocks a writer may leave unflushed, 0 for no limit
+	heldBlock_t *	held[HELD_BUCKETS];	//Metadata waiting for the data written before it, hashed by block
+	uint64_t		heldBlocks;			//Blocks in held, changed atomically so reads can skip the lock
+	uint64_t		heldSince;			//Milliseconds at the oldest held block
+	uint64_t		heldLow;			//Lowest and highest held block, so most calls skip the lookup
+	uint64_t		heldHigh;
+	uint64_t		releases;			//Times held blocks were written out or dropped, a read racing one reads again
+	uint64_t		flushEpoch;			//Flushes started, each writes the blocks held before it started
+	int				flushing;			//Set while a flush runs, from taking the dirty runs to releasing held blocks
+	pthread_mutex_t	flushLock;			//Lets one flush run at a time
+	uint64_t		syscallCount;		//System calls made by the LBA functions
+	uint64_t		syscallBase;		//syscallCount when lbaStats was last reset
+	lbaStats_t		lbaStats;			//Work done by the LBA functions, added to atomically
+	};
+
+#define TRACE_WORDS (sizeof(traceRecord_t) / sizeof(uint64_t))
+
+// The traced calls of one thread, overwritten oldest first once it is full.
+// Only the thread adds to it, and other threads read it to dump it. A ring
+// whose thread exited keeps its records until another thread takes it.
+typedef struct traceRing {
+	struct traceRing *	next;			//Ring of another thread
+	uint64_t			size;			//Records the memory of the ring has room for
+	uint64_t			capacity;		//Records the ring holds, at most size
+	int					unused;			//1 while no thread owns the ring
+	uint64_t			head;			//Records ever written to the ring
+	uint64_t			since;			//Value of head when tracing last started
+	uint16_t			thread;			//Number of the thread
+	uint64_t			words[];		//Records stored as words, so each is copied atomically
+	} traceRing_t;
+
+static traceRing_t * traceRings = NULL;	//Ring of every thread that traced a call
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;	//Guards the list of rings and who owns them
+static partition_p tracedPartition = NULL;	//Partition whose calls are traced, NULL if none
+static uint64_t traceBlockSize = 0;		//Geometry of the partition last traced, for the dump
+static uint64_t traceBlockCount = 0;
+static uint64_t traceCapacity = LBA_TRACE_DEFAULT_RECORDS;	//Records in a new ring
+static uint16_t traceThreads = 0;		//Rings made so far, numbers the threads
+static __thread traceRing_t * threadRing = NULL;	//Ring of this thread
+static pthread_once_t traceRingOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t traceRingKey;		//Ring of each thread, given up when the thread exits
+
+// Counts system calls made by the LBA functions.
+static void countSyscalls (partition_p part, uint64_t count)
+	{
+	__atomic_add_fetch(&part->syscallCount, count, __ATOMIC_RELAXED);
+	}
+
+// Adds to one of the counters of the lbaStats of a partition.
+static void countStat (uint64_t * counter, uint64_t value)
+	{
+	__atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+	}
 
 int initializePartition (int fd, uint64_t volSize, uint64_t blockSize)
 	{
@@ -61,6 +146,11 @@ int initializePartition (int fd, uint64_t volSize, uint64_t blockSize)
 // volSize and blockSize are ignored.  If the file does not exist, it will
 // be created to the specified volume size in units of the block size
 // (must be power of 2) plus one for the partition header.
+// The durability decides when writes are flushed to the device, one of
+// DURABILITY_NONE, DURABILITY_ORDERED or DURABILITY_FULL.
+//
+// Any number of partitions can be open at once, each used through the
+// partition it returns.
 //
 // On return
 // 		return value 0 = success;
@@ -68,7 +158,8 @@ int initializePartition (int fd, uint64_t volSize, uint64_t blockSize)
 //		return value -2 = insufficient space for the volume
 //		volSize will be filled with the volume size
 //		blockSize will be filled with the block size
-int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockSize)
+//		partition will be filled with the partition on success
+int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockSize, int durability, partition_p * partition)
 	{
 	int fd;
 	int retVal = PART_NOERROR;
@@ -128,11 +219,16 @@ int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockS
 		{
 		*volSize = buf->volumesize;
 		*blockSize = buf->blocksize;
-		partInfop = malloc (sizeof(partitionInfo_t)+strlen(buf->volumeName)+4);
-		memcpy(partInfop, buf, sizeof(partitionInfo_t)+strlen(buf->volumeName)+4);
-		partInfop->filename = malloc (strlen(filename)+4);
-		strcpy(partInfop->filename, filename);
-		partInfop->fd = fd;
+		partition_p part = calloc (1, sizeof(partition_t));
+		part->info = malloc (sizeof(partitionInfo_t)+strlen(buf->volumeName)+4);
+		memcpy(part->info, buf, sizeof(partitionInfo_t)+strlen(buf->volumeName)+4);
+		part->info->filename = malloc (strlen(filename)+4);
+		strcpy(part->info->filename, filename);
+		part->info->fd = fd;
+		part->durability = (durability >= DURABILITY_NONE && durability <= DURABILITY_FULL) ? durability : DURABILITY_FULL;
+		pthread_mutex_init(&part->dirtyLock, NULL);
+		pthread_mutex_init(&part->flushLock, NULL);
+		*partition = part;
 		retVal = PART_NOERROR;
 		}
 	else
@@ -148,24 +244,651 @@ int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockS
 	return retVal;
 	}
 
-int closePartitionSystem ()
+int closePartitionSystem (partition_p part)
+	{
+	//A trace of the partition stops with it
+	partition_p traced = part;
+	__atomic_compare_exchange_n(&tracedPartition, &traced, NULL, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+	//Blocks still held after a failed flush are dropped, they could point at data that never reached the device
+	LBAsync(part);
+	for (uint32_t i = 0; i < HELD_BUCKETS; i++)
+		while (part->held[i] != NULL)
+			{
+			heldBlock_t * block = part->held[i];
+			part->held[i] = block->next;
+			free (block);
+			}
+
+	fsync(part->info->fd);
+	close (part->info->fd);
+	free (part->info->filename);
+	free (part->info);
+	pthread_mutex_destroy(&part->dirtyLock);
+	pthread_mutex_destroy(&part->flushLock);
+	free (part);
+	return 0;
+	}
+
+// Returns the header of the partition, with its block size and number of blocks.
+partitionInfo_p LBAinfo (partition_p part)
+	{
+	return part->info;
+	}
+
+
+// Returns the durability used by writes of the calling thread.
+int LBAdurability (partition_p part)
+	{
+	return (threadDurability != DURABILITY_DEFAULT) ? threadDurability : part->durability;
+	}
+
+// Overrides the durability for writes of the calling thread,
+// DURABILITY_DEFAULT goes back to the durability of the partition.
+void LBAsetThreadDurability (int durability)
+	{
+	threadDurability = durability;
+	}
+
+// Milliseconds from a fixed point, unaffected by changes to the clock.
+static uint64_t currentMillis ()
+	{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	}
+
+// Nanoseconds from a fixed point, unaffected by changes to the clock.
+static uint64_t currentNanos ()
+	{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	}
+
+// Takes a lock on a range of the volume. The lock is tried without waiting
+// first, so only a lock held by another process costs a second call and is
+// counted as a wait.
+static void lockRange (partition_p part, struct flock * fl)
+	{
+	if (fcntl(part->info->fd, F_SETLK, fl) == 0)
+		return;
+	uint64_t start = currentNanos();
+	fcntl(part->info->fd, F_SETLKW, fl);
+	countStat(&part->lbaStats.lockWaits, 1);
+	countStat(&part->lbaStats.lockWaitNanos, currentNanos() - start);
+	countSyscalls(part, 1);
+	}
+
+// Returns the time a traced call starts, or 0 if calls are not being traced.
+static uint64_t traceBegin (partition_p part)
+	{
+#ifndef LBA_NO_TRACE
+	if (__atomic_load_n(&tracedPartition, __ATOMIC_RELAXED) == part)
+		return currentNanos();
+#endif
+	return 0;
+	}
+
+// Gives up the ring of a thread that exits, so another thread can take it.
+static void releaseTraceRing (void * arg)
+	{
+	traceRing_t * ring = arg;
+	pthread_mutex_lock(&traceLock);
+	ring->unused = 1;
+	pthread_mutex_unlock(&traceLock);
+	}
+
+// Creates the key giving up each thread's ring when the thread exits.
+static void createTraceRingKey ()
+	{
+	pthread_key_create(&traceRingKey, releaseTraceRing);
+	}
+
+// Empties ring and sets it to hold capacity records.
+static void resetTraceRing (traceRing_t * ring, uint64_t capacity)
+	{
+	ring->capacity = capacity;
+	ring->since = 0;
+	ring->head = 0;
+	}
+
+// Finds a ring of capacity records for the calling thread, which either has
+// none or has one of another capacity. A ring of another capacity only holds
+// records from before tracing last started, since the capacity only changes
+// at a start, so it is emptied and kept if it has room or freed if not. A
+// ring left by an exited thread is taken before making one.
+static traceRing_t * takeTraceRing (uint64_t capacity)
+	{
+	pthread_once(&traceRingOnce, createTraceRingKey);
+	pthread_mutex_lock(&traceLock);
+	traceRing_t * ring = threadRing;
+	if (ring != NULL)
+		{
+		ring->unused = 1;
+		threadRing = NULL;
+		pthread_setspecific(traceRingKey, NULL);
+		}
+
+	//Keep the records of an exited thread traced at this capacity, they are since the start
+	traceRing_t * found = NULL;
+	for (ring = traceRings; ring != NULL; ring = ring->next)
+		if (ring->unused && (ring->capacity == capacity))
+			{
+			found = ring;
+			break;
+			}
+	for (traceRing_t ** link = &traceRings; (found == NULL) && (*link != NULL); )
+		{
+		ring = *link;
+		if (!ring->unused || (ring->capacity == capacity))
+			link = &ring->next;
+		else if (ring->size >= capacity)
+			{
+			resetTraceRing(ring, capacity);
+			found = ring;
+			}
+		else
+			{
+			*link = ring->next;
+			free(ring);
+			}
+		}
+
+	if (found == NULL)
+		{
+		found = malloc (sizeof(traceRing_t) + capacity * sizeof(traceRecord_t));
+		if (found != NULL)
+			{
+			found->size = capacity;
+			resetTraceRing(found, capacity);
+			found->thread = traceThreads++;
+			found->next = traceRings;
+			traceRings = found;
+			}
+		}
+	if (found != NULL)
+		{
+		found->unused = 0;
+		threadRing = found;
+		pthread_setspecific(traceRingKey, found);
+		}
+	pthread_mutex_unlock(&traceLock);
+	return found;
+	}
+
+// Records a call that started at the time returned by traceBegin in the
+// ring of the calling thread, taking a ring first if it has none.
+static void traceEnd (int op, uint64_t lba, uint64_t count, uint64_t start)
+	{
+#ifndef LBA_NO_TRACE
+	if (start == 0)
+		return;
+
+	uint64_t capacity = __atomic_load_n(&traceCapacity, __ATOMIC_RELAXED);
+	traceRing_t * ring = threadRing;
+	if ((ring == NULL) || (ring->capacity != capacity))
+		{
+		ring = takeTraceRing(capacity);
+		if (ring == NULL)
+			return;
+		}
+
+	traceRecord_t record = { start, currentNanos() - start, lba, count, ring->thread, op, threadTag };
+	uint64_t words[TRACE_WORDS];
+	memcpy(words, &record, sizeof(record));
+	uint64_t head = ring->head;
+	uint64_t * slot = &ring->words[(head % ring->capacity) * TRACE_WORDS];
+	for (uint64_t i = 0; i < TRACE_WORDS; i++)
+		__atomic_store_n(&slot[i], words[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+#endif
+	}
+
+// Orders trace records by the time they started.
+static int compareRecords (const void * a, const void * b)
+	{
+	const traceRecord_t * left = a;
+	const traceRecord_t * right = b;
+	return (left->timestamp > right->timestamp) - (left->timestamp < right->timestamp);
+	}
+
+// Orders runs of blocks by their first block.
+static int compareRanges (const void * a, const void * b)
+	{
+	const dirtyRange_t * left = a;
+	const dirtyRange_t * right = b;
+	return (left->start > right->start) - (left->start < right->start);
+	}
+
+// Remembers a run of blocks that was written but not flushed. A write that
+// continues the last run extends it, so sequential writes take one run.
+// The caller holds dirtyLock.
+// Returns 1 if the writer is over the dirty limit and must flush.
+static int addDirty (partition_p part, uint64_t lbaPosition, uint64_t lbaCount)
+	{
+	if (part->dirtyBlocks == 0)
+		part->dirtySince = currentMillis();
+	part->dirtyBlocks += lbaCount;
+
+	dirtyRange_t * last = (part->dirtyRangeCount > 0) ? &part->dirtyRanges[part->dirtyRangeCount - 1] : NULL;
+	if ((last != NULL) && (lbaPosition >= last->start) && (lbaPosition <= last->start + last->count))
+		{
+		if (lbaPosition + lbaCount > last->start + last->count)
+			last->count = lbaPosition + lbaCount - last->start;
+		}
+	else if (part->dirtyRangeCount < DIRTY_RANGE_LIMIT)
+		{
+		part->dirtyRanges[part->dirtyRangeCount].start = lbaPosition;
+		part->dirtyRanges[part->dirtyRangeCount].count = lbaCount;
+		part->dirtyRangeCount++;
+		}
+	else
+		part->dirtyOverflow = 1;
+
+	return (part->dirtyLimit != 0) && (part->dirtyBlocks > part->dirtyLimit);
+	}
+
+// Locked addDirty, for a write that just finished.
+static int markDirty (partition_p part, uint64_t lbaPosition, uint64_t lbaCount)
+	{
+	pthread_mutex_lock(&part->dirtyLock);
+	int overLimit = addDirty(part, lbaPosition, lbaCount);
+	pthread_mutex_unlock(&part->dirtyLock);
+	return overLimit;
+	}
+
+// Finds the link to the held copy of a block, or to the end of its bucket if
+// the block is not held. The caller holds dirtyLock.
+static heldBlock_t ** findHeld (partition_p part, uint64_t lba)
+	{
+	heldBlock_t ** link = &part->held[lba % HELD_BUCKETS];
+	while ((*link != NULL) && ((*link)->lba != lba))
+		link = &(*link)->next;
+	return link;
+	}
+
+// Returns 1 if any block of the run is held. The caller holds dirtyLock.
+static int isHeld (partition_p part, uint64_t lbaPosition, uint64_t lbaCount)
+	{
+	if ((part->heldBlocks == 0) || (lbaPosition > part->heldHigh) || (lbaPosition + lbaCount <= part->heldLow))
+		return 0;
+	for (uint64_t i = 0; i < lbaCount; i++)
+		if (*findHeld(part, lbaPosition + i) != NULL)
+			return 1;
+	return 0;
+	}
+
+// Counts held blocks that left held. Reads check releases before heldBlocks,
+// so a read that finds nothing held still sees that blocks were written out
+// since it started. The caller holds dirtyLock.
+static void countReleased (partition_p part, uint64_t removed)
+	{
+	__atomic_add_fetch(&part->releases, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&part->heldBlocks, removed, __ATOMIC_SEQ_CST);
+	}
+
+// Takes dirtyLock if a write of the run would land on held blocks, so the
+// write and dropping the held copies look like one step to reads.
+// Returns 1 if the lock was taken.
+static int lockHeld (partition_p part, uint64_t lbaPosition, uint64_t lbaCount)
+	{
+	if (__atomic_load_n(&part->heldBlocks, __ATOMIC_SEQ_CST) == 0)
+		return 0;
+	pthread_mutex_lock(&part->dirtyLock);
+	if (isHeld(part, lbaPosition, lbaCount))
+		return 1;
+	pthread_mutex_unlock(&part->dirtyLock);
+	return 0;
+	}
+
+// Drops the held copies of a run that was just written over and releases the
+// lock taken by lockHeld.
+static void dropHeld (partition_p part, uint64_t lbaPosition, uint64_t lbaCount)
+	{
+	uint64_t removed = 0;
+	for (uint64_t i = 0; i < lbaCount; i++)
+		{
+		heldBlock_t ** link = findHeld(part, lbaPosition + i);
+		heldBlock_t * block = *link;
+		if (block == NULL)
+			continue;
+		*link = block->next;
+		free (block);
+		removed++;
+		}
+	countReleased(part, removed);
+	pthread_mutex_unlock(&part->dirtyLock);
+	}
+
+// Writes out the content of each held block that was written before the flush
+// numbered epoch started, now that the data written before it is on the device,
+// and marks it to be flushed. The caller holds dirtyLock, so no read sees a
+// block between being written and leaving held.
+// Returns the number of blocks written.
+static uint64_t releaseHeld (partition_p part, uint64_t epoch)
+	{
+	uint64_t blockSize = part->info->blocksize;
+	uint64_t written = 0;
+	uint64_t removed = 0;
+
+	if (part->heldBlocks == 0)
+		return 0;
+	for (uint32_t i = 0; i < HELD_BUCKETS; i++)
+		{
+		heldBlock_t ** link = &part->held[i];
+		while (*link != NULL)
+			{
+			heldBlock_t * block = *link;
+			uint8_t * content = (block->epoch <= epoch) ? block->data : block->older;
+			if (content == NULL)
+				{
+				link = &block->next;
+				continue;
+				}
+
+			int tag = LBAsetTag(block->tag);
+			uint64_t traceStart = traceBegin(part);
+			pwrite(part->info->fd, content, blockSize, (block->lba + 1) * blockSize);
+			traceEnd(LBA_TRACE_WRITE, block->lba, 1, traceStart);
+			LBArestoreTag(&tag);
+			addDirty(part, block->lba, 1);
+			written++;
+
+			//A block written again during the flush stays held with its latest content
+			if (content == block->older)
+				{
+				block->older = NULL;
+				link = &block->next;
+				continue;
+				}
+			*link = block->next;
+			free (block);
+			removed++;
+			}
+		}
+
+	if (written > 0)
+		{
+		countReleased(part, removed);
+		part->heldSince = currentMillis();
+		countSyscalls(part, written);
+		countStat(&part->lbaStats.writes, written);
+		countStat(&part->lbaStats.writeBlocks, written);
+		countStat(&part->lbaStats.writeBytes, written * blockSize);
+		}
+	return written;
+	}
+
+// Flushes every write made since the last flush to the device, then writes
+// the metadata held before the flush started. Writeback of the written runs
+// is started in block order, so the device sees one sequential pass, before
+// waiting for all of it. Sets released to the number of held blocks written.
+// Returns 0 on success, -1 if the flush failed.
+static int flushDirty (partition_p part, uint64_t * released)
+	{
+	*released = 0;
+
+	//Taken before flushing, so a write that lands during the flush is flushed next time
+	pthread_mutex_lock(&part->flushLock);
+	pthread_mutex_lock(&part->dirtyLock);
+	if ((part->dirtyBlocks == 0) && (part->heldBlocks == 0))
+		{
+		pthread_mutex_unlock(&part->dirtyLock);
+		pthread_mutex_unlock(&part->flushLock);
+		return 0;
+		}
+	uint64_t epoch = part->flushEpoch++;
+	part->flushing = 1;
+	uint64_t blocks = part->dirtyBlocks;
+	uint64_t since = part->dirtySince;
+	uint32_t count = part->dirtyOverflow ? 0 : part->dirtyRangeCount;
+	dirtyRange_t * ranges = malloc ((count > 0 ? count : 1) * sizeof(dirtyRange_t));
+	memcpy(ranges, part->dirtyRanges, count * sizeof(dirtyRange_t));
+	part->dirtyRangeCount = 0;
+	part->dirtyOverflow = 0;
+	part->dirtyBlocks = 0;
+	pthread_mutex_unlock(&part->dirtyLock);
+
+	//With nothing written since the last flush, the held blocks only wait to be written
+	int synced = 0;
+	if (blocks > 0)
+		{
+		uint64_t traceStart = traceBegin(part);
+		qsort(ranges, count, sizeof(dirtyRange_t), compareRanges);
+		for (uint32_t i = 0; i < count; i++)
+			sync_file_range(part->info->fd, (ranges[i].start + 1) * part->info->blocksize,
+				ranges[i].count * part->info->blocksize, SYNC_FILE_RANGE_WRITE);
+		countSyscalls(part, count + 1);
+		countStat(&part->lbaStats.syncs, 1);
+
+		synced = fdatasync(part->info->fd);
+		traceEnd(LBA_TRACE_SYNC, 0, blocks, traceStart);
+		}
+	free (ranges);
+
+	pthread_mutex_lock(&part->dirtyLock);
+	if (synced == -1)
+		{
+		//Everything is flushed by the next sync, whatever runs it holds
+		if (part->dirtyBlocks == 0 || since < part->dirtySince)
+			part->dirtySince = since;
+		part->dirtyBlocks += blocks;
+		part->dirtyOverflow = 1;
+		}
+	else
+		*released = releaseHeld(part, epoch);
+	part->flushing = 0;
+	pthread_mutex_unlock(&part->dirtyLock);
+	pthread_mutex_unlock(&part->flushLock);
+	return (synced == -1) ? -1 : 0;
+	}
+
+// Flushes every write made since the last flush to the device, along with
+// the metadata held for it.
+// Returns 0 on success, -1 if the flush failed.
+int LBAsync (partition_p part)
 	{
-	fsync(partInfop->fd);
-	close (partInfop->fd);
-	free (partInfop->filename);
-	free (partInfop);
+	if (part == NULL)		//System Not initialized
+		return -1;
 
-	partInfop = NULL;
+	//The held metadata written by the first flush is flushed by the second
+	uint64_t released;
+	if (flushDirty(part, &released) == -1)
+		return -1;
+	if ((released > 0) && (flushDirty(part, &released) == -1))
+		return -1;
 	return 0;
 	}
 
+// Returns the number of system calls the LBA functions have made on the partition
+// since it started.
+uint64_t LBAsyscalls (partition_p part)
+	{
+	return __atomic_load_n(&part->syscallCount, __ATOMIC_RELAXED);
+	}
+
+// Copies the work done by the LBA functions on the partition since it started
+// or the stats were last reset, and resets them if reset is 1.
+void LBAstats (partition_p part, lbaStats_t * stats, int reset)
+	{
+	uint64_t * from = (uint64_t *)&part->lbaStats;
+	uint64_t * to = (uint64_t *)stats;
+	for (uint64_t i = 0; i < sizeof(lbaStats_t) / sizeof(uint64_t); i++)
+		to[i] = reset ? __atomic_exchange_n(&from[i], 0, __ATOMIC_RELAXED) : __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+
+	uint64_t count = __atomic_load_n(&part->syscallCount, __ATOMIC_RELAXED);
+	uint64_t base = reset ? __atomic_exchange_n(&part->syscallBase, count, __ATOMIC_RELAXED) : __atomic_load_n(&part->syscallBase, __ATOMIC_RELAXED);
+	stats->syscalls = count - base;
+	}
+
+// Starts recording every read, write, copy and flush of the partition made by
+// any thread, keeping the last recordsPerThread of each thread, or
+// LBA_TRACE_DEFAULT_RECORDS if 0. Records from before the start are dropped.
+// Returns 0 on success, -1 if tracing was compiled out with LBA_NO_TRACE.
+int LBAtraceStart (partition_p part, uint64_t recordsPerThread)
+	{
+#ifdef LBA_NO_TRACE
+	return -1;
+#else
+	__atomic_store_n(&traceCapacity, (recordsPerThread > 0) ? recordsPerThread : LBA_TRACE_DEFAULT_RECORDS, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&traceLock);
+	for (traceRing_t * ring = traceRings; ring != NULL; ring = ring->next)
+		__atomic_store_n(&ring->since, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&traceLock);
+	traceBlockSize = part->info->blocksize;
+	traceBlockCount = part->info->numberOfBlocks;
+	__atomic_store_n(&tracedPartition, part, __ATOMIC_RELAXED);
+	return 0;
+#endif
+	}
+
+// Stops recording. The records are kept until the next start.
+void LBAtraceStop ()
+	{
+	__atomic_store_n(&tracedPartition, NULL, __ATOMIC_RELAXED);
+	}
+
+// Writes the records kept since the last start to filename as a traceHeader_t
+// followed by the records in time order. Safe to call while tracing, records
+// a thread overwrites while its ring is copied are counted as dropped.
+// Returns the number of records written, -1 if the file could not be written.
+int64_t LBAtraceDump (char * filename)
+	{
+	traceHeader_t header = { LBA_TRACE_MAGIC, LBA_TRACE_VERSION, traceBlockSize, traceBlockCount, 0, 0 };
+
+	//Rings are only freed or emptied holding the lock, and a thread only adds to its own
+	pthread_mutex_lock(&traceLock);
+	traceRing_t * rings = traceRings;
+	uint64_t total = 0;
+	for (traceRing_t * ring = rings; ring != NULL; ring = ring->next)
+		total += ring->capacity;
+	traceRecord_t * records = malloc ((total > 0 ? total : 1) * sizeof(traceRecord_t));
+	if (records == NULL)
+		{
+		pthread_mutex_unlock(&traceLock);
+		return -1;
+		}
+
+	for (traceRing_t * ring = rings; ring != NULL; ring = ring->next)
+		{
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t first = __atomic_load_n(&ring->since, __ATOMIC_RELAXED);
+		if (head - first > ring->capacity)
+			{
+			header.dropped += head - ring->capacity - first;
+			first = head - ring->capacity;
+			}
+
+		uint64_t copied = header.recordCount;
+		for (uint64_t i = first; i < head; i++)
+			{
+			uint64_t words[TRACE_WORDS];
+			uint64_t * slot = &ring->words[(i % ring->capacity) * TRACE_WORDS];
+			for (uint64_t w = 0; w < TRACE_WORDS; w++)
+				words[w] = __atomic_load_n(&slot[w], __ATOMIC_RELAXED);
+			memcpy(&records[header.recordCount++], words, sizeof(traceRecord_t));
+			}
+
+		//Drop the records the thread wrote over while they were copied
+		uint64_t after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (after - first > ring->capacity)
+			{
+			uint64_t lost = after - ring->capacity - first;
+			if (lost > header.recordCount - copied)
+				lost = header.recordCount - copied;
+			memmove(&records[copied], &records[copied + lost], (header.recordCount - copied - lost) * sizeof(traceRecord_t));
+			header.recordCount -= lost;
+			header.dropped += lost;
+			}
+		}
+	pthread_mutex_unlock(&traceLock);
+	qsort(records, header.recordCount, sizeof(traceRecord_t), compareRecords);
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int64_t retVal = -1;
+	if (fd != -1)
+		{
+		uint64_t recordBytes = header.recordCount * sizeof(traceRecord_t);
+		if ((write(fd, &header, sizeof(header)) == sizeof(header)) &&
+				(write(fd, records, recordBytes) == (ssize_t)recordBytes))
+			retVal = header.recordCount;
+		close (fd);
+		}
+	free (records);
+	return retVal;
+	}
+
+// Sets the caller tag of the traced calls of the calling thread, one of LBA_TAG_*.
+// Returns the tag it replaces.
+int LBAsetTag (int tag)
+	{
+	int previous = threadTag;
+	threadTag = tag;
+	return previous;
+	}
+
+// Goes back to the tag returned by LBAsetTag, called when an LBA_TAG_SCOPE ends.
+void LBArestoreTag (int * tag)
+	{
+	threadTag = *tag;
+	}
+
+// Returns the number of blocks written since the last flush, counting the
+// metadata held until the next flush.
+uint64_t LBAdirtyBlocks (partition_p part)
+	{
+	pthread_mutex_lock(&part->dirtyLock);
+	uint64_t blocks = part->dirtyBlocks + part->heldBlocks;
+	pthread_mutex_unlock(&part->dirtyLock);
+	return blocks;
+	}
+
+// Returns how many milliseconds ago the oldest write that is not flushed
+// was made, held metadata included, 0 if every write is flushed.
+uint64_t LBAdirtyAge (partition_p part)
+	{
+	pthread_mutex_lock(&part->dirtyLock);
+	uint64_t since = (part->dirtyBlocks > 0) ? part->dirtySince : UINT64_MAX;
+	if ((part->heldBlocks > 0) && (part->heldSince < since))
+		since = part->heldSince;
+	uint64_t age = (since != UINT64_MAX) ? currentMillis() - since : 0;
+	pthread_mutex_unlock(&part->dirtyLock);
+	return age;
+	}
+
+// Sets how many blocks may be written without a flush before the writer
+// that passes the limit flushes them itself, 0 for no limit.
+void LBAsetDirtyLimit (partition_p part, uint64_t blocks)
+	{
+	pthread_mutex_lock(&part->dirtyLock);
+	part->dirtyLimit = blocks;
+	pthread_mutex_unlock(&part->dirtyLock);
+	}
+
+// Flushes a write that just finished if every write must be flushed,
+// otherwise remembers the blocks to flush. A writer that leaves too much
+// unflushed is held up by flushing everything itself.
+static void flushWrite (partition_p part, uint64_t lbaPosition, uint64_t lbaCount)
+	{
+	if (LBAdurability(part) == DURABILITY_FULL)
+		{
+		uint64_t traceStart = traceBegin(part);
+		fdatasync(part->info->fd);
+		traceEnd(LBA_TRACE_SYNC, lbaPosition, lbaCount, traceStart);
+		countSyscalls(part, 1);
+		countStat(&part->lbaStats.syncs, 1);
+		}
+	else if (markDirty(part, lbaPosition, lbaCount))
+		LBAsync(part);
+	}
 
 //Check to see if Write or read is beyond the capacity of the volume
-uint64_t LBAwrite (void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
+uint64_t LBAwrite (partition_p part, void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
 	{
 	struct flock fl;
 
-	if (partInfop == NULL)		//System Not initialized
+	if (part == NULL)		//System Not initialized
 		return 0;
 
 	if(lbaCount == 0)
@@ -173,38 +896,143 @@ uint64_t LBAwrite (void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
 
 	fl.l_type = F_WRLCK;
 	fl.l_whence = SEEK_SET;
-	fl.l_start = (lbaPosition * partInfop->blocksize)+ partInfop->blocksize;
-	fl.l_len = lbaCount * partInfop->blocksize;
+	fl.l_start = (lbaPosition * part->info->blocksize)+ part->info->blocksize;
+	fl.l_len = lbaCount * part->info->blocksize;
 
 	//Validate that they stay within the volume
-	if ((lbaPosition + lbaCount) > partInfop->numberOfBlocks)
+	if ((lbaPosition + lbaCount) > part->info->numberOfBlocks)
 		{
 		//The are trying to write too far
-		if (lbaPosition+1 >= partInfop->numberOfBlocks)
+		if (lbaPosition+1 >= part->info->numberOfBlocks)
 			return 0;	//no write because starting beyond volume
 
-		lbaCount = 	partInfop->numberOfBlocks - lbaPosition;
-		fl.l_len = lbaCount * partInfop->blocksize;
+		lbaCount = 	part->info->numberOfBlocks - lbaPosition;
+		fl.l_len = lbaCount * part->info->blocksize;
 		}
 
-	fcntl(partInfop->fd, F_SETLKW, &fl);
+	uint64_t traceStart = traceBegin(part);
+	lockRange(part, &fl);
 
-	lseek (partInfop->fd, fl.l_start, SEEK_SET);
-	uint64_t retWrite = write(partInfop->fd, buffer, fl.l_len);
+	//Positioned writes so threads sharing the volume do not race on the file offset
+	int overHeld = lockHeld(part, lbaPosition, lbaCount);
+	uint64_t retWrite = pwrite(part->info->fd, buffer, fl.l_len, fl.l_start);
+	if (overHeld)
+		dropHeld(part, lbaPosition, lbaCount);
+	countSyscalls(part, 3);		//Lock, write and unlock
+	countStat(&part->lbaStats.writes, 1);
+	countStat(&part->lbaStats.writeBlocks, lbaCount);
+	countStat(&part->lbaStats.writeBytes, fl.l_len);
 
-	fsync(partInfop->fd);
+	flushWrite(part, lbaPosition, lbaCount);
 
 	fl.l_type = F_UNLCK;
-	fcntl(partInfop->fd, F_SETLKW, &fl);
+	fcntl(part->info->fd, F_SETLKW, &fl);
+	traceEnd(LBA_TRACE_WRITE, lbaPosition, lbaCount, traceStart);
 
-	return retWrite / partInfop->blocksize;
+	return retWrite / part->info->blocksize;
 	}
 
-uint64_t LBAread (void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
+// Writes metadata, blocks that point at other blocks. With ordered durability,
+// metadata written while data written before it is not flushed yet is held in
+// memory instead and written by the flush that puts that data on the device,
+// so writing metadata never waits for a flush. Reads see the held blocks.
+// Returns the number of blocks written or held.
+uint64_t LBAwriteMetadata (partition_p part, void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
+	{
+	if (part == NULL)		//System Not initialized
+		return 0;
+
+	if ((lbaCount == 0) || (lbaPosition + lbaCount > part->info->numberOfBlocks) || (LBAdurability(part) != DURABILITY_ORDERED))
+		return LBAwrite(part, buffer, lbaCount, lbaPosition);
+
+	pthread_mutex_lock(&part->dirtyLock);
+	if ((part->dirtyBlocks == 0) && !part->flushing)
+		{
+		//Everything written before is on the device already
+		pthread_mutex_unlock(&part->dirtyLock);
+		return LBAwrite(part, buffer, lbaCount, lbaPosition);
+		}
+
+	uint64_t blockSize = part->info->blocksize;
+	uint64_t held = 0;
+	for (; held < lbaCount; held++)
+		{
+		uint64_t lba = lbaPosition + held;
+		heldBlock_t ** link = findHeld(part, lba);
+		heldBlock_t * block = *link;
+		if (block == NULL)
+			{
+			block = malloc (sizeof(heldBlock_t) + 2 * blockSize);
+			if (block == NULL)
+				break;
+			block->next = NULL;
+			block->lba = lba;
+			block->data = block->buffers;
+			block->older = NULL;
+			*link = block;
+			if (part->heldBlocks == 0)
+				{
+				part->heldSince = currentMillis();
+				part->heldLow = lba;
+				part->heldHigh = lba;
+				}
+			else if (lba < part->heldLow)
+				part->heldLow = lba;
+			else if (lba > part->heldHigh)
+				part->heldHigh = lba;
+			__atomic_add_fetch(&part->heldBlocks, 1, __ATOMIC_SEQ_CST);
+			}
+		else if (block->epoch < part->flushEpoch)
+			{
+			//The flush started since the last write still writes what that write held
+			uint8_t * spare = (block->older != NULL) ? block->older
+				: ((block->data == block->buffers) ? block->buffers + blockSize : block->buffers);
+			block->older = block->data;
+			block->data = spare;
+			}
+		memcpy(block->data, (uint8_t *)buffer + held * blockSize, blockSize);
+		block->epoch = part->flushEpoch;
+		block->tag = threadTag;
+		}
+	int overLimit = (held < lbaCount) || (part->heldBlocks * 2 * blockSize > HELD_BYTES_LIMIT);
+	pthread_mutex_unlock(&part->dirtyLock);
+
+	//A writer that holds too much flushes it, and writes what it could not hold after the flush
+	if (overLimit)
+		LBAsync(part);
+	if (held < lbaCount)
+		held += LBAwrite(part, (uint8_t *)buffer + held * blockSize, lbaCount - held, lbaPosition + held);
+	return held;
+	}
+
+// Copies the held blocks of a run just read over what was read, so reads see
+// metadata that is not written yet. Returns 0 if held blocks were written out
+// or dropped since releases was taken, so the read may have missed them and is
+// made again.
+static int readHeld (partition_p part, uint8_t * buffer, uint64_t lbaCount, uint64_t lbaPosition, uint64_t releases)
+	{
+	if ((__atomic_load_n(&part->heldBlocks, __ATOMIC_SEQ_CST) == 0)
+		&& (__atomic_load_n(&part->releases, __ATOMIC_SEQ_CST) == releases))
+		return 1;
+
+	pthread_mutex_lock(&part->dirtyLock);
+	int current = (part->releases == releases);
+	if (current && isHeld(part, lbaPosition, lbaCount))
+		for (uint64_t i = 0; i < lbaCount; i++)
+			{
+			heldBlock_t * block = *findHeld(part, lbaPosition + i);
+			if (block != NULL)
+				memcpy(buffer + i * part->info->blocksize, block->data, part->info->blocksize);
+			}
+	pthread_mutex_unlock(&part->dirtyLock);
+	return current;
+	}
+
+uint64_t LBAread (partition_p part, void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
 	{
 	struct flock fl;
 
-	if (partInfop == NULL)		//System Not initialized
+	if (part == NULL)		//System Not initialized
 		return 0;
 
 	if(lbaCount == 0)
@@ -212,29 +1040,218 @@ uint64_t LBAread (void * buffer, uint64_t lbaCount, uint64_t lbaPosition)
 
 	fl.l_type = F_RDLCK;
 	fl.l_whence = SEEK_SET;
-	fl.l_start = (lbaPosition * partInfop->blocksize)+ partInfop->blocksize;
-	fl.l_len = lbaCount * partInfop->blocksize;
+	fl.l_start = (lbaPosition * part->info->blocksize)+ part->info->blocksize;
+	fl.l_len = lbaCount * part->info->blocksize;
 
 	//Validate that they stay within the volume
-	if ((lbaPosition + lbaCount) > partInfop->numberOfBlocks)
+	if ((lbaPosition + lbaCount) > part->info->numberOfBlocks)
 		{
 		//The are trying to read too far
-		if (lbaPosition+1 >= partInfop->numberOfBlocks)
+		if (lbaPosition+1 >= part->info->numberOfBlocks)
 			return 0;	//no read because starting beyond volume
 
-		lbaCount = 	partInfop->numberOfBlocks - lbaPosition;
-		fl.l_len = lbaCount * partInfop->blocksize;
+		lbaCount = 	part->info->numberOfBlocks - lbaPosition;
+		fl.l_len = lbaCount * part->info->blocksize;
 		}
 
-	fcntl(partInfop->fd, F_SETLKW, &fl);
+	uint64_t traceStart = traceBegin(part);
+	lockRange(part, &fl);
 
-	lseek (partInfop->fd, fl.l_start, SEEK_SET);
-	read(partInfop->fd, buffer, fl.l_len);
+	//A read that raced held blocks being written out reads again
+	uint64_t releases;
+	do
+		{
+		releases = __atomic_load_n(&part->releases, __ATOMIC_SEQ_CST);
+		pread(part->info->fd, buffer, fl.l_len, fl.l_start);
+		}
+	while (!readHeld(part, buffer, lbaCount, lbaPosition, releases));
+	countSyscalls(part, 3);		//Lock, read and unlock
+	countStat(&part->lbaStats.reads, 1);
+	countStat(&part->lbaStats.readBlocks, lbaCount);
+	countStat(&part->lbaStats.readBytes, fl.l_len);
 
 	fl.l_type = F_UNLCK;
-	fcntl(partInfop->fd, F_SETLKW, &fl);
+	fcntl(part->info->fd, F_SETLKW, &fl);
+	traceEnd(LBA_TRACE_READ, lbaPosition, lbaCount, traceStart);
 
 	return 0;
 	}
 
+//
+// Copies count bytes from inFd at inOffset to outFd at outOffset. Tries
+// copy_file_range first so the data never leaves the kernel, then splice
+// through a pipe, and finally large buffered reads and writes.
+// Returns the number of bytes copied.
+uint64_t copyRange (partition_p part, int inFd, off_t inOffset, int outFd, off_t outOffset, uint64_t count)
+	{
+	uint64_t copied = 0;
+	ssize_t ret;
+
+	while (copied < count)
+		{
+		ret = copy_file_range(inFd, &inOffset, outFd, &outOffset, count - copied, 0);
+		countSyscalls(part, 1);
+		if (ret <= 0)
+			break;
+		copied += ret;
+		}
+
+	int pipeFds[2];
+	if ((copied < count) && (pipe(pipeFds) == 0))
+		{
+		countSyscalls(part, 3);		//Opening and closing the pipe
+		while (copied < count)
+			{
+			uint64_t chunk = count - copied;
+			if (chunk > COPY_BUFFER_SIZE)
+				chunk = COPY_BUFFER_SIZE;
+			ret = splice(inFd, &inOffset, pipeFds[1], NULL, chunk, SPLICE_F_MOVE);
+			countSyscalls(part, 1);
+			if (ret <= 0)
+				break;
+
+			ssize_t moved = 0;
+			while (moved < ret)
+				{
+				ssize_t outRet = splice(pipeFds[0], NULL, outFd, &outOffset, ret - moved, SPLICE_F_MOVE);
+				countSyscalls(part, 1);
+				if (outRet <= 0)
+					break;
+				moved += outRet;
+				}
+			copied += moved;
+			if (moved < ret)
+				{
+				//Whatever is left in the pipe is read again below
+				inOffset -= ret - moved;
+				break;
+				}
+			}
+		close(pipeFds[0]);
+		close(pipeFds[1]);
+		}
+
+	if (copied < count)
+		{
+		uint64_t bufferSize = (count - copied < COPY_BUFFER_SIZE) ? count - copied : COPY_BUFFER_SIZE;
+		char * buf = malloc (bufferSize);
+		while ((buf != NULL) && (copied < count))
+			{
+			uint64_t chunk = count - copied;
+			if (chunk > bufferSize)
+				chunk = bufferSize;
+			ret = pread(inFd, buf, chunk, inOffset);
+			countSyscalls(part, 1);
+			if (ret <= 0)
+				break;
+			countSyscalls(part, 1);
+			if (pwrite(outFd, buf, ret, outOffset) != ret)
+				break;
+			inOffset += ret;
+			outOffset += ret;
+			copied += ret;
+			}
+		free (buf);
+		}
+
+	return copied;
+	}
+
+// Copies byteCount bytes of the file srcFd starting at srcOffset into the volume
+// starting at lbaPosition. The whole range is locked, and synced once when
+// every write is flushed.
+uint64_t LBAcopyIn (partition_p part, int srcFd, uint64_t srcOffset, uint64_t byteCount, uint64_t lbaPosition)
+	{
+	struct flock fl;
+
+	if (part == NULL)		//System Not initialized
+		return 0;
 
+	if (byteCount == 0)
+		return 0;
+
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (lbaPosition * part->info->blocksize)+ part->info->blocksize;
+	fl.l_len = byteCount;
+
+	//Validate that they stay within the volume
+	if (lbaPosition >= part->info->numberOfBlocks)
+		return 0;	//no write because starting beyond volume
+	if (lbaPosition * part->info->blocksize + byteCount > part->info->numberOfBlocks * part->info->blocksize)
+		{
+		byteCount = (part->info->numberOfBlocks - lbaPosition) * part->info->blocksize;
+		fl.l_len = byteCount;
+		}
+
+	uint64_t traceStart = traceBegin(part);
+	lockRange(part, &fl);
+
+	uint64_t blockCount = (byteCount + part->info->blocksize - 1) / part->info->blocksize;
+	int overHeld = lockHeld(part, lbaPosition, blockCount);
+	uint64_t retCopy = copyRange(part, srcFd, srcOffset, part->info->fd, fl.l_start, byteCount);
+	if (overHeld)
+		dropHeld(part, lbaPosition, blockCount);
+	countSyscalls(part, 2);		//Lock and unlock
+	countStat(&part->lbaStats.writes, 1);
+	countStat(&part->lbaStats.writeBlocks, blockCount);
+	countStat(&part->lbaStats.writeBytes, retCopy);
+
+	flushWrite(part, lbaPosition, blockCount);
+
+	fl.l_type = F_UNLCK;
+	fcntl(part->info->fd, F_SETLKW, &fl);
+	traceEnd(LBA_TRACE_COPYIN, lbaPosition, blockCount, traceStart);
+
+	return retCopy;
+	}
+
+// Copies byteCount bytes of the volume starting at lbaPosition into the file
+// destFd starting at destOffset.
+uint64_t LBAcopyOut (partition_p part, int destFd, uint64_t destOffset, uint64_t byteCount, uint64_t lbaPosition)
+	{
+	struct flock fl;
+
+	if (part == NULL)		//System Not initialized
+		return 0;
+
+	if (byteCount == 0)
+		return 0;
+
+	fl.l_type = F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (lbaPosition * part->info->blocksize)+ part->info->blocksize;
+	fl.l_len = byteCount;
+
+	//Validate that they stay within the volume
+	if (lbaPosition >= part->info->numberOfBlocks)
+		return 0;	//no read because starting beyond volume
+	if (lbaPosition * part->info->blocksize + byteCount > part->info->numberOfBlocks * part->info->blocksize)
+		{
+		byteCount = (part->info->numberOfBlocks - lbaPosition) * part->info->blocksize;
+		fl.l_len = byteCount;
+		}
+
+	//The copy cannot see held blocks, so any it covers are written out first
+	uint64_t blockCount = (byteCount + part->info->blocksize - 1) / part->info->blocksize;
+	if (lockHeld(part, lbaPosition, blockCount))
+		{
+		pthread_mutex_unlock(&part->dirtyLock);
+		LBAsync(part);
+		}
+
+	uint64_t traceStart = traceBegin(part);
+	lockRange(part, &fl);
+
+	uint64_t retCopy = copyRange(part, part->info->fd, fl.l_start, destFd, destOffset, byteCount);
+	countSyscalls(part, 2);		//Lock and unlock
+	countStat(&part->lbaStats.reads, 1);
+	countStat(&part->lbaStats.readBlocks, blockCount);
+	countStat(&part->lbaStats.readBytes, retCopy);
+
+	fl.l_type = F_UNLCK;
+	fcntl(part->info->fd, F_SETLKW, &fl);
+	traceEnd(LBA_TRACE_COPYOUT, lbaPosition, blockCount, traceStart);
+
+	return retCopy;
+	}
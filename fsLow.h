@@ -9,6 +9,10 @@
 // volSize and blockSize are ignored.  If the file does not exist, it will
 // be created to the specified volume size in units of the block size
 // (must be power of 2) plus one for the partition header.
+// The durability decides when writes are flushed to the device, one of
+// DURABILITY_NONE, DURABILITY_ORDERED or DURABILITY_FULL.
+// Any number of partitions can be open at once, each used through the
+// partition it returns.
 //
 // On return
 // 		return value 0 = success;
@@ -16,18 +20,104 @@
 //		return value -2 = insufficient space for the volume
 //		volSize will be filled with the volume size
 //		blockSize will be filled with the block size
+//		partition will be filled with the partition on success
 #include <stdint.h>
 typedef unsigned long long ull_t;
 
-int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockSize);
+// An open partition, with its own locks and counters
+typedef struct partition partition_t, * partition_p;
 
-int closePartitionSystem ();
+typedef struct partitionInfo partitionInfo_t, * partitionInfo_p;
 
-uint64_t LBAwrite (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
+int startPartitionSystem (char * filename, uint64_t * volSize, uint64_t * blockSize, int durability, partition_p * partition);
 
-uint64_t LBAread (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
+// Closes the partition and frees it, after flushing it to the device.
+int closePartitionSystem (partition_p part);
+
+// Returns the header of the partition, with its block size and number of blocks.
+partitionInfo_p LBAinfo (partition_p part);
+
+uint64_t LBAwrite (partition_p part, void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
+
+// Writes metadata, blocks that point at other blocks. With ordered durability,
+// metadata written while data written before it is not flushed yet is held in
+// memory and written by the flush that puts that data on the device, so the
+// metadata never reaches the device before the data it points at. Reads see
+// the held blocks. Returns the number of blocks written or held.
+uint64_t LBAwriteMetadata (partition_p part, void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
+
+uint64_t LBAread (partition_p part, void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
+
+// Copies byteCount bytes between another open file and the volume starting at
+// lbaPosition without going through a user space buffer when possible.
+// Returns the number of bytes copied.
+uint64_t LBAcopyIn (partition_p part, int srcFd, uint64_t srcOffset, uint64_t byteCount, uint64_t lbaPosition);
+
+uint64_t LBAcopyOut (partition_p part, int destFd, uint64_t destOffset, uint64_t byteCount, uint64_t lbaPosition);
+
+// Flushes every write made since the last flush to the device, along with
+// the metadata held for it.
+// Returns 0 on success, -1 if the flush failed.
+int LBAsync (partition_p part);
+
+// Returns the number of blocks written since the last flush, counting the
+// metadata held until the next flush.
+uint64_t LBAdirtyBlocks (partition_p part);
+
+// Returns how many milliseconds ago the oldest write that is not flushed
+// was made, held metadata included, 0 if every write is flushed.
+uint64_t LBAdirtyAge (partition_p part);
+
+// Sets how many blocks may be written without a flush before the writer
+// that passes the limit flushes them itself, 0 for no limit.
+void LBAsetDirtyLimit (partition_p part, uint64_t blocks);
+
+// Returns the number of system calls the LBA functions have made on the partition
+// since it started.
+uint64_t LBAsyscalls (partition_p part);
+
+// Starts recording every read, write, copy and flush of the partition made by
+// any thread, keeping the last recordsPerThread of each thread, or
+// LBA_TRACE_DEFAULT_RECORDS if 0. Records from before the start are dropped.
+// One partition is traced at a time, starting another moves the trace to it.
+// Returns 0 on success, -1 if tracing was compiled out with LBA_NO_TRACE.
+int LBAtraceStart (partition_p part, uint64_t recordsPerThread);
+
+// Stops recording. The records are kept until the next start.
+void LBAtraceStop ();
+
+// Writes the records kept since the last start to filename as a traceHeader_t
+// followed by the records in time order. Safe to call while tracing.
+// Returns the number of records written, -1 if the file could not be written.
+int64_t LBAtraceDump (char * filename);
+
+// Sets the caller tag of the traced calls of the calling thread, one of LBA_TAG_*.
+// Returns the tag it replaces.
+int LBAsetTag (int tag);
+
+// Goes back to the tag returned by LBAsetTag, called when an LBA_TAG_SCOPE ends.
+void LBArestoreTag (int * tag);
+
+// Returns the durability used by writes of the calling thread to the partition.
+int LBAdurability (partition_p part);
+
+// Overrides the durability for writes of the calling thread,
+// DURABILITY_DEFAULT goes back to the durability of the partition.
+void LBAsetThreadDurability (int durability);
 
 #define MINBLOCKSIZE 512
+#define LBA_TRACE_DEFAULT_RECORDS 65536	//Records kept for each thread when no other number is given
+#define LBA_TRACE_MAGIC		0x454341525441424C	//"LBATRACE" read as a little endian uint64_t
+#define LBA_TRACE_VERSION	1
+#define COPY_BUFFER_SIZE (1024 * 1024)	//Largest chunk moved by one splice or buffered copy
+#define DIRTY_RANGE_LIMIT 1024			//Most separate runs of unflushed blocks written back in order
+#define HELD_BUCKETS 1024				//Hash buckets of the metadata blocks held until the next flush
+#define HELD_BYTES_LIMIT (8 * 1024 * 1024)	//Memory held metadata may take before its writer flushes it
+
+#define DURABILITY_DEFAULT	-1		//Follow the durability of the partition
+#define DURABILITY_NONE		0		//Writes are only flushed by a sync or when the partition closes
+#define DURABILITY_ORDERED	1		//Data is flushed before the metadata that points at it is written
+#define DURABILITY_FULL		2		//Every write is flushed before it returns
 #define PART_SIGNATURE	0x526F626572742042
 #define PART_SIGNATURE2	0x4220747265626F52
 #define PART_CAPTION "CSC-415 - Operating Systems File System Project Header\n\n"
@@ -38,7 +128,7 @@ uint64_t LBAread (void * buffer, uint64_t lbaCount, uint64_t lbaPosition);
 #define	PART_NOERROR 		0
 #define PART_ERR_INVALID	-4
 
-typedef struct partitionInfo {
+struct partitionInfo {
 	char 		volumePrefix[sizeof(PART_CAPTION)+2];
 	uint64_t	signature;
 	uint64_t	volumesize;
@@ -48,9 +138,68 @@ typedef struct partitionInfo {
 	int			fd;					//Never Written - file descriptor
 	uint64_t	signature2;
 	char		volumeName[];
-	} partitionInfo_t, * partitionInfo_p;
+	};
+
+// Operations recorded by the trace
+#define LBA_TRACE_READ		0
+#define LBA_TRACE_WRITE		1
+#define LBA_TRACE_COPYIN	2		//Copy into the volume from another file
+#define LBA_TRACE_COPYOUT	3		//Copy out of the volume to another file
+#define LBA_TRACE_SYNC		4		//Flush, lba and count are the blocks flushed by a full durability write
+#define LBA_TRACE_OPS		5
+
+// What a traced call was made for, set by the caller with LBA_TAG_SCOPE
+#define LBA_TAG_OTHER		0
+#define LBA_TAG_SUPER		1		//Superblock
+#define LBA_TAG_INODE		2
+#define LBA_TAG_BITMAP		3		//BitVector and reference counts
+#define LBA_TAG_INDIRECT	4		//Indirect blocks of a block map
+#define LBA_TAG_DIRECTORY	5		//Data blocks of a directory
+#define LBA_TAG_DATA		6		//Data blocks of a file
+#define LBA_TAG_COUNT		7
+
+// Tags the LBA calls of the calling thread until the scope ends, then goes back to the tag before
+#define LBA_TAG_SCOPE(tag) int lbaTag __attribute__((cleanup(LBArestoreTag))) = LBAsetTag(tag)
+
+// Start of a trace dump, followed by recordCount records
+typedef struct traceHeader {
+	uint64_t	magic;				//LBA_TRACE_MAGIC
+	uint64_t	version;			//LBA_TRACE_VERSION
+	uint64_t	blockSize;
+	uint64_t	numberOfBlocks;
+	uint64_t	recordCount;
+	uint64_t	dropped;			//Records overwritten before the dump because a ring was full
+	} traceHeader_t;
+
+// One traced LBA call
+typedef struct traceRecord {
+	uint64_t	timestamp;			//Nanoseconds from a fixed point when the call started
+	uint64_t	latency;			//Nanoseconds the call took, including waits for locks and flushes
+	uint64_t	lba;				//First block
+	uint32_t	count;				//Number of blocks
+	uint16_t	thread;				//Number of the thread that made the call
+	uint8_t		op;					//LBA_TRACE_*
+	uint8_t		tag;				//LBA_TAG_*
+	} traceRecord_t;
+
+// Work done by the LBA functions, every field a uint64_t
+typedef struct lbaStats {
+	uint64_t	reads;				//Calls that read from the volume, including copies out
+	uint64_t	readBlocks;
+	uint64_t	readBytes;
+	uint64_t	writes;				//Calls that wrote to the volume, including copies in
+	uint64_t	writeBlocks;
+	uint64_t	writeBytes;
+	uint64_t	syncs;				//Flushes of the volume to the device
+	uint64_t	lockWaits;			//Range locks that had to wait for another process
+	uint64_t	lockWaitNanos;		//Time spent waiting for those locks
+	uint64_t	syscalls;			//System calls made, see LBAsyscalls
+	} lbaStats_t, * lbaStats_p;
 
-extern partitionInfo_p partInfop;
+// Copies the work done by the LBA functions on the partition since it started
+// or the stats were last reset, and resets them if reset is 1. Resetting does
+// not change the count returned by LBAsyscalls.
+void LBAstats (partition_p part, lbaStats_t * stats, int reset);
 
 #endif // FS_LOW
 
@@ -31,7 +31,21 @@
 *	cpout - copy from this filesystem to linux filesystem
 *	reserve - resizes the reserved blocks to hold the number of bytes requested.
 *	resize - resizes the file.
+*	sync - writes everything out to the disk
+*	stats - prints the counts and latencies of the operations
+*	trace - records the reads and writes of the volume and dumps them to a file
+*	record - records the operations called to a log for fsreplay
 *	exit - exit the driver/shell
+*
+*	With -c <command>, -f <script> or -b the driver runs in batch
+*	mode instead: it runs each -c command, then each line of the
+*	script or of stdin, without prompts, answers yes to every
+*	question, prints the time of each command to stderr and exits
+*	with a failure status if any command failed. -e stops at the
+*	first failure. Blank lines and lines starting with # are skipped.
+*	Only a volume the driver just made is formatted without asking,
+*	on any other volume without a file system the commands fail
+*	until the batch runs format.
 ****************************************************************/
 
 #include <errno.h>
@@ -42,117 +56,295 @@
 #include <string.h>
 
 #include "FileSystem.h"
+#include "Stats.h"
 
 #define MAX_INPUT_BUFFER 512
 #define MAX_ARG MAX_INPUT_BUFFER/2+1
 #define MIN_BLOCKS 20
+#define USAGE "Usage: ./myfs [-b] [-f <script>] [-c <command>]... [-e] <filename> <volumesize> <blocksize> [none|ordered|full]\n"
 
 uint32_t parseArgs(char*, char**);
-void processArgs(int, char**);
-void run_help(int, char**);
-void run_mkdir(int, char**);
-void run_mkfile(int, char**);
-void run_ls(int, char**);
-void run_lsfs(int, char**);
-void run_format(int, char**);
-void run_rmdir(int, char**);
-void run_reserve(int, char**);
-void run_resize(int, char**);
-void run_cd(int, char**);
-void run_pwd(int, char**);
-void run_cp(int, char**);
-void run_mv(int, char**);
-void run_rm(int, char**);
-void run_cpin(int, char**);
-void run_cpout(int, char**);
+int processArgs(int, char**);
+int run_help(int, char**);
+int run_mkdir(int, char**);
+int run_mkfile(int, char**);
+int run_ls(int, char**);
+int run_lsfs(int, char**);
+int run_format(int, char**);
+int run_rmdir(int, char**);
+int run_reserve(int, char**);
+int run_resize(int, char**);
+int run_cd(int, char**);
+int run_pwd(int, char**);
+int run_cp(int, char**);
+int run_mv(int, char**);
+int run_rm(int, char**);
+int run_cpin(int, char**);
+int run_cpout(int, char**);
+int run_sync(int, char**);
+int run_stats(int, char**);
+int run_trace(int, char**);
+int run_record(int, char**);
 void flushInput();
+int confirm(char*);
+void closeDriver(int);
+int runLine(char*);
+int isBlank(char*);
+int runTimed(char*);
+int runBatchLine(char*);
+int runBatch(char**, uint32_t, FILE*, uint8_t);
+
+uint8_t batchMode = 0;		//Commands come from -c, a script or stdin with no prompts, every question is answered yes
+FsVolume_p vol;				//Volume the commands run on
 
 int main(int argc, char **argv) {
     char userInput[MAX_INPUT_BUFFER];
-    char* args[MAX_ARG];
-    uint32_t numArgs;
     char* filename;
     uint64_t volumeSize = 0;
     uint64_t blockSize = 0;
+    int durability = DURABILITY_ORDERED;
+    char** commands = malloc(argc * sizeof(char*));
+    uint32_t numCommands = 0;
+    char* scriptName = NULL;
+    FILE* script = NULL;
+    uint8_t stopOnFailure = 0;
+    int option;
+
+    //Batch options come before the volume
+    while ((option = getopt(argc, argv, "bf:c:e")) != -1) {
+		switch (option) {
+		case 'b':
+			batchMode = 1;
+			script = stdin;
+			break;
+		case 'f':
+			batchMode = 1;
+			scriptName = optarg;
+			break;
+		case 'c':
+			batchMode = 1;
+			commands[numCommands++] = optarg;
+			break;
+		case 'e':
+			stopOnFailure = 1;
+			break;
+		default:
+			printf(USAGE);
+			exit(EXIT_FAILURE);
+		}
+    }
+    int numParams = argc - optind;
+    char** params = &argv[optind];
 
-    if (argc < 4) {
+    if (numParams < 3) {
 		if (access("testfile", F_OK) == -1) {
 			printf("Missing arguments: Filename, Volume Size, Block Size\n");
-			printf("Usage: ./myfs <filename> <volumesize> <blocksize>\n");
+			printf(USAGE);
 			exit(EXIT_FAILURE);
 		} else {
 			filename = "testfile";
 		}
-    } else if (argc > 4) {
+    } else if (numParams > 4) {
 		printf("Too many arguments\n");
 		exit(EXIT_FAILURE);
     } else {
-		filename = argv[1];
-		volumeSize = atoll(argv[2]);
-		blockSize = atoll(argv[3]);
+		filename = params[0];
+		volumeSize = atoll(params[1]);
+		blockSize = atoll(params[2]);
 		//Minimum volume size
 		if (volumeSize < blockSize * MIN_BLOCKS) {
 			volumeSize = blockSize * MIN_BLOCKS;
 		}
+		//When writes are flushed to the disk
+		if (numParams == 4) {
+			if (strcmp(params[3], "none") == 0) {
+				durability = DURABILITY_NONE;
+			} else if (strcmp(params[3], "ordered") == 0) {
+				durability = DURABILITY_ORDERED;
+			} else if (strcmp(params[3], "full") == 0) {
+				durability = DURABILITY_FULL;
+			} else {
+				printf("Unknown durability %s\n", params[3]);
+				printf(USAGE);
+				exit(EXIT_FAILURE);
+			}
+		}
+    }
+
+    if (scriptName != NULL) {
+		script = fopen(scriptName, "r");
+		if (script == NULL) {
+			printf("Could not open %s: %s\n", scriptName, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
     }
 
-	int retVal = startPartitionSystem(filename, &volumeSize, &blockSize);
-	if (retVal != 0) {
+	//Batch mode only formats a volume without asking if fs_mount makes it
+	int created = access(filename, F_OK) != 0;
+	vol = fs_mount(filename, &volumeSize, &blockSize, durability);
+	if (vol == NULL) {
 		printf("Error: opening partition %s\n", filename);
 		exit(EXIT_FAILURE);
 	}
 
-	printf("Opened %s, Volume Size: %llu;  BlockSize: %llu; Return %d\n", filename, (ull_t)volumeSize, (ull_t)blockSize, retVal);
+	printf("Opened %s, Volume Size: %llu;  BlockSize: %llu\n", filename, (ull_t)volumeSize, (ull_t)blockSize);
 
 	/* Check if partition is already formatted, if not then format */
-	if (!check_fs()) {
-		char answer;
+	if (!check_fs(vol)) {
 		printf("Partition is not formatted.\n");
 		printf("You must format the partition to continue.\n");
-		printf("Format now? (y/n): ");
-		scanf(" %c", &answer);
-		flushInput();
-		if (answer == 'y' || answer == 'Y') {
-			fs_format();
+		if (batchMode && !created) {
+			printf("Not formatting an existing partition unless the batch runs format first.\n");
+		} else if (confirm("Format now?")) {
+			fs_format(vol, DIR_FORMAT_COMPACT);
 		} else {
 			printf("Canceling format.\n");
 			printf("Exiting...\n");
-			closePartitionSystem();
+			fs_unmount(vol);
 			exit(EXIT_SUCCESS);
 		}
 	}
 
+	//Write back in the background what the durability leaves unflushed
+	if (startWriteback(vol, NULL) == -1)
+		printf("Could not start the background flusher\n");
+
+	if (batchMode)
+		closeDriver(runBatch(commands, numCommands, script, stopOnFailure));
+
     while (1) {
-		if (wd->pathLength > 30)
-			printf("...%s>", &wd->wdPath[wd->pathLength-30]);
+		char* cwd = fs_getcwd(vol);
+		size_t cwdLength = strlen(cwd);
+		if (cwdLength > 30)
+			printf("...%s>", &cwd[cwdLength-30]);
 		else
-			printf("%s>", wd->wdPath);
+			printf("%s>", cwd);
 
         /* retrieve input */
         if (fgets(userInput, MAX_INPUT_BUFFER, stdin) == NULL)
             /* check for EOF */
             if (feof(stdin))
-                exit(EXIT_SUCCESS);
+                closeDriver(EXIT_SUCCESS);
 
         /* test for empty input */
         if (strlen(userInput) == 1) {
             printf("Error: No command entered.\n");
-        } else if (strcmp(userInput, "exit\n") == 0) {
-        	/* test for exit command */
-        	closePartitionSystem();
-            exit(EXIT_SUCCESS);
         } else {
             /* check and flush extra data in input stream */
             if (strchr(userInput, '\n') == NULL)
                 flushInput();
 
-            numArgs = parseArgs(userInput, args);
-            processArgs(numArgs, args);
+            if (runLine(userInput) == -1)
+                closeDriver(EXIT_SUCCESS);
         }
     }
     return 0;
 }
 
+/* Stop recording and writing back, close the volume and exit with the status */
+void closeDriver(int status) {
+	fs_unmount(vol);
+	exit(status);
+}
+
+/* Run a line of input, returns 0 if it succeeded, 1 if it failed, -1 for exit */
+int runLine(char* input) {
+	char* args[MAX_ARG];
+	uint32_t numArgs = parseArgs(input, args);
+
+	if (numArgs == 0)
+		return 0;
+	if (strcmp(args[0], "exit") == 0)
+		return -1;
+	return processArgs(numArgs, args);
+}
+
+/* Check if a line of a batch has no command, blank lines and # comments are skipped */
+int isBlank(char* line) {
+	line += strspn(line, " \t\r\n");
+	return *line == '\0' || *line == '#';
+}
+
+/* Run a command of a batch and print to stderr how long it took,
+   returns 0 if it succeeded, 1 if it failed, -1 for exit */
+int runTimed(char* command) {
+	char input[MAX_INPUT_BUFFER];
+	char label[MAX_INPUT_BUFFER];
+
+	if (strlen(command) >= MAX_INPUT_BUFFER) {
+		printf("Command too long: %.40s...\n", command);
+		return 1;
+	}
+	//parseArgs cuts up the input, so keep a copy to print
+	strcpy(input, command);
+	strcpy(label, command);
+	label[strcspn(label, "\r\n")] = '\0';
+
+	uint64_t start = statNow();
+	int status = runLine(input);
+	uint64_t elapsed = statNow() - start;
+
+	//Output of the command comes before its time when both go to a terminal
+	fflush(stdout);
+	fprintf(stderr, "%10.3f ms %s %s\n", elapsed / 1e6, status == 1 ? "FAIL" : "ok  ", label);
+	return status;
+}
+
+/* Run a command of a batch with runTimed. Until the volume is formatted
+   only format and exit can run, anything else fails and ends the batch */
+int runBatchLine(char* command) {
+	char* word = command + strspn(command, " \t");
+	size_t length = strcspn(word, " \t\r\n");
+
+	if (!check_fs(vol) && !(length == 6 && strncmp(word, "format", 6) == 0)
+			&& !(length == 4 && strncmp(word, "exit", 4) == 0)) {
+		printf("Error: partition is not formatted, run format first\n");
+		fprintf(stderr, "%10.3f ms FAIL %.*s\n", 0.0, (int)strcspn(command, "\r\n"), command);
+		return 1;
+	}
+	return runTimed(command);
+}
+
+/* Run the -c commands and then the lines of the script, if any.
+   Returns the exit status of the driver, failure if a command failed */
+int runBatch(char** commands, uint32_t numCommands, FILE* script, uint8_t stopOnFailure) {
+	char line[MAX_INPUT_BUFFER];
+	uint64_t ran = 0;
+	uint64_t failed = 0;
+	int status = 0;
+	uint64_t start = statNow();
+
+	for (uint32_t i = 0; i < numCommands && status != -1 && !(stopOnFailure && failed); i++) {
+		if (isBlank(commands[i]))
+			continue;
+		status = runBatchLine(commands[i]);
+		ran++;
+		failed += status == 1;
+	}
+	while (script != NULL && status != -1 && !(stopOnFailure && failed) && fgets(line, MAX_INPUT_BUFFER, script) != NULL) {
+		if (strchr(line, '\n') == NULL && !feof(script)) {
+			//Skip the rest of a line too long for the buffer
+			int c;
+			while ((c = fgetc(script)) != '\n' && c != EOF)
+				;
+			printf("Command too long: %.40s...\n", line);
+			status = 1;
+		} else if (isBlank(line)) {
+			continue;
+		} else {
+			status = runBatchLine(line);
+		}
+		ran++;
+		failed += status == 1;
+	}
+	if (script != NULL && script != stdin)
+		fclose(script);
+
+	fprintf(stderr, "%llu commands, %llu failed, %.3f ms\n", (ull_t)ran, (ull_t)failed, (statNow() - start) / 1e6);
+	free(commands);
+	return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 /* Separate arguments into an array */
 uint32_t parseArgs(char* input, char** args) {
     uint32_t i = 0;
@@ -167,51 +359,60 @@ uint32_t parseArgs(char* input, char** args) {
 }
 
 /* run command with given arguments */
-void processArgs(int numArgs, char** args) {
+int processArgs(int numArgs, char** args) {
 	if (strcmp(args[0], "format") == 0) {
-		run_format(numArgs, args);
+		return run_format(numArgs, args);
 	} else if (strcmp(args[0], "help") == 0) {
-		run_help(numArgs, args);
+		return run_help(numArgs, args);
 	} else if (strcmp(args[0], "lsfs") == 0) {
-		run_lsfs(numArgs, args);
+		return run_lsfs(numArgs, args);
 	} else if (strcmp(args[0], "ls") == 0) {
-		run_ls(numArgs, args);
+		return run_ls(numArgs, args);
 	} else if (strcmp(args[0], "cd") == 0) {
-		run_cd(numArgs, args);
+		return run_cd(numArgs, args);
 	} else if (strcmp(args[0], "pwd") == 0) {
-		run_pwd(numArgs, args);
+		return run_pwd(numArgs, args);
 	} else if (strcmp(args[0], "mkdir") == 0) {
-		run_mkdir(numArgs, args);
+		return run_mkdir(numArgs, args);
 	} else if (strcmp(args[0], "mkfile") == 0) {
-		run_mkfile(numArgs, args);
+		return run_mkfile(numArgs, args);
 	} else if (strcmp(args[0], "rmdir") == 0) {
-		run_rmdir(numArgs, args);
+		return run_rmdir(numArgs, args);
 	} else if (strcmp(args[0], "reserve") == 0) {
-		run_reserve(numArgs, args);
+		return run_reserve(numArgs, args);
 	} else if (strcmp(args[0], "resize") == 0) {
-		run_resize(numArgs, args);
+		return run_resize(numArgs, args);
 	} else if (strcmp(args[0], "cp") == 0) {
-		run_cp(numArgs, args);
+		return run_cp(numArgs, args);
 	} else if (strcmp(args[0], "mv") == 0) {
-		run_mv(numArgs, args);
+		return run_mv(numArgs, args);
 	} else if (strcmp(args[0], "rm") == 0) {
-		run_rm(numArgs, args);
+		return run_rm(numArgs, args);
 	} else if (strcmp(args[0], "cpin") == 0) {
-		run_cpin(numArgs, args);
+		return run_cpin(numArgs, args);
 	} else if (strcmp(args[0], "cpout") == 0) {
-		run_cpout(numArgs, args);
+		return run_cpout(numArgs, args);
+	} else if (strcmp(args[0], "sync") == 0) {
+		return run_sync(numArgs, args);
+	} else if (strcmp(args[0], "stats") == 0) {
+		return run_stats(numArgs, args);
+	} else if (strcmp(args[0], "trace") == 0) {
+		return run_trace(numArgs, args);
+	} else if (strcmp(args[0], "record") == 0) {
+		return run_record(numArgs, args);
 	} else {
 		printf("%s: command not found\n", args[0]);
 		printf("Type help for more info\n");
+		return 1;
 	}
 }
 
 /* Display help information for each function in filesystem */
-void run_help(int numArgs, char** args) {
+int run_help(int numArgs, char** args) {
 	if (numArgs > 2) {
 		printf("Too many arguments\n");
 		printf("Type help or help <function> for more information\n");
-		return;
+		return 1;
 	} else if (numArgs == 1) {
 		printf("Type help <function> to get more information about a function\n");
 		printf("Commands:\n");
@@ -230,12 +431,18 @@ void run_help(int numArgs, char** args) {
 		printf("rm     - deletes a file\n");
 		printf("cpin   - copy a file in from another filesystem\n");
 		printf("cpout  - copies a file to another filesystem\n");
+		printf("sync   - writes everything out to the disk\n");
+		printf("stats  - prints the counts and latencies of the operations\n");
+		printf("trace  - records the reads and writes of the volume\n");
+		printf("record - records the operations called to a log\n");
 		printf("exit   - exit shell\n");
 	} else {
 		if (strcmp(args[1], "format") == 0) {
-			printf("Usage: format\n");
+			printf("Usage: format [--fixed]\n");
 			printf("Formats the partition and installs the filesystem.\n");
 			printf("Will delete any current filesystems that are installed\n");
+			printf("Directories use compact variable length entries, or fixed size\n");
+			printf("entries with --fixed.\n");
 		} else if (strcmp(args[1], "lsfs") == 0) {
 			printf("Usage: lsfs\n");
 			printf("Lists the information about the current filesystem.\n");
@@ -261,9 +468,9 @@ void run_help(int numArgs, char** args) {
 			printf("Deletes the directory with the given name\n");
 		} else if (strcmp(args[1], "resize") == 0) {
 			printf("Usage: resize <filename> <size>\n");
-			printf("Resizes the file. Maximum is capped by the number of available blocks to hold the\n");
-			printf("requested size. When increasing the size, if the size is greater than the currently\n");
-			printf("allocated blocks, new blocks will be wiped and allocated to the file.\n");
+			printf("Resizes the file. Maximum is capped by the max file size of the filesystem.\n");
+			printf("When increasing the size, if the size is greater than the currently reserved\n");
+			printf("blocks, the new blocks are left as holes until they are written to.\n");
 			printf("Resize does not deallocate blocks, reserve command must be used.\n");
 		} else if (strcmp(args[1], "reserve") == 0) {
 			printf("Usage: reserve <filename> <size>\n");
@@ -271,8 +478,10 @@ void run_help(int numArgs, char** args) {
 			printf("Minimum reserved is one block or the minium blocks needed to hold the current size of the file.\n");
 			printf("Maximum blocks are limited by the number of available free blocks to be allocated.\n");
 		} else if (strcmp(args[1], "cp") == 0) {
-			printf("Usage: cp <source> <destination>\n");
+			printf("Usage: cp <source> <destination> [--reflink]\n");
 			printf("Copies the file from the source to the destination\n");
+			printf("With --reflink the copy shares the data blocks of the source, and a block\n");
+			printf("is only copied once either file writes to it.\n");
 		} else if (strcmp(args[1], "mv") == 0) {
 			printf("Usage: mv <source> <destination>\n");
 			printf("Moves the file from the source to the destination\n");
@@ -285,293 +494,331 @@ void run_help(int numArgs, char** args) {
 		} else if (strcmp(args[1], "cpout") == 0) {
 			printf("Usage: cpout <source> <destination>\n");
 			printf("Copies a file from the current filesystem to another filesystem\n");
+		} else if (strcmp(args[1], "sync") == 0) {
+			printf("Usage: sync\n");
+			printf("Writes every change out to the disk, whatever the durability of the partition\n");
+		} else if (strcmp(args[1], "stats") == 0) {
+			printf("Usage: stats [reset]\n");
+			printf("Prints how many times each operation ran and its latency percentiles,\n");
+			printf("the reads, writes, flushes and lock waits of the volume, and the work\n");
+			printf("done by the block allocator. With reset, the counts start again from zero.\n");
+		} else if (strcmp(args[1], "trace") == 0) {
+			printf("Usage: trace start [records] | trace stop | trace dump <file>\n");
+			printf("start records every read, write, copy and flush of the volume, keeping the\n");
+			printf("last records of each thread, %d unless given. stop ends the recording.\n", LBA_TRACE_DEFAULT_RECORDS);
+			printf("dump writes the records kept since the start to the file for traceview.\n");
+		} else if (strcmp(args[1], "record") == 0) {
+			printf("Usage: record start <file> | record stop\n");
+			printf("start records every command run, with its arguments and how long it took,\n");
+			printf("to the file until stop. fsreplay runs the log again against a volume.\n");
 		} else {
 			printf("Unknown command.\n");
 			printf("Type help or help <function> for more information\n");
+			return 1;
 		}
 	}
+	return 0;
 }
 
 //Format the volume
-void run_format(int numArgs, char** args) {
-	if (numArgs > 1) {
+int run_format(int numArgs, char** args) {
+	if (numArgs > 2 || (numArgs == 2 && strcmp(args[1], "fixed") != 0)) {
 		printf("Unknown arguments\n");
-		printf("Usage: format\n");
-		return;
+		printf("Usage: format [--fixed]\n");
+		return 1;
 	}
 
-	char answer;
 	int retvalue;
 	printf("Warning: This will delete the current filesystem!\n");
-	printf("Do you want to continue? (y/n): ");
-	scanf(" %c", &answer);
-	flushInput();
-	if (answer == 'y' || answer == 'Y') {
-		retvalue = fs_format();
+	if (confirm("Do you want to continue?")) {
+		retvalue = fs_format(vol, numArgs == 2 ? DIR_FORMAT_FIXED : DIR_FORMAT_COMPACT);
 	} else {
 		printf("Canceled format\n");
-		return;
+		return 1;
 	}
 
 	if (retvalue == -1) {
 		printf("Format failed!\n");
-	} else if (retvalue == 0) {
-		printf("Format success!\n");
+		return 1;
 	}
+	printf("Format success!\n");
+	return 0;
 }
 
 //Print information about the filesystem
-void run_lsfs(int numArgs, char** args) {
+int run_lsfs(int numArgs, char** args) {
 	if (numArgs > 1) {
 		printf("Unknown arguments\n");
 		printf("Usage: lsfs\n");
-		return;
+		return 1;
 	}
 
-	fs_lsfs();
+	fs_lsfs(vol);
+	return 0;
 }
 
 //List the current directory
-void run_ls(int numArgs, char** args) {
+int run_ls(int numArgs, char** args) {
 	if (numArgs > 1) {
 		printf("Unknown arguments\n");
 		printf("Usage: ls\n");
-		return;
+		return 1;
 	}
 
-	fs_ls();
+	fs_ls(vol);
+	return 0;
 }
 
 //Print full working directory path name
-void run_pwd(int numArgs, char** args) {
+int run_pwd(int numArgs, char** args) {
 	if (numArgs > 1) {
 		printf("Unknown arguments\n");
 		printf("Usage: pwd\n");
-		return;
+		return 1;
 	}
 
-	fs_pwd();
+	fs_pwd(vol);
+	return 0;
 }
 
 //Used to change directory
-void run_cd(int numArgs, char** args) {
+int run_cd(int numArgs, char** args) {
 	int retvalue;
 	if (numArgs > 2) {
 		printf("Unknown arguments\n");
 		printf("Usage: mkdir <dirname>\n");
-		return;
+		return 1;
 	}
 
 	if (numArgs == 2) {
-		retvalue = fs_cd(args[1]);
+		retvalue = fs_cd(vol, args[1]);
 		if (retvalue == -1)
 			printf("Could not change to directory: %s\n", args[1]);
 		if (retvalue == -2)
 			printf("Not a directory: %s\n", args[1]);
 	} else {
-		retvalue = fs_cd(NULL);
+		retvalue = fs_cd(vol, NULL);
 		if (retvalue == -1)
 			printf("Error changing direct to root\n");
 	}
+	return retvalue < 0;
 }
 
 //Create a directory
-void run_mkdir(int numArgs, char** args) {
+int run_mkdir(int numArgs, char** args) {
 	if (numArgs > 2) {
 		printf("Unknown arguments\n");
 		printf("Usage: mkdir <dirname>\n");
-		return;
+		return 1;
 	} else if (numArgs < 2) {
 		printf("Missing directory name\n");
 		printf("Usage: mkdir <dirname>\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_mkdir(args[1]);
+	int retvalue = fs_mkdir(vol, args[1]);
 
 	if (retvalue == -1) {
 		printf("Could not make directory: %s\n", args[1]);
 	} else if (retvalue == -2) {
 		printf("%s directory already exists\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Create an empty file
-void run_mkfile(int numArgs, char** args) {
+int run_mkfile(int numArgs, char** args) {
 	if (numArgs > 3) {
 		printf("Unknown arguments\n");
 		printf("Usage: mkfile <filename> [size]\n");
-		return;
+		return 1;
 	} else if (numArgs < 2) {
 		printf("Missing filename\n");
 		printf("Usage: mkfile <filename> [size]\n");
-		return;
+		return 1;
 	}
 
 	int retvalue;
 	if (numArgs == 3)
-		retvalue = fs_mkfile(args[1], atol(args[2]));
+		retvalue = fs_mkfile(vol, args[1], atol(args[2]));
 	else
-		retvalue = fs_mkfile(args[1], 0);
+		retvalue = fs_mkfile(vol, args[1], 0);
 
 	if (retvalue == -1) {
 		printf("Could not make file: %s\n", args[1]);
 	} else if (retvalue == -2) {
 		printf("%s file already exists\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Remove a directory
-void run_rmdir(int numArgs, char** args) {
+int run_rmdir(int numArgs, char** args) {
 	if (numArgs > 2) {
 		printf("Unknown arguments\n");
 		printf("Usage: rmdir <dirname>\n");
-		return;
+		return 1;
 	} else if (numArgs < 2) {
 		printf("Missing directory name\n");
 		printf("Usage: rmdir <dirname>\n");
-		return;
+		return 1;
+	}
+
+	//Only a directory that exists has files to warn about
+	Inode inode;
+	if (fs_stat(vol, args[1], &inode) == 0 && inode.type == DIRECTORY_TYPE) {
+		printf("This will delete all files located within the directory.\n");
+		if (!confirm("Do you want to continue?")) {
+			printf("Canceled rmdir\n");
+			return 1;
+		}
 	}
 
-	int retvalue = fs_rmdir(args[1]);
+	int retvalue = fs_rmdir(vol, args[1]);
 
 	if (retvalue == 0) {
 		printf("Could not remove directory: %s\n", args[1]);
 	} else if (retvalue == -1) {
 		printf("%s is not a directory\n", args[1]);
 	}
+	return retvalue != 1;
 }
 
 //Resize a file, Can not resize a directory
-void run_resize(int numArgs, char** args) {
+int run_resize(int numArgs, char** args) {
 	if (numArgs > 3) {
 		printf("Unknown arguments\n");
 		printf("Usage: resize <filename> <size>\n");
-		return;
+		return 1;
 	} else if (numArgs < 3) {
 		printf("Missing arguments\n");
 		printf("Usage: resize <filename> <size>\n");
-		return;
+		return 1;
 	}
 
 	uint64_t newSize = atol(args[2]);
 	if (newSize < 0) {
 		printf("Size must be positive\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_resize(args[1], newSize);
+	int retvalue = fs_resize(vol, args[1], newSize);
 
 	if (retvalue == -1) {
 		printf("Could not resize file %s to %ld\n", args[1], newSize);
 	} else if (retvalue == -2) {
 		printf("%s does not exist\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Deallocate or allocate more blocks for a file
-void run_reserve(int numArgs, char** args) {
+int run_reserve(int numArgs, char** args) {
 	if (numArgs > 3) {
 		printf("Unknown arguments\n");
 		printf("Usage: reserve <filename> <size>\n");
-		return;
+		return 1;
 	} else if (numArgs < 3) {
 		printf("Missing arguments\n");
 		printf("Usage: reserve <filename> <size>\n");
-		return;
+		return 1;
 	}
 
 	int64_t newSize = atol(args[2]);
 	if (newSize < 0) {
 		printf("Size must be positive\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_reserve(args[1], newSize);
+	int retvalue = fs_reserve(vol, args[1], newSize);
 
 	if (retvalue == -1) {
 		printf("Could not changed reserved in file %s to %ld\n", args[1], newSize);
 	} else if (retvalue == -2) {
 		printf("%s does not exist\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Copy a file or directory
-void run_cp(int numArgs, char** args) {
-	if (numArgs > 3) {
+int run_cp(int numArgs, char** args) {
+	if (numArgs > 4 || (numArgs == 4 && strcmp(args[3], "reflink") != 0)) {
 		printf("Unknown arguments\n");
-		printf("Usage: cp <source> <destination>\n");
-		return;
+		printf("Usage: cp <source> <destination> [--reflink]\n");
+		return 1;
 	} else if (numArgs < 3) {
 		printf("Missing arguments\n");
-		printf("Usage: cp <source> <destination>\n");
-		return;
+		printf("Usage: cp <source> <destination> [--reflink]\n");
+		return 1;
 	}
 
-	int retvalue = fs_cp(args[1], args[2]);
+	int retvalue = fs_cp(vol, args[1], args[2], numArgs == 4);
 
 	if (retvalue == -1) {
 		printf("Could not copy file %s to %s\n", args[1], args[2]);
 	} else if (retvalue == -2) {
 		printf("%s does not exist\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Move a file or directory
-void run_mv(int numArgs, char** args) {
+int run_mv(int numArgs, char** args) {
 	if (numArgs > 3) {
 		printf("Unknown arguments\n");
 		printf("Usage: mv <source> <destination>\n");
-		return;
+		return 1;
 	} else if (numArgs < 3) {
 		printf("Missing arguments\n");
 		printf("Usage: mv <source> <destination>\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_mv(args[1], args[2]);
+	int retvalue = fs_mv(vol, args[1], args[2]);
 
 	if (retvalue == -1) {
 		printf("Could not move file %s to %s\n", args[1], args[2]);
 	} else if (retvalue == -2) {
 		printf("%s does not exist\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Remove a file
-void run_rm(int numArgs, char** args) {
+int run_rm(int numArgs, char** args) {
 	if (numArgs > 2) {
 		printf("Unknown arguments\n");
 		printf("Usage: rm <filename>\n");
-		return;
+		return 1;
 	} else if (numArgs < 2) {
 		printf("Missing arguments\n");
 		printf("Usage: rm <filename>\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_rm(args[1]);
+	int retvalue = fs_rm(vol, args[1]);
 
 	if (retvalue == -1) {
 		printf("Could not delete file\n");
 	} else if (retvalue == -2) {
 		printf("%s does not exist\n", args[1]);
 	}
+	return retvalue < 0;
 }
 
 //Copy a file from another filesystem to this filesystem
-void run_cpin(int numArgs, char** args) {
+int run_cpin(int numArgs, char** args) {
 	if (numArgs > 3) {
 		printf("Unknown arguments\n");
 		printf("Usage: cpin <source> <desintation>\n");
-		return;
+		return 1;
 	} else if (numArgs < 3) {
 		printf("Missing arguments\n");
 		printf("Usage: cpin <source> <desintation>\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_cpin(args[1], args[2]);
+	int retvalue = fs_cpin(vol, args[1], args[2]);
 
 	if (retvalue == -1) {
 		printf("Could not copy file %s to %s\n", args[1], args[2]);
@@ -580,21 +827,22 @@ void run_cpin(int numArgs, char** args) {
 	} else if (retvalue == -3) {
 		printf("Could not open %s\n", args[2]);
 	}
+	return retvalue < 0;
 }
 
 //Copy a file from this filesystem to another filesystem
-void run_cpout(int numArgs, char** args) {
+int run_cpout(int numArgs, char** args) {
 	if (numArgs > 3) {
 		printf("Unknown arguments\n");
 		printf("Usage: cpout <source> <destination>\n");
-		return;
+		return 1;
 	} else if (numArgs < 3) {
 		printf("Missing arguments\n");
 		printf("Usage: cpout <source> <destination>\n");
-		return;
+		return 1;
 	}
 
-	int retvalue = fs_cpout(args[1], args[2]);
+	int retvalue = fs_cpout(vol, args[1], args[2]);
 
 	if (retvalue == -1) {
 		printf("Could not copy file %s to %s\n", args[1], args[2]);
@@ -603,6 +851,113 @@ void run_cpout(int numArgs, char** args) {
 	} else if (retvalue == -3) {
 		printf("Could not open %s\n", args[2]);
 	}
+	return retvalue < 0;
+}
+
+//Write every change out to the disk
+int run_sync(int numArgs, char** args) {
+	if (numArgs > 1) {
+		printf("Unknown arguments\n");
+		printf("Usage: sync\n");
+		return 1;
+	}
+
+	if (fsSync(vol) == -1) {
+		printf("Could not sync the filesystem\n");
+		return 1;
+	}
+	return 0;
+}
+
+//Record the reads and writes of the volume
+int run_trace(int numArgs, char** args) {
+	if (numArgs >= 2 && numArgs <= 3 && strcmp(args[1], "start") == 0) {
+		uint64_t records = (numArgs == 3) ? strtoull(args[2], NULL, 10) : 0;
+		if (LBAtraceStart(fs_partition(vol), records) == -1) {
+			printf("Tracing was left out of this build\n");
+			return 1;
+		}
+	} else if (numArgs == 2 && strcmp(args[1], "stop") == 0) {
+		LBAtraceStop();
+	} else if (numArgs == 3 && strcmp(args[1], "dump") == 0) {
+		int64_t records = LBAtraceDump(args[2]);
+		if (records == -1) {
+			printf("Could not write %s\n", args[2]);
+			return 1;
+		}
+		printf("Wrote %ld records to %s\n", records, args[2]);
+	} else {
+		printf("Unknown arguments\n");
+		printf("Usage: trace start [records] | trace stop | trace dump <file>\n");
+		return 1;
+	}
+	return 0;
+}
+
+//Record the operations called to a log
+int run_record(int numArgs, char** args) {
+	if (numArgs == 3 && strcmp(args[1], "start") == 0) {
+		if (fs_recordStart(vol, args[2]) == -1) {
+			printf("Could not record to %s\n", args[2]);
+			return 1;
+		}
+	} else if (numArgs == 2 && strcmp(args[1], "stop") == 0) {
+		fs_recordStop(vol);
+	} else {
+		printf("Unknown arguments\n");
+		printf("Usage: record start <file> | record stop\n");
+		return 1;
+	}
+	return 0;
+}
+
+//Print the counts and latencies of the operations
+int run_stats(int numArgs, char** args) {
+	if (numArgs > 2 || (numArgs == 2 && strcmp(args[1], "reset") != 0)) {
+		printf("Unknown arguments\n");
+		printf("Usage: stats [reset]\n");
+		return 1;
+	}
+
+	FsStats_p stats = malloc(sizeof(FsStats));
+	fs_stats(vol, stats, numArgs == 2);
+
+	printf("  %-9s %11s %11s %11s %11s %11s %11s\n", "Operation", "Count", "Mean us", "p50 us", "p99 us", "p99.9 us", "Max us");
+	for (uint32_t op = 0; op < FS_OP_COUNT; op++) {
+		LatencyHistogram_p histogram = &stats->ops[op];
+		if (histogram->count == 0)
+			continue;
+		printf("  %-9s %11lu %11.1f %11.1f %11.1f %11.1f %11.1f\n", fsOpNames[op], histogram->count,
+			histogram->total / 1e3 / histogram->count, histogramPercentile(histogram, 0.5) / 1e3,
+			histogramPercentile(histogram, 0.99) / 1e3, histogramPercentile(histogram, 0.999) / 1e3, histogram->max / 1e3);
+	}
+
+	lbaStats_p lba = &stats->lba;
+	printf("Volume reads:       %lu calls, %lu blocks, %lu bytes\n", lba->reads, lba->readBlocks, lba->readBytes);
+	printf("Volume writes:      %lu calls, %lu blocks, %lu bytes\n", lba->writes, lba->writeBlocks, lba->writeBytes);
+	printf("Volume flushes:     %lu\n", lba->syncs);
+	printf("Volume lock waits:  %lu, %.1f us waited\n", lba->lockWaits, lba->lockWaitNanos / 1e3);
+	printf("Volume syscalls:    %lu\n", lba->syscalls);
+
+	AllocStats_p alloc = &stats->alloc;
+	printf("Block searches:     %lu, %.1f us mean, %.1f us max\n", alloc->calls,
+		(alloc->calls > 0) ? alloc->nanoseconds / 1e3 / alloc->calls : 0, alloc->maxNanoseconds / 1e3);
+	printf("Bits examined:      %lu\n", alloc->bitsExamined);
+	printf("Blocks found:       %lu in %lu fragments\n", alloc->blocks, alloc->holes);
+	printf("Fallback searches:  %lu\n", alloc->fallbacks);
+	free(stats);
+	return 0;
+}
+
+// asks a yes or no question, batch mode answers yes without asking
+int confirm(char* question) {
+    char answer = 'n';
+    if (batchMode)
+        return 1;
+    printf("%s (y/n): ", question);
+    scanf(" %c", &answer);
+    flushInput();
+    return answer == 'y' || answer == 'Y';
 }
 
 // flushes the input buffer
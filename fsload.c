@@ -0,0 +1,422 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: fsload.c
+*
+* Description: This file is a load generator for fsserver. Each
+*	connection runs on its own thread in its own directory and
+*	keeps up to the pipeline depth of requests in flight, sending
+*	them a batch per write. It runs these phases:
+*	create - creates every file
+*	write - writes every block of a data file
+*	read - reads every block of the data file back and checks it
+*	stat - looks up every file
+*	readdir - lists the directory of the connection
+*	remove - deletes every file
+*	The latency of a request runs from when it is queued to when
+*	its answer arrives, so it includes the time spent waiting
+*	behind the requests ahead of it.
+*
+*	Usage: ./fsload [options]
+*	-S <path>		socket of the server (fsserver.sock)
+*	-c <count>		connections, each on its own thread (4)
+*	-n <files>		files, and blocks of the data file, per connection (1000)
+*	-s <bytes>		bytes of each read and write (4096)
+*	-m <bytes>		most bytes of the data file, writes past it wrap around (1048576)
+*	-q <depth>		most requests in flight on a connection (16)
+*	-B <requests>	requests sent in one write, at most the depth (8)
+*	-p <phases>		comma separated phases to run (create,write,read,stat,readdir,remove)
+*	-j <file>		also write the results as JSON to the file
+*	-k				keep the files afterwards
+****************************************************************/
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FsClient.h"
+#include "Bench.h"
+
+#define LOAD_PATH_SIZE 256				//Max size of a path made by the load generator
+
+#define PHASE_CREATE 0
+#define PHASE_WRITE 1
+#define PHASE_READ 2
+#define PHASE_STAT 3
+#define PHASE_READDIR 4
+#define PHASE_REMOVE 5
+#define PHASE_COUNT 6
+
+const char* loadPhaseNames[PHASE_COUNT] = { "create", "write", "read", "stat", "readdir", "remove" };
+
+/* Settings of a run of the load generator */
+typedef struct LoadConfig {
+	char* socketPath;
+	uint32_t connections;
+	uint64_t files;
+	uint64_t ioSize;
+	uint64_t span;
+	uint64_t depth;
+	uint64_t batch;
+	char* phases;
+	char* jsonFile;
+	int keepFiles;
+} LoadConfig, *LoadConfig_p;
+
+/* A connection and the thread driving it */
+typedef struct LoadThread {
+	pthread_t thread;
+	uint32_t number;					//Number of the connection, naming its directory
+	FsClient_p client;
+	int fd;								//Data file of the connection on the server
+	uint8_t* writeBuffer;				//Data written by the write phase
+	uint8_t* readBuffer;				//Data read back by the read phase
+	uint32_t phase;						//Phase being run, see PHASE_*
+	BenchPhase result;					//Operations of the phase
+	int lost;							//1 if the connection was lost
+} LoadThread, *LoadThread_p;
+
+LoadConfig config;
+char loadRoot[32];			//Directory holding the directories of the connections, named after the process
+
+void usage();
+int parseOptions(int argc, char** argv, LoadConfig_p config);
+int phaseSelected(const char* name);
+void* runThread(void* arg);
+int64_t queueRequest(LoadThread_p thread, uint64_t i);
+int checkReply(LoadThread_p thread, uint64_t i, FsReply_p reply);
+uint64_t blockOffset(uint64_t block);
+void fillBlock(uint8_t* buffer, uint64_t length, uint32_t connection, uint64_t block);
+
+int main(int argc, char** argv) {
+	BenchPhase phases[PHASE_COUNT];
+	uint32_t phaseCount = 0;
+	char path[LOAD_PATH_SIZE];
+
+	if (!parseOptions(argc, argv, &config)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	//Give each connection an empty directory apart from other runs, with a data file open
+	LoadThread_p threads = calloc(config.connections, sizeof(LoadThread));
+	for (uint32_t t = 0; t < config.connections; t++) {
+		LoadThread_p thread = &threads[t];
+		thread->number = t;
+		thread->client = fsc_connect(config.socketPath);
+		if (thread->client == NULL) {
+			printf("Could not connect to %s\n", config.socketPath);
+			exit(EXIT_FAILURE);
+		}
+		if (t == 0) {
+			snprintf(loadRoot, sizeof(loadRoot), "fsload%d", getpid());
+			fsc_rmdir(thread->client, loadRoot);
+			fsc_mkdir(thread->client, loadRoot);
+		}
+		snprintf(path, LOAD_PATH_SIZE, "%s/c%u", loadRoot, t);
+		int made = fsc_mkdir(thread->client, path);
+		snprintf(path, LOAD_PATH_SIZE, "%s/c%u/data", loadRoot, t);
+		if (made != 0 || fsc_create(thread->client, path, 0) != 0
+				|| (thread->fd = fsc_open(thread->client, path)) == -1) {
+			printf("Could not make the files of connection %u\n", t);
+			exit(EXIT_FAILURE);
+		}
+		thread->writeBuffer = malloc(config.ioSize);
+		thread->readBuffer = malloc(config.ioSize);
+	}
+
+	//Run each phase on every connection at once, then add up what the connections saw
+	for (uint32_t phase = 0; phase < PHASE_COUNT; phase++) {
+		if (!phaseSelected(loadPhaseNames[phase]))
+			continue;
+		BenchPhase_p merged = &phases[phaseCount++];
+		beginPhase(merged, NULL, loadPhaseNames[phase], config.connections * config.files);
+		for (uint32_t t = 0; t < config.connections; t++) {
+			threads[t].phase = phase;
+			beginPhase(&threads[t].result, NULL, loadPhaseNames[phase], config.files);
+			pthread_create(&threads[t].thread, NULL, runThread, &threads[t]);
+		}
+		for (uint32_t t = 0; t < config.connections; t++) {
+			pthread_join(threads[t].thread, NULL);
+			mergePhase(merged, &threads[t].result);
+			freePhase(&threads[t].result);
+		}
+		endPhase(merged);
+	}
+
+	//Close the data files before removing the directories that hold them
+	int lost = 0;
+	for (uint32_t t = 0; t < config.connections; t++) {
+		if (threads[t].lost) {
+			printf("Lost connection %u\n", t);
+			lost = 1;
+		} else {
+			fsc_close(threads[t].client, threads[t].fd);
+		}
+	}
+	if (!config.keepFiles && !threads[0].lost)
+		fsc_rmdir(threads[0].client, loadRoot);
+	for (uint32_t t = 0; t < config.connections; t++) {
+		fsc_disconnect(threads[t].client);
+		free(threads[t].writeBuffer);
+		free(threads[t].readBuffer);
+	}
+	free(threads);
+
+	BenchParam params[] = {
+		{ "connections", NULL, config.connections },
+		{ "files", NULL, config.files },
+		{ "io_size", NULL, config.ioSize },
+		{ "span", NULL, config.span },
+		{ "depth", NULL, config.depth },
+		{ "batch", NULL, config.batch }
+	};
+	uint32_t paramCount = sizeof(params) / sizeof(BenchParam);
+	printf("\n");
+	printBenchText(stdout, params, paramCount, phases, phaseCount);
+	if (config.jsonFile != NULL) {
+		FILE* json = fopen(config.jsonFile, "w");
+		if (json == NULL) {
+			printf("Could not open %s\n", config.jsonFile);
+		} else {
+			printBenchJson(json, "fsload", params, paramCount, phases, phaseCount);
+			fclose(json);
+		}
+	}
+
+	for (uint32_t i = 0; i < phaseCount; i++)
+		freePhase(&phases[i]);
+	return lost ? EXIT_FAILURE : 0;
+}
+
+/** Prints the options of the load generator */
+void usage() {
+	printf("Usage: ./fsload [options]\n");
+	printf("  -S <path>       socket of the server (%s)\n", FSP_DEFAULT_SOCKET);
+	printf("  -c <count>      connections, each on its own thread (4)\n");
+	printf("  -n <files>      files, and blocks of the data file, per connection (1000)\n");
+	printf("  -s <bytes>      bytes of each read and write (4096)\n");
+	printf("  -m <bytes>      most bytes of the data file, writes past it wrap around (1048576)\n");
+	printf("  -q <depth>      most requests in flight on a connection (16)\n");
+	printf("  -B <requests>   requests sent in one write, at most the depth (8)\n");
+	printf("  -p <phases>     phases to run (create,write,read,stat,readdir,remove)\n");
+	printf("  -j <file>       also write the results as JSON to the file\n");
+	printf("  -k              keep the files afterwards\n");
+}
+
+/**
+ * Reads the options into the config, starting from the defaults.
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config where to store the settings
+ * @returns 1 if successful
+ * @returns 0 if an option is unknown or invalid
+ */
+int parseOptions(int argc, char** argv, LoadConfig_p config) {
+	int option;
+
+	config->socketPath = FSP_DEFAULT_SOCKET;
+	config->connections = 4;
+	config->files = 1000;
+	config->ioSize = 4096;
+	config->span = 1024 * 1024;
+	config->depth = 16;
+	config->batch = 8;
+	config->phases = "create,write,read,stat,readdir,remove";
+	config->jsonFile = NULL;
+	config->keepFiles = 0;
+
+	while ((option = getopt(argc, argv, "S:c:n:s:m:q:B:p:j:kh")) != -1) {
+		switch (option) {
+		case 'S': config->socketPath = optarg; break;
+		case 'c': config->connections = strtoul(optarg, NULL, 10); break;
+		case 'n': config->files = strtoull(optarg, NULL, 10); break;
+		case 's': config->ioSize = strtoull(optarg, NULL, 10); break;
+		case 'm': config->span = strtoull(optarg, NULL, 10); break;
+		case 'q': config->depth = strtoull(optarg, NULL, 10); break;
+		case 'B': config->batch = strtoull(optarg, NULL, 10); break;
+		case 'p': config->phases = optarg; break;
+		case 'j': config->jsonFile = optarg; break;
+		case 'k': config->keepFiles = 1; break;
+		default:
+			return 0;
+		}
+	}
+	if (optind < argc || config->connections == 0 || config->files == 0 || config->depth == 0 || config->batch == 0)
+		return 0;
+	if (config->ioSize < sizeof(uint64_t) || config->ioSize > FSP_MAX_DATA) {
+		printf("The I/O size must be from %lu to %d bytes\n", sizeof(uint64_t), FSP_MAX_DATA);
+		return 0;
+	}
+	if (config->span < config->ioSize)
+		config->span = config->ioSize;
+	if (config->batch > config->depth)
+		config->batch = config->depth;
+
+	//Every phase named must be known
+	char* phases = strdup(config->phases);
+	char* save;
+	int valid = 1;
+	for (char* token = strtok_r(phases, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+		int known = 0;
+		for (uint32_t i = 0; i < PHASE_COUNT; i++) {
+			if (strcmp(token, loadPhaseNames[i]) == 0)
+				known = 1;
+		}
+		if (!known) {
+			printf("Unknown phase %s\n", token);
+			valid = 0;
+		}
+	}
+	free(phases);
+	return valid;
+}
+
+/**
+ * Returns whether the phase was chosen with -p
+ * @param name the name of the phase
+ * @returns 1 if the phase runs
+ * @returns 0 if it does not
+ */
+int phaseSelected(const char* name) {
+	char* phases = strdup(config.phases);
+	char* save;
+	int found = 0;
+	for (char* token = strtok_r(phases, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+		if (strcmp(token, name) == 0)
+			found = 1;
+	}
+	free(phases);
+	return found;
+}
+
+/**
+ * Runs the phase of a connection. Requests are queued a batch at a time
+ * whenever a batch fits in the pipeline, and answers are read in between.
+ * @param arg the LoadThread of the connection
+ * @returns NULL
+ */
+void* runThread(void* arg) {
+	LoadThread_p thread = arg;
+	FsReply reply;
+	uint64_t total = (thread->phase == PHASE_READDIR) ? (config.files + 9) / 10 : config.files;
+	uint64_t* starts = malloc(config.depth * sizeof(uint64_t));
+	uint64_t sent = 0;
+	uint64_t done = 0;
+
+	if (thread->lost) {
+		free(starts);
+		return NULL;
+	}
+	while (done < total) {
+		uint64_t count = (total - sent < config.batch) ? total - sent : config.batch;
+		if (count > 0 && config.depth - (sent - done) >= count) {
+			for (uint64_t i = 0; i < count; i++, sent++) {
+				starts[sent % config.depth] = benchNow();
+				queueRequest(thread, sent);
+			}
+			if (fsc_flush(thread->client) == -1)
+				break;
+			continue;
+		}
+		if (fsc_receive(thread->client, &reply) == -1)
+			break;
+		recordOp(&thread->result, starts[done % config.depth], !checkReply(thread, done, &reply));
+		done++;
+	}
+	if (done < total)
+		thread->lost = 1;
+	free(starts);
+	return NULL;
+}
+
+/**
+ * Queues the request of the connection's phase for a file or block.
+ * @param thread the connection
+ * @param i the number of the file or block
+ * @returns the id of the request
+ */
+int64_t queueRequest(LoadThread_p thread, uint64_t i) {
+	char path[LOAD_PATH_SIZE];
+	FsClient_p client = thread->client;
+
+	snprintf(path, LOAD_PATH_SIZE, "%s/c%u/f%lu", loadRoot, thread->number, i);
+	switch (thread->phase) {
+	case PHASE_CREATE:
+		return fsc_send(client, FSP_CREATE, path, -1, 0, -1, NULL, 0);
+	case PHASE_WRITE:
+		fillBlock(thread->writeBuffer, config.ioSize, thread->number, i);
+		return fsc_send(client, FSP_WRITE, NULL, thread->fd, 0, blockOffset(i), thread->writeBuffer, config.ioSize);
+	case PHASE_READ:
+		return fsc_send(client, FSP_READ, NULL, thread->fd, config.ioSize, blockOffset(i), NULL, 0);
+	case PHASE_STAT:
+		return fsc_send(client, FSP_STAT, path, -1, 0, -1, NULL, 0);
+	case PHASE_READDIR:
+		snprintf(path, LOAD_PATH_SIZE, "%s/c%u", loadRoot, thread->number);
+		return fsc_send(client, FSP_READDIR, path, -1, 0, -1, NULL, 0);
+	default:
+		return fsc_send(client, FSP_REMOVE, path, -1, 0, -1, NULL, 0);
+	}
+}
+
+/**
+ * Checks the answer to a request made by queueRequest and counts the bytes it moved.
+ * @param thread the connection
+ * @param i the number of the file or block
+ * @param reply the answer
+ * @returns 1 if the request succeeded
+ * @returns 0 if it failed or read back the wrong data
+ */
+int checkReply(LoadThread_p thread, uint64_t i, FsReply_p reply) {
+	if (reply->result < 0)
+		return 0;
+	switch (thread->phase) {
+	case PHASE_WRITE:
+		if ((uint64_t)reply->result != config.ioSize)
+			return 0;
+		thread->result.bytes += config.ioSize;
+		return 1;
+	case PHASE_READ:
+		if ((uint64_t)reply->result != config.ioSize || reply->dataLength != config.ioSize)
+			return 0;
+		thread->result.bytes += config.ioSize;
+
+		//The block holds what the last write to its offset wrote
+		uint64_t slots = config.span / config.ioSize;
+		uint64_t written = i % slots + (config.files - 1 - i % slots) / slots * slots;
+		fillBlock(thread->readBuffer, config.ioSize, thread->number, written);
+		return memcmp(reply->data, thread->readBuffer, config.ioSize) == 0;
+	default:
+		return 1;
+	}
+}
+
+/**
+ * Returns where a block goes in the data file, wrapping around past the span.
+ * @param block the number of the block
+ * @returns the offset of the block
+ */
+uint64_t blockOffset(uint64_t block) {
+	return block % (config.span / config.ioSize) * config.ioSize;
+}
+
+/**
+ * Fills a block with data unique to the connection and block, so a read
+ * returning another block's data is caught.
+ * @param buffer where to write the data
+ * @param length bytes of the block
+ * @param connection the number of the connection
+ * @param block the number of the block
+ */
+void fillBlock(uint8_t* buffer, uint64_t length, uint32_t connection, uint64_t block) {
+	uint64_t seed = ((uint64_t)connection << 40) ^ (block * 2654435761u);
+	for (uint64_t i = 0; i < length; i++)
+		buffer[i] = (seed >> ((i % 8) * 8)) + i;
+}
@@ -0,0 +1,503 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: fsreplay.c
+*
+* Description: This file runs a log of operations, written by the
+*	record command of the driver or by fs_recordStart, again
+*	against a volume, so a slow workload can be looked at away
+*	from where it ran. The operations run in the order they
+*	started, either as fast as possible or at the times they
+*	started in the recording.
+*	With several replay threads, the operations of each recorded
+*	thread stay together and in order on one replay thread.
+*	File descriptors in the log are mapped to the ones opened by
+*	the replayed opens. Writes write a fixed pattern of the
+*	recorded length. An ls is replayed as a listing of the working
+*	directory without printing it and every cpout writes to the same
+*	file outside the volume.
+*	Afterwards it reports the throughput and latency percentiles
+*	of each kind of operation, beside the ones recorded. With
+*	several threads, the system calls of an operation include
+*	those of operations running beside it.
+*
+*	Usage: ./fsreplay [options] <log>
+*	-f <file>		volume to replay against, created and formatted if needed (replay.vol)
+*	-s <bytes>		size of a created volume (67108864)
+*	-b <bytes>		block size of a created volume (512)
+*	-t				start each operation at its recorded time instead of as fast as possible
+*	-p <threads>	replay threads (1)
+*	-o <file>		file every cpout writes to (replay.out)
+*	-d <mode>		durability, none, ordered or full (ordered)
+*	-j <file>		also write the results as JSON to the file
+****************************************************************/
+
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "FileSystem.h"
+#include "Record.h"
+#include "Bench.h"
+
+/* Settings of a run of the tool */
+typedef struct ReplayConfig {
+	char* logFile;
+	char* volumeFile;
+	uint64_t volumeSize;
+	uint64_t blockSize;
+	int timed;
+	uint32_t threads;
+	char* outFile;
+	int durability;
+	char* durabilityName;
+	char* jsonFile;
+} ReplayConfig, *ReplayConfig_p;
+
+/* An operation read from the log */
+typedef struct ReplayOp {
+	RecordEntry entry;
+	char* path;							//First path, NULL if none
+	char* path2;						//Second path, NULL if none
+	uint64_t index;						//Position in the log, to keep operations that start together in order
+} ReplayOp, *ReplayOp_p;
+
+/* The operations run by one replay thread and what they took */
+typedef struct ReplayThread {
+	pthread_t thread;
+	ReplayOp_p* ops;					//Operations in order of start
+	uint64_t count;
+	uint8_t* readBuffer;
+	BenchPhase phases[FS_OP_COUNT];
+	uint64_t syscalls[FS_OP_COUNT];
+} ReplayThread, *ReplayThread_p;
+
+ReplayConfig config;
+int32_t fdMap[MAX_OPEN_FILES];			//File descriptor opened by the replay for each recorded one, -1 if none
+uint8_t* writeBuffer;					//Pattern written by every write
+uint64_t replayStart;					//Nanoseconds when the replay started
+FsVolume_p vol;							//Volume the log is replayed on
+
+void usage();
+int parseOptions(int argc, char** argv, ReplayConfig_p config);
+ReplayOp_p loadLog(char* fileName, uint64_t* count);
+int compareOps(const void* a, const void* b);
+void* runThread(void* arg);
+int runOp(ReplayThread_p thread, ReplayOp_p op);
+void ignoreEntry(DirEntry_p entry, Inode_p inode, void* arg);
+
+int main(int argc, char** argv) {
+	uint64_t count;
+
+	if (!parseOptions(argc, argv, &config)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	ReplayOp_p ops = loadLog(config.logFile, &count);
+	if (ops == NULL)
+		exit(EXIT_FAILURE);
+	qsort(ops, count, sizeof(ReplayOp), compareOps);
+
+	vol = fs_mount(config.volumeFile, &config.volumeSize, &config.blockSize, config.durability);
+	if (vol == NULL) {
+		printf("Error: opening partition %s\n", config.volumeFile);
+		exit(EXIT_FAILURE);
+	}
+	if (!check_fs(vol)) {
+		printf("Formatting %s\n", config.volumeFile);
+		if (fs_format(vol, DIR_FORMAT_COMPACT) != 0) {
+			printf("Format failed!\n");
+			fs_unmount(vol);
+			exit(EXIT_FAILURE);
+		}
+	}
+	startWriteback(vol, NULL);
+
+	//Hand each recorded thread's operations to one replay thread, keeping their order
+	uint64_t maxLength = 1;
+	ReplayThread_p threads = calloc(config.threads, sizeof(ReplayThread));
+	for (uint32_t t = 0; t < config.threads; t++)
+		threads[t].ops = malloc((count > 0 ? count : 1) * sizeof(ReplayOp_p));
+	for (uint64_t i = 0; i < count; i++) {
+		ReplayThread_p thread = &threads[ops[i].entry.thread % config.threads];
+		thread->ops[thread->count++] = &ops[i];
+		if ((ops[i].entry.op == FS_OP_READ || ops[i].entry.op == FS_OP_WRITE) && ops[i].entry.size > maxLength)
+			maxLength = ops[i].entry.size;
+	}
+	writeBuffer = malloc(maxLength);
+	for (uint64_t i = 0; i < maxLength; i++)
+		writeBuffer[i] = i * 31 + 7;
+	for (uint32_t i = 0; i < MAX_OPEN_FILES; i++)
+		fdMap[i] = -1;
+
+	uint64_t syscalls = LBAsyscalls(fs_partition(vol));
+	replayStart = benchNow();
+	for (uint32_t t = 0; t < config.threads; t++) {
+		threads[t].readBuffer = malloc(maxLength);
+		for (uint32_t op = 0; op < FS_OP_COUNT; op++)
+			beginPhase(&threads[t].phases[op], NULL, fsOpNames[op], 64);
+		pthread_create(&threads[t].thread, NULL, runThread, &threads[t]);
+	}
+	for (uint32_t t = 0; t < config.threads; t++)
+		pthread_join(threads[t].thread, NULL);
+	uint64_t elapsed = benchNow() - replayStart;
+	syscalls = LBAsyscalls(fs_partition(vol)) - syscalls;
+
+	//Each kind of operation is measured against the whole replay, beside a total of every operation
+	BenchPhase replayed[FS_OP_COUNT + 1];
+	BenchPhase recorded[FS_OP_COUNT + 1];
+	uint32_t phaseCount = 0;
+	uint64_t recordedEnd = 0;
+	for (uint64_t i = 0; i < count; i++) {
+		if (ops[i].entry.start + ops[i].entry.latency > recordedEnd)
+			recordedEnd = ops[i].entry.start + ops[i].entry.latency;
+	}
+	beginPhase(&replayed[FS_OP_COUNT], NULL, "total", count);
+	beginPhase(&recorded[FS_OP_COUNT], NULL, "total", count);
+	for (uint32_t op = 0; op < FS_OP_COUNT; op++) {
+		BenchPhase_p phase = &replayed[phaseCount];
+		beginPhase(phase, NULL, fsOpNames[op], 64);
+		for (uint32_t t = 0; t < config.threads; t++) {
+			mergePhase(phase, &threads[t].phases[op]);
+			phase->syscalls += threads[t].syscalls[op];
+		}
+		if (phase->count == 0) {
+			freePhase(phase);
+			continue;
+		}
+
+		BenchPhase_p original = &recorded[phaseCount];
+		beginPhase(original, NULL, fsOpNames[op], phase->count);
+		for (uint64_t i = 0; i < count; i++) {
+			if (ops[i].entry.op != op)
+				continue;
+			if (original->count == original->capacity) {
+				original->capacity *= 2;
+				original->latencies = realloc(original->latencies, original->capacity * sizeof(uint64_t));
+			}
+			original->latencies[original->count++] = ops[i].entry.latency;
+			if (op == FS_OP_READ || op == FS_OP_WRITE)
+				original->bytes += ops[i].entry.size;
+		}
+		mergePhase(&replayed[FS_OP_COUNT], phase);
+		mergePhase(&recorded[FS_OP_COUNT], original);
+		phaseCount++;
+	}
+	for (uint32_t i = 0; i < phaseCount; i++) {
+		endPhase(&replayed[i]);
+		endPhase(&recorded[i]);
+		replayed[i].elapsed = elapsed;
+		recorded[i].elapsed = recordedEnd;
+	}
+	endPhase(&replayed[FS_OP_COUNT]);
+	endPhase(&recorded[FS_OP_COUNT]);
+	replayed[FS_OP_COUNT].elapsed = elapsed;
+	replayed[FS_OP_COUNT].syscalls = syscalls;
+	recorded[FS_OP_COUNT].elapsed = recordedEnd;
+	memcpy(&replayed[phaseCount], &replayed[FS_OP_COUNT], sizeof(BenchPhase));
+	memcpy(&recorded[phaseCount], &recorded[FS_OP_COUNT], sizeof(BenchPhase));
+	phaseCount++;
+
+	BenchParam params[] = {
+		{ "log", config.logFile, 0 },
+		{ "volume", config.volumeFile, 0 },
+		{ "block_size", NULL, config.blockSize },
+		{ "timing", config.timed ? "recorded" : "fastest", 0 },
+		{ "threads", NULL, config.threads },
+		{ "durability", config.durabilityName, 0 },
+		{ "operations", NULL, count },
+		{ "recorded_ms", NULL, recordedEnd / 1000000 },
+		{ "replayed_ms", NULL, elapsed / 1000000 }
+	};
+	uint32_t paramCount = sizeof(params) / sizeof(BenchParam);
+	printf("\n");
+	printBenchText(stdout, params, paramCount, replayed, phaseCount);
+	printf("\nRecorded");
+	printBenchText(stdout, NULL, 0, recorded, phaseCount);
+	if (config.jsonFile != NULL) {
+		FILE* json = fopen(config.jsonFile, "w");
+		if (json == NULL) {
+			printf("Could not open %s\n", config.jsonFile);
+		} else {
+			printBenchJson(json, "fsreplay", params, paramCount, replayed, phaseCount);
+			fclose(json);
+		}
+	}
+
+	fs_unmount(vol);
+	for (uint32_t i = 0; i < phaseCount; i++) {
+		freePhase(&replayed[i]);
+		freePhase(&recorded[i]);
+	}
+	for (uint32_t t = 0; t < config.threads; t++) {
+		for (uint32_t op = 0; op < FS_OP_COUNT; op++)
+			freePhase(&threads[t].phases[op]);
+		free(threads[t].ops);
+		free(threads[t].readBuffer);
+	}
+	for (uint64_t i = 0; i < count; i++) {
+		free(ops[i].path);
+		free(ops[i].path2);
+	}
+	free(threads);
+	free(ops);
+	free(writeBuffer);
+	return 0;
+}
+
+/** Prints the options of the tool */
+void usage() {
+	printf("Usage: ./fsreplay [options] <log>\n");
+	printf("  -f <file>       volume to replay against, created and formatted if needed (replay.vol)\n");
+	printf("  -s <bytes>      size of a created volume (67108864)\n");
+	printf("  -b <bytes>      block size of a created volume (512)\n");
+	printf("  -t              start each operation at its recorded time instead of as fast as possible\n");
+	printf("  -p <threads>    replay threads (1)\n");
+	printf("  -o <file>       file every cpout writes to (replay.out)\n");
+	printf("  -d <mode>       durability, none, ordered or full (ordered)\n");
+	printf("  -j <file>       also write the results as JSON to the file\n");
+}
+
+/**
+ * Reads the options into the config, starting from the defaults.
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config where to store the settings
+ * @returns 1 if successful
+ * @returns 0 if an option is unknown or invalid
+ */
+int parseOptions(int argc, char** argv, ReplayConfig_p config) {
+	int option;
+
+	config->volumeFile = "replay.vol";
+	config->volumeSize = 64 * 1024 * 1024;
+	config->blockSize = 512;
+	config->timed = 0;
+	config->threads = 1;
+	config->outFile = "replay.out";
+	config->durability = DURABILITY_ORDERED;
+	config->durabilityName = "ordered";
+	config->jsonFile = NULL;
+
+	while ((option = getopt(argc, argv, "f:s:b:tp:o:d:j:h")) != -1) {
+		switch (option) {
+		case 'f': config->volumeFile = optarg; break;
+		case 's': config->volumeSize = strtoull(optarg, NULL, 10); break;
+		case 'b': config->blockSize = strtoull(optarg, NULL, 10); break;
+		case 't': config->timed = 1; break;
+		case 'p': config->threads = strtoul(optarg, NULL, 10); break;
+		case 'o': config->outFile = optarg; break;
+		case 'j': config->jsonFile = optarg; break;
+		case 'd':
+			config->durabilityName = optarg;
+			if (strcmp(optarg, "none") == 0)
+				config->durability = DURABILITY_NONE;
+			else if (strcmp(optarg, "ordered") == 0)
+				config->durability = DURABILITY_ORDERED;
+			else if (strcmp(optarg, "full") == 0)
+				config->durability = DURABILITY_FULL;
+			else
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	if (optind + 1 != argc)
+		return 0;
+	config->logFile = argv[optind];
+	return config->threads > 0;
+}
+
+/**
+ * Reads a path of an entry from the log
+ * @param log the log
+ * @param length the bytes of the path
+ * @param path where to store the path, NULL if the entry has none
+ * @returns 1 if successful
+ * @returns 0 if the log ended
+ */
+static int readPath(FILE* log, uint16_t length, char** path) {
+	*path = NULL;
+	if (length == 0)
+		return 1;
+	*path = malloc(length + 1);
+	(*path)[length] = '\0';
+	return fread(*path, length, 1, log) == 1;
+}
+
+/**
+ * Reads every operation of a log.
+ * @param fileName the log
+ * @param count where to store the number of operations
+ * @returns the operations in the order they were written, freed by the caller
+ * @returns NULL if the log could not be read
+ */
+ReplayOp_p loadLog(char* fileName, uint64_t* count) {
+	RecordHeader header;
+	FILE* log = fopen(fileName, "rb");
+	if (log == NULL) {
+		printf("Could not open %s\n", fileName);
+		return NULL;
+	}
+	if (fread(&header, sizeof(RecordHeader), 1, log) != 1 || header.magic != RECORD_MAGIC) {
+		printf("%s is not a log of operations\n", fileName);
+		fclose(log);
+		return NULL;
+	}
+	if (header.version != RECORD_VERSION) {
+		printf("%s is version %lu of the log format, not %d\n", fileName, header.version, RECORD_VERSION);
+		fclose(log);
+		return NULL;
+	}
+
+	uint64_t capacity = 1024;
+	ReplayOp_p ops = malloc(capacity * sizeof(ReplayOp));
+	*count = 0;
+	while (fread(&ops[*count].entry, sizeof(RecordEntry), 1, log) == 1) {
+		ReplayOp_p op = &ops[*count];
+		int whole = readPath(log, op->entry.pathLength, &op->path);
+		op->path2 = NULL;
+		if (whole)
+			whole = readPath(log, op->entry.path2Length, &op->path2);
+		if (!whole || op->entry.op >= FS_OP_COUNT) {
+			//A log cut short by a crash keeps every whole entry before the cut
+			printf("Ignoring the end of %s after %lu operations\n", fileName, *count);
+			free(op->path);
+			free(op->path2);
+			break;
+		}
+		op->index = (*count)++;
+		if (*count == capacity) {
+			capacity *= 2;
+			ops = realloc(ops, capacity * sizeof(ReplayOp));
+		}
+	}
+	fclose(log);
+	return ops;
+}
+
+/**
+ * Orders operations by when they started, then by their position in the log
+ * @param a the first operation
+ * @param b the second operation
+ * @returns negative, zero or positive as a is before, the same as or after b
+ */
+int compareOps(const void* a, const void* b) {
+	const ReplayOp* left = a;
+	const ReplayOp* right = b;
+	if (left->entry.start != right->entry.start)
+		return (left->entry.start > right->entry.start) - (left->entry.start < right->entry.start);
+	return (left->index > right->index) - (left->index < right->index);
+}
+
+/**
+ * Runs the operations of a replay thread in order, waiting for the recorded
+ * start of each when replaying with the recorded timing.
+ * @param arg the ReplayThread
+ * @returns NULL
+ */
+void* runThread(void* arg) {
+	ReplayThread_p thread = arg;
+
+	for (uint64_t i = 0; i < thread->count; i++) {
+		ReplayOp_p op = thread->ops[i];
+		if (config.timed) {
+			uint64_t now = benchNow();
+			if (replayStart + op->entry.start > now) {
+				uint64_t wait = replayStart + op->entry.start - now;
+				struct timespec sleep = { wait / 1000000000, wait % 1000000000 };
+				nanosleep(&sleep, NULL);
+			}
+		}
+
+		uint64_t syscalls = LBAsyscalls(fs_partition(vol));
+		uint64_t start = benchNow();
+		int failed = runOp(thread, op);
+		recordOp(&thread->phases[op->entry.op], start, failed);
+		thread->syscalls[op->entry.op] += LBAsyscalls(fs_partition(vol)) - syscalls;
+	}
+	return NULL;
+}
+
+/** Throws away an entry of a replayed listing */
+void ignoreEntry(DirEntry_p entry, Inode_p inode, void* arg) {
+}
+
+/**
+ * Runs one operation from the log.
+ * @param thread the replay thread running it
+ * @param op the operation
+ * @returns 1 if the operation failed
+ * @returns 0 if successful
+ */
+int runOp(ReplayThread_p thread, ReplayOp_p op) {
+	RecordEntry_p entry = &op->entry;
+	Inode inode;
+	int64_t bytes;
+
+	//Operations on a file descriptor whose open failed fail too
+	int fd = -1;
+	if (entry->fd >= 0 && entry->fd < MAX_OPEN_FILES)
+		fd = __atomic_load_n(&fdMap[entry->fd], __ATOMIC_ACQUIRE);
+
+	switch (entry->op) {
+	case FS_OP_FORMAT: return fs_format(vol, entry->size) != 0;
+	case FS_OP_MKDIR: return fs_mkdir(vol, op->path) < 0;
+	case FS_OP_MKFILE: return fs_mkfile(vol, op->path, entry->size) < 0;
+	case FS_OP_RMDIR: return fs_rmdir(vol, op->path) != 1;
+	case FS_OP_RM: return fs_rm(vol, op->path) < 0;
+	case FS_OP_CP: return fs_cp(vol, op->path, op->path2, entry->size) < 0;
+	case FS_OP_MV: return fs_mv(vol, op->path, op->path2) < 0;
+	case FS_OP_CPIN: return fs_cpin(vol, op->path, op->path2) < 0;
+	case FS_OP_CPOUT: return fs_cpout(vol, op->path, config.outFile) < 0;
+	case FS_OP_CD: return fs_cd(vol, op->path) < 0;
+	case FS_OP_LS: return fs_listdir(vol, fs_getcwd(vol), ignoreEntry, NULL) == -1;
+	case FS_OP_LISTDIR: return fs_listdir(vol, op->path, ignoreEntry, NULL) == -1;
+	case FS_OP_STAT: return fs_stat(vol, op->path, &inode) < 0;
+	case FS_OP_RESIZE: return fs_resize(vol, op->path, entry->size) < 0;
+	case FS_OP_RESERVE: return fs_reserve(vol, op->path, entry->size) < 0;
+	case FS_OP_SYNC: return fsSync(vol) == -1;
+	case FS_OP_OPEN:
+		fd = fileOpen(vol, op->path);
+		if (entry->fd >= 0 && entry->fd < MAX_OPEN_FILES)
+			__atomic_store_n(&fdMap[entry->fd], fd, __ATOMIC_RELEASE);
+		return fd == -1;
+	}
+
+	if (fd == -1)
+		return 1;
+	switch (entry->op) {
+	case FS_OP_CLOSE:
+		__atomic_store_n(&fdMap[entry->fd], -1, __ATOMIC_RELEASE);
+		return !fileClose(vol, fd);
+	case FS_OP_READ:
+		if (entry->flags & RECORD_ADVANCE)
+			bytes = fileRead(vol, fd, thread->readBuffer, entry->size);
+		else
+			bytes = filePread(vol, fd, thread->readBuffer, entry->size, entry->offset);
+		break;
+	case FS_OP_WRITE:
+		if (entry->flags & RECORD_ADVANCE)
+			bytes = fileWrite(vol, fd, writeBuffer, entry->size);
+		else
+			bytes = filePwrite(vol, fd, writeBuffer, entry->size, entry->offset);
+		break;
+	case FS_OP_SEEK: return !fileSeek(vol, fd, entry->offset, entry->size);
+	case FS_OP_FSYNC: return fileSync(vol, fd) == -1;
+	default: return 1;
+	}
+	if (bytes == -1)
+		return 1;
+	thread->phases[entry->op].bytes += bytes;
+	return 0;
+}
@@ -0,0 +1,583 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: fsserver.c
+*
+* Description: This file is a server that owns one volume and
+*	serves its files to other processes over a Unix domain
+*	socket, see FsClient.h for the protocol. Separate processes
+*	that mount the same volume file each keep their own superblock,
+*	bit vector and open files, which the range locks of fsLow can
+*	not keep in step, so processes that share a volume go through
+*	the server instead.
+*	One thread serves every connection, so the requests of all
+*	clients run one at a time against one set of in-memory state.
+*	It reads every request a client has sent, runs them in order
+*	and sends all their answers back in one write, so a client
+*	that pipelines and batches requests pays for few system calls.
+*	File descriptors belong to the connection that opened them and
+*	are closed when it disconnects. Paths are relative to the root.
+*
+*	Usage: ./fsserver [options]
+*	-f <file>		volume to serve, created and formatted if needed (server.vol)
+*	-s <bytes>		size of a created volume (67108864)
+*	-b <bytes>		block size of a created volume (512)
+*	-S <path>		socket to listen on, replaced if it exists (fsserver.sock)
+*	-c <clients>	most connections at once (64)
+*	-d <mode>		durability, none, ordered or full (ordered)
+****************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "FileSystem.h"
+#include "FsClient.h"
+
+#define READ_CHUNK 262144				//Most bytes read from a client at once
+#define OUTPUT_LIMIT (64 * 1024 * 1024)	//Answers waiting for a client before its requests stop being read
+
+/* Settings of a run of the server */
+typedef struct ServerConfig {
+	char* volumeFile;
+	uint64_t volumeSize;
+	uint64_t blockSize;
+	char* socketPath;
+	uint32_t maxClients;
+	int durability;
+} ServerConfig, *ServerConfig_p;
+
+/* A connected client */
+typedef struct ServerClient {
+	int socket;							//-1 if the slot is free
+	uint8_t* in;						//Bytes received and not yet run
+	uint64_t inLength;
+	uint64_t inCapacity;
+	uint8_t* out;						//Answers not yet sent
+	uint64_t outStart;					//First byte not yet sent
+	uint64_t outLength;
+	uint64_t outCapacity;
+	uint8_t owned[MAX_OPEN_FILES];		//File descriptors opened by the client
+} ServerClient, *ServerClient_p;
+
+/* An answer being built in the output of a client */
+typedef struct ServerReply {
+	ServerClient_p client;
+	uint64_t start;						//Where the FsResponse of the answer starts in out
+} ServerReply, *ServerReply_p;
+
+ServerConfig config;
+FsVolume_p vol;							//Volume being served
+volatile sig_atomic_t stopping = 0;		//Set by SIGINT or SIGTERM
+uint64_t requestsServed = 0;
+uint64_t clientsServed = 0;
+
+void usage();
+int parseOptions(int argc, char** argv, ServerConfig_p config);
+void stopServer(int signal);
+int openListener(char* socketPath);
+void acceptClient(int listener, ServerClient_p clients);
+void closeClient(ServerClient_p client);
+int readRequests(ServerClient_p client);
+int writeAnswers(ServerClient_p client);
+uint64_t runRequests(ServerClient_p client);
+int runRequest(ServerClient_p client, FsRequest_p request, char* path, uint8_t* data);
+uint8_t* beginReply(ServerReply_p reply, ServerClient_p client, uint64_t id, uint32_t capacity);
+void addReplyData(ServerReply_p reply, const void* data, uint32_t length);
+void endReply(ServerReply_p reply, int64_t result);
+void addEntry(DirEntry_p entry, Inode_p inode, void* arg);
+
+int main(int argc, char** argv) {
+	if (!parseOptions(argc, argv, &config)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	vol = fs_mount(config.volumeFile, &config.volumeSize, &config.blockSize, config.durability);
+	if (vol == NULL) {
+		printf("Error: opening partition %s\n", config.volumeFile);
+		exit(EXIT_FAILURE);
+	}
+	if (!check_fs(vol)) {
+		printf("Formatting %s\n", config.volumeFile);
+		if (fs_format(vol, DIR_FORMAT_COMPACT) != 0) {
+			printf("Format failed!\n");
+			fs_unmount(vol);
+			exit(EXIT_FAILURE);
+		}
+	}
+	startWriteback(vol, NULL);
+
+	int listener = openListener(config.socketPath);
+	if (listener == -1) {
+		printf("Could not listen on %s: %s\n", config.socketPath, strerror(errno));
+		fs_unmount(vol);
+		exit(EXIT_FAILURE);
+	}
+
+	//Stop cleanly on SIGINT or SIGTERM, and find out about closed clients from send instead of SIGPIPE
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stopServer;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	ServerClient_p clients = calloc(config.maxClients, sizeof(ServerClient));
+	struct pollfd* polls = calloc(config.maxClients + 1, sizeof(struct pollfd));
+	for (uint32_t i = 0; i < config.maxClients; i++)
+		clients[i].socket = -1;
+	printf("Serving %s on %s\n", config.volumeFile, config.socketPath);
+	fflush(stdout);
+
+	while (!stopping) {
+		//polls[0] is the listener, polls[i + 1] is client i
+		polls[0].fd = listener;
+		polls[0].events = POLLIN;
+		for (uint32_t i = 0; i < config.maxClients; i++) {
+			ServerClient_p client = &clients[i];
+			polls[i + 1].fd = client->socket;
+			polls[i + 1].events = 0;
+			if (client->socket == -1)
+				continue;
+			if (client->outLength - client->outStart < OUTPUT_LIMIT)
+				polls[i + 1].events |= POLLIN;
+			if (client->outLength > client->outStart)
+				polls[i + 1].events |= POLLOUT;
+		}
+		if (poll(polls, config.maxClients + 1, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			printf("poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		if (polls[0].revents & POLLIN)
+			acceptClient(listener, clients);
+		for (uint32_t i = 0; i < config.maxClients; i++) {
+			ServerClient_p client = &clients[i];
+			short revents = polls[i + 1].revents;
+			if (client->socket == -1 || revents == 0)
+				continue;
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				if (readRequests(client) == -1) {
+					closeClient(client);
+					continue;
+				}
+				requestsServed += runRequests(client);
+			}
+			if (client->outLength > client->outStart && writeAnswers(client) == -1)
+				closeClient(client);
+		}
+	}
+
+	for (uint32_t i = 0; i < config.maxClients; i++) {
+		if (clients[i].socket != -1)
+			closeClient(&clients[i]);
+	}
+	close(listener);
+	unlink(config.socketPath);
+	free(clients);
+	free(polls);
+	fs_unmount(vol);
+	printf("Served %lu requests from %lu clients\n", requestsServed, clientsServed);
+	return 0;
+}
+
+/** Prints the options of the server */
+void usage() {
+	printf("Usage: ./fsserver [options]\n");
+	printf("  -f <file>       volume to serve, created and formatted if needed (server.vol)\n");
+	printf("  -s <bytes>      size of a created volume (67108864)\n");
+	printf("  -b <bytes>      block size of a created volume (512)\n");
+	printf("  -S <path>       socket to listen on, replaced if it exists (%s)\n", FSP_DEFAULT_SOCKET);
+	printf("  -c <clients>    most connections at once (64)\n");
+	printf("  -d <mode>       durability, none, ordered or full (ordered)\n");
+}
+
+/**
+ * Reads the options into the config, starting from the defaults.
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config where to store the settings
+ * @returns 1 if successful
+ * @returns 0 if an option is not valid
+ */
+int parseOptions(int argc, char** argv, ServerConfig_p config) {
+	int option;
+
+	config->volumeFile = "server.vol";
+	config->volumeSize = 64 * 1024 * 1024;
+	config->blockSize = 512;
+	config->socketPath = FSP_DEFAULT_SOCKET;
+	config->maxClients = 64;
+	config->durability = DURABILITY_ORDERED;
+
+	while ((option = getopt(argc, argv, "f:s:b:S:c:d:h")) != -1) {
+		switch (option) {
+		case 'f': config->volumeFile = optarg; break;
+		case 's': config->volumeSize = strtoull(optarg, NULL, 10); break;
+		case 'b': config->blockSize = strtoull(optarg, NULL, 10); break;
+		case 'S': config->socketPath = optarg; break;
+		case 'c': config->maxClients = strtoul(optarg, NULL, 10); break;
+		case 'd':
+			if (strcmp(optarg, "none") == 0)
+				config->durability = DURABILITY_NONE;
+			else if (strcmp(optarg, "ordered") == 0)
+				config->durability = DURABILITY_ORDERED;
+			else if (strcmp(optarg, "full") == 0)
+				config->durability = DURABILITY_FULL;
+			else
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	return optind == argc && config->maxClients > 0;
+}
+
+/**
+ * Asks the server to stop, called on SIGINT or SIGTERM.
+ * @param signal the signal
+ */
+void stopServer(int signal) {
+	stopping = 1;
+}
+
+/**
+ * Makes the socket clients connect to.
+ * @param socketPath where to make the socket, replacing anything there
+ * @returns the listening socket
+ * @returns -1 if it could not be made
+ */
+int openListener(char* socketPath) {
+	struct sockaddr_un address;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1)
+		return -1;
+	unlink(socketPath);
+	if (bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listener, SOMAXCONN) == -1) {
+		close(listener);
+		return -1;
+	}
+	fcntl(listener, F_SETFL, O_NONBLOCK);
+	return listener;
+}
+
+/**
+ * Accepts a waiting connection into a free slot. Without a free slot the
+ * connection is closed right away.
+ * @param listener the listening socket
+ * @param clients the slots
+ */
+void acceptClient(int listener, ServerClient_p clients) {
+	int socket = accept(listener, NULL, NULL);
+	if (socket == -1)
+		return;
+
+	for (uint32_t i = 0; i < config.maxClients; i++) {
+		ServerClient_p client = &clients[i];
+		if (client->socket != -1)
+			continue;
+		fcntl(socket, F_SETFL, O_NONBLOCK);
+		client->socket = socket;
+		client->inLength = 0;
+		client->outStart = 0;
+		client->outLength = 0;
+		if (client->in == NULL) {
+			client->inCapacity = READ_CHUNK;
+			client->in = malloc(client->inCapacity);
+			client->outCapacity = READ_CHUNK;
+			client->out = malloc(client->outCapacity);
+		}
+		memset(client->owned, 0, sizeof(client->owned));
+		clientsServed++;
+		return;
+	}
+	close(socket);
+}
+
+/**
+ * Disconnects a client and closes the file descriptors it left open.
+ * Its buffers are kept for the next client of the slot.
+ * @param client the client
+ */
+void closeClient(ServerClient_p client) {
+	for (int fd = 0; fd < MAX_OPEN_FILES; fd++) {
+		if (client->owned[fd])
+			fileClose(vol, fd);
+	}
+	memset(client->owned, 0, sizeof(client->owned));
+	close(client->socket);
+	client->socket = -1;
+}
+
+/**
+ * Reads what the client has sent, at most READ_CHUNK bytes.
+ * @param client the client
+ * @returns 0 if successful, even if nothing was waiting
+ * @returns -1 if the client disconnected
+ */
+int readRequests(ServerClient_p client) {
+	if (client->inCapacity - client->inLength < READ_CHUNK) {
+		client->inCapacity = client->inLength + READ_CHUNK;
+		client->in = realloc(client->in, client->inCapacity);
+	}
+	ssize_t received = recv(client->socket, client->in + client->inLength, READ_CHUNK, 0);
+	if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	if (received <= 0)
+		return -1;
+	client->inLength += received;
+	return 0;
+}
+
+/**
+ * Sends as much of the client's answers as the socket takes.
+ * @param client the client
+ * @returns 0 if successful, even if some answers are left
+ * @returns -1 if the client disconnected
+ */
+int writeAnswers(ServerClient_p client) {
+	while (client->outStart < client->outLength) {
+		ssize_t sent = send(client->socket, client->out + client->outStart, client->outLength - client->outStart, MSG_NOSIGNAL);
+		if (sent == -1 && errno == EINTR)
+			continue;
+		if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (sent <= 0)
+			return -1;
+		client->outStart += sent;
+	}
+	client->outStart = 0;
+	client->outLength = 0;
+	return 0;
+}
+
+/**
+ * Runs every request the client has sent in full, in the order they were sent.
+ * A request that is not valid disconnects the client once the ones before it ran.
+ * @param client the client
+ * @returns the number of requests run
+ */
+uint64_t runRequests(ServerClient_p client) {
+	FsRequest request;
+	char path[MAX_PATH_NAME];
+	uint64_t position = 0;
+	uint64_t count = 0;
+
+	while (client->inLength - position >= sizeof(FsRequest)) {
+		memcpy(&request, client->in + position, sizeof(FsRequest));
+		if (request.pathLength >= MAX_PATH_NAME || request.dataLength > FSP_MAX_DATA) {
+			shutdown(client->socket, SHUT_RD);
+			break;
+		}
+		uint64_t length = sizeof(FsRequest) + request.pathLength + request.dataLength;
+		if (client->inLength - position < length)
+			break;
+		memcpy(path, client->in + position + sizeof(FsRequest), request.pathLength);
+		path[request.pathLength] = '\0';
+		runRequest(client, &request, path, client->in + position + sizeof(FsRequest) + request.pathLength);
+		position += length;
+		count++;
+	}
+
+	//Keep the start of a request that has not fully arrived
+	memmove(client->in, client->in + position, client->inLength - position);
+	client->inLength -= position;
+	return count;
+}
+
+/**
+ * Checks that a file descriptor was opened by the client.
+ * @param client the client
+ * @param fd the file descriptor
+ * @returns 1 if the client owns it
+ */
+static int ownsFile(ServerClient_p client, int32_t fd) {
+	return fd >= 0 && fd < MAX_OPEN_FILES && client->owned[fd];
+}
+
+/**
+ * Runs one request and adds its answer to the client's output.
+ * @param client the client that sent it
+ * @param request the request
+ * @param path the path of the request, empty if none
+ * @param data the data of the request
+ * @returns the result of the request
+ */
+int runRequest(ServerClient_p client, FsRequest_p request, char* path, uint8_t* data) {
+	ServerReply reply;
+	Inode inode;
+	int64_t result = -1;
+
+	switch (request->op) {
+	case FSP_OPEN:
+		beginReply(&reply, client, request->id, 0);
+		result = fileOpen(vol, path);
+		if (result >= 0)
+			client->owned[result] = 1;
+		break;
+	case FSP_CLOSE:
+		beginReply(&reply, client, request->id, 0);
+		if (ownsFile(client, request->fd) && fileClose(vol, request->fd)) {
+			client->owned[request->fd] = 0;
+			result = 0;
+		}
+		break;
+	case FSP_READ: {
+		uint64_t length = (request->size < FSP_MAX_DATA) ? request->size : FSP_MAX_DATA;
+		uint8_t* buffer = beginReply(&reply, client, request->id, length);
+		if (ownsFile(client, request->fd)) {
+			result = (request->offset < 0) ? fileRead(vol, request->fd, buffer, length)
+				: filePread(vol, request->fd, buffer, length, request->offset);
+		}
+		if (result > 0)
+			reply.client->outLength += result;
+		break;
+	}
+	case FSP_WRITE:
+		beginReply(&reply, client, request->id, 0);
+		if (ownsFile(client, request->fd)) {
+			result = (request->offset < 0) ? fileWrite(vol, request->fd, data, request->dataLength)
+				: filePwrite(vol, request->fd, data, request->dataLength, request->offset);
+		}
+		break;
+	case FSP_STAT:
+		beginReply(&reply, client, request->id, sizeof(Inode));
+		result = fs_stat(vol, path, &inode);
+		if (result == 0)
+			addReplyData(&reply, &inode, sizeof(Inode));
+		break;
+	case FSP_READDIR:
+		beginReply(&reply, client, request->id, 0);
+		result = fs_listdir(vol, path, addEntry, &reply);
+		if (result == -1)
+			client->outLength = reply.start + sizeof(FsResponse);
+		break;
+	case FSP_CREATE:
+		beginReply(&reply, client, request->id, 0);
+		result = (fs_mkfile(vol, path, request->size) == 0) ? 0 : -1;
+		break;
+	case FSP_MKDIR:
+		beginReply(&reply, client, request->id, 0);
+		result = (fs_mkdir(vol, path) == 0) ? 0 : -1;
+		break;
+	case FSP_REMOVE:
+		beginReply(&reply, client, request->id, 0);
+		result = (fs_rm(vol, path) == 0) ? 0 : -1;
+		break;
+	case FSP_RMDIR:
+		beginReply(&reply, client, request->id, 0);
+		result = (fs_rmdir(vol, path) == 1) ? 0 : -1;
+		break;
+	case FSP_FSYNC:
+		beginReply(&reply, client, request->id, 0);
+		if (ownsFile(client, request->fd))
+			result = fileSync(vol, request->fd);
+		break;
+	case FSP_SYNC:
+		beginReply(&reply, client, request->id, 0);
+		result = fsSync(vol);
+		break;
+	default:
+		beginReply(&reply, client, request->id, 0);
+		break;
+	}
+	endReply(&reply, result);
+	return result;
+}
+
+/**
+ * Starts an answer at the end of the client's output.
+ * @param reply the answer to start
+ * @param client the client it is for
+ * @param id the id of the request answered
+ * @param capacity the bytes of data to make room for
+ * @returns where the data of the answer goes
+ */
+uint8_t* beginReply(ServerReply_p reply, ServerClient_p client, uint64_t id, uint32_t capacity) {
+	FsResponse response;
+
+	reply->client = client;
+	reply->start = client->outLength;
+	if (client->outLength + sizeof(FsResponse) + capacity > client->outCapacity) {
+		while (client->outLength + sizeof(FsResponse) + capacity > client->outCapacity)
+			client->outCapacity *= 2;
+		client->out = realloc(client->out, client->outCapacity);
+	}
+	memset(&response, 0, sizeof(FsResponse));
+	response.id = id;
+	memcpy(client->out + client->outLength, &response, sizeof(FsResponse));
+	client->outLength += sizeof(FsResponse);
+	return client->out + client->outLength;
+}
+
+/**
+ * Adds data to the end of an answer, making room for it.
+ * @param reply the answer
+ * @param data the data
+ * @param length bytes of data
+ */
+void addReplyData(ServerReply_p reply, const void* data, uint32_t length) {
+	ServerClient_p client = reply->client;
+
+	if (client->outLength + length > client->outCapacity) {
+		while (client->outLength + length > client->outCapacity)
+			client->outCapacity *= 2;
+		client->out = realloc(client->out, client->outCapacity);
+	}
+	memcpy(client->out + client->outLength, data, length);
+	client->outLength += length;
+}
+
+/**
+ * Finishes an answer with its result and the length of the data added since it began.
+ * @param reply the answer
+ * @param result the result of the request
+ */
+void endReply(ServerReply_p reply, int64_t result) {
+	FsResponse_p response = (FsResponse_p)(reply->client->out + reply->start);
+	response->result = result;
+	response->dataLength = reply->client->outLength - reply->start - sizeof(FsResponse);
+}
+
+/**
+ * Adds an entry of a directory to a FSP_READDIR answer, see fs_listdir
+ * @param entry the directory entry
+ * @param inode the inode of the entry
+ * @param arg the answer
+ */
+void addEntry(DirEntry_p entry, Inode_p inode, void* arg) {
+	FsWireEntry wire;
+
+	memset(&wire, 0, sizeof(FsWireEntry));
+	wire.inodeID = entry->inodeID;
+	wire.size = (inode->type == DIRECTORY_TYPE) ? inode->size + inode->subtreeSize : inode->size;
+	wire.nameLength = strnlen(entry->name, MAX_NAME_SIZE);
+	wire.type = inode->type;
+	addReplyData(arg, &wire, sizeof(FsWireEntry));
+	addReplyData(arg, entry->name, wire.nameLength);
+}
@@ -0,0 +1,445 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: iobench.c
+*
+* Description: This file is a benchmark of moving file data
+*	through fileWrite and fileRead. For every block size it
+*	formats a fresh volume and makes one file for each region
+*	of the block map, since each region takes its own path:
+*	direct - the blocks pointed at by the inode
+*	indirect - the blocks pointed at by the single indirect block
+*	double - the blocks below the double indirect block
+*	Every I/O size then runs these phases over a span at the
+*	start of each region:
+*	seqwrite - overwrites the span in order
+*	seqread - reads the span in order
+*	randwrite - overwrites random I/O size slots of the span
+*	randread - reads random I/O size slots of the span
+*	The span is written once before the phases so every read
+*	and overwrite reaches allocated blocks.
+*
+*	Usage: ./iobench [options]
+*	-f <file>		volume to create, replaced if it exists (iobench.vol)
+*	-s <bytes>		volume size (134217728)
+*	-B <sizes>		comma separated block sizes (512,4096,65536)
+*	-i <sizes>		comma separated I/O sizes (512,4096,65536)
+*	-R <regions>	comma separated regions (direct,indirect,double)
+*	-p <phases>		comma separated phases (seqwrite,seqread,randwrite,randread)
+*	-n <ops>		operations in each phase (2000)
+*	-m <bytes>		largest span used in a region (8388608)
+*	-d <mode>		durability, none, ordered or full (none)
+*	-r <seed>		seed of the random offsets (1)
+*	-j <file>		also write the results as JSON to the file
+*	-k				keep the volume of the last block size afterwards
+*	Sizes may end in k for kilobytes.
+****************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileSystem.h"
+#include "Bench.h"
+
+#define MAX_SIZES 16					//Most block sizes or I/O sizes in one run
+#define NUM_REGIONS 3
+#define NUM_PATTERNS 4
+#define FILL_SIZE (1024 * 1024)			//Bytes written at a time when filling a span
+
+/* Settings of a run of the benchmark */
+typedef struct IoConfig {
+	char* volumeFile;
+	uint64_t volumeSize;
+	uint64_t blockSizes[MAX_SIZES];
+	uint32_t blockSizeCount;
+	char* blockSizeList;
+	uint64_t ioSizes[MAX_SIZES];
+	uint32_t ioSizeCount;
+	char* ioSizeList;
+	char* regions;
+	char* patterns;
+	uint64_t ops;
+	uint64_t maxSpan;
+	int durability;
+	char* durabilityName;
+	uint32_t seed;
+	char* jsonFile;
+	int keepVolume;
+} IoConfig, *IoConfig_p;
+
+const char* regionNames[NUM_REGIONS] = { "direct", "indirect", "double" };
+const char* patternNames[NUM_PATTERNS] = { "seqwrite", "seqread", "randwrite", "randread" };
+
+void usage();
+int parseOptions(int argc, char** argv, IoConfig_p config);
+uint32_t parseSizes(char* list, uint64_t* sizes);
+int listContains(const char* list, const char* name);
+void formatSize(char* text, uint64_t size);
+void regionBounds(uint32_t region, uint64_t blockSize, uint64_t* start, uint64_t* length);
+int fillSpan(FsVolume_p vol, int fd, uint64_t start, uint64_t span);
+void runPattern(FsVolume_p vol, BenchPhase_p phase, int fd, uint32_t pattern, uint64_t start, uint64_t span, uint64_t ioSize, uint64_t ops, uint8_t* buffer);
+
+int main(int argc, char** argv) {
+	IoConfig config;
+	BenchPhase_p phases = NULL;
+	uint32_t phaseCount = 0;
+	uint32_t phaseCapacity = 0;
+	char name[BENCH_NAME_SIZE];
+	char blockText[16];
+	char ioText[16];
+
+	if (!parseOptions(argc, argv, &config)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	srand(config.seed);
+
+	uint64_t largestIo = 0;
+	for (uint32_t i = 0; i < config.ioSizeCount; i++) {
+		if (config.ioSizes[i] > largestIo)
+			largestIo = config.ioSizes[i];
+	}
+	uint8_t* buffer = malloc((largestIo > FILL_SIZE) ? largestIo : FILL_SIZE);
+	for (uint64_t i = 0; i < ((largestIo > FILL_SIZE) ? largestIo : FILL_SIZE); i++)
+		buffer[i] = i * 31 + 7;
+
+	for (uint32_t b = 0; b < config.blockSizeCount; b++) {
+		uint64_t volumeSize = config.volumeSize;
+		uint64_t blockSize = config.blockSizes[b];
+
+		//Every block size starts from a fresh volume
+		if (unlink(config.volumeFile) == -1 && errno != ENOENT) {
+			printf("Could not replace %s\n", config.volumeFile);
+			exit(EXIT_FAILURE);
+		}
+		FsVolume_p vol = fs_mount(config.volumeFile, &volumeSize, &blockSize, config.durability);
+		if (vol == NULL) {
+			printf("Error: opening partition %s\n", config.volumeFile);
+			exit(EXIT_FAILURE);
+		}
+		if (fs_format(vol, DIR_FORMAT_COMPACT) != 0) {
+			printf("Format failed!\n");
+			fs_unmount(vol);
+			exit(EXIT_FAILURE);
+		}
+		startWriteback(vol, NULL);
+		formatSize(blockText, blockSize);
+
+		for (uint32_t region = 0; region < NUM_REGIONS; region++) {
+			if (!listContains(config.regions, regionNames[region]))
+				continue;
+
+			uint64_t regionStart;
+			uint64_t regionLength;
+			regionBounds(region, blockSize, &regionStart, &regionLength);
+			uint64_t span = (regionLength < config.maxSpan) ? regionLength : config.maxSpan;
+
+			fs_mkfile(vol, (char*)regionNames[region], 0);
+			int fd = fileOpen(vol, (char*)regionNames[region]);
+			if (fd == -1 || !fillSpan(vol, fd, regionStart, span)) {
+				printf("Could not fill the %s region with %s blocks, the volume may be too small\n", regionNames[region], blockText);
+				if (fd != -1)
+					fileClose(vol, fd);
+				continue;
+			}
+
+			for (uint32_t io = 0; io < config.ioSizeCount; io++) {
+				formatSize(ioText, config.ioSizes[io]);
+				if (config.ioSizes[io] > span) {
+					printf("Skipping %s I/O, the %s region only holds %lu bytes with %s blocks\n", ioText, regionNames[region], span, blockText);
+					continue;
+				}
+
+				for (uint32_t pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+					if (!listContains(config.patterns, patternNames[pattern]))
+						continue;
+					if (phaseCount == phaseCapacity) {
+						phaseCapacity = (phaseCapacity > 0) ? phaseCapacity * 2 : 16;
+						phases = realloc(phases, phaseCapacity * sizeof(BenchPhase));
+					}
+					snprintf(name, BENCH_NAME_SIZE, "%s/%s/%s/%s", blockText, regionNames[region], ioText, patternNames[pattern]);
+					beginPhase(&phases[phaseCount], fs_partition(vol), name, config.ops);
+					runPattern(vol, &phases[phaseCount], fd, pattern, regionStart, span, config.ioSizes[io], config.ops, buffer);
+					endPhase(&phases[phaseCount++]);
+				}
+			}
+			fileClose(vol, fd);
+		}
+
+		fs_unmount(vol);
+		if (!config.keepVolume || b + 1 < config.blockSizeCount)
+			unlink(config.volumeFile);
+	}
+
+	BenchParam params[] = {
+		{ "volume_size", NULL, config.volumeSize },
+		{ "block_sizes", config.blockSizeList, 0 },
+		{ "io_sizes", config.ioSizeList, 0 },
+		{ "ops_per_phase", NULL, config.ops },
+		{ "max_span", NULL, config.maxSpan },
+		{ "durability", config.durabilityName, 0 },
+		{ "seed", NULL, config.seed }
+	};
+	uint32_t paramCount = sizeof(params) / sizeof(BenchParam);
+	printf("\n");
+	printBenchText(stdout, params, paramCount, phases, phaseCount);
+	if (config.jsonFile != NULL) {
+		FILE* json = fopen(config.jsonFile, "w");
+		if (json == NULL) {
+			printf("Could not open %s\n", config.jsonFile);
+		} else {
+			printBenchJson(json, "iobench", params, paramCount, phases, phaseCount);
+			fclose(json);
+		}
+	}
+
+	for (uint32_t i = 0; i < phaseCount; i++)
+		freePhase(&phases[i]);
+	free(phases);
+	free(buffer);
+	return 0;
+}
+
+/** Prints the options of the benchmark */
+void usage() {
+	printf("Usage: ./iobench [options]\n");
+	printf("  -f <file>     volume to create, replaced if it exists (iobench.vol)\n");
+	printf("  -s <bytes>    volume size (134217728)\n");
+	printf("  -B <sizes>    block sizes (512,4096,65536)\n");
+	printf("  -i <sizes>    I/O sizes (512,4096,65536)\n");
+	printf("  -R <regions>  regions of the block map (direct,indirect,double)\n");
+	printf("  -p <phases>   phases (seqwrite,seqread,randwrite,randread)\n");
+	printf("  -n <ops>      operations in each phase (2000)\n");
+	printf("  -m <bytes>    largest span used in a region (8388608)\n");
+	printf("  -d <mode>     durability, none, ordered or full (none)\n");
+	printf("  -r <seed>     seed of the random offsets (1)\n");
+	printf("  -j <file>     also write the results as JSON to the file\n");
+	printf("  -k            keep the volume of the last block size afterwards\n");
+	printf("Sizes may end in k for kilobytes.\n");
+}
+
+/**
+ * Reads the options into the config, starting from the defaults.
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config where to store the settings
+ * @returns 1 if successful
+ * @returns 0 if an option is unknown or invalid
+ */
+int parseOptions(int argc, char** argv, IoConfig_p config) {
+	int option;
+
+	config->volumeFile = "iobench.vol";
+	config->volumeSize = 128 * 1024 * 1024;
+	config->blockSizeList = "512,4096,65536";
+	config->ioSizeList = "512,4096,65536";
+	config->regions = "direct,indirect,double";
+	config->patterns = "seqwrite,seqread,randwrite,randread";
+	config->ops = 2000;
+	config->maxSpan = 8 * 1024 * 1024;
+	config->durability = DURABILITY_NONE;
+	config->durabilityName = "none";
+	config->seed = 1;
+	config->jsonFile = NULL;
+	config->keepVolume = 0;
+
+	while ((option = getopt(argc, argv, "f:s:B:i:R:p:n:m:d:r:j:kh")) != -1) {
+		switch (option) {
+		case 'f': config->volumeFile = optarg; break;
+		case 's': config->volumeSize = strtoull(optarg, NULL, 10); break;
+		case 'B': config->blockSizeList = optarg; break;
+		case 'i': config->ioSizeList = optarg; break;
+		case 'R': config->regions = optarg; break;
+		case 'p': config->patterns = optarg; break;
+		case 'n': config->ops = strtoull(optarg, NULL, 10); break;
+		case 'm': config->maxSpan = strtoull(optarg, NULL, 10); break;
+		case 'r': config->seed = strtoul(optarg, NULL, 10); break;
+		case 'j': config->jsonFile = optarg; break;
+		case 'k': config->keepVolume = 1; break;
+		case 'd':
+			config->durabilityName = optarg;
+			if (strcmp(optarg, "none") == 0)
+				config->durability = DURABILITY_NONE;
+			else if (strcmp(optarg, "ordered") == 0)
+				config->durability = DURABILITY_ORDERED;
+			else if (strcmp(optarg, "full") == 0)
+				config->durability = DURABILITY_FULL;
+			else
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	if (optind < argc || config->ops == 0 || config->maxSpan == 0)
+		return 0;
+
+	config->blockSizeCount = parseSizes(config->blockSizeList, config->blockSizes);
+	config->ioSizeCount = parseSizes(config->ioSizeList, config->ioSizes);
+	if (config->blockSizeCount == 0 || config->ioSizeCount == 0)
+		return 0;
+
+	//Every region and phase named must be known
+	const char* lists[2] = { config->regions, config->patterns };
+	const char** names[2] = { regionNames, patternNames };
+	uint32_t counts[2] = { NUM_REGIONS, NUM_PATTERNS };
+	int valid = 1;
+	for (uint32_t l = 0; l < 2; l++) {
+		char* list = strdup(lists[l]);
+		for (char* token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+			int known = 0;
+			for (uint32_t i = 0; i < counts[l]; i++) {
+				if (strcmp(token, names[l][i]) == 0)
+					known = 1;
+			}
+			if (!known) {
+				printf("Unknown %s %s\n", (l == 0) ? "region" : "phase", token);
+				valid = 0;
+			}
+		}
+		free(list);
+	}
+	return valid;
+}
+
+/**
+ * Reads a comma separated list of sizes, each optionally ending in k.
+ * @param list the list to read
+ * @param sizes where to store the sizes, at most MAX_SIZES
+ * @returns the number of sizes read
+ * @returns 0 if a size is not valid or there are too many
+ */
+uint32_t parseSizes(char* list, uint64_t* sizes) {
+	char* copy = strdup(list);
+	uint32_t count = 0;
+	char* end;
+
+	for (char* token = strtok(copy, ","); token != NULL; token = strtok(NULL, ",")) {
+		uint64_t size = strtoull(token, &end, 10);
+		if (*end == 'k' || *end == 'K') {
+			size *= 1024;
+			end++;
+		}
+		if (*end != '\0' || size == 0 || count == MAX_SIZES) {
+			printf("Invalid size list %s\n", list);
+			free(copy);
+			return 0;
+		}
+		sizes[count++] = size;
+	}
+	free(copy);
+	return count;
+}
+
+/**
+ * Returns whether a comma separated list contains the name
+ * @param list the list to search
+ * @param name the name to find
+ * @returns 1 if found
+ * @returns 0 if not found
+ */
+int listContains(const char* list, const char* name) {
+	char* copy = strdup(list);
+	int found = 0;
+	for (char* token = strtok(copy, ","); token != NULL; token = strtok(NULL, ",")) {
+		if (strcmp(token, name) == 0)
+			found = 1;
+	}
+	free(copy);
+	return found;
+}
+
+/**
+ * Writes a size in bytes as text, in kilobytes when it is a whole number of them
+ * @param text where to write the size, at least 16 bytes
+ * @param size the size in bytes
+ */
+void formatSize(char* text, uint64_t size) {
+	if (size >= 1024 && size % 1024 == 0)
+		snprintf(text, 16, "%luk", size / 1024);
+	else
+		snprintf(text, 16, "%lu", size);
+}
+
+/**
+ * Finds the byte range of a file mapped by a region of the block map
+ * @param region 0 for the direct blocks, 1 for single indirect, 2 for double indirect
+ * @param blockSize the block size of the volume
+ * @param start where to store the first byte of the region
+ * @param length where to store the number of bytes in the region
+ */
+void regionBounds(uint32_t region, uint64_t blockSize, uint64_t* start, uint64_t* length) {
+	uint64_t pointers = blockSize / sizeof(uint64_t);
+
+	if (region == 0) {
+		*start = 0;
+		*length = NUM_DIRECT * blockSize;
+	} else if (region == 1) {
+		*start = NUM_DIRECT * blockSize;
+		*length = pointers * blockSize;
+	} else {
+		*start = (NUM_DIRECT + pointers) * blockSize;
+		*length = pointers * pointers * blockSize;
+	}
+}
+
+/**
+ * Writes the span once so the phases reach allocated blocks.
+ * @param vol the volume holding the file
+ * @param fd the file descriptor of the file
+ * @param start the first byte of the span
+ * @param span the number of bytes in the span
+ * @returns 1 if successful
+ * @returns 0 if the span could not be written
+ */
+int fillSpan(FsVolume_p vol, int fd, uint64_t start, uint64_t span) {
+	uint8_t* buffer = calloc(1, FILL_SIZE);
+
+	fileSeek(vol, fd, start, FS_SEEK_SET);
+	for (uint64_t written = 0; written < span; written += FILL_SIZE) {
+		uint64_t length = (span - written < FILL_SIZE) ? span - written : FILL_SIZE;
+		if (fileWrite(vol, fd, buffer, length) != length) {
+			free(buffer);
+			return 0;
+		}
+	}
+	free(buffer);
+	return 1;
+}
+
+/**
+ * Runs one access pattern over the span, one I/O size slot at a time.
+ * @param vol the volume holding the file
+ * @param phase the phase recording the operations
+ * @param fd the file descriptor of the file
+ * @param pattern the index of the pattern in patternNames
+ * @param start the first byte of the span
+ * @param span the number of bytes in the span
+ * @param ioSize the bytes moved by each operation
+ * @param ops the number of operations
+ * @param buffer the data written, or where data is read to
+ */
+void runPattern(FsVolume_p vol, BenchPhase_p phase, int fd, uint32_t pattern, uint64_t start, uint64_t span, uint64_t ioSize, uint64_t ops, uint8_t* buffer) {
+	uint64_t slots = span / ioSize;
+	int writing = (pattern == 0 || pattern == 2);
+	int random = (pattern >= 2);
+
+	for (uint64_t i = 0; i < ops; i++) {
+		uint64_t slot = random ? ((uint64_t)rand() * RAND_MAX + rand()) % slots : i % slots;
+		uint64_t opStart = benchNow();
+		int64_t moved = -1;
+		if (fileSeek(vol, fd, start + slot * ioSize, FS_SEEK_SET))
+			moved = writing ? fileWrite(vol, fd, buffer, ioSize) : fileRead(vol, fd, buffer, ioSize);
+		recordOp(phase, opStart, moved != ioSize);
+		if (moved > 0)
+			phase->bytes += moved;
+	}
+}
@@ -0,0 +1,374 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: mdbench.c
+*
+* Description: This file is a benchmark of the metadata operations
+*	of the file system. It formats a fresh volume, builds a tree
+*	of directories and runs these phases over the files spread
+*	across the directories at the bottom of the tree:
+*	mkdir - creates every directory of the tree
+*	create - creates every file
+*	stat - looks up every file in a shuffled order
+*	list - lists every directory at the bottom of the tree
+*	rename - renames every file within its directory
+*	remove - deletes every file
+*
+*	Usage: ./mdbench [options]
+*	-f <file>		volume to create, replaced if it exists (mdbench.vol)
+*	-s <bytes>		volume size (67108864)
+*	-b <bytes>		block size (512)
+*	-n <files>		number of files (10000)
+*	-w <dirs>		directories made in each directory of the tree (16)
+*	-l <levels>		levels of directories in the tree (1)
+*	-d <mode>		durability, none, ordered or full (none)
+*	-p <phases>		comma separated phases to run after mkdir and create (stat,list,rename,remove)
+*	-r <seed>		seed of the stat order (1)
+*	-x				use fixed size directory entries
+*	-j <file>		also write the results as JSON to the file
+*	-k				keep the volume afterwards
+****************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileSystem.h"
+#include "Bench.h"
+
+#define MAX_LEAF_DIRECTORIES (1 << 20)	//Most directories at the bottom of the tree
+#define MAX_PHASES 6
+#define BENCH_PATH_SIZE 256				//Max size of a path made by the benchmark
+
+/* Settings of a run of the benchmark */
+typedef struct MdConfig {
+	char* volumeFile;
+	uint64_t volumeSize;
+	uint64_t blockSize;
+	uint64_t files;
+	uint64_t width;
+	uint64_t levels;
+	int durability;
+	char* durabilityName;
+	char* phases;
+	uint32_t seed;
+	uint8_t directoryFormat;
+	char* jsonFile;
+	int keepVolume;
+} MdConfig, *MdConfig_p;
+
+void usage();
+int parseOptions(int argc, char** argv, MdConfig_p config);
+int phaseSelected(MdConfig_p config, const char* name);
+void filePath(char* path, char** leaves, uint64_t leafCount, const char* prefix, uint64_t file);
+void countEntry(DirEntry_p entry, Inode_p inode, void* arg);
+
+int main(int argc, char** argv) {
+	MdConfig config;
+	BenchPhase phases[MAX_PHASES];
+	uint32_t phaseCount = 0;
+	char path[BENCH_PATH_SIZE];
+	char newPath[BENCH_PATH_SIZE];
+	uint64_t start;
+
+	if (!parseOptions(argc, argv, &config)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	//Count the directories at the bottom of the tree
+	uint64_t leafCount = 1;
+	for (uint64_t i = 0; i < config.levels; i++) {
+		leafCount *= config.width;
+		if (leafCount > MAX_LEAF_DIRECTORIES) {
+			printf("The tree can not have more than %d directories at the bottom\n", MAX_LEAF_DIRECTORIES);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	//Start from a fresh volume
+	if (unlink(config.volumeFile) == -1 && errno != ENOENT) {
+		printf("Could not replace %s\n", config.volumeFile);
+		exit(EXIT_FAILURE);
+	}
+	FsVolume_p vol = fs_mount(config.volumeFile, &config.volumeSize, &config.blockSize, config.durability);
+	if (vol == NULL) {
+		printf("Error: opening partition %s\n", config.volumeFile);
+		exit(EXIT_FAILURE);
+	}
+	if (fs_format(vol, config.directoryFormat) != 0) {
+		printf("Format failed!\n");
+		fs_unmount(vol);
+		exit(EXIT_FAILURE);
+	}
+	startWriteback(vol, NULL);
+
+	//Make the tree a level at a time, each level holding the paths of the one before
+	uint64_t totalDirectories = 0;
+	uint64_t levelSize = 1;
+	for (uint64_t i = 0; i < config.levels; i++) {
+		levelSize *= config.width;
+		totalDirectories += levelSize;
+	}
+	char** leaves = malloc(sizeof(char*));
+	leaves[0] = strdup("");
+	uint64_t parentCount = 1;
+	beginPhase(&phases[phaseCount], fs_partition(vol), "mkdir", totalDirectories);
+	for (uint64_t level = 0; level < config.levels; level++) {
+		char** children = malloc(parentCount * config.width * sizeof(char*));
+		for (uint64_t parent = 0; parent < parentCount; parent++) {
+			for (uint64_t child = 0; child < config.width; child++) {
+				snprintf(path, BENCH_PATH_SIZE, "%s%sd%lu", leaves[parent], (level > 0) ? "/" : "", child);
+				children[parent * config.width + child] = strdup(path);
+				start = benchNow();
+				int result = fs_mkdir(vol, path);
+				recordOp(&phases[phaseCount], start, result != 0);
+			}
+			free(leaves[parent]);
+		}
+		free(leaves);
+		leaves = children;
+		parentCount *= config.width;
+	}
+	endPhase(&phases[phaseCount++]);
+
+	beginPhase(&phases[phaseCount], fs_partition(vol), "create", config.files);
+	for (uint64_t i = 0; i < config.files; i++) {
+		filePath(path, leaves, leafCount, "f", i);
+		start = benchNow();
+		int result = fs_mkfile(vol, path, 0);
+		recordOp(&phases[phaseCount], start, result != 0);
+	}
+	endPhase(&phases[phaseCount++]);
+
+	//Look the files up in a shuffled order so each lookup starts cold in its directory
+	if (phaseSelected(&config, "stat")) {
+		uint64_t* order = malloc(config.files * sizeof(uint64_t));
+		Inode inode;
+		srand(config.seed);
+		for (uint64_t i = 0; i < config.files; i++)
+			order[i] = i;
+		for (uint64_t i = config.files; i > 1; i--) {
+			uint64_t j = ((uint64_t)rand() * RAND_MAX + rand()) % i;
+			uint64_t swap = order[i - 1];
+			order[i - 1] = order[j];
+			order[j] = swap;
+		}
+
+		beginPhase(&phases[phaseCount], fs_partition(vol), "stat", config.files);
+		for (uint64_t i = 0; i < config.files; i++) {
+			filePath(path, leaves, leafCount, "f", order[i]);
+			start = benchNow();
+			int result = fs_stat(vol, path, &inode);
+			recordOp(&phases[phaseCount], start, result != 0);
+		}
+		endPhase(&phases[phaseCount++]);
+		free(order);
+	}
+
+	if (phaseSelected(&config, "list")) {
+		uint64_t entries = 0;
+		beginPhase(&phases[phaseCount], fs_partition(vol), "list", leafCount);
+		for (uint64_t i = 0; i < leafCount; i++) {
+			start = benchNow();
+			int64_t result = fs_listdir(vol, leaves[i], countEntry, &entries);
+			recordOp(&phases[phaseCount], start, result == -1);
+		}
+		endPhase(&phases[phaseCount++]);
+	}
+
+	const char* prefix = "f";
+	if (phaseSelected(&config, "rename")) {
+		beginPhase(&phases[phaseCount], fs_partition(vol), "rename", config.files);
+		for (uint64_t i = 0; i < config.files; i++) {
+			filePath(path, leaves, leafCount, "f", i);
+			filePath(newPath, leaves, leafCount, "r", i);
+			start = benchNow();
+			int result = fs_mv(vol, path, newPath);
+			recordOp(&phases[phaseCount], start, result != 0);
+		}
+		endPhase(&phases[phaseCount++]);
+		prefix = "r";
+	}
+
+	if (phaseSelected(&config, "remove")) {
+		beginPhase(&phases[phaseCount], fs_partition(vol), "remove", config.files);
+		for (uint64_t i = 0; i < config.files; i++) {
+			filePath(path, leaves, leafCount, prefix, i);
+			start = benchNow();
+			int result = fs_rm(vol, path);
+			recordOp(&phases[phaseCount], start, result != 0);
+		}
+		endPhase(&phases[phaseCount++]);
+	}
+
+	fs_unmount(vol);
+	if (!config.keepVolume)
+		unlink(config.volumeFile);
+
+	BenchParam params[] = {
+		{ "volume_size", NULL, config.volumeSize },
+		{ "block_size", NULL, config.blockSize },
+		{ "files", NULL, config.files },
+		{ "width", NULL, config.width },
+		{ "levels", NULL, config.levels },
+		{ "leaf_directories", NULL, leafCount },
+		{ "durability", config.durabilityName, 0 },
+		{ "directory_format", (config.directoryFormat == DIR_FORMAT_FIXED) ? "fixed" : "compact", 0 },
+		{ "seed", NULL, config.seed }
+	};
+	uint32_t paramCount = sizeof(params) / sizeof(BenchParam);
+	printf("\n");
+	printBenchText(stdout, params, paramCount, phases, phaseCount);
+	if (config.jsonFile != NULL) {
+		FILE* json = fopen(config.jsonFile, "w");
+		if (json == NULL) {
+			printf("Could not open %s\n", config.jsonFile);
+		} else {
+			printBenchJson(json, "mdbench", params, paramCount, phases, phaseCount);
+			fclose(json);
+		}
+	}
+
+	for (uint32_t i = 0; i < phaseCount; i++)
+		freePhase(&phases[i]);
+	for (uint64_t i = 0; i < leafCount; i++)
+		free(leaves[i]);
+	free(leaves);
+	return 0;
+}
+
+/** Prints the options of the benchmark */
+void usage() {
+	printf("Usage: ./mdbench [options]\n");
+	printf("  -f <file>     volume to create, replaced if it exists (mdbench.vol)\n");
+	printf("  -s <bytes>    volume size (67108864)\n");
+	printf("  -b <bytes>    block size (512)\n");
+	printf("  -n <files>    number of files (10000)\n");
+	printf("  -w <dirs>     directories made in each directory of the tree (16)\n");
+	printf("  -l <levels>   levels of directories in the tree (1)\n");
+	printf("  -d <mode>     durability, none, ordered or full (none)\n");
+	printf("  -p <phases>   phases to run after mkdir and create (stat,list,rename,remove)\n");
+	printf("  -r <seed>     seed of the stat order (1)\n");
+	printf("  -x            use fixed size directory entries\n");
+	printf("  -j <file>     also write the results as JSON to the file\n");
+	printf("  -k            keep the volume afterwards\n");
+}
+
+/**
+ * Reads the options into the config, starting from the defaults.
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config where to store the settings
+ * @returns 1 if successful
+ * @returns 0 if an option is unknown or invalid
+ */
+int parseOptions(int argc, char** argv, MdConfig_p config) {
+	int option;
+
+	config->volumeFile = "mdbench.vol";
+	config->volumeSize = 64 * 1024 * 1024;
+	config->blockSize = 512;
+	config->files = 10000;
+	config->width = 16;
+	config->levels = 1;
+	config->durability = DURABILITY_NONE;
+	config->durabilityName = "none";
+	config->phases = "stat,list,rename,remove";
+	config->seed = 1;
+	config->directoryFormat = DIR_FORMAT_COMPACT;
+	config->jsonFile = NULL;
+	config->keepVolume = 0;
+
+	while ((option = getopt(argc, argv, "f:s:b:n:w:l:d:p:r:xj:kh")) != -1) {
+		switch (option) {
+		case 'f': config->volumeFile = optarg; break;
+		case 's': config->volumeSize = strtoull(optarg, NULL, 10); break;
+		case 'b': config->blockSize = strtoull(optarg, NULL, 10); break;
+		case 'n': config->files = strtoull(optarg, NULL, 10); break;
+		case 'w': config->width = strtoull(optarg, NULL, 10); break;
+		case 'l': config->levels = strtoull(optarg, NULL, 10); break;
+		case 'p': config->phases = optarg; break;
+		case 'r': config->seed = strtoul(optarg, NULL, 10); break;
+		case 'x': config->directoryFormat = DIR_FORMAT_FIXED; break;
+		case 'j': config->jsonFile = optarg; break;
+		case 'k': config->keepVolume = 1; break;
+		case 'd':
+			config->durabilityName = optarg;
+			if (strcmp(optarg, "none") == 0)
+				config->durability = DURABILITY_NONE;
+			else if (strcmp(optarg, "ordered") == 0)
+				config->durability = DURABILITY_ORDERED;
+			else if (strcmp(optarg, "full") == 0)
+				config->durability = DURABILITY_FULL;
+			else
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	if (optind < argc || config->width == 0 || config->levels == 0)
+		return 0;
+
+	//Every phase named must be known
+	char* phases = strdup(config->phases);
+	int valid = 1;
+	for (char* token = strtok(phases, ","); token != NULL; token = strtok(NULL, ",")) {
+		if (strcmp(token, "stat") != 0 && strcmp(token, "list") != 0
+				&& strcmp(token, "rename") != 0 && strcmp(token, "remove") != 0) {
+			printf("Unknown phase %s\n", token);
+			valid = 0;
+		}
+	}
+	free(phases);
+	return valid;
+}
+
+/**
+ * Returns whether the phase was chosen with -p
+ * @param config the settings of the run
+ * @param name the name of the phase
+ * @returns 1 if the phase runs
+ * @returns 0 if it does not
+ */
+int phaseSelected(MdConfig_p config, const char* name) {
+	char* phases = strdup(config->phases);
+	int found = 0;
+	for (char* token = strtok(phases, ","); token != NULL; token = strtok(NULL, ",")) {
+		if (strcmp(token, name) == 0)
+			found = 1;
+	}
+	free(phases);
+	return found;
+}
+
+/**
+ * Makes the path of a file. Files are spread across the directories at the
+ * bottom of the tree in turn.
+ * @param path where to store the path
+ * @param leaves the paths of the directories at the bottom of the tree
+ * @param leafCount the number of directories at the bottom of the tree
+ * @param prefix the start of the file's name
+ * @param file the number of the file
+ */
+void filePath(char* path, char** leaves, uint64_t leafCount, const char* prefix, uint64_t file) {
+	snprintf(path, BENCH_PATH_SIZE, "%s/%s%lu", leaves[file % leafCount], prefix, file);
+}
+
+/**
+ * Counts an entry listed by fs_listdir
+ * @param entry the directory entry
+ * @param inode the inode of the entry
+ * @param arg the count to add to
+ */
+void countEntry(DirEntry_p entry, Inode_p inode, void* arg) {
+	(*(uint64_t*)arg)++;
+}
@@ -0,0 +1,324 @@
+/***************************************************************
+* Class: CSC-415-03 Spring 2020
+* Group Name: Zeta 3
+* Name: Dale Armstrong
+* StudentID: 920649883
+*
+* Project: Assignment 3 - File System
+* @file: traceview.c
+*
+* Description: This file analyzes a trace of the reads and writes
+*	of a volume, written by the trace dump command of the driver
+*	or by LBAtraceDump. It reports:
+*	- the calls, blocks and latency of each caller tag, and how
+*	  much of the I/O was metadata instead of file data
+*	- a histogram of the seek distance between consecutive calls
+*	- a heatmap of the blocks read and written in each region
+*	  of the volume
+*
+*	Usage: ./traceview [-r <regions>] <trace file>
+*	-r <regions>	regions of the volume in the heatmap (32)
+****************************************************************/
+
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsLow.h"
+
+#define SEEK_BUCKETS 48					//Power of two buckets of the seek distances
+#define BAR_WIDTH 30					//Widest bar of the heatmap
+
+const char* tagNames[LBA_TAG_COUNT] = { "other", "super", "inode", "bitmap", "indirect", "directory", "data" };
+
+/* Totals of the calls made for one caller tag */
+typedef struct TagTotals {
+	uint64_t reads;						//Reads and copies out
+	uint64_t readBlocks;
+	uint64_t writes;					//Writes and copies in
+	uint64_t writeBlocks;
+	uint64_t syncs;
+	uint64_t latency;					//Nanoseconds taken by every call
+} TagTotals, *TagTotals_p;
+
+void usage();
+traceRecord_t* loadTrace(char* fileName, traceHeader_t* header);
+void printTags(traceHeader_t* header, traceRecord_t* records);
+void printSeeks(traceHeader_t* header, traceRecord_t* records);
+void printHeatmap(traceHeader_t* header, traceRecord_t* records, uint64_t regions);
+void printBar(uint64_t value, uint64_t max);
+uint32_t distanceBucket(uint64_t distance);
+
+int main(int argc, char** argv) {
+	traceHeader_t header;
+	uint64_t regions = 32;
+	int option;
+
+	while ((option = getopt(argc, argv, "r:h")) != -1) {
+		switch (option) {
+		case 'r': regions = strtoull(optarg, NULL, 10); break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind + 1 != argc || regions == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	traceRecord_t* records = loadTrace(argv[optind], &header);
+	if (records == NULL)
+		exit(EXIT_FAILURE);
+
+	uint16_t threads = 0;
+	uint64_t start = 0;
+	uint64_t end = 0;
+	for (uint64_t i = 0; i < header.recordCount; i++) {
+		if (records[i].thread >= threads)
+			threads = records[i].thread + 1;
+		if (i == 0 || records[i].timestamp < start)
+			start = records[i].timestamp;
+		if (records[i].timestamp + records[i].latency > end)
+			end = records[i].timestamp + records[i].latency;
+	}
+	printf("Block size:         %lu\n", header.blockSize);
+	printf("Blocks:             %lu\n", header.numberOfBlocks);
+	printf("Records:            %lu\n", header.recordCount);
+	printf("Dropped:            %lu\n", header.dropped);
+	printf("Threads:            %u\n", threads);
+	printf("Duration:           %.3f ms\n", (end - start) / 1e6);
+
+	printTags(&header, records);
+	printSeeks(&header, records);
+	printHeatmap(&header, records, regions);
+	free(records);
+	return 0;
+}
+
+/** Prints the options of the analyzer */
+void usage() {
+	printf("Usage: ./traceview [-r <regions>] <trace file>\n");
+	printf("  -r <regions>  regions of the volume in the heatmap (32)\n");
+}
+
+/**
+ * Reads a trace dump.
+ * @param fileName the trace dump
+ * @param header where to store the header of the dump
+ * @returns the records, freed by the caller
+ * @returns NULL if the file could not be read or is not a trace dump
+ */
+traceRecord_t* loadTrace(char* fileName, traceHeader_t* header) {
+	FILE* file = fopen(fileName, "rb");
+	if (file == NULL) {
+		printf("Could not open %s\n", fileName);
+		return NULL;
+	}
+	if (fread(header, sizeof(traceHeader_t), 1, file) != 1 || header->magic != LBA_TRACE_MAGIC) {
+		printf("%s is not a trace dump\n", fileName);
+		fclose(file);
+		return NULL;
+	}
+	if (header->version != LBA_TRACE_VERSION) {
+		printf("%s is version %lu of the trace format, not %d\n", fileName, header->version, LBA_TRACE_VERSION);
+		fclose(file);
+		return NULL;
+	}
+
+	traceRecord_t* records = malloc((header->recordCount > 0 ? header->recordCount : 1) * sizeof(traceRecord_t));
+	if (fread(records, sizeof(traceRecord_t), header->recordCount, file) != header->recordCount) {
+		printf("%s is shorter than its header says\n", fileName);
+		free(records);
+		records = NULL;
+	}
+	fclose(file);
+	return records;
+}
+
+/**
+ * Prints the calls, blocks and latency of each caller tag, and how the
+ * metadata compares to the file data.
+ * @param header the header of the dump
+ * @param records the records of the dump
+ */
+void printTags(traceHeader_t* header, traceRecord_t* records) {
+	TagTotals tags[LBA_TAG_COUNT];
+
+	memset(tags, 0, sizeof(tags));
+	for (uint64_t i = 0; i < header->recordCount; i++) {
+		traceRecord_t* record = &records[i];
+		TagTotals_p totals = &tags[(record->tag < LBA_TAG_COUNT) ? record->tag : LBA_TAG_OTHER];
+		if (record->op == LBA_TRACE_READ || record->op == LBA_TRACE_COPYOUT) {
+			totals->reads++;
+			totals->readBlocks += record->count;
+		} else if (record->op == LBA_TRACE_WRITE || record->op == LBA_TRACE_COPYIN) {
+			totals->writes++;
+			totals->writeBlocks += record->count;
+		} else {
+			totals->syncs++;
+		}
+		totals->latency += record->latency;
+	}
+
+	printf("\n  %-9s %10s %12s %10s %12s %8s %10s\n", "Tag", "Reads", "Read blocks", "Writes", "Write blocks", "Flushes", "Mean us");
+	TagTotals metadata;
+	memset(&metadata, 0, sizeof(metadata));
+	for (uint32_t tag = 0; tag < LBA_TAG_COUNT; tag++) {
+		TagTotals_p totals = &tags[tag];
+		uint64_t calls = totals->reads + totals->writes + totals->syncs;
+		if (calls == 0)
+			continue;
+		printf("  %-9s %10lu %12lu %10lu %12lu %8lu %10.1f\n", tagNames[tag], totals->reads, totals->readBlocks,
+			totals->writes, totals->writeBlocks, totals->syncs, totals->latency / 1e3 / calls);
+		if (tag != LBA_TAG_OTHER && tag != LBA_TAG_DATA) {
+			metadata.reads += totals->reads;
+			metadata.readBlocks += totals->readBlocks;
+			metadata.writes += totals->writes;
+			metadata.writeBlocks += totals->writeBlocks;
+		}
+	}
+
+	TagTotals_p data = &tags[LBA_TAG_DATA];
+	uint64_t metadataCalls = metadata.reads + metadata.writes;
+	uint64_t metadataBlocks = metadata.readBlocks + metadata.writeBlocks;
+	uint64_t dataCalls = data->reads + data->writes;
+	uint64_t dataBlocks = data->readBlocks + data->writeBlocks;
+	printf("\nMetadata calls:     %lu, %lu blocks\n", metadataCalls, metadataBlocks);
+	printf("Data calls:         %lu, %lu blocks\n", dataCalls, dataBlocks);
+	if (dataCalls > 0)
+		printf("Metadata per data:  %.2f calls, %.2f blocks\n", (double)metadataCalls / dataCalls,
+			(dataBlocks > 0) ? (double)metadataBlocks / dataBlocks : 0);
+}
+
+/**
+ * Finds the bucket of a seek distance, bucket i holding 2^i up to 2^(i+1) - 1
+ * @param distance the distance, at least 1
+ * @returns the index of the bucket
+ */
+uint32_t distanceBucket(uint64_t distance) {
+	uint32_t bucket = 0;
+	while (bucket + 1 < SEEK_BUCKETS && distance >> (bucket + 1) > 0)
+		bucket++;
+	return bucket;
+}
+
+/**
+ * Prints a histogram of the distance from the end of each call to the start
+ * of the next, in the order the calls started. Flushes are left out.
+ * @param header the header of the dump
+ * @param records the records of the dump
+ */
+void printSeeks(traceHeader_t* header, traceRecord_t* records) {
+	uint64_t forward[SEEK_BUCKETS];
+	uint64_t backward[SEEK_BUCKETS];
+	uint64_t sequential = 0;
+	uint64_t seeks = 0;
+	uint64_t nextBlock = 0;
+	int haveLast = 0;
+
+	memset(forward, 0, sizeof(forward));
+	memset(backward, 0, sizeof(backward));
+	for (uint64_t i = 0; i < header->recordCount; i++) {
+		traceRecord_t* record = &records[i];
+		if (record->op == LBA_TRACE_SYNC)
+			continue;
+		if (haveLast) {
+			seeks++;
+			if (record->lba == nextBlock)
+				sequential++;
+			else if (record->lba > nextBlock)
+				forward[distanceBucket(record->lba - nextBlock)]++;
+			else
+				backward[distanceBucket(nextBlock - record->lba)]++;
+		}
+		nextBlock = record->lba + record->count;
+		haveLast = 1;
+	}
+
+	printf("\nSeek distance in blocks\n");
+	if (seeks == 0)
+		return;
+	printf("  %-21s %10s %7s %10s %7s\n", "Distance", "Forward", "", "Backward", "");
+	printf("  %-21s %10lu %6.1f%%\n", "0 (sequential)", sequential, sequential * 100.0 / seeks);
+	for (uint32_t i = 0; i < SEEK_BUCKETS; i++) {
+		if (forward[i] == 0 && backward[i] == 0)
+			continue;
+		char range[32];
+		if (i == 0)
+			snprintf(range, sizeof(range), "1");
+		else
+			snprintf(range, sizeof(range), "%lu-%lu", (uint64_t)1 << i, ((uint64_t)2 << i) - 1);
+		printf("  %-21s %10lu %6.1f%% %10lu %6.1f%%\n", range, forward[i], forward[i] * 100.0 / seeks,
+			backward[i], backward[i] * 100.0 / seeks);
+	}
+}
+
+/**
+ * Prints a bar as long as the value is of the max
+ * @param value the value
+ * @param max the value of a full bar
+ */
+void printBar(uint64_t value, uint64_t max) {
+	uint64_t length = (max > 0) ? (value * BAR_WIDTH + max - 1) / max : 0;
+	printf("|");
+	for (uint64_t i = 0; i < BAR_WIDTH; i++)
+		printf("%c", (i < length) ? '#' : ' ');
+}
+
+/**
+ * Prints the blocks read and written in each region of the volume.
+ * A call that spans regions counts its blocks in each.
+ * @param header the header of the dump
+ * @param records the records of the dump
+ * @param regions the number of regions
+ */
+void printHeatmap(traceHeader_t* header, traceRecord_t* records, uint64_t regions) {
+	if (header->numberOfBlocks == 0)
+		return;
+	if (regions > header->numberOfBlocks)
+		regions = header->numberOfBlocks;
+	uint64_t regionSize = (header->numberOfBlocks + regions - 1) / regions;
+	uint64_t* reads = calloc(regions, sizeof(uint64_t));
+	uint64_t* writes = calloc(regions, sizeof(uint64_t));
+
+	for (uint64_t i = 0; i < header->recordCount; i++) {
+		traceRecord_t* record = &records[i];
+		if (record->op == LBA_TRACE_SYNC)
+			continue;
+		uint64_t* counts = (record->op == LBA_TRACE_READ || record->op == LBA_TRACE_COPYOUT) ? reads : writes;
+		uint64_t block = record->lba;
+		uint64_t end = record->lba + record->count;
+		while (block < end && block / regionSize < regions) {
+			uint64_t regionEnd = (block / regionSize + 1) * regionSize;
+			uint64_t blocks = ((end < regionEnd) ? end : regionEnd) - block;
+			counts[block / regionSize] += blocks;
+			block += blocks;
+		}
+	}
+
+	uint64_t maxReads = 0;
+	uint64_t maxWrites = 0;
+	for (uint64_t r = 0; r < regions; r++) {
+		if (reads[r] > maxReads)
+			maxReads = reads[r];
+		if (writes[r] > maxWrites)
+			maxWrites = writes[r];
+	}
+
+	printf("\nBlocks read and written by region\n");
+	printf("  %-23s %10s %10s %-*s %s\n", "Blocks", "Read", "Written", BAR_WIDTH + 1, " Read", " Written");
+	for (uint64_t r = 0; r < regions; r++) {
+		char range[48];
+		uint64_t last = (r + 1) * regionSize - 1;
+		snprintf(range, sizeof(range), "%lu-%lu", r * regionSize, (last < header->numberOfBlocks) ? last : header->numberOfBlocks - 1);
+		printf("  %-23s %10lu %10lu ", range, reads[r], writes[r]);
+		printBar(reads[r], maxReads);
+		printBar(writes[r], maxWrites);
+		printf("|\n");
+	}
+	free(reads);
+	free(writes);
+}